@@ -8,7 +8,10 @@
 
 #include "algorithm.h"
 #include <vector>
-#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cmath>
 #include "glm/gtx/fast_trigonometry.hpp"
 #include "glm/gtc/constants.hpp"
 
@@ -67,188 +70,593 @@ namespace hardrock
         if (height > 128) return -1;
         if (sizes == nullptr || out_positions == nullptr) return -1;
         if (count == 0) return -2;
-        
-        typedef std::pair<std::uint16_t, std::uint16_t> InnerNode;
-        static const std::uint16_t NODE_FULL = -2;
-        static const std::uint16_t NODE_EMPTY = -1;
-        
-        std::vector<std::uint16_t> wide_to_narrow_idx_list(count);
-        for (size_t i = 0; i < wide_to_narrow_idx_list.size(); ++i)
+        std::vector<TexturePackInput16> input(count);
+        std::vector<TexturePackOutput16> output(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            input[i].width = sizes[i].width;
+            input[i].height = sizes[i].height;
+        }
+        int r = TexturePack16(width, height, count, &input[0], &output[0], TexturePackHeuristic::GUILLOTINE, false);
+        if (r != 0)
+            return r;
+        for (std::size_t i = 0; i < count; ++i)
         {
-            wide_to_narrow_idx_list[i] = i;
+            out_positions[i].x = static_cast<std::uint8_t>(output[i].x);
+            out_positions[i].y = static_cast<std::uint8_t>(output[i].y);
         }
-        std::sort(wide_to_narrow_idx_list.begin(), wide_to_narrow_idx_list.end(),
-            [sizes](std::uint16_t a, std::uint16_t b)
+        return 0;
+    }
+    
+    namespace
+    {
+        struct PackRect
         {
-            return sizes[a].width > sizes[b].width;
-        });
+            std::int32_t x, y, width, height;
+        };
         
-        const std::uint8_t max_inner_node_count = count << 1;
-        std::vector<InnerNode> inner_node_list(max_inner_node_count);
-        std::vector<std::uint8_t> split_list;
-        split_list.reserve(max_inner_node_count);
+        // Visit order shared by the heuristics: long side first, then short side.
+        std::vector<std::size_t> PackOrder(std::size_t count, const TexturePackInput16* sizes)
+        {
+            std::vector<std::size_t> order(count);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                order[i] = i;
+            }
+            std::stable_sort(order.begin(), order.end(), [sizes](std::size_t a, std::size_t b)
+            {
+                const std::uint16_t a_long = std::max(sizes[a].width, sizes[a].height);
+                const std::uint16_t b_long = std::max(sizes[b].width, sizes[b].height);
+                if (a_long != b_long)
+                    return a_long > b_long;
+                return std::min(sizes[a].width, sizes[a].height) > std::min(sizes[b].width, sizes[b].height);
+            });
+            return order;
+        }
         
-        struct VisitStackData
+        int PackGuillotine(std::uint16_t width, std::uint16_t height, std::size_t count, const TexturePackInput16* sizes, TexturePackOutput16* out_positions, bool allow_rotate)
         {
-            std::uint8_t x, y, width, height;
-            std::uint16_t* p_node_idx;
-            std::uint16_t vertical_split;
-        };
-        std::vector<VisitStackData> visit_stack;
-        visit_stack.reserve(max_inner_node_count);
-        std::uint16_t root_node_idx = NODE_EMPTY;
-        for (std::uint16_t i = 0; i < count; ++i)
-        {
-            const std::uint16_t tex_idx = wide_to_narrow_idx_list[i];
-            const TexturePackInput* p_size = sizes + tex_idx;
-            printf("size: %d %d\n", p_size->width, p_size->height);
-
-            if (root_node_idx == NODE_FULL)
-                return -3;
-            visit_stack.resize(0);
-            visit_stack.push_back({0, 0, width, height, &root_node_idx, true});
-            printf("visit_stack.push_back %d %d %d %d ? %d\n", 0, 0, width, height, true);
-            bool inserted = false;
-            while (visit_stack.size())
-            {
-                const VisitStackData visit_data = visit_stack.back();
-                visit_stack.pop_back();
-                printf("visit_stack.pop_back %d %d %d %d ? %d\n", visit_data.x, visit_data.y, visit_data.width, visit_data.height, visit_data.vertical_split);
-                if (p_size->width > visit_data.width || p_size->height > visit_data.height)
-                {
-                    std::cout << "too large" << std::endl;
-                    continue;
-                }
-                if (*visit_data.p_node_idx == NODE_EMPTY)
+            // Every inner node splits its area in two, vertical and horizontal splits alternate.
+            // first is the left/top part, second the right/bottom part.
+            typedef std::pair<std::uint32_t, std::uint32_t> InnerNode;
+            static const std::uint32_t NODE_FULL = -2;
+            static const std::uint32_t NODE_EMPTY = -1;
+            
+            std::vector<std::size_t> wide_to_narrow_idx_list(count);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                wide_to_narrow_idx_list[i] = i;
+            }
+            std::stable_sort(wide_to_narrow_idx_list.begin(), wide_to_narrow_idx_list.end(),
+                [sizes](std::size_t a, std::size_t b)
+            {
+                return sizes[a].width > sizes[b].width;
+            });
+            
+            // every insertion adds at most two inner nodes
+            const std::size_t max_inner_node_count = count << 1;
+            std::vector<InnerNode> inner_node_list(max_inner_node_count);
+            std::vector<std::uint16_t> split_list;
+            split_list.reserve(max_inner_node_count);
+            
+            struct VisitStackData
+            {
+                std::uint16_t x, y, width, height;
+                std::uint32_t* p_node_idx;
+                bool vertical_split;
+            };
+            std::vector<VisitStackData> visit_stack;
+            visit_stack.reserve(max_inner_node_count);
+            std::uint32_t root_node_idx = NODE_EMPTY;
+            
+            auto insert = [&](std::uint16_t tex_width, std::uint16_t tex_height, std::uint16_t& out_x, std::uint16_t& out_y) -> bool
+            {
+                visit_stack.resize(0);
+                visit_stack.push_back({0, 0, width, height, &root_node_idx, true});
+                while (visit_stack.size())
                 {
-                    const bool same_width = p_size->width == visit_data.width;
-                    const bool same_height = p_size->height == visit_data.height;
-                    if (same_width && same_height)
-                    {
-                        *visit_data.p_node_idx = NODE_FULL;
-                    }
-                    else if (visit_data.vertical_split)
+                    const VisitStackData visit_data = visit_stack.back();
+                    visit_stack.pop_back();
+                    if (tex_width > visit_data.width || tex_height > visit_data.height)
+                        continue;
+                    if (*visit_data.p_node_idx == NODE_EMPTY)
                     {
-                        const std::uint16_t new_v_node_idx = split_list.size();
-                        *visit_data.p_node_idx = new_v_node_idx;
-                        split_list.push_back(p_size->width);
-                        std::cout << "add v node " << static_cast<int>(p_size->width) << std::endl;
-                        InnerNode& new_v_inner_node = inner_node_list[new_v_node_idx];
-                        if (same_height)
+                        const bool same_width = tex_width == visit_data.width;
+                        const bool same_height = tex_height == visit_data.height;
+                        // first split along the visit direction, then split the first part the other way
+                        const std::uint16_t split0 = visit_data.vertical_split ? tex_width : tex_height;
+                        const std::uint16_t split1 = visit_data.vertical_split ? tex_height : tex_width;
+                        const bool same0 = visit_data.vertical_split ? same_width : same_height;
+                        const bool same1 = visit_data.vertical_split ? same_height : same_width;
+                        if (same_width && same_height)
                         {
-                            new_v_inner_node.second = NODE_EMPTY;
-                            new_v_inner_node.first = NODE_FULL;
+                            *visit_data.p_node_idx = NODE_FULL;
                         }
                         else
                         {
-                            if (same_width)
-                                new_v_inner_node.second = NODE_FULL;
+                            const std::uint32_t new_node_idx = static_cast<std::uint32_t>(split_list.size());
+                            *visit_data.p_node_idx = new_node_idx;
+                            split_list.push_back(split0);
+                            InnerNode& new_inner_node = inner_node_list[new_node_idx];
+                            if (same1)
+                            {
+                                new_inner_node.second = NODE_EMPTY;
+                                new_inner_node.first = NODE_FULL;
+                            }
                             else
-                                new_v_inner_node.second = NODE_EMPTY;
-                            const std::uint16_t new_h_node_idx = split_list.size();
-                            split_list.push_back(p_size->height);
-                            std::cout << "add h node " << static_cast<int>(p_size->height) << std::endl;
-                            new_v_inner_node.first = new_h_node_idx;
-                            InnerNode& new_h_inner_node = inner_node_list[new_h_node_idx];
-                            new_h_inner_node.first = NODE_FULL;
-                            new_h_inner_node.second = NODE_EMPTY;
+                            {
+                                new_inner_node.second = same0 ? NODE_FULL : NODE_EMPTY;
+                                const std::uint32_t new_sub_node_idx = static_cast<std::uint32_t>(split_list.size());
+                                split_list.push_back(split1);
+                                new_inner_node.first = new_sub_node_idx;
+                                InnerNode& new_sub_inner_node = inner_node_list[new_sub_node_idx];
+                                new_sub_inner_node.first = NODE_FULL;
+                                new_sub_inner_node.second = NODE_EMPTY;
+                            }
                         }
+                        out_x = visit_data.x;
+                        out_y = visit_data.y;
+                        return true;
                     }
-                    else
+                    else // must not be NODE_FULL
                     {
-                        const std::uint16_t new_h_node_idx = split_list.size();
-                        *visit_data.p_node_idx = new_h_node_idx;
-                        split_list.push_back(p_size->height);
-                        std::cout << "add h node " << static_cast<int>(p_size->height) << std::endl;
-                        InnerNode& new_h_inner_node = inner_node_list[new_h_node_idx];
-                        if (same_width)
+                        InnerNode& inner_node = inner_node_list[*visit_data.p_node_idx];
+                        const std::uint16_t split = split_list[*visit_data.p_node_idx];
+                        bool is_full = true;
+                        if (visit_data.vertical_split)
                         {
-                            new_h_inner_node.second = NODE_EMPTY;
-                            new_h_inner_node.first = NODE_FULL;
+                            if (inner_node.second != NODE_FULL)
+                            {
+                                const std::uint16_t right_width = visit_data.width - split;
+                                if (right_width >= tex_width)
+                                {
+                                    const std::uint16_t right_x = visit_data.x + split;
+                                    visit_stack.push_back({right_x, visit_data.y, right_width, visit_data.height, &inner_node.second, false});
+                                }
+                                is_full = false;
+                            }
+                            if (inner_node.first != NODE_FULL)
+                            {
+                                if (split >= tex_width)
+                                {
+                                    visit_stack.push_back({visit_data.x, visit_data.y, split, visit_data.height, &inner_node.first, false});
+                                }
+                                is_full = false;
+                            }
                         }
                         else
                         {
-                            if (same_height)
-                                new_h_inner_node.second = NODE_FULL;
-                            else
-                                new_h_inner_node.second = NODE_EMPTY;
-                            const std::uint16_t new_v_node_idx = split_list.size();
-                            split_list.push_back(p_size->width);
-                            std::cout << "add v node " << static_cast<int>(p_size->width) << std::endl;
-                            new_h_inner_node.first = new_v_node_idx;
-                            InnerNode& new_v_inner_node = inner_node_list[new_v_node_idx];
-                            new_v_inner_node.first = NODE_FULL;
-                            new_v_inner_node.second = NODE_EMPTY;
+                            if (inner_node.second != NODE_FULL)
+                            {
+                                const std::uint16_t bottom_height = visit_data.height - split;
+                                if (bottom_height >= tex_height)
+                                {
+                                    const std::uint16_t bottom_y = visit_data.y + split;
+                                    visit_stack.push_back({visit_data.x, bottom_y, visit_data.width, bottom_height, &inner_node.second, true});
+                                }
+                                is_full = false;
+                            }
+                            if (inner_node.first != NODE_FULL)
+                            {
+                                if (split >= tex_height)
+                                {
+                                    visit_stack.push_back({visit_data.x, visit_data.y, visit_data.width, split, &inner_node.first, true});
+                                }
+                                is_full = false;
+                            }
+                        }
+                        if (is_full)
+                        {
+                            *visit_data.p_node_idx = NODE_FULL;
                         }
                     }
-                    
-                    auto p_out = out_positions + tex_idx;
-                    p_out->x = visit_data.x;
-                    p_out->y = visit_data.y;
-                    printf("put tex %d %d\n", visit_data.x, visit_data.y);
-                    inserted = true;
-                    break;
                 }
-                else // must not be NODE_FULL
+                return false;
+            };
+            
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                const std::size_t tex_idx = wide_to_narrow_idx_list[i];
+                const TexturePackInput16* p_size = sizes + tex_idx;
+                TexturePackOutput16* p_out = out_positions + tex_idx;
+                if (root_node_idx == NODE_FULL)
+                    return -3;
+                p_out->rotated = 0;
+                if (insert(p_size->width, p_size->height, p_out->x, p_out->y))
+                    continue;
+                if (allow_rotate && p_size->width != p_size->height && insert(p_size->height, p_size->width, p_out->x, p_out->y))
                 {
-                    InnerNode& inner_node = inner_node_list[*visit_data.p_node_idx];
-                    const std::uint8_t split = split_list[*visit_data.p_node_idx];
-                    bool is_full = true;
-                    if (visit_data.vertical_split)
+                    p_out->rotated = 1;
+                    continue;
+                }
+                return -3;
+            }
+            return 0;
+        }
+        
+        int PackMaxRects(std::uint16_t width, std::uint16_t height, std::size_t count, const TexturePackInput16* sizes, TexturePackOutput16* out_positions, bool allow_rotate)
+        {
+            TexturePacker packer(width, height);
+            const std::vector<std::size_t> order = PackOrder(count, sizes);
+            for (std::size_t tex_idx : order)
+            {
+                if (packer.Insert(sizes[tex_idx].width, sizes[tex_idx].height, allow_rotate, out_positions[tex_idx]) != 0)
+                    return -3;
+            }
+            return 0;
+        }
+        
+        int PackSkyline(std::uint16_t width, std::uint16_t height, std::size_t count, const TexturePackInput16* sizes, TexturePackOutput16* out_positions, bool allow_rotate)
+        {
+            struct Segment
+            {
+                std::int32_t x, y, width;
+            };
+            std::vector<Segment> skyline;
+            skyline.push_back({0, 0, width});
+            // lowest top if a w wide rectangle starts at segment i, -1 if it does not fit
+            auto fit = [&skyline, width, height](std::size_t i, std::int32_t w, std::int32_t h) -> std::int32_t
+            {
+                const std::int32_t x = skyline[i].x;
+                if (x + w > width)
+                    return -1;
+                std::int32_t y = 0;
+                std::int32_t width_left = w;
+                for (std::size_t j = i; width_left > 0; ++j)
+                {
+                    y = std::max(y, skyline[j].y);
+                    if (y + h > height)
+                        return -1;
+                    width_left -= skyline[j].width;
+                }
+                return y;
+            };
+            const std::vector<std::size_t> order = PackOrder(count, sizes);
+            for (std::size_t tex_idx : order)
+            {
+                const std::int32_t tex_width = sizes[tex_idx].width;
+                const std::int32_t tex_height = sizes[tex_idx].height;
+                std::int32_t best_top = std::numeric_limits<std::int32_t>::max();
+                std::int32_t best_width = std::numeric_limits<std::int32_t>::max();
+                std::size_t best_idx = 0;
+                PackRect placed = {0, 0, 0, 0};
+                bool rotated = false;
+                for (std::size_t i = 0; i < skyline.size(); ++i)
+                {
+                    for (int rotate = 0; rotate < (allow_rotate ? 2 : 1); ++rotate)
                     {
-                        if (inner_node.second != NODE_FULL)
-                        {
-                            const std::uint8_t right_width = visit_data.width - split;
-                            if (right_width >= p_size->width)
-                            {
-                                const std::uint8_t right_x = visit_data.x + split;
-                                visit_stack.push_back({right_x, visit_data.y, right_width, visit_data.height, &inner_node.second, false});
-                                printf("visit_stack.push_back1 %d %d %d %d ? false\n", right_x, visit_data.y, right_width, visit_data.height);
-                            }
-                            is_full = false;
-                        }
-                        if (inner_node.first != NODE_FULL)
+                        const std::int32_t w = rotate ? tex_height : tex_width;
+                        const std::int32_t h = rotate ? tex_width : tex_height;
+                        const std::int32_t y = fit(i, w, h);
+                        if (y < 0)
+                            continue;
+                        if (y + h < best_top || (y + h == best_top && skyline[i].width < best_width))
                         {
-                            if (split >= p_size->width)
-                            {
-                                visit_stack.push_back({visit_data.x, visit_data.y, split, visit_data.height, &inner_node.first, false});
-                                printf("visit_stack.push_back2 %d %d %d %d ? false\n", visit_data.x, visit_data.y, split, visit_data.height);
-                            }
-                            is_full = false;
+                            best_top = y + h;
+                            best_width = skyline[i].width;
+                            best_idx = i;
+                            placed = {skyline[i].x, y, w, h};
+                            rotated = rotate != 0;
                         }
                     }
+                }
+                if (placed.width == 0)
+                    return -3;
+                TexturePackOutput16* p_out = out_positions + tex_idx;
+                p_out->x = static_cast<std::uint16_t>(placed.x);
+                p_out->y = static_cast<std::uint16_t>(placed.y);
+                p_out->rotated = rotated ? 1 : 0;
+                
+                // raise the skyline under the placed rectangle
+                skyline.insert(skyline.begin() + best_idx, {placed.x, placed.y + placed.height, placed.width});
+                const std::int32_t placed_end = placed.x + placed.width;
+                std::size_t i = best_idx + 1;
+                while (i < skyline.size() && skyline[i].x < placed_end)
+                {
+                    const std::int32_t segment_end = skyline[i].x + skyline[i].width;
+                    if (segment_end <= placed_end)
+                    {
+                        skyline.erase(skyline.begin() + i);
+                    }
                     else
                     {
-                        if (inner_node.second != NODE_FULL)
-                        {
-                            const std::uint8_t bottom_height = visit_data.height - split;
-                            if (bottom_height >= p_size->height)
-                            {
-                                const std::uint8_t bottom_y = visit_data.y + split;
-                                visit_stack.push_back({visit_data.x, bottom_y, visit_data.width, bottom_height, &inner_node.second, true});
-                                printf("visit_stack.push_back3 %d %d %d %d ? true\n", visit_data.x, bottom_y, visit_data.width, bottom_height);
-                            }
-                            is_full = false;
-                        }
-                        if (inner_node.first != NODE_FULL)
-                        {
-                            if (split >= p_size->height)
-                            {
-                                visit_stack.push_back({visit_data.x, visit_data.y, visit_data.width, split, &inner_node.first, true});
-                                printf("visit_stack.push_back4 %d %d %d %d ? true\n", visit_data.x, visit_data.y, visit_data.width, split);
-                            }
-                            is_full = false;
-                        }
+                        skyline[i].width = segment_end - placed_end;
+                        skyline[i].x = placed_end;
+                        break;
                     }
-                    if (is_full)
+                }
+                for (std::size_t j = 0; j + 1 < skyline.size();)
+                {
+                    if (skyline[j].y == skyline[j + 1].y)
                     {
-                        *visit_data.p_node_idx = NODE_FULL;
+                        skyline[j].width += skyline[j + 1].width;
+                        skyline.erase(skyline.begin() + j + 1);
+                    }
+                    else
+                    {
+                        ++j;
                     }
                 }
             }
-            if (!inserted)
-                return -3;
+            return 0;
         }
+    }
+    
+    TexturePacker::TexturePacker(std::uint16_t width, std::uint16_t height)
+    : width(width)
+    , height(height)
+    {
+        this->Reset();
+    }
+    
+    void TexturePacker::Reset()
+    {
+        this->free_list.resize(0);
+        this->free_list.push_back({0, 0, this->width, this->height});
+    }
+    
+    int TexturePacker::Insert(std::uint16_t width, std::uint16_t height, bool allow_rotate, TexturePackOutput16& out_position)
+    {
+        const std::int32_t tex_width = width;
+        const std::int32_t tex_height = height;
+        
+        // best short side fit, ties broken by the long side
+        std::int32_t best_short = std::numeric_limits<std::int32_t>::max();
+        std::int32_t best_long = std::numeric_limits<std::int32_t>::max();
+        Rect placed = {0, 0, 0, 0};
+        bool rotated = false;
+        for (const Rect& free_rect : this->free_list)
+        {
+            for (int rotate = 0; rotate < (allow_rotate ? 2 : 1); ++rotate)
+            {
+                const std::int32_t w = rotate ? tex_height : tex_width;
+                const std::int32_t h = rotate ? tex_width : tex_height;
+                if (w > free_rect.width || h > free_rect.height)
+                    continue;
+                const std::int32_t dw = free_rect.width - w;
+                const std::int32_t dh = free_rect.height - h;
+                const std::int32_t short_fit = std::min(dw, dh);
+                const std::int32_t long_fit = std::max(dw, dh);
+                if (short_fit < best_short || (short_fit == best_short && long_fit < best_long))
+                {
+                    best_short = short_fit;
+                    best_long = long_fit;
+                    placed = {free_rect.x, free_rect.y, w, h};
+                    rotated = rotate != 0;
+                }
+            }
+        }
+        if (placed.width == 0)
+            return 1;
+        out_position.x = static_cast<std::uint16_t>(placed.x);
+        out_position.y = static_cast<std::uint16_t>(placed.y);
+        out_position.rotated = rotated ? 1 : 0;
+        
+        // split every free rectangle the placed one overlaps into up to four maximal ones
+        this->new_free_list.resize(0);
+        for (std::size_t i = 0; i < this->free_list.size();)
+        {
+            const Rect free_rect = this->free_list[i];
+            if (placed.x >= free_rect.x + free_rect.width || placed.x + placed.width <= free_rect.x ||
+                placed.y >= free_rect.y + free_rect.height || placed.y + placed.height <= free_rect.y)
+            {
+                ++i;
+                continue;
+            }
+            if (placed.x > free_rect.x)
+                this->new_free_list.push_back({free_rect.x, free_rect.y, placed.x - free_rect.x, free_rect.height});
+            if (placed.x + placed.width < free_rect.x + free_rect.width)
+                this->new_free_list.push_back({placed.x + placed.width, free_rect.y, free_rect.x + free_rect.width - placed.x - placed.width, free_rect.height});
+            if (placed.y > free_rect.y)
+                this->new_free_list.push_back({free_rect.x, free_rect.y, free_rect.width, placed.y - free_rect.y});
+            if (placed.y + placed.height < free_rect.y + free_rect.height)
+                this->new_free_list.push_back({free_rect.x, placed.y + placed.height, free_rect.width, free_rect.y + free_rect.height - placed.y - placed.height});
+            this->free_list[i] = this->free_list.back();
+            this->free_list.pop_back();
+        }
+        this->addFreeRects();
         return 0;
     }
-}
\ No newline at end of file
+    
+    void TexturePacker::Free(std::uint16_t x, std::uint16_t y, std::uint16_t width, std::uint16_t height)
+    {
+        Rect rect = {x, y, width, height};
+        // grow the freed rectangle over free neighbours that share a whole edge with it
+        bool merged = true;
+        while (merged)
+        {
+            merged = false;
+            for (const Rect& free_rect : this->free_list)
+            {
+                if (free_rect.y == rect.y && free_rect.height == rect.height &&
+                    (free_rect.x + free_rect.width == rect.x || rect.x + rect.width == free_rect.x))
+                {
+                    rect.width += free_rect.width;
+                    rect.x = std::min(rect.x, free_rect.x);
+                    merged = true;
+                }
+                else if (free_rect.x == rect.x && free_rect.width == rect.width &&
+                    (free_rect.y + free_rect.height == rect.y || rect.y + rect.height == free_rect.y))
+                {
+                    rect.height += free_rect.height;
+                    rect.y = std::min(rect.y, free_rect.y);
+                    merged = true;
+                }
+            }
+        }
+        if (rect.width == this->width && rect.height == this->height)
+        {
+            this->Reset();
+            return;
+        }
+        this->new_free_list.resize(0);
+        this->new_free_list.push_back(rect);
+        this->addFreeRects();
+    }
+    
+    void TexturePacker::addFreeRects()
+    {
+        auto contains = [](const Rect& a, const Rect& b)
+        {
+            return b.x >= a.x && b.y >= a.y && b.x + b.width <= a.x + a.width && b.y + b.height <= a.y + a.height;
+        };
+        // only the new rectangles can be redundant, or make old ones redundant
+        for (std::size_t i = 0; i < this->new_free_list.size(); ++i)
+        {
+            const Rect& new_rect = this->new_free_list[i];
+            bool contained = false;
+            for (std::size_t j = 0; j < this->new_free_list.size() && !contained; ++j)
+            {
+                // of two equal rectangles keep the first
+                if (j != i && contains(this->new_free_list[j], new_rect) && (j < i || !contains(new_rect, this->new_free_list[j])))
+                    contained = true;
+            }
+            for (std::size_t j = 0; j < this->free_list.size() && !contained; ++j)
+            {
+                if (contains(this->free_list[j], new_rect))
+                    contained = true;
+            }
+            if (contained)
+                continue;
+            for (std::size_t j = 0; j < this->free_list.size();)
+            {
+                if (contains(new_rect, this->free_list[j]))
+                {
+                    this->free_list[j] = this->free_list.back();
+                    this->free_list.pop_back();
+                }
+                else
+                {
+                    ++j;
+                }
+            }
+            this->free_list.push_back(new_rect);
+        }
+    }
+    
+    int TexturePack16(std::uint16_t width, std::uint16_t height, std::size_t count, const TexturePackInput16* sizes, TexturePackOutput16* out_positions, TexturePackHeuristic heuristic, bool allow_rotate)
+    {
+        if (sizes == nullptr || out_positions == nullptr) return -1;
+        if (count == 0) return -2;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (sizes[i].width == 0 || sizes[i].height == 0) return -1;
+        }
+        switch (heuristic)
+        {
+            case TexturePackHeuristic::GUILLOTINE:
+                return PackGuillotine(width, height, count, sizes, out_positions, allow_rotate);
+            case TexturePackHeuristic::MAX_RECTS:
+                return PackMaxRects(width, height, count, sizes, out_positions, allow_rotate);
+            case TexturePackHeuristic::SKYLINE:
+                return PackSkyline(width, height, count, sizes, out_positions, allow_rotate);
+        }
+        return -1;
+    }
+    
+    int Lz4DecompressBlock(const std::uint8_t* p_src, std::size_t src_size, std::uint8_t* p_dst, std::size_t dst_size)
+    {
+        const std::uint8_t* const p_src_end = p_src + src_size;
+        std::uint8_t* const p_dst_begin = p_dst;
+        std::uint8_t* const p_dst_end = p_dst + dst_size;
+        while (p_src < p_src_end)
+        {
+            const std::uint8_t token = *p_src++;
+            std::size_t literal_length = token >> 4;
+            if (literal_length == 15)
+            {
+                std::uint8_t b;
+                do
+                {
+                    if (p_src >= p_src_end) return 1;
+                    b = *p_src++;
+                    literal_length += b;
+                } while (b == 255);
+            }
+            if (literal_length > static_cast<std::size_t>(p_src_end - p_src)) return 1;
+            if (literal_length > static_cast<std::size_t>(p_dst_end - p_dst)) return 2;
+            if (literal_length <= 16 && p_src_end - p_src >= 16 && p_dst_end - p_dst >= 16)
+            {
+                // short literal run, a fixed size copy is much cheaper than a variable one
+                std::memcpy(p_dst, p_src, 16);
+            }
+            else
+            {
+                std::memcpy(p_dst, p_src, literal_length);
+            }
+            p_src += literal_length;
+            p_dst += literal_length;
+            // the last sequence has literals only
+            if (p_src == p_src_end)
+                break;
+
+            if (p_src_end - p_src < 2) return 1;
+            const std::size_t offset = static_cast<std::size_t>(p_src[0]) | (static_cast<std::size_t>(p_src[1]) << 8);
+            p_src += 2;
+            if (offset == 0 || offset > static_cast<std::size_t>(p_dst - p_dst_begin)) return 1;
+            std::size_t match_length = token & 0xf;
+            if (match_length == 15)
+            {
+                std::uint8_t b;
+                do
+                {
+                    if (p_src >= p_src_end) return 1;
+                    b = *p_src++;
+                    match_length += b;
+                } while (b == 255);
+            }
+            match_length += 4;
+            if (match_length > static_cast<std::size_t>(p_dst_end - p_dst)) return 2;
+            const std::uint8_t* p_match = p_dst - offset;
+            if (offset >= 8 && static_cast<std::size_t>(p_dst_end - p_dst) >= match_length + 8)
+            {
+                // 8 byte steps may run past the match, the next sequence overwrites it
+                std::uint8_t* const p_match_end = p_dst + match_length;
+                do
+                {
+                    std::memcpy(p_dst, p_match, 8);
+                    p_dst += 8;
+                    p_match += 8;
+                } while (p_dst < p_match_end);
+                p_dst = p_match_end;
+            }
+            else
+            {
+                // overlapping copy repeats the last offset bytes
+                for (std::size_t i = 0; i < match_length; ++i)
+                    *p_dst++ = *p_match++;
+            }
+        }
+        return p_dst == p_dst_end ? 0 : 2;
+    }
+    
+    int LineMove::GetExitTime(const glm::vec2 &bounds_min, const glm::vec2 &bounds_max) const
+    {
+        const double infinity = std::numeric_limits<double>::infinity();
+        // steps after origin_time inside the bounds on both axes
+        double first_step = 0;
+        double last_step = infinity;
+        auto clip = [&](float pos, float move, float bound_min, float bound_max)
+        {
+            if (move == 0)
+            {
+                if (pos < bound_min || pos > bound_max)
+                    last_step = -infinity;
+                return;
+            }
+            const double step_a = static_cast<double>(bound_min - pos) / move;
+            const double step_b = static_cast<double>(bound_max - pos) / move;
+            first_step = std::max(first_step, std::ceil(std::min(step_a, step_b)));
+            last_step = std::min(last_step, std::floor(std::max(step_a, step_b)));
+        };
+        clip(this->origin_pos.x, this->move_vector.x, bounds_min.x, bounds_max.x);
+        clip(this->origin_pos.y, this->move_vector.y, bounds_min.y, bounds_max.y);
+        // never inside, out from the start
+        if (first_step > last_step)
+            return this->origin_time;
+        const double exit_time = this->origin_time + last_step + 1;
+        if (exit_time >= std::numeric_limits<int>::max())
+            return std::numeric_limits<int>::max();
+        return static_cast<int>(exit_time);
+    }
+}
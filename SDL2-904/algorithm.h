@@ -11,6 +11,7 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <vector>
 #include "glm/vec2.hpp"
 
 namespace hardrock
@@ -55,6 +56,57 @@ namespace hardrock
     };
     int TexturePack(std::uint8_t width, std::uint8_t height, std::uint16_t count, const TexturePackInput* sizes, TexturePackOutput* out_positions);
     
+    enum class TexturePackHeuristic
+    {
+        // binary split tree, the packer TexturePack has always used
+        GUILLOTINE,
+        // maximal free rectangles with best short side fit, tightest result
+        MAX_RECTS,
+        // bottom-left skyline, fastest on large sets
+        SKYLINE,
+    };
+    struct TexturePackInput16
+    {
+        std::uint16_t width;
+        std::uint16_t height;
+    };
+    struct TexturePackOutput16
+    {
+        std::uint16_t x;
+        std::uint16_t y;
+        // placed as height x width, the caller has to rotate the sprite by 90 degrees
+        std::uint8_t rotated;
+        std::uint8_t padding;
+    };
+    // Pack count rectangles into a width x height bin.
+    // return 0 on success, -1 on bad arguments, -2 if count is 0, -3 if they do not fit.
+    int TexturePack16(std::uint16_t width, std::uint16_t height, std::size_t count, const TexturePackInput16* sizes, TexturePackOutput16* out_positions, TexturePackHeuristic heuristic = TexturePackHeuristic::MAX_RECTS, bool allow_rotate = false);
+    
+    // Incremental MaxRects packer, rectangles can be inserted and freed one at a time.
+    class TexturePacker
+    {
+        struct Rect
+        {
+            std::int32_t x, y, width, height;
+        };
+        const std::uint16_t width;
+        const std::uint16_t height;
+        std::vector<Rect> free_list;
+        std::vector<Rect> new_free_list;
+        void addFreeRects();
+    public:
+        TexturePacker(std::uint16_t width, std::uint16_t height);
+        void Reset();
+        // Best short side fit. return 0 on success, 1 if there is no room.
+        int Insert(std::uint16_t width, std::uint16_t height, bool allow_rotate, TexturePackOutput16& out_position);
+        // Give back a rectangle returned by Insert, with its placed (rotated) size.
+        void Free(std::uint16_t x, std::uint16_t y, std::uint16_t width, std::uint16_t height);
+    };
+    
+    // Decode one LZ4 block (as written by pack.py) into exactly dst_size bytes.
+    // return 0 on success, non-zero if the block is malformed or does not fill dst.
+    int Lz4DecompressBlock(const std::uint8_t* p_src, std::size_t src_size, std::uint8_t* p_dst, std::size_t dst_size);
+    
     class LineMove
     {
         glm::vec2 move_vector;
@@ -69,6 +121,9 @@ namespace hardrock
         {
             return this->move_vector * static_cast<float>(t - this->origin_time) + this->origin_pos;
         }
+        // The first t from which the position is outside [bounds_min, bounds_max] for good, up to
+        // the rounding of GetPos. INT_MAX if it never leaves.
+        int GetExitTime(const glm::vec2 &bounds_min, const glm::vec2 &bounds_max) const;
     };
 }
 
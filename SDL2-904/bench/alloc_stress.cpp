@@ -0,0 +1,146 @@
+//
+//  alloc_stress.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  TlsfAllocator under random free and allocate pairs: 4M units, about 10k live blocks of
+//  1 to 256 units. A checked run keeps a map of the used units and stops at the first
+//  overlap. It frees every block twice and the second Free has to fail. Then everything is
+//  freed and has to merge back into one block, which one allocation of the whole buffer has
+//  to get. The timed run follows without the map.
+//  usage: alloc_stress
+//
+
+#include <cstdio>
+#include <vector>
+#include "structure.h"
+#include "bench.h"
+
+namespace
+{
+    const std::size_t CAPACITY = 4u << 20;
+    const std::size_t LIVE_COUNT = 10000;
+    const std::size_t CHECKED_OP_COUNT = 200000;
+    const std::size_t TIMED_PAIR_COUNT = 1000000;
+
+    struct LiveBlock
+    {
+        std::size_t pos;
+        std::size_t size;
+        hardrock::TlsfAllocator::BlockIdType block_id;
+    };
+
+    class Driver
+    {
+        hardrock::TlsfAllocator allocator;
+        hardrock::BenchRandom random;
+        // one byte per unit, empty for the timed run
+        std::vector<std::uint8_t> used_map;
+    public:
+        std::vector<LiveBlock> live_list;
+        std::size_t failed_allocate_count;
+        std::size_t failed_free_count;
+        std::size_t double_free_count;
+        std::size_t overlap_count;
+        Driver(bool checked)
+        : allocator(CAPACITY), random(7), used_map(checked ? CAPACITY : 0)
+        , failed_allocate_count(0), failed_free_count(0), double_free_count(0), overlap_count(0)
+        {
+        }
+        const hardrock::TlsfAllocator& Allocator() const { return this->allocator; }
+        bool NextBit() { return (this->random.Next() & 1) != 0; }
+        void Allocate()
+        {
+            LiveBlock block;
+            block.size = 1 + this->random.Below(256);
+            if (this->allocator.Allocate(block.size, block.pos, block.block_id) != 0)
+            {
+                ++this->failed_allocate_count;
+                return;
+            }
+            for (std::size_t i = 0; i < block.size && !this->used_map.empty(); ++i)
+            {
+                this->overlap_count += this->used_map[block.pos + i];
+                this->used_map[block.pos + i] = 1;
+            }
+            this->live_list.push_back(block);
+        }
+        // one block over the whole buffer and free it again, only fits when everything is free
+        bool AllocateAll()
+        {
+            std::size_t pos;
+            hardrock::TlsfAllocator::BlockIdType block_id;
+            return this->allocator.Allocate(CAPACITY, pos, block_id) == 0 && pos == 0 && this->allocator.Free(block_id) == 0;
+        }
+        void Free()
+        {
+            const std::size_t k = this->random.Below(static_cast<std::uint32_t>(this->live_list.size()));
+            const LiveBlock block = this->live_list[k];
+            this->live_list[k] = this->live_list.back();
+            this->live_list.pop_back();
+            if (this->allocator.Free(block.block_id) != 0)
+                ++this->failed_free_count;
+            // the block may have merged into a neighbour, its id must be refused either way
+            if (!this->used_map.empty() && this->allocator.Free(block.block_id) == 0)
+                ++this->double_free_count;
+            for (std::size_t i = 0; i < block.size && !this->used_map.empty(); ++i)
+                this->used_map[block.pos + i] = 0;
+        }
+    };
+}
+
+int main()
+{
+    {
+        Driver driver(true);
+        while (driver.live_list.size() < LIVE_COUNT)
+            driver.Allocate();
+        for (std::size_t i = 0; i < CHECKED_OP_COUNT && driver.overlap_count == 0; ++i)
+        {
+            if (driver.NextBit())
+                driver.Allocate();
+            else
+                driver.Free();
+            while (driver.live_list.size() > LIVE_COUNT + 500)
+                driver.Free();
+            while (driver.live_list.size() < LIVE_COUNT - 500)
+                driver.Allocate();
+        }
+        hardrock::TlsfAllocator::Stats stats = driver.Allocator().GetStats();
+        std::size_t used_size = 0;
+        for (const LiveBlock& block : driver.live_list)
+            used_size += block.size;
+        const bool counts_match = stats.free_size == CAPACITY - used_size && stats.used_block_count == driver.live_list.size();
+        std::printf("checked %zu ops: %zu overlaps, %zu failed allocations, %zu failed frees, %zu double frees taken, free size %s\n",
+                    CHECKED_OP_COUNT, driver.overlap_count, driver.failed_allocate_count, driver.failed_free_count, driver.double_free_count,
+                    counts_match ? "matches" : "DIFFERS");
+        while (!driver.live_list.empty())
+            driver.Free();
+        stats = driver.Allocator().GetStats();
+        const bool merged = stats.free_size == CAPACITY && stats.free_block_count == 1 && stats.largest_free_size == CAPACITY;
+        const bool allocated_all = merged && driver.AllocateAll();
+        std::printf("after freeing everything: %zu free blocks, largest %zu of %zu, whole buffer %s\n",
+                    stats.free_block_count, stats.largest_free_size, CAPACITY, allocated_all ? "allocated" : "FAILED");
+        if (driver.overlap_count != 0 || driver.failed_free_count != 0 || driver.double_free_count != 0 || !counts_match || !allocated_all)
+            return 1;
+    }
+
+    Driver driver(false);
+    while (driver.live_list.size() < LIVE_COUNT)
+        driver.Allocate();
+    driver.failed_allocate_count = 0;
+    hardrock::Stopwatch stopwatch;
+    for (std::size_t i = 0; i < TIMED_PAIR_COUNT; ++i)
+    {
+        driver.Free();
+        driver.Allocate();
+    }
+    const double ns = stopwatch.Nanoseconds() / TIMED_PAIR_COUNT;
+    const hardrock::TlsfAllocator::Stats stats = driver.Allocator().GetStats();
+    std::printf("%.1f ns per free and allocate pair over %zu pairs, %zu live, %zu failed allocations\n",
+                ns, TIMED_PAIR_COUNT, driver.live_list.size(), driver.failed_allocate_count);
+    std::printf("fragmentation %.3f, %zu free blocks\n", stats.fragmentation, stats.free_block_count);
+    return driver.failed_free_count != 0 ? 1 : 0;
+}
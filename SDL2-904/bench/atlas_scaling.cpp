@@ -0,0 +1,118 @@
+//
+//  atlas_scaling.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  CreateTextureAtlas of 256 WebP sprites on a ThreadPool of 1, 2, 4 and 8 threads.
+//  usage: atlas_scaling <res.pack>
+//  The 16 game sprites of png_src are loaded once and handed over 16 times each. The
+//  resource loads are left out, so this is the header and decode passes the pool splits,
+//  plus the packing and the GL upload that stay on the calling thread.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "resource.h"
+#include "renderer.h"
+#include "parallel.h"
+#include "algorithm.h"
+#include "bench.h"
+#include "bench_gl.h"
+
+namespace
+{
+    const std::size_t REPEAT_COUNT = 16;
+    const int RUN_COUNT = 20;
+    const std::size_t THREAD_COUNT_LIST[] = { 1, 2, 4, 8 };
+
+    // Each entry of data_set REPEAT_COUNT times over.
+    struct RepeatedDataSet : public hardrock::IResourceDataSet
+    {
+        const hardrock::IResourceDataSet& data_set;
+        RepeatedDataSet(const hardrock::IResourceDataSet& data_set) : data_set(data_set) { }
+        std::size_t Count() const override { return this->data_set.Count() * REPEAT_COUNT; }
+        int GetDataByRid(std::uint32_t rid, const std::uint8_t*& out_p_data, std::size_t& out_size) const override
+        {
+            return this->data_set.GetDataByRid(rid, out_p_data, out_size);
+        }
+        int GetDataByIdx(std::size_t idx, const std::uint8_t*& out_p_data, std::size_t& out_size) const override
+        {
+            return this->data_set.GetDataByIdx(idx % this->data_set.Count(), out_p_data, out_size);
+        }
+    };
+}
+
+int main(int argc, char* args[])
+{
+    if (argc != 2)
+    {
+        std::fprintf(stderr, "usage: %s <res.pack>\n", args[0]);
+        return 1;
+    }
+    hardrock::MappedPackResourceManager resource_manager(args[1]);
+    hardrock::BenchGlContext gl_context;
+    if (gl_context.Create(640, 480) != 0)
+        return 1;
+    auto up_render_device = hardrock::CreateBenchRenderDevice(resource_manager, 640, 480);
+    if (!up_render_device)
+        return 1;
+    std::vector<std::uint32_t> tex_res_id_list =
+    {
+        hardrock::FnvHash("boom_0.webp"),
+        hardrock::FnvHash("boom_1.webp"),
+        hardrock::FnvHash("boom_2.webp"),
+        hardrock::FnvHash("boom_3.webp"),
+        hardrock::FnvHash("boom_4.webp"),
+        hardrock::FnvHash("boss_l.webp"),
+        hardrock::FnvHash("boss_m.webp"),
+        hardrock::FnvHash("boss_r.webp"),
+        hardrock::FnvHash("bullet_0.webp"),
+        hardrock::FnvHash("bullet_1.webp"),
+        hardrock::FnvHash("enemy_l.webp"),
+        hardrock::FnvHash("enemy_m.webp"),
+        hardrock::FnvHash("enemy_r.webp"),
+        hardrock::FnvHash("self_l.webp"),
+        hardrock::FnvHash("self_m.webp"),
+        hardrock::FnvHash("self_r.webp"),
+    };
+    std::sort(tex_res_id_list.begin(), tex_res_id_list.end());
+    auto up_tex_res_bundle = resource_manager.LoadResourceBatch(&tex_res_id_list[0], tex_res_id_list.size());
+    if (!up_tex_res_bundle)
+    {
+        std::fprintf(stderr, "the sprites are not in %s\n", args[1]);
+        return 1;
+    }
+    const RepeatedDataSet data_set(*up_tex_res_bundle);
+
+    std::printf("%zu sprites, best of %d runs, %u hardware threads\n", data_set.Count(), RUN_COUNT, std::thread::hardware_concurrency());
+    double base_ms = 0.0;
+    for (std::size_t thread_count : THREAD_COUNT_LIST)
+    {
+        hardrock::ThreadPool thread_pool(thread_count);
+        double min_ms = 1e30;
+        for (int run = 0; run < RUN_COUNT; ++run)
+        {
+            hardrock::RenderDevice::AtlasIdType atlas_id;
+            hardrock::Stopwatch stopwatch;
+            // 1024 x 1024 texels
+            const int r = up_render_device->CreateTextureAtlas(data_set, 16, 64, 64, atlas_id, &thread_pool);
+            glFinish();
+            const double ms = stopwatch.Milliseconds();
+            if (r != 0)
+            {
+                std::fprintf(stderr, "CreateTextureAtlas failed: %d\n", r);
+                return 1;
+            }
+            min_ms = std::min(min_ms, ms);
+            up_render_device->RemoveTextureAtlas(atlas_id);
+        }
+        if (thread_count == 1)
+            base_ms = min_ms;
+        std::printf("%zu threads %8.3f ms %6.2fx\n", thread_count, min_ms, base_ms / min_ms);
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+//
+//  atlas_startup.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  Startup cost of the sprite atlas main.cpp builds: the atlas baked by res_build
+//  against decoding and packing the WebP sprites, each including the resource loads.
+//  Both end with the single GL upload, which is waited for with glFinish.
+//  usage: atlas_startup <res.pack>
+//  Also prints the pixels each atlas saves by trimming sprite borders.
+//
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include "resource.h"
+#include "renderer.h"
+#include "algorithm.h"
+#include "bench.h"
+#include "bench_gl.h"
+
+namespace
+{
+    const int RUN_COUNT = 200;
+
+    struct Timing
+    {
+        double total_ms;
+        double min_ms;
+    };
+
+    // Build and remove the atlas RUN_COUNT times, return 1 if a build fails.
+    template <typename Build>
+    int TimeBuilds(hardrock::RenderDevice& render_device, Build build, Timing& out_timing)
+    {
+        out_timing.total_ms = 0.0;
+        out_timing.min_ms = 1e30;
+        for (int run = 0; run < RUN_COUNT; ++run)
+        {
+            hardrock::RenderDevice::AtlasIdType atlas_id;
+            hardrock::Stopwatch stopwatch;
+            if (build(atlas_id) != 0)
+                return 1;
+            glFinish();
+            const double ms = stopwatch.Milliseconds();
+            out_timing.total_ms += ms;
+            out_timing.min_ms = std::min(out_timing.min_ms, ms);
+            render_device.RemoveTextureAtlas(atlas_id);
+        }
+        return 0;
+    }
+
+    template <typename Build>
+    int PrintTrimReport(hardrock::RenderDevice& render_device, Build build, const char* name)
+    {
+        hardrock::RenderDevice::AtlasIdType atlas_id;
+        if (build(atlas_id) != 0)
+            return 1;
+        std::size_t full_area, drawn_area;
+        const int r = render_device.GetTextureAtlasTrimReport(atlas_id, full_area, drawn_area);
+        render_device.RemoveTextureAtlas(atlas_id);
+        if (r != 0)
+            return r;
+        std::printf("%s trim: %zu of %zu pixels drawn per sprite set, %zu saved\n", name, drawn_area, full_area, full_area - drawn_area);
+        return 0;
+    }
+}
+
+int main(int argc, char* args[])
+{
+    if (argc != 2)
+    {
+        std::fprintf(stderr, "usage: %s <res.pack>\n", args[0]);
+        return 1;
+    }
+    hardrock::MappedPackResourceManager resource_manager(args[1]);
+    hardrock::BenchGlContext gl_context;
+    if (gl_context.Create(640, 480) != 0)
+        return 1;
+    auto up_render_device = hardrock::CreateBenchRenderDevice(resource_manager, 640, 480);
+    if (!up_render_device)
+        return 1;
+    // the sprites and atlas size of main.cpp
+    std::array<std::uint32_t, 5> tex_res_id_list =
+    {
+        hardrock::FnvHash("self_l.webp"),
+        hardrock::FnvHash("self_m.webp"),
+        hardrock::FnvHash("self_r.webp"),
+        hardrock::FnvHash("bullet_0.webp"),
+        hardrock::FnvHash("bullet_1.webp"),
+    };
+    std::sort(tex_res_id_list.begin(), tex_res_id_list.end());
+
+    auto build_decoded = [&](hardrock::RenderDevice::AtlasIdType& out_atlas_id)
+    {
+        auto up_tex_res_bundle = resource_manager.LoadResourceBatch(&tex_res_id_list[0], tex_res_id_list.size());
+        if (!up_tex_res_bundle)
+            return 1;
+        return up_render_device->CreateTextureAtlas(*up_tex_res_bundle, 16, 16, 16, out_atlas_id);
+    };
+    auto build_prebaked = [&](hardrock::RenderDevice::AtlasIdType& out_atlas_id)
+    {
+        auto up_sprite_atlas_data = resource_manager.LoadResource(hardrock::FnvHash("sprite.atlas"));
+        if (!up_sprite_atlas_data)
+            return 1;
+        return up_render_device->CreatePrebakedTextureAtlas(&up_sprite_atlas_data->at(0), up_sprite_atlas_data->size(), &tex_res_id_list[0], tex_res_id_list.size(), out_atlas_id);
+    };
+
+    Timing decoded, prebaked;
+    if (TimeBuilds(*up_render_device, build_decoded, decoded) != 0)
+    {
+        std::fprintf(stderr, "decoding the WebP sprites failed\n");
+        return 1;
+    }
+    if (TimeBuilds(*up_render_device, build_prebaked, prebaked) != 0)
+    {
+        std::fprintf(stderr, "loading sprite.atlas failed\n");
+        return 1;
+    }
+    std::printf("%zu sprites, %d runs each\n", tex_res_id_list.size(), RUN_COUNT);
+    std::printf("decoded  %8.3f ms mean, %8.3f ms min\n", decoded.total_ms / RUN_COUNT, decoded.min_ms);
+    std::printf("prebaked %8.3f ms mean, %8.3f ms min\n", prebaked.total_ms / RUN_COUNT, prebaked.min_ms);
+    if (PrintTrimReport(*up_render_device, build_decoded, "decoded") != 0 ||
+        PrintTrimReport(*up_render_device, build_prebaked, "prebaked") != 0)
+    {
+        std::fprintf(stderr, "GetTextureAtlasTrimReport failed\n");
+        return 1;
+    }
+    return 0;
+}
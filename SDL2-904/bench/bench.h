@@ -0,0 +1,49 @@
+//
+//  bench.h
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#ifndef __SDL2_904__bench__
+#define __SDL2_904__bench__
+
+#include <chrono>
+#include <cstdint>
+
+namespace hardrock
+{
+    // Wall clock time since construction or the last Restart.
+    class Stopwatch
+    {
+        std::chrono::steady_clock::time_point start;
+    public:
+        Stopwatch() : start(std::chrono::steady_clock::now()) { }
+        void Restart() { this->start = std::chrono::steady_clock::now(); }
+        double Seconds() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - this->start).count(); }
+        double Milliseconds() const { return this->Seconds() * 1e3; }
+        double Nanoseconds() const { return this->Seconds() * 1e9; }
+    };
+
+    // xorshift32, the drivers need the same sequence on every platform and run.
+    class BenchRandom
+    {
+        std::uint32_t state;
+    public:
+        BenchRandom(std::uint32_t seed) : state(seed ? seed : 1) { }
+        std::uint32_t Next()
+        {
+            this->state ^= this->state << 13;
+            this->state ^= this->state >> 17;
+            this->state ^= this->state << 5;
+            return this->state;
+        }
+        // in [0, n)
+        std::uint32_t Below(std::uint32_t n) { return static_cast<std::uint32_t>(static_cast<std::uint64_t>(this->Next()) * n >> 32); }
+        // in [lo, hi)
+        float Range(float lo, float hi) { return lo + (hi - lo) * (this->Next() >> 8) * (1.0f / 16777216.0f); }
+    };
+}
+
+#endif /* defined(__SDL2_904__bench__) */
@@ -0,0 +1,116 @@
+//
+//  bench_gl.h
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#ifndef __SDL2_904__bench_gl__
+#define __SDL2_904__bench_gl__
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include <SDL2/SDL.h>
+#include "renderer.h"
+#include "resource.h"
+#include "algorithm.h"
+
+namespace hardrock
+{
+    // A hidden window with the GL 3.2 core context of main.cpp, for the drivers that draw
+    // through a GL RenderDevice. A hidden window owns no pixels, so drivers that read back what
+    // they drew bind an offscreen framebuffer first.
+    class BenchGlContext
+    {
+        SDL_Window* p_window;
+        SDL_GLContext p_context;
+        GLuint framebuffer;
+        GLuint renderbuffer;
+        int width;
+        int height;
+    public:
+        BenchGlContext() : p_window(nullptr), p_context(nullptr), framebuffer(0), renderbuffer(0), width(0), height(0) { }
+        ~BenchGlContext()
+        {
+            if (this->framebuffer)
+            {
+                glDeleteFramebuffers(1, &this->framebuffer);
+                glDeleteRenderbuffers(1, &this->renderbuffer);
+            }
+            if (this->p_context)
+                SDL_GL_DeleteContext(this->p_context);
+            if (this->p_window)
+                SDL_DestroyWindow(this->p_window);
+            SDL_Quit();
+        }
+        // return 1 and print why if SDL gives no window or context
+        int Create(int width, int height)
+        {
+            if (SDL_Init(SDL_INIT_VIDEO) < 0)
+            {
+                std::fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
+                return 1;
+            }
+            SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+            SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+            SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+            this->p_window = SDL_CreateWindow("bench", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+            if (this->p_window == nullptr)
+            {
+                std::fprintf(stderr, "SDL_CreateWindow failed: %s\n", SDL_GetError());
+                return 1;
+            }
+            this->p_context = SDL_GL_CreateContext(this->p_window);
+            if (this->p_context == nullptr)
+            {
+                std::fprintf(stderr, "SDL_GL_CreateContext failed: %s\n", SDL_GetError());
+                return 1;
+            }
+            this->width = width;
+            this->height = height;
+            return 0;
+        }
+        // Draw into an RGBA8 framebuffer of the window size from now on.
+        int BindFramebuffer()
+        {
+            glGenFramebuffers(1, &this->framebuffer);
+            glGenRenderbuffers(1, &this->renderbuffer);
+            glBindRenderbuffer(GL_RENDERBUFFER, this->renderbuffer);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, this->width, this->height);
+            glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->renderbuffer);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            {
+                std::fprintf(stderr, "the offscreen framebuffer is incomplete\n");
+                return 1;
+            }
+            glViewport(0, 0, this->width, this->height);
+            return 0;
+        }
+        // RGBA8 pixels of the bound framebuffer, bottom row first
+        void ReadPixels(std::vector<std::uint32_t>& out_pixels) const
+        {
+            out_pixels.resize(static_cast<std::size_t>(this->width) * this->height);
+            glReadPixels(0, 0, this->width, this->height, GL_RGBA, GL_UNSIGNED_BYTE, &out_pixels[0]);
+        }
+    };
+
+    // RenderDevice::Create with the shaders main.cpp loads from res.pack, tile_instanced.vert for
+    // the INSTANCED path. Null on failure.
+    inline std::unique_ptr<RenderDevice> CreateBenchRenderDevice(MappedPackResourceManager& resource_manager, int screen_width, int screen_height, RenderDevice::RenderPath render_path = RenderDevice::RenderPath::VERTICES, RenderDevice::BufferMode buffer_mode = RenderDevice::BufferMode::RETAINED, std::size_t tile_capacity = RenderDevice::DEFAULT_TILE_CAPACITY)
+    {
+        const char* vert_shader_name = render_path == RenderDevice::RenderPath::INSTANCED ? "tile_instanced.vert" : "test.vert";
+        auto up_vert_shader_data = resource_manager.LoadResource(FnvHash(vert_shader_name));
+        auto up_frag_shader_data = resource_manager.LoadResource(FnvHash("test.frag"));
+        if (!up_vert_shader_data || !up_frag_shader_data)
+        {
+            std::fprintf(stderr, "no %s or test.frag in the pack\n", vert_shader_name);
+            return nullptr;
+        }
+        return RenderDevice::Create(screen_width, screen_height, &up_vert_shader_data->at(0), up_vert_shader_data->size(), &up_frag_shader_data->at(0), up_frag_shader_data->size(), render_path, buffer_mode, tile_capacity);
+    }
+}
+
+#endif /* defined(__SDL2_904__bench_gl__) */
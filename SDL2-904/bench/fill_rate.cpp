@@ -0,0 +1,165 @@
+//
+//  fill_rate.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  Fill rate of the software device: 10000 axis-aligned 16 x 16 sprites of the main.cpp atlas
+//  at 640 x 480, drawn on one thread and on a ThreadPool of every core. The frame is then
+//  drawn by a GL device into an offscreen framebuffer and the pixels that differ are counted.
+//  usage: fill_rate <res.pack>
+//
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <vector>
+#include "resource.h"
+#include "renderer.h"
+#include "software_executor.h"
+#include "parallel.h"
+#include "algorithm.h"
+#include "bench.h"
+#include "bench_gl.h"
+
+namespace
+{
+    const int SCREEN_WIDTH = 640;
+    const int SCREEN_HEIGHT = 480;
+    const std::size_t SPRITE_COUNT = 10000;
+    const float SPRITE_SIZE = 16.0f;
+    const int FRAME_COUNT = 10;
+
+    struct Atlas
+    {
+        std::unique_ptr<std::vector<std::uint8_t>> up_data;
+        std::array<std::uint32_t, 5> rid_list;
+    };
+
+    // an atlas and a batch of SPRITE_COUNT tiles
+    int Prepare(hardrock::RenderDevice& render_device, const Atlas& atlas, hardrock::RenderDevice::BatchIdType& out_batch_id)
+    {
+        hardrock::RenderDevice::AtlasIdType atlas_id;
+        if (render_device.CreatePrebakedTextureAtlas(&atlas.up_data->at(0), atlas.up_data->size(), &atlas.rid_list[0], atlas.rid_list.size(), atlas_id) != 0)
+            return 1;
+        return render_device.CreateBatch(SPRITE_COUNT, atlas_id, out_batch_id);
+    }
+
+    // Draw FRAME_COUNT frames of tile_list with the software device, return 1 if one fails.
+    int TimeSoftware(hardrock::ThreadPool* p_thread_pool, const Atlas& atlas, const std::vector<hardrock::Tile>& tile_list, std::vector<std::uint32_t>& out_pixels)
+    {
+        auto up_render_device = hardrock::RenderDevice::CreateSoftware(SCREEN_WIDTH, SCREEN_HEIGHT, p_thread_pool, hardrock::RenderDevice::RenderPath::VERTICES, hardrock::RenderDevice::BufferMode::RETAINED, SPRITE_COUNT);
+        hardrock::RenderDevice::BatchIdType batch_id;
+        if (!up_render_device || Prepare(*up_render_device, atlas, batch_id) != 0)
+            return 1;
+        hardrock::SoftwareCommandExecutor* p_executor = up_render_device->GetSoftwareExecutor();
+        double total_ms = 0.0, best_ms = 1e30;
+        for (int frame = 0; frame < FRAME_COUNT; ++frame)
+        {
+            hardrock::TileSpanSequence tile_seq(&tile_list[0], tile_list.size());
+            hardrock::RenderDevice::RenderQuest render_quest = { &tile_seq, {}, glm::mat2(1, 0, 0, 1), batch_id, 0, {} };
+            p_executor->Clear(0xff000000u);
+            hardrock::Stopwatch stopwatch;
+            if (up_render_device->Render(&render_quest, &render_quest + 1) != 0)
+                return 1;
+            const double ms = stopwatch.Milliseconds();
+            total_ms += ms;
+            best_ms = std::min(best_ms, ms);
+        }
+        const std::uint64_t pixel_count = p_executor->GetPixelCount();
+        std::printf("%2zu threads: %7.2f ms a frame mean, %7.2f ms best, %llu pixels, %6.1f Mpixels/s\n",
+                    p_thread_pool ? p_thread_pool->ThreadCount() : 1, total_ms / FRAME_COUNT, best_ms,
+                    static_cast<unsigned long long>(pixel_count), pixel_count / best_ms * 1e-3);
+        out_pixels.assign(p_executor->GetPixels(), p_executor->GetPixels() + SCREEN_WIDTH * SCREEN_HEIGHT);
+        return 0;
+    }
+
+    // the frame through a GL device, rows flipped to put row 0 at the top like the software device
+    int DrawGl(hardrock::MappedPackResourceManager& resource_manager, const Atlas& atlas, const std::vector<hardrock::Tile>& tile_list, std::vector<std::uint32_t>& out_pixels)
+    {
+        hardrock::BenchGlContext gl_context;
+        if (gl_context.Create(SCREEN_WIDTH, SCREEN_HEIGHT) != 0 || gl_context.BindFramebuffer() != 0)
+            return 1;
+        auto up_render_device = hardrock::CreateBenchRenderDevice(resource_manager, SCREEN_WIDTH, SCREEN_HEIGHT, hardrock::RenderDevice::RenderPath::VERTICES, hardrock::RenderDevice::BufferMode::RETAINED, SPRITE_COUNT);
+        hardrock::RenderDevice::BatchIdType batch_id;
+        if (!up_render_device || Prepare(*up_render_device, atlas, batch_id) != 0)
+            return 1;
+        hardrock::TileSpanSequence tile_seq(&tile_list[0], tile_list.size());
+        hardrock::RenderDevice::RenderQuest render_quest = { &tile_seq, {}, glm::mat2(1, 0, 0, 1), batch_id, 0, {} };
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        if (up_render_device->Render(&render_quest, &render_quest + 1) != 0)
+            return 1;
+        std::vector<std::uint32_t> pixels;
+        gl_context.ReadPixels(pixels);
+        if (glGetError() != GL_NO_ERROR)
+            return 1;
+        out_pixels.resize(pixels.size());
+        for (int y = 0; y < SCREEN_HEIGHT; ++y)
+            std::copy(&pixels[(SCREEN_HEIGHT - 1 - y) * SCREEN_WIDTH], &pixels[(SCREEN_HEIGHT - y) * SCREEN_WIDTH], &out_pixels[y * SCREEN_WIDTH]);
+        return 0;
+    }
+}
+
+int main(int argc, char* args[])
+{
+    if (argc != 2)
+    {
+        std::fprintf(stderr, "usage: %s <res.pack>\n", args[0]);
+        return 1;
+    }
+    hardrock::MappedPackResourceManager resource_manager(args[1]);
+    Atlas atlas =
+    {
+        resource_manager.LoadResource(hardrock::FnvHash("sprite.atlas")),
+        {{
+            hardrock::FnvHash("self_l.webp"),
+            hardrock::FnvHash("self_m.webp"),
+            hardrock::FnvHash("self_r.webp"),
+            hardrock::FnvHash("bullet_0.webp"),
+            hardrock::FnvHash("bullet_1.webp"),
+        }},
+    };
+    if (!atlas.up_data)
+    {
+        std::fprintf(stderr, "no sprite.atlas in %s\n", args[1]);
+        return 1;
+    }
+    std::sort(atlas.rid_list.begin(), atlas.rid_list.end());
+
+    // whole pixel positions, so GL and the software device sample the same texels
+    std::vector<hardrock::Tile> tile_list(SPRITE_COUNT);
+    hardrock::BenchRandom random(3);
+    for (auto& tile : tile_list)
+    {
+        tile.transform = glm::mat2(SPRITE_SIZE, 0.0f, 0.0f, SPRITE_SIZE);
+        tile.translate = glm::vec2(static_cast<float>(random.Below(SCREEN_WIDTH)), static_cast<float>(random.Below(SCREEN_HEIGHT)));
+        tile.tex_id = static_cast<std::uint16_t>(random.Below(atlas.rid_list.size()));
+        tile.palette_id = 0;
+        tile.color = glm::u8vec4(0xf0, 0xf0, 0xf0, 0xff);
+    }
+
+    std::vector<std::uint32_t> pixels, pool_pixels, gl_pixels;
+    hardrock::ThreadPool thread_pool;
+    if (TimeSoftware(nullptr, atlas, tile_list, pixels) != 0 || TimeSoftware(&thread_pool, atlas, tile_list, pool_pixels) != 0)
+    {
+        std::fprintf(stderr, "drawing with the software device failed\n");
+        return 1;
+    }
+    if (pool_pixels != pixels)
+    {
+        std::fprintf(stderr, "the ThreadPool frame differs from the single thread one\n");
+        return 1;
+    }
+    if (DrawGl(resource_manager, atlas, tile_list, gl_pixels) != 0)
+    {
+        std::fprintf(stderr, "drawing with the GL device failed\n");
+        return 1;
+    }
+    std::size_t diff_count = 0;
+    for (std::size_t i = 0; i < pixels.size(); ++i)
+        diff_count += pixels[i] != gl_pixels[i];
+    std::printf("%zu of %zu pixels differ from GL\n", diff_count, pixels.size());
+    return 0;
+}
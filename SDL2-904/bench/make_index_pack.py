@@ -0,0 +1,46 @@
+#!/usr/bin/env python
+# -*- coding: UTF-8 -*-
+
+# Write a pack of count small entries with random rids, for the index lookup benchmark.
+# The sorted rids go to <output>.rids, one per line.
+
+import os
+import sys
+import random
+import struct
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'res_build'))
+import pack
+
+def main():
+    import argparse
+    parser = argparse.ArgumentParser(description='Write a synthetic pack.')
+    parser.add_argument('-o', '--output', help='Output file.', required=True)
+    parser.add_argument('-n', '--count', help='Entry count.', type=int, required=True)
+    parser.add_argument('-p', '--perfect-hash', help='Append a perfect hash section.', action='store_true')
+    args = parser.parse_args()
+    # the same rids with and without the hash section
+    random.seed(args.count)
+    rid_list = sorted(set(random.getrandbits(32) for _ in xrange(args.count)))
+    with open(args.output, 'wb') as f:
+        f.write(struct.pack(pack.FMT_HEADER, '????', 0, 0))
+        pos = struct.calcsize(pack.FMT_HEADER)
+        index_list = []
+        for rid in rid_list:
+            d = chr(rid & 0xff) * (1 + rid % 64)
+            f.write(d)
+            index_list.append((rid, pos, len(d)))
+            pos += len(d)
+        index_pos = pos
+        for index in index_list:
+            f.write(struct.pack(pack.FMT_INDEX, *index))
+        if args.perfect_hash:
+            pack.write_hash_section(f, rid_list)
+        f.seek(0)
+        f.write(struct.pack(pack.FMT_HEADER, 'PACK', len(index_list), index_pos))
+    with open(args.output + '.rids', 'w') as f:
+        for rid in rid_list:
+            f.write('%d\n' % rid)
+
+if __name__ == '__main__':
+    main()
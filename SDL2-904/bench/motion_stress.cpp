@@ -0,0 +1,249 @@
+//
+//  motion_stress.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  MotionSystem with the five kinds mixed. A third of the movers are removed, then 200
+//  steps are checked against a scalar reference that uses FastSinCos, and a system on a
+//  ThreadPool has to match the single threaded one exactly. After that Update of all the
+//  movers is timed on the calling thread and on pools of 2, 4 and 8 threads.
+//  usage: motion_stress
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "motion.h"
+#include "parallel.h"
+#include "algorithm.h"
+#include "bench.h"
+
+namespace
+{
+    const std::size_t MOVER_COUNT_LIST[] = { 100000, 200000 };
+    const std::size_t THREAD_COUNT_LIST[] = { 2, 4, 8 };
+    const int STEP_COUNT = 200;
+    const int TIMED_UPDATE_COUNT = 50;
+    // the kernels may round differently from the scalar code, e.g. with fused multiply-adds
+    const float MAX_DISTANCE = 0.05f;
+
+    struct Reference
+    {
+        hardrock::MotionKind kind;
+        glm::vec2 pos;
+        glm::vec2 velocity;
+        glm::vec2 acceleration;
+        glm::vec2 centre;
+        glm::vec2 swing;
+        float angle;
+        float speed;
+        float angular_speed;
+        float speed_acceleration;
+        float phase;
+        float phase_speed;
+        float amplitude;
+        float steer;
+    };
+
+    void Step(Reference& r, const glm::vec2& target)
+    {
+        float sin, cos;
+        switch (r.kind)
+        {
+            case hardrock::MotionKind::LINEAR:
+                r.pos += r.velocity;
+                break;
+            case hardrock::MotionKind::ACCELERATED:
+                r.velocity += r.acceleration;
+                r.pos += r.velocity;
+                break;
+            case hardrock::MotionKind::POLAR:
+                r.speed += r.speed_acceleration;
+                r.angle += r.angular_speed;
+                hardrock::FastSinCos(r.angle, &sin, &cos);
+                r.pos += glm::vec2(cos, sin) * r.speed;
+                break;
+            case hardrock::MotionKind::SINE:
+                r.centre += r.velocity;
+                r.phase += r.phase_speed;
+                hardrock::FastSinCos(r.phase, &sin, &cos);
+                r.pos = r.centre + r.swing * sin;
+                break;
+            default:
+            {
+                const glm::vec2 d = target - r.pos;
+                const float length = std::sqrt(std::max(d.x * d.x + d.y * d.y, 1e-12f));
+                r.velocity += (d * (r.speed / length) - r.velocity) * r.steer;
+                r.pos += r.velocity;
+                break;
+            }
+        }
+    }
+
+    Reference MakeReference(hardrock::BenchRandom& random, std::size_t i)
+    {
+        Reference r = Reference();
+        r.kind = static_cast<hardrock::MotionKind>(i % static_cast<std::size_t>(hardrock::MotionKind::COUNT));
+        r.pos = glm::vec2(random.Range(20.0f, 620.0f), random.Range(40.0f, 440.0f));
+        r.velocity = glm::vec2(random.Range(-4.0f, 4.0f), random.Range(-4.0f, 4.0f));
+        switch (r.kind)
+        {
+            case hardrock::MotionKind::LINEAR:
+                break;
+            case hardrock::MotionKind::ACCELERATED:
+                r.acceleration = glm::vec2(random.Range(-0.1f, 0.1f), random.Range(-0.1f, 0.1f));
+                break;
+            case hardrock::MotionKind::POLAR:
+                r.angle = random.Range(-10.0f, 10.0f);
+                r.speed = random.Range(-3.0f, 3.0f);
+                r.angular_speed = random.Range(-0.2f, 0.2f);
+                r.speed_acceleration = random.Range(-0.01f, 0.01f);
+                break;
+            case hardrock::MotionKind::SINE:
+            {
+                r.phase = random.Range(-6.0f, 6.0f);
+                r.phase_speed = random.Range(-0.3f, 0.3f);
+                r.amplitude = random.Range(-20.0f, 20.0f);
+                const float length = std::sqrt(r.velocity.x * r.velocity.x + r.velocity.y * r.velocity.y);
+                r.swing = glm::vec2(-r.velocity.y, r.velocity.x) * (r.amplitude / length);
+                r.centre = r.pos;
+                break;
+            }
+            default:
+                r.speed = 3.0f;
+                r.steer = 0.05f;
+                break;
+        }
+        return r;
+    }
+
+    int AddMover(const Reference& r, hardrock::MotionSystem& system, hardrock::MotionRef& out_ref)
+    {
+        switch (r.kind)
+        {
+            case hardrock::MotionKind::LINEAR:
+                return system.CreateLinear(r.pos, r.velocity, out_ref);
+            case hardrock::MotionKind::ACCELERATED:
+                return system.CreateAccelerated(r.pos, r.velocity, r.acceleration, out_ref);
+            case hardrock::MotionKind::POLAR:
+                return system.CreatePolar(r.pos, r.angle, r.speed, r.angular_speed, r.speed_acceleration, out_ref);
+            case hardrock::MotionKind::SINE:
+                return system.CreateSine(r.pos, r.velocity, r.amplitude, r.phase, r.phase_speed, out_ref);
+            default:
+                return system.CreateHoming(r.pos, r.velocity, r.speed, r.steer, out_ref);
+        }
+    }
+
+    // best Update time of mover_count movers, p_thread_pool may be null
+    double TimeUpdate(std::size_t mover_count, hardrock::ThreadPool* p_thread_pool)
+    {
+        hardrock::MotionSystem system(p_thread_pool);
+        system.SetHomingTarget(glm::vec2(320.0f, 240.0f));
+        hardrock::BenchRandom random(3);
+        for (std::size_t i = 0; i < mover_count; ++i)
+        {
+            hardrock::MotionRef ref;
+            AddMover(MakeReference(random, i), system, ref);
+        }
+        double best_ms = 1e30;
+        for (int k = 0; k < TIMED_UPDATE_COUNT; ++k)
+        {
+            hardrock::Stopwatch stopwatch;
+            system.Update();
+            best_ms = std::min(best_ms, stopwatch.Milliseconds());
+        }
+        return best_ms;
+    }
+
+    int Run(std::size_t mover_count)
+    {
+        const char* const kind_name_list[] = { "linear", "accelerated", "polar", "sine", "homing" };
+        hardrock::ThreadPool thread_pool(4);
+        hardrock::MotionSystem single;
+        hardrock::MotionSystem threaded(&thread_pool);
+        const glm::vec2 target(320.0f, 240.0f);
+        single.SetHomingTarget(target);
+        threaded.SetHomingTarget(target);
+
+        hardrock::BenchRandom random(3);
+        std::vector<Reference> reference_list(mover_count);
+        std::vector<hardrock::MotionRef> single_ref_list(mover_count);
+        std::vector<hardrock::MotionRef> threaded_ref_list(mover_count);
+        for (std::size_t i = 0; i < mover_count; ++i)
+        {
+            reference_list[i] = MakeReference(random, i);
+            if (AddMover(reference_list[i], single, single_ref_list[i]) != 0 || AddMover(reference_list[i], threaded, threaded_ref_list[i]) != 0)
+            {
+                std::fprintf(stderr, "the motion system is full at %zu movers\n", i);
+                return 1;
+            }
+        }
+        std::size_t error_count = 0;
+        for (std::size_t i = 0; i < mover_count; i += 3)
+        {
+            error_count += single.Remove(single_ref_list[i]) != 0 || threaded.Remove(threaded_ref_list[i]) != 0;
+            // a second remove has to see the stale ref
+            error_count += single.Remove(single_ref_list[i]) != 1;
+        }
+
+        for (int step = 0; step < STEP_COUNT; ++step)
+        {
+            single.Update();
+            threaded.Update();
+            for (Reference& r : reference_list)
+                Step(r, target);
+        }
+        float max_distance[static_cast<std::size_t>(hardrock::MotionKind::COUNT)] = {};
+        std::size_t threaded_diff_count = 0;
+        for (std::size_t i = 0; i < mover_count; ++i)
+        {
+            if (i % 3 == 0)
+                continue;
+            glm::vec2 single_pos, threaded_pos;
+            if (single.GetPos(single_ref_list[i], single_pos) != 0 || threaded.GetPos(threaded_ref_list[i], threaded_pos) != 0)
+            {
+                ++error_count;
+                continue;
+            }
+            threaded_diff_count += single_pos.x != threaded_pos.x || single_pos.y != threaded_pos.y;
+            const glm::vec2 d = single_pos - reference_list[i].pos;
+            float& max = max_distance[static_cast<std::size_t>(reference_list[i].kind)];
+            max = std::max(max, std::sqrt(d.x * d.x + d.y * d.y));
+        }
+        std::printf("%zu of %zu movers left, %d steps, %zu handle errors, %zu threaded positions differ\n",
+                    single.Size(), mover_count, STEP_COUNT, error_count, threaded_diff_count);
+        bool close = true;
+        for (std::size_t k = 0; k < static_cast<std::size_t>(hardrock::MotionKind::COUNT); ++k)
+        {
+            std::printf("  %-12s %g px from the scalar reference\n", kind_name_list[k], max_distance[k]);
+            close = close && max_distance[k] <= MAX_DISTANCE;
+        }
+        if (error_count != 0 || threaded_diff_count != 0 || !close)
+            return 1;
+
+        // all the movers again, so every thread count moves the same set
+        std::printf("  Update of %zu, best of %d: calling thread %.3f ms", mover_count, TIMED_UPDATE_COUNT, TimeUpdate(mover_count, nullptr));
+        for (std::size_t thread_count : THREAD_COUNT_LIST)
+        {
+            hardrock::ThreadPool pool(thread_count);
+            std::printf(", %zu threads %.3f ms", thread_count, TimeUpdate(mover_count, &pool));
+        }
+        std::printf("\n");
+        return 0;
+    }
+}
+
+int main()
+{
+    std::printf("%u hardware threads\n", std::thread::hardware_concurrency());
+    for (std::size_t mover_count : MOVER_COUNT_LIST)
+    {
+        if (Run(mover_count) != 0)
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+//
+//  pack_compress.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  LoadResource throughput of a pack written with pack.py -c against the same files
+//  stored raw, through both pack managers.
+//  usage: pack_compress <compressed pack> <raw pack> <resource list>
+//  The resource list is the pack.py input, only the names are used. The files are
+//  read with a warm page cache, so this is the decode cost, not the I/O saved.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "resource.h"
+#include "algorithm.h"
+#include "bench.h"
+
+namespace
+{
+    const int ROUND_COUNT = 5;
+
+    std::size_t FileSize(const char* path)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        return file ? static_cast<std::size_t>(file.tellg()) : 0;
+    }
+
+    // Load every rid ROUND_COUNT times, return raw MB/s or a negative value if a load fails.
+    double TimeLoads(const hardrock::IResourceManager& resource_manager, const std::vector<std::uint32_t>& rid_list, std::vector<std::uint8_t>& buffer)
+    {
+        std::size_t total_size = 0;
+        hardrock::Stopwatch stopwatch;
+        for (int round = 0; round < ROUND_COUNT; ++round)
+        {
+            for (std::uint32_t rid : rid_list)
+            {
+                const int size = resource_manager.LoadResource(rid, &buffer[0], buffer.size());
+                if (size <= 0)
+                    return -1.0;
+                total_size += static_cast<std::size_t>(size);
+            }
+        }
+        return total_size / stopwatch.Seconds() / (1024.0 * 1024.0);
+    }
+}
+
+int main(int argc, char* args[])
+{
+    if (argc != 4)
+    {
+        std::fprintf(stderr, "usage: %s <compressed pack> <raw pack> <resource list>\n", args[0]);
+        return 1;
+    }
+    std::vector<std::uint32_t> rid_list;
+    {
+        std::ifstream f(args[3]);
+        std::string line;
+        while (std::getline(f, line))
+        {
+            std::istringstream parts(line);
+            std::string name, path;
+            if (parts >> name >> path)
+                rid_list.push_back(hardrock::FnvHash(name.c_str()));
+        }
+    }
+    if (rid_list.empty())
+    {
+        std::fprintf(stderr, "no resources in %s\n", args[3]);
+        return 1;
+    }
+    hardrock::MappedPackResourceManager mapped_compressed(args[1]);
+    hardrock::MappedPackResourceManager mapped_raw(args[2]);
+    hardrock::PackResourceManager stream_compressed(args[1]);
+    hardrock::PackResourceManager stream_raw(args[2]);
+
+    // the compressed pack has to give back the raw bytes
+    std::size_t raw_total = 0;
+    std::size_t max_size = 0;
+    for (std::uint32_t rid : rid_list)
+    {
+        auto up_compressed = mapped_compressed.LoadResource(rid);
+        auto up_raw = mapped_raw.LoadResource(rid);
+        if (!up_compressed || !up_raw || *up_compressed != *up_raw ||
+            stream_compressed.LoadResource(rid, nullptr, 0) != static_cast<int>(up_raw->size()))
+        {
+            std::fprintf(stderr, "rid %08x differs between the packs\n", rid);
+            return 1;
+        }
+        raw_total += up_raw->size();
+        max_size = std::max(max_size, up_raw->size());
+    }
+
+    std::vector<std::uint8_t> buffer(max_size);
+    struct Case
+    {
+        const char* name;
+        const hardrock::IResourceManager* p_resource_manager;
+    };
+    const Case case_list[] =
+    {
+        { "mapped, compressed", &mapped_compressed },
+        { "mapped, raw", &mapped_raw },
+        { "stream, compressed", &stream_compressed },
+        { "stream, raw", &stream_raw },
+    };
+    std::printf("%zu resources, %.2f MB raw, packs of %.2f MB compressed and %.2f MB raw\n",
+                rid_list.size(), raw_total / (1024.0 * 1024.0),
+                FileSize(args[1]) / (1024.0 * 1024.0), FileSize(args[2]) / (1024.0 * 1024.0));
+    for (const Case& c : case_list)
+    {
+        // an untimed pass warms the page cache
+        TimeLoads(*c.p_resource_manager, rid_list, buffer);
+        const double mb_per_second = TimeLoads(*c.p_resource_manager, rid_list, buffer);
+        if (mb_per_second < 0.0)
+        {
+            std::fprintf(stderr, "%s: load failed\n", c.name);
+            return 1;
+        }
+        std::printf("%-20s %8.1f MB/s\n", c.name, mb_per_second);
+    }
+    return 0;
+}
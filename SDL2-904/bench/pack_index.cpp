@@ -0,0 +1,97 @@
+//
+//  pack_index.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  Pack index lookups with the perfect hash section against binary search.
+//  usage: pack_index <pack with hash> <pack without hash> <rid list>
+//  Both packs hold the rids of the list, one pack manager is opened on each and
+//  GetResourceView is timed over the same random rid sequence.
+//
+
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include "resource.h"
+#include "bench.h"
+
+namespace
+{
+    const std::size_t LOOKUP_COUNT = 1000000;
+
+    // return ns per lookup, or a negative value if a lookup fails
+    double TimeLookups(const hardrock::MappedPackResourceManager& resource_manager, const std::vector<std::uint32_t>& query_list)
+    {
+        std::size_t total_size = 0;
+        hardrock::Stopwatch stopwatch;
+        for (std::uint32_t rid : query_list)
+        {
+            const std::uint8_t* p_data;
+            std::size_t size;
+            if (resource_manager.GetResourceView(rid, p_data, size) != 0)
+                return -1.0;
+            total_size += size;
+        }
+        const double ns = stopwatch.Nanoseconds() / query_list.size();
+        // keep the loop from being dropped
+        return total_size != 0 ? ns : -1.0;
+    }
+}
+
+int main(int argc, char* args[])
+{
+    if (argc != 4)
+    {
+        std::fprintf(stderr, "usage: %s <pack with hash> <pack without hash> <rid list>\n", args[0]);
+        return 1;
+    }
+    std::vector<std::uint32_t> rid_list;
+    {
+        std::ifstream f(args[3]);
+        std::uint32_t rid;
+        while (f >> rid)
+            rid_list.push_back(rid);
+    }
+    if (rid_list.empty())
+    {
+        std::fprintf(stderr, "no rids in %s\n", args[3]);
+        return 1;
+    }
+    hardrock::MappedPackResourceManager hash_manager(args[1]);
+    hardrock::MappedPackResourceManager binary_manager(args[2]);
+
+    // every rid has to be found by both, with the same data
+    for (std::uint32_t rid : rid_list)
+    {
+        const std::uint8_t* p_hash_data;
+        const std::uint8_t* p_binary_data;
+        std::size_t hash_size, binary_size;
+        if (hash_manager.GetResourceView(rid, p_hash_data, hash_size) != 0 ||
+            binary_manager.GetResourceView(rid, p_binary_data, binary_size) != 0 ||
+            hash_size != binary_size || *p_hash_data != *p_binary_data)
+        {
+            std::fprintf(stderr, "rid %u differs between the packs\n", rid);
+            return 1;
+        }
+    }
+
+    hardrock::BenchRandom random(1);
+    std::vector<std::uint32_t> query_list(LOOKUP_COUNT);
+    for (auto& rid : query_list)
+        rid = rid_list[random.Below(static_cast<std::uint32_t>(rid_list.size()))];
+    // warm both mappings before timing
+    TimeLookups(hash_manager, query_list);
+    TimeLookups(binary_manager, query_list);
+    const double hash_ns = TimeLookups(hash_manager, query_list);
+    const double binary_ns = TimeLookups(binary_manager, query_list);
+    if (hash_ns < 0.0 || binary_ns < 0.0)
+    {
+        std::fprintf(stderr, "lookup failed\n");
+        return 1;
+    }
+    std::printf("%zu entries, %zu random lookups: hash %.1f ns, binary search %.1f ns per lookup\n",
+                rid_list.size(), query_list.size(), hash_ns, binary_ns);
+    return 0;
+}
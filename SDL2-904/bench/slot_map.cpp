@@ -0,0 +1,143 @@
+//
+//  slot_map.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  LargeSlotMap in front of dense position and velocity arrays, the way the motion code
+//  keeps its movers: 100k creates, an update pass, a lookup through every handle, 50k
+//  random removes followed by an update pass, and 50k creates on the freed slots. Best of
+//  5. Every run also checks that removed handles are refused once their slots are reused
+//  and that live handles still find their elements.
+//  usage: slot_map
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include "structure.h"
+#include "bench.h"
+
+namespace
+{
+    const std::size_t OBJECT_COUNT = 100000;
+    const int RUN_COUNT = 5;
+
+    struct Vec
+    {
+        float x;
+        float y;
+    };
+
+    struct Objects
+    {
+        hardrock::LargeSlotMap slot_map;
+        std::vector<Vec> velocity_list;
+        std::vector<Vec> pos_list;
+        Objects() : slot_map(OBJECT_COUNT)
+        {
+            this->velocity_list.reserve(OBJECT_COUNT);
+            this->pos_list.reserve(OBJECT_COUNT);
+        }
+        int Create(const Vec& velocity, const Vec& pos, hardrock::LargeSlotMap::HandleType& out_handle)
+        {
+            if (this->slot_map.Create(out_handle) != 0)
+                return 1;
+            this->velocity_list.push_back(velocity);
+            this->pos_list.push_back(pos);
+            return 0;
+        }
+        int Remove(hardrock::LargeSlotMap::HandleType handle)
+        {
+            std::size_t idx;
+            if (this->slot_map.Remove(handle, idx) != 0)
+                return 1;
+            this->velocity_list[idx] = this->velocity_list.back();
+            this->pos_list[idx] = this->pos_list.back();
+            this->velocity_list.pop_back();
+            this->pos_list.pop_back();
+            return 0;
+        }
+        void Update()
+        {
+            for (std::size_t i = 0; i < this->pos_list.size(); ++i)
+            {
+                this->pos_list[i].x += this->velocity_list[i].x;
+                this->pos_list[i].y += this->velocity_list[i].y;
+            }
+        }
+    };
+}
+
+int main()
+{
+    const char* const phase_name_list[] = { "create", "update pass", "handle lookup", "remove half + update", "recreate half" };
+    const int PHASE_COUNT = 5;
+    double best_ms[PHASE_COUNT];
+    std::fill(best_ms, best_ms + PHASE_COUNT, 1e30);
+    float sum = 0.0f;
+    for (int run = 0; run < RUN_COUNT; ++run)
+    {
+        Objects objects;
+        std::vector<hardrock::LargeSlotMap::HandleType> handle_list(OBJECT_COUNT);
+        double ms[PHASE_COUNT];
+        int error_count = 0;
+
+        hardrock::Stopwatch stopwatch;
+        for (std::size_t i = 0; i < OBJECT_COUNT; ++i)
+            error_count += objects.Create({1.0f, 2.0f}, {static_cast<float>(i), 0.0f}, handle_list[i]);
+        ms[0] = stopwatch.Milliseconds();
+
+        stopwatch.Restart();
+        objects.Update();
+        ms[1] = stopwatch.Milliseconds();
+
+        stopwatch.Restart();
+        for (auto handle : handle_list)
+        {
+            std::size_t idx;
+            if (objects.slot_map.Find(handle, idx) != 0)
+                ++error_count;
+            else
+                sum += objects.pos_list[idx].x;
+        }
+        ms[2] = stopwatch.Milliseconds();
+
+        hardrock::BenchRandom random(static_cast<std::uint32_t>(run + 1));
+        for (std::size_t i = handle_list.size() - 1; i > 0; --i)
+            std::swap(handle_list[i], handle_list[random.Below(static_cast<std::uint32_t>(i + 1))]);
+        stopwatch.Restart();
+        for (std::size_t i = 0; i < OBJECT_COUNT / 2; ++i)
+            error_count += objects.Remove(handle_list[i]);
+        objects.Update();
+        ms[3] = stopwatch.Milliseconds();
+
+        std::vector<hardrock::LargeSlotMap::HandleType> new_handle_list(OBJECT_COUNT / 2);
+        stopwatch.Restart();
+        for (auto& handle : new_handle_list)
+            error_count += objects.Create({1.0f, 2.0f}, {0.0f, 0.0f}, handle);
+        ms[4] = stopwatch.Milliseconds();
+
+        // the first half reuses the slots of the removed handles, which have to stay stale
+        for (std::size_t i = 0; i < OBJECT_COUNT / 2; ++i)
+            error_count += objects.slot_map.Contains(handle_list[i]) || !objects.slot_map.Contains(new_handle_list[i]);
+        for (std::size_t i = OBJECT_COUNT / 2; i < OBJECT_COUNT; ++i)
+        {
+            std::size_t idx;
+            error_count += objects.slot_map.Find(handle_list[i], idx) != 0 || objects.slot_map.HandleAt(idx) != handle_list[i];
+        }
+        error_count += objects.slot_map.Size() != OBJECT_COUNT || objects.pos_list.size() != OBJECT_COUNT;
+        if (error_count != 0)
+        {
+            std::fprintf(stderr, "run %d: %d handle errors\n", run, error_count);
+            return 1;
+        }
+        for (int k = 0; k < PHASE_COUNT; ++k)
+            best_ms[k] = std::min(best_ms[k], ms[k]);
+    }
+    std::printf("%zu objects, best of %d runs, stale and live handles checked (%g)\n", OBJECT_COUNT, RUN_COUNT, sum);
+    for (int k = 0; k < PHASE_COUNT; ++k)
+        std::printf("%-22s %8.3f ms\n", phase_name_list[k], best_ms[k]);
+    return 0;
+}
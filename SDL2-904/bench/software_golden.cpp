@@ -0,0 +1,302 @@
+//
+//  software_golden.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  Golden image test of SoftwareCommandExecutor. A fixed command buffer with rotated, scaled,
+//  repeating, coloured and translucent tiles on an RGBA and an INDEX8 texture, both made up
+//  here, is drawn on one thread and on a ThreadPool. Both frames have to match the lossless
+//  WebP reference byte for byte. --write replaces the reference with the frame, for changes
+//  to the rasterizer that are meant to change its output.
+//  usage: software_golden <reference.webp> [--write]
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "command.h"
+#include "software_executor.h"
+#include "parallel.h"
+#include "webp/decode.h"
+#include "webp/encode.h"
+
+namespace
+{
+    const int WIDTH = 256;
+    const int HEIGHT = 192;
+    const std::uint32_t RGBA_TEXTURE = 1;
+    const std::uint32_t INDEX_TEXTURE = 2;
+    const std::uint32_t CLEAR_RGBA = 0xff402010u;
+
+    // RenderDevice::TileVertex, the VERTICES tile data is 4 of them per tile
+    struct Vertex
+    {
+        float x, y;
+        std::uint8_t s, t;
+        std::uint8_t palette, padding;
+        std::uint8_t color[4];
+    };
+    static_assert(sizeof(Vertex) == 16, "the layout of RenderDevice::TileVertex");
+
+    // Quad with corner (u, v) at (x, y) + u * vec_x + v * vec_y in pixels, row 0 at the top,
+    // sampling rect (s0, t0, s1, t1) in 1/128 of the texture.
+    void AddTile(std::vector<Vertex>& vertex_list, float x, float y, float vec_x_x, float vec_x_y, float vec_y_x, float vec_y_y, const std::uint8_t rect[4], std::uint32_t rgba, std::uint8_t palette)
+    {
+        const float corner[4][2] =
+        {
+            { x, y },
+            { x + vec_x_x, y + vec_x_y },
+            { x + vec_x_x + vec_y_x, y + vec_x_y + vec_y_y },
+            { x + vec_y_x, y + vec_y_y },
+        };
+        const std::uint8_t tex[4][2] = { { rect[0], rect[1] }, { rect[2], rect[1] }, { rect[2], rect[3] }, { rect[0], rect[3] } };
+        for (int i = 0; i < 4; ++i)
+        {
+            Vertex vertex;
+            vertex.x = corner[i][0] * (2.0f / WIDTH) - 1.0f;
+            vertex.y = 1.0f - corner[i][1] * (2.0f / HEIGHT);
+            vertex.s = tex[i][0];
+            vertex.t = tex[i][1];
+            vertex.palette = palette;
+            vertex.padding = 0;
+            std::memcpy(vertex.color, &rgba, sizeof(rgba));
+            vertex_list.push_back(vertex);
+        }
+    }
+
+    // Tiles of both draws, the RGBA ones first. Returns the number of RGBA tiles.
+    std::size_t BuildTiles(std::vector<Vertex>& vertex_list)
+    {
+        const std::uint8_t full[4] = { 0, 0, 128, 128 };
+        const std::uint8_t quarter[4] = { 32, 32, 96, 96 };
+        const std::uint8_t repeat[4] = { 0, 0, 255, 200 };
+        const std::uint8_t flipped[4] = { 128, 0, 0, 128 };
+        // ColorMult 1 and ColorAdd 0 are 0xf0 per channel
+        const std::uint32_t plain = 0xfff0f0f0u;
+        // a row of 16 pixel tiles sharing edges, the top-left rule may cover each pixel once only
+        for (int i = 0; i < 8; ++i)
+            AddTile(vertex_list, 8.0f + 16.0f * i, 8.0f, 16.0f, 0.0f, 0.0f, 16.0f, full, plain, 0);
+        // half pixel offsets put edges on pixel centres
+        for (int i = 0; i < 4; ++i)
+            AddTile(vertex_list, 8.5f + 20.0f * i, 30.5f, 17.0f, 0.0f, 0.0f, 13.0f, quarter, plain, 0);
+        // rotated and scaled, overlapping in draw order
+        for (int i = 0; i < 6; ++i)
+        {
+            const float angle = 0.4f * i + 0.1f;
+            const float scale = 18.0f + 6.0f * i;
+            AddTile(vertex_list, 150.0f + 12.0f * i, 40.0f + 5.0f * i, std::cos(angle) * scale, std::sin(angle) * scale, -std::sin(angle) * scale, std::cos(angle) * scale, full, plain, 0);
+        }
+        // texture repeat, a mirrored rect and one partly off screen
+        AddTile(vertex_list, 10.0f, 60.0f, 70.0f, 0.0f, 0.0f, 50.0f, repeat, plain, 0);
+        AddTile(vertex_list, 90.0f, 60.0f, 40.0f, 0.0f, 0.0f, 40.0f, flipped, plain, 0);
+        AddTile(vertex_list, 230.0f, 170.0f, 50.0f, 10.0f, -10.0f, 50.0f, full, plain, 0);
+        // colour multiply and add, and translucent tiles over the others
+        AddTile(vertex_list, 20.0f, 120.0f, 40.0f, 0.0f, 0.0f, 40.0f, full, 0xff30a0f0u, 0);
+        AddTile(vertex_list, 70.0f, 120.0f, 40.0f, 0.0f, 0.0f, 40.0f, full, 0xff0f0f0fu, 0);
+        AddTile(vertex_list, 40.0f, 100.0f, 60.0f, 0.0f, 0.0f, 60.0f, full, 0x80f0f0f0u, 0);
+        AddTile(vertex_list, 100.0f, 20.0f, 80.0f, 20.0f, -20.0f, 80.0f, quarter, 0x40f0f0f0u, 0);
+        const std::size_t rgba_tile_count = vertex_list.size() / 4;
+
+        // INDEX8 tiles on both palettes, and a row 5 past the last palette, which is clamped
+        for (int i = 0; i < 3; ++i)
+            AddTile(vertex_list, 130.0f + 36.0f * i, 130.0f, 32.0f, 4.0f, -4.0f, 32.0f, full, plain, static_cast<std::uint8_t>(i == 2 ? 6 : i));
+        AddTile(vertex_list, 150.0f, 100.0f, 90.0f, 0.0f, 0.0f, 24.0f, repeat, 0xc0f0f0f0u, 1);
+        return rgba_tile_count;
+    }
+
+    // 32 x 32 RGBA texels: colour quadrants, a transparent border, an alpha ramp and a texel grid
+    std::vector<std::uint32_t> BuildRgbaTexture()
+    {
+        std::vector<std::uint32_t> texel_list(32 * 32);
+        for (std::uint32_t y = 0; y < 32; ++y)
+        {
+            for (std::uint32_t x = 0; x < 32; ++x)
+            {
+                std::uint32_t r = x < 16 ? 255 : 40;
+                std::uint32_t g = y < 16 ? 200 : 60;
+                std::uint32_t b = (x ^ y) & 1 ? 255 : 90;
+                std::uint32_t a = 255;
+                if (x == 0 || y == 0 || x == 31 || y == 31)
+                    a = 0;
+                else if (y >= 24)
+                    a = x * 8;
+                texel_list[y * 32 + x] = r | g << 8 | b << 16 | a << 24;
+            }
+        }
+        return texel_list;
+    }
+
+    // 16 x 16 indices and 2 palettes of 256 colours, index 0 is transparent
+    void BuildIndexTexture(std::vector<std::uint32_t>& out_texel_list, std::vector<std::uint32_t>& out_palette_list)
+    {
+        out_texel_list.resize(16 * 16);
+        for (std::uint32_t y = 0; y < 16; ++y)
+        {
+            for (std::uint32_t x = 0; x < 16; ++x)
+                out_texel_list[y * 16 + x] = (x + y) % 7 == 0 ? 0 : (x * 16 + y) & 0xff;
+        }
+        out_palette_list.resize(2 * 256);
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            out_palette_list[i] = i == 0 ? 0 : i | (255 - i) << 8 | 128u << 16 | 255u << 24;
+            out_palette_list[256 + i] = i == 0 ? 0 : (i * 3 & 0xff) << 16 | (i & 0xf0) | 192u << 24;
+        }
+    }
+
+    void AddCommand(hardrock::RenderCommandBuffer& command_buffer, hardrock::RenderCommandType type, const float value[4])
+    {
+        std::memcpy(command_buffer.Add(type).value, value, sizeof(float) * 4);
+    }
+
+    // Draw the frame with p_thread_pool, which may be null, into out_pixels.
+    int DrawFrame(hardrock::ThreadPool* p_thread_pool, std::vector<std::uint32_t>& out_pixels)
+    {
+        std::vector<Vertex> vertex_list;
+        const std::size_t rgba_tile_count = BuildTiles(vertex_list);
+        const std::size_t tile_count = vertex_list.size() / 4;
+        const std::vector<std::uint32_t> rgba_texel_list = BuildRgbaTexture();
+        std::vector<std::uint32_t> index_texel_list, palette_list;
+        BuildIndexTexture(index_texel_list, palette_list);
+        const hardrock::MemoryTexture rgba_texture = { 32, 32, &rgba_texel_list[0], nullptr, 0 };
+        const hardrock::MemoryTexture index_texture = { 16, 16, &index_texel_list[0], &palette_list[0], 2 };
+
+        hardrock::SoftwareCommandExecutor executor(WIDTH, HEIGHT, hardrock::RenderDevice::RenderPath::VERTICES, hardrock::RenderDevice::BufferMode::RETAINED, tile_count, p_thread_pool);
+        executor.SetTexture(RGBA_TEXTURE, &rgba_texture);
+        executor.SetTexture(INDEX_TEXTURE, &index_texture);
+        executor.Clear(CLEAR_RGBA);
+
+        // one frame as RenderDevice records it with RETAINED, the INDEX8 draw under a world transform
+        const float no_translate[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        const float identity[4] = { 1.0f, 0.0f, 0.0f, 1.0f };
+        const float translate[4] = { -0.05f, 0.03f, 0.0f, 0.0f };
+        const float transform[4] = { 0.96f, -0.12f, 0.12f, 0.96f };
+        hardrock::RenderCommandBuffer command_buffer;
+        command_buffer.Clear(reinterpret_cast<const std::uint8_t*>(&vertex_list[0]));
+        hardrock::RenderCommand& begin_frame = command_buffer.Add(hardrock::RenderCommandType::BEGIN_FRAME);
+        begin_frame.frame.frame = 0;
+        begin_frame.frame.ring_slot = 0;
+        hardrock::RenderCommand& write_tiles = command_buffer.Add(hardrock::RenderCommandType::WRITE_TILES);
+        write_tiles.range.offset = 0;
+        write_tiles.range.size = static_cast<std::uint32_t>(vertex_list.size() * sizeof(Vertex));
+        write_tiles.range.source_offset = 0;
+        AddCommand(command_buffer, hardrock::RenderCommandType::SET_TRANSLATE, no_translate);
+        AddCommand(command_buffer, hardrock::RenderCommandType::SET_TRANSFORM, identity);
+        hardrock::RenderCommand& bind_rgba = command_buffer.Add(hardrock::RenderCommandType::BIND_ATLAS);
+        bind_rgba.atlas.texture = RGBA_TEXTURE;
+        bind_rgba.atlas.palette_texture = 0;
+        bind_rgba.atlas.palette_count = 0;
+        hardrock::RenderCommand& draw_rgba = command_buffer.Add(hardrock::RenderCommandType::DRAW_ELEMENTS);
+        draw_rgba.draw.first = 0;
+        draw_rgba.draw.count = static_cast<std::uint32_t>(rgba_tile_count * 6);
+        draw_rgba.draw.base_vertex = 0;
+        AddCommand(command_buffer, hardrock::RenderCommandType::SET_TRANSLATE, translate);
+        AddCommand(command_buffer, hardrock::RenderCommandType::SET_TRANSFORM, transform);
+        hardrock::RenderCommand& bind_index = command_buffer.Add(hardrock::RenderCommandType::BIND_ATLAS);
+        bind_index.atlas.texture = INDEX_TEXTURE;
+        bind_index.atlas.palette_texture = 0;
+        bind_index.atlas.palette_count = 2;
+        hardrock::RenderCommand& draw_index = command_buffer.Add(hardrock::RenderCommandType::DRAW_ELEMENTS);
+        draw_index.draw.first = static_cast<std::uint32_t>(rgba_tile_count * 6);
+        draw_index.draw.count = static_cast<std::uint32_t>((tile_count - rgba_tile_count) * 6);
+        draw_index.draw.base_vertex = 0;
+        command_buffer.Add(hardrock::RenderCommandType::END_FRAME);
+
+        hardrock::RenderFrameStats stats = {};
+        if (executor.Execute(command_buffer, stats) != 0)
+            return 1;
+        out_pixels.assign(executor.GetPixels(), executor.GetPixels() + WIDTH * HEIGHT);
+        return 0;
+    }
+
+    std::size_t CountDiffs(const std::vector<std::uint32_t>& pixels, const std::vector<std::uint32_t>& expect_pixels)
+    {
+        std::size_t diff_count = 0;
+        for (std::size_t i = 0; i < pixels.size(); ++i)
+        {
+            if (pixels[i] == expect_pixels[i])
+                continue;
+            if (diff_count == 0)
+                std::fprintf(stderr, "first difference at (%zu, %zu): %08x, expected %08x\n", i % WIDTH, i / WIDTH, pixels[i], expect_pixels[i]);
+            ++diff_count;
+        }
+        return diff_count;
+    }
+
+    // the pixels are R | G << 8 | B << 16 | A << 24, so RGBA bytes on the little-endian targets
+    int WriteReference(const char* path, const std::vector<std::uint32_t>& pixels)
+    {
+        std::uint8_t* p_webp_data = nullptr;
+        const std::size_t size = WebPEncodeLosslessRGBA(reinterpret_cast<const std::uint8_t*>(&pixels[0]), WIDTH, HEIGHT, WIDTH * 4, &p_webp_data);
+        if (size == 0)
+            return 1;
+        std::FILE* p_file = std::fopen(path, "wb");
+        const bool written = p_file && std::fwrite(p_webp_data, 1, size, p_file) == size;
+        if (p_file)
+            std::fclose(p_file);
+        WebPFree(p_webp_data);
+        return written ? 0 : 1;
+    }
+
+    int ReadReference(const char* path, std::vector<std::uint32_t>& out_pixels)
+    {
+        std::FILE* p_file = std::fopen(path, "rb");
+        if (!p_file)
+            return 1;
+        std::vector<std::uint8_t> webp_data;
+        std::uint8_t buffer[4096];
+        std::size_t read_size;
+        while ((read_size = std::fread(buffer, 1, sizeof(buffer), p_file)) != 0)
+            webp_data.insert(webp_data.end(), buffer, buffer + read_size);
+        std::fclose(p_file);
+        int width, height;
+        if (webp_data.empty() || !WebPGetInfo(&webp_data[0], webp_data.size(), &width, &height) || width != WIDTH || height != HEIGHT)
+            return 1;
+        out_pixels.resize(WIDTH * HEIGHT);
+        const std::size_t output_size = out_pixels.size() * sizeof(std::uint32_t);
+        return WebPDecodeRGBAInto(&webp_data[0], webp_data.size(), reinterpret_cast<std::uint8_t*>(&out_pixels[0]), output_size, WIDTH * 4) ? 0 : 1;
+    }
+}
+
+int main(int argc, char* args[])
+{
+    const bool write = argc == 3 && std::strcmp(args[2], "--write") == 0;
+    if (argc != 2 && !write)
+    {
+        std::fprintf(stderr, "usage: %s <reference.webp> [--write]\n", args[0]);
+        return 1;
+    }
+    std::vector<std::uint32_t> pixels, pool_pixels;
+    hardrock::ThreadPool thread_pool(4);
+    if (DrawFrame(nullptr, pixels) != 0 || DrawFrame(&thread_pool, pool_pixels) != 0)
+    {
+        std::fprintf(stderr, "the executor rejected the command buffer\n");
+        return 1;
+    }
+    const std::size_t pool_diff_count = CountDiffs(pool_pixels, pixels);
+    std::printf("ThreadPool frame: %zu pixels differ from the single thread one\n", pool_diff_count);
+    if (pool_diff_count != 0)
+        return 1;
+
+    if (write)
+    {
+        if (WriteReference(args[1], pixels) != 0)
+        {
+            std::fprintf(stderr, "writing %s failed\n", args[1]);
+            return 1;
+        }
+        std::printf("wrote %s\n", args[1]);
+        return 0;
+    }
+    std::vector<std::uint32_t> reference_pixels;
+    if (ReadReference(args[1], reference_pixels) != 0)
+    {
+        std::fprintf(stderr, "%s is no %d x %d WebP\n", args[1], WIDTH, HEIGHT);
+        return 1;
+    }
+    const std::size_t diff_count = CountDiffs(pixels, reference_pixels);
+    std::printf("%d x %d frame: %zu pixels differ from %s\n", WIDTH, HEIGHT, diff_count, args[1]);
+    return diff_count == 0 ? 0 : 1;
+}
@@ -0,0 +1,177 @@
+//
+//  texture_pack.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  TexturePack16 with each heuristic on the png_src sprites and on 1000 and 5000 random
+//  sprites of 1 to 16 units. For each, the smallest square bin it fits in is searched for,
+//  then the pack into that bin is timed, best of 3, and checked for overlaps against an
+//  occupancy grid. Fill is the sprite area over the bin area.
+//  usage: texture_pack <png>...
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "algorithm.h"
+#include "bench.h"
+
+namespace
+{
+    const std::size_t RANDOM_COUNT_LIST[] = { 1000, 5000 };
+    const int RUN_COUNT = 3;
+
+    struct Variant
+    {
+        const char* name;
+        hardrock::TexturePackHeuristic heuristic;
+        bool allow_rotate;
+    };
+    const Variant VARIANT_LIST[] =
+    {
+        { "guillotine", hardrock::TexturePackHeuristic::GUILLOTINE, false },
+        { "maxrects", hardrock::TexturePackHeuristic::MAX_RECTS, false },
+        { "maxrects rotated", hardrock::TexturePackHeuristic::MAX_RECTS, true },
+        { "skyline", hardrock::TexturePackHeuristic::SKYLINE, false },
+    };
+
+    // width and height from the IHDR chunk, which a PNG has to start with
+    int ReadPngSize(const char* path, hardrock::TexturePackInput16& out_size)
+    {
+        std::FILE* p_file = std::fopen(path, "rb");
+        if (!p_file)
+            return 1;
+        std::uint8_t header[24];
+        const std::size_t read_size = std::fread(header, 1, sizeof(header), p_file);
+        std::fclose(p_file);
+        if (read_size != sizeof(header) || header[1] != 'P' || header[2] != 'N' || header[3] != 'G')
+            return 1;
+        const std::uint32_t width = header[16] << 24 | header[17] << 16 | header[18] << 8 | header[19];
+        const std::uint32_t height = header[20] << 24 | header[21] << 16 | header[22] << 8 | header[23];
+        if (width == 0 || height == 0 || width > 0xffff || height > 0xffff)
+            return 1;
+        out_size.width = static_cast<std::uint16_t>(width);
+        out_size.height = static_cast<std::uint16_t>(height);
+        return 0;
+    }
+
+    // return the number of cells covered twice or outside the side x side bin
+    std::size_t CountOverlaps(std::uint16_t side, const std::vector<hardrock::TexturePackInput16>& size_list, const std::vector<hardrock::TexturePackOutput16>& position_list)
+    {
+        std::vector<std::uint8_t> grid(static_cast<std::size_t>(side) * side);
+        std::size_t overlap_count = 0;
+        for (std::size_t i = 0; i < size_list.size(); ++i)
+        {
+            const auto& pos = position_list[i];
+            const std::size_t width = pos.rotated ? size_list[i].height : size_list[i].width;
+            const std::size_t height = pos.rotated ? size_list[i].width : size_list[i].height;
+            if (pos.x + width > side || pos.y + height > side)
+            {
+                overlap_count += width * height;
+                continue;
+            }
+            for (std::size_t y = pos.y; y < pos.y + height; ++y)
+            {
+                for (std::size_t x = pos.x; x < pos.x + width; ++x)
+                {
+                    overlap_count += grid[y * side + x];
+                    grid[y * side + x] = 1;
+                }
+            }
+        }
+        return overlap_count;
+    }
+
+    // return 1 if a variant fails or overlaps
+    int Run(const char* set_name, const std::vector<hardrock::TexturePackInput16>& size_list)
+    {
+        std::size_t area = 0;
+        for (const auto& size : size_list)
+            area += static_cast<std::size_t>(size.width) * size.height;
+        std::printf("%s: %zu sprites, %zu units of area\n", set_name, size_list.size(), area);
+        std::vector<hardrock::TexturePackOutput16> position_list(size_list.size());
+        for (const Variant& variant : VARIANT_LIST)
+        {
+            auto pack = [&](std::uint16_t side)
+            {
+                return hardrock::TexturePack16(side, side, size_list.size(), &size_list[0], &position_list[0], variant.heuristic, variant.allow_rotate);
+            };
+            // smallest side that fits, by bisection between the area bound and a bin that fits
+            std::uint16_t lo = static_cast<std::uint16_t>(std::ceil(std::sqrt(static_cast<double>(area))));
+            std::uint16_t hi = lo;
+            while (pack(hi) != 0)
+            {
+                if (hi >= 0x8000)
+                {
+                    std::fprintf(stderr, "%s: %s fits in no bin\n", set_name, variant.name);
+                    return 1;
+                }
+                lo = hi + 1;
+                hi = static_cast<std::uint16_t>(hi * 2);
+            }
+            while (lo < hi)
+            {
+                const std::uint16_t mid = static_cast<std::uint16_t>((lo + hi) / 2);
+                if (pack(mid) == 0)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            double best_ms = 1e30;
+            for (int run = 0; run < RUN_COUNT; ++run)
+            {
+                hardrock::Stopwatch stopwatch;
+                const int r = pack(hi);
+                best_ms = std::min(best_ms, stopwatch.Milliseconds());
+                if (r != 0)
+                {
+                    std::fprintf(stderr, "%s: %s failed again at %u\n", set_name, variant.name, hi);
+                    return 1;
+                }
+            }
+            const std::size_t overlap_count = CountOverlaps(hi, size_list, position_list);
+            std::printf("  %-17s %5u x %-5u %5.1f%% fill %10.3f ms, %zu cells overlap\n",
+                        variant.name, hi, hi, 100.0 * area / (static_cast<double>(hi) * hi), best_ms, overlap_count);
+            if (overlap_count != 0)
+                return 1;
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char* args[])
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "usage: %s <png>...\n", args[0]);
+        return 1;
+    }
+    std::vector<hardrock::TexturePackInput16> png_size_list(argc - 1);
+    for (int i = 1; i < argc; ++i)
+    {
+        if (ReadPngSize(args[i], png_size_list[i - 1]) != 0)
+        {
+            std::fprintf(stderr, "%s is no PNG\n", args[i]);
+            return 1;
+        }
+    }
+    if (Run("png_src, in pixels", png_size_list) != 0)
+        return 1;
+
+    hardrock::BenchRandom random(11);
+    for (std::size_t count : RANDOM_COUNT_LIST)
+    {
+        std::vector<hardrock::TexturePackInput16> size_list(count);
+        for (auto& size : size_list)
+        {
+            size.width = static_cast<std::uint16_t>(1 + random.Below(16));
+            size.height = static_cast<std::uint16_t>(1 + random.Below(16));
+        }
+        if (Run("random 1..16, in units", size_list) != 0)
+            return 1;
+    }
+    return 0;
+}
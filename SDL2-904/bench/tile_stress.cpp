@@ -0,0 +1,215 @@
+//
+//  tile_stress.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  A 250000 tile DENSE LargeTileSet drawn as one batch, so indices pass 65535, in every
+//  render path and buffer mode, into an offscreen framebuffer. Each frame is compared with
+//  the same tiles drawn in order through a 16-bit device of MAX_SHORT_INDEX_TILE_COUNT tiles.
+//  Also fills 16 and 32-bit pools to their last index.
+//  usage: tile_stress <res.pack>
+//
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "resource.h"
+#include "renderer.h"
+#include "scene.h"
+#include "structure.h"
+#include "algorithm.h"
+#include "bench.h"
+#include "bench_gl.h"
+
+namespace
+{
+    const int SCREEN_WIDTH = 640;
+    const int SCREEN_HEIGHT = 480;
+    const std::size_t TILE_COUNT = 250000;
+    const int FRAME_COUNT = 3;
+
+    template <typename Index>
+    int CheckFullPool(std::size_t size)
+    {
+        hardrock::BasicCircleLinkedListPool<Index> pool(size);
+        const Index last = static_cast<Index>(size - 1);
+        if (pool.Next(last) != 0 || pool.Prev(0) != last)
+        {
+            std::fprintf(stderr, "pool of %zu does not wrap at its last index\n", size);
+            return 1;
+        }
+        return 0;
+    }
+
+    struct Atlas
+    {
+        std::unique_ptr<std::vector<std::uint8_t>> up_data;
+        std::array<std::uint32_t, 5> rid_list;
+    };
+
+    int CreateAtlas(hardrock::RenderDevice& render_device, const Atlas& atlas, hardrock::RenderDevice::AtlasIdType& out_atlas_id)
+    {
+        return render_device.CreatePrebakedTextureAtlas(&atlas.up_data->at(0), atlas.up_data->size(), &atlas.rid_list[0], atlas.rid_list.size(), out_atlas_id);
+    }
+
+    void Clear()
+    {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    // Draw tile_list with 16-bit devices in runs of MAX_SHORT_INDEX_TILE_COUNT tiles.
+    int DrawReference(hardrock::MappedPackResourceManager& resource_manager, const hardrock::BenchGlContext& gl_context, const Atlas& atlas, const std::vector<hardrock::Tile>& tile_list, std::vector<std::uint32_t>& out_pixels)
+    {
+        const std::size_t capacity = hardrock::RenderDevice::MAX_SHORT_INDEX_TILE_COUNT;
+        auto up_render_device = hardrock::CreateBenchRenderDevice(resource_manager, SCREEN_WIDTH, SCREEN_HEIGHT, hardrock::RenderDevice::RenderPath::VERTICES, hardrock::RenderDevice::BufferMode::RETAINED, capacity);
+        if (!up_render_device)
+            return 1;
+        hardrock::RenderDevice::AtlasIdType atlas_id;
+        hardrock::RenderDevice::BatchIdType batch_id;
+        if (CreateAtlas(*up_render_device, atlas, atlas_id) != 0 || up_render_device->CreateBatch(capacity, atlas_id, batch_id) != 0)
+            return 1;
+        Clear();
+        for (std::size_t i = 0; i < tile_list.size(); i += capacity)
+        {
+            hardrock::TileSpanSequence tile_seq(&tile_list[i], std::min(capacity, tile_list.size() - i));
+            hardrock::RenderDevice::RenderQuest render_quest = { &tile_seq, {}, glm::mat2(1, 0, 0, 1), batch_id, 0, {} };
+            if (up_render_device->Render(&render_quest, &render_quest + 1) != 0)
+                return 1;
+        }
+        gl_context.ReadPixels(out_pixels);
+        return glGetError() == GL_NO_ERROR ? 0 : 1;
+    }
+}
+
+int main(int argc, char* args[])
+{
+    if (argc != 2)
+    {
+        std::fprintf(stderr, "usage: %s <res.pack>\n", args[0]);
+        return 1;
+    }
+    if (CheckFullPool<std::uint16_t>(65536) != 0 || CheckFullPool<std::uint32_t>(TILE_COUNT + 2) != 0)
+        return 1;
+
+    hardrock::MappedPackResourceManager resource_manager(args[1]);
+    hardrock::BenchGlContext gl_context;
+    if (gl_context.Create(SCREEN_WIDTH, SCREEN_HEIGHT) != 0 || gl_context.BindFramebuffer() != 0)
+        return 1;
+    Atlas atlas =
+    {
+        resource_manager.LoadResource(hardrock::FnvHash("sprite.atlas")),
+        {{
+            hardrock::FnvHash("self_l.webp"),
+            hardrock::FnvHash("self_m.webp"),
+            hardrock::FnvHash("self_r.webp"),
+            hardrock::FnvHash("bullet_0.webp"),
+            hardrock::FnvHash("bullet_1.webp"),
+        }},
+    };
+    if (!atlas.up_data)
+    {
+        std::fprintf(stderr, "no sprite.atlas in %s\n", args[1]);
+        return 1;
+    }
+    std::sort(atlas.rid_list.begin(), atlas.rid_list.end());
+
+    hardrock::LargeTileSet tile_set(TILE_COUNT, hardrock::TileStorageMode::DENSE);
+    std::vector<hardrock::LargeTileSet::IndexType> tile_idx_list;
+    hardrock::BenchRandom random(5);
+    for (std::size_t i = 0; i < TILE_COUNT; ++i)
+    {
+        const auto tile_idx = tile_set.TileAdd();
+        if (tile_idx == 0)
+        {
+            std::fprintf(stderr, "TileAdd failed at %zu\n", i);
+            return 1;
+        }
+        tile_idx_list.push_back(tile_idx);
+        hardrock::Tile& tile = tile_set.TileAt(tile_idx);
+        const float angle = random.Range(0.0f, 6.2831853f);
+        const float scale = random.Range(2.0f, 8.0f);
+        tile.transform = glm::mat2(std::cos(angle) * scale, std::sin(angle) * scale, -std::sin(angle) * scale, std::cos(angle) * scale);
+        tile.translate = glm::vec2(random.Range(0.0f, SCREEN_WIDTH), random.Range(0.0f, SCREEN_HEIGHT));
+        tile.tex_id = static_cast<std::uint16_t>(random.Below(5));
+        tile.palette_id = 0;
+        tile.color = glm::u8vec4(random.Next(), random.Next(), random.Next(), 128 + random.Below(128));
+    }
+    if (tile_set.TileAdd() != 0)
+    {
+        std::fprintf(stderr, "TileAdd went past the capacity\n");
+        return 1;
+    }
+    std::printf("LargeTileSet holds %zu tiles, largest index %u\n", TILE_COUNT, *std::max_element(tile_idx_list.begin(), tile_idx_list.end()));
+
+    std::vector<hardrock::Tile> tile_list;
+    {
+        auto tile_seq = tile_set.GetTileSequence();
+        while (tile_seq.HasNext())
+            tile_list.push_back(tile_seq.Next());
+    }
+    std::vector<std::uint32_t> reference_pixels;
+    if (DrawReference(resource_manager, gl_context, atlas, tile_list, reference_pixels) != 0)
+    {
+        std::fprintf(stderr, "drawing the 16-bit reference failed\n");
+        return 1;
+    }
+
+    const hardrock::RenderDevice::RenderPath path_list[] = { hardrock::RenderDevice::RenderPath::VERTICES, hardrock::RenderDevice::RenderPath::INSTANCED };
+    const hardrock::RenderDevice::BufferMode mode_list[] = { hardrock::RenderDevice::BufferMode::RETAINED, hardrock::RenderDevice::BufferMode::RING };
+    int result = 0;
+    for (auto render_path : path_list)
+    {
+        for (auto buffer_mode : mode_list)
+        {
+            auto up_render_device = hardrock::CreateBenchRenderDevice(resource_manager, SCREEN_WIDTH, SCREEN_HEIGHT, render_path, buffer_mode, TILE_COUNT);
+            hardrock::RenderDevice::AtlasIdType atlas_id;
+            hardrock::RenderDevice::BatchIdType batch_id;
+            if (!up_render_device || CreateAtlas(*up_render_device, atlas, atlas_id) != 0 || up_render_device->CreateBatch(TILE_COUNT, atlas_id, batch_id) != 0)
+            {
+                std::fprintf(stderr, "creating the %zu tile device failed\n", TILE_COUNT);
+                return 1;
+            }
+            double total_ms = 0.0;
+            for (int frame = 0; frame < FRAME_COUNT; ++frame)
+            {
+                // tiles across the whole set change, so every frame uploads all of them
+                for (std::size_t i = 0; i < TILE_COUNT; i += 7)
+                    tile_set.TileAt(tile_idx_list[i]).palette_id = 0;
+                auto tile_seq = tile_set.GetTileSequence();
+                hardrock::RenderDevice::RenderQuest render_quest = { &tile_seq, {}, glm::mat2(1, 0, 0, 1), batch_id, 0, {} };
+                Clear();
+                hardrock::Stopwatch stopwatch;
+                if (up_render_device->Render(&render_quest, &render_quest + 1) != 0)
+                {
+                    std::fprintf(stderr, "Render failed\n");
+                    return 1;
+                }
+                glFinish();
+                total_ms += stopwatch.Milliseconds();
+                tile_set.ClearChanges();
+            }
+            std::vector<std::uint32_t> pixels;
+            gl_context.ReadPixels(pixels);
+            if (glGetError() != GL_NO_ERROR)
+            {
+                std::fprintf(stderr, "GL error\n");
+                return 1;
+            }
+            std::size_t diff_count = 0;
+            for (std::size_t i = 0; i < reference_pixels.size(); ++i)
+                diff_count += pixels[i] != reference_pixels[i];
+            const bool instanced = render_path == hardrock::RenderDevice::RenderPath::INSTANCED;
+            std::printf("%-9s %-8s %8.1f ms a frame, %zu bytes uploaded in the last, %zu pixels differ from the reference\n",
+                        instanced ? "INSTANCED" : "VERTICES", buffer_mode == hardrock::RenderDevice::BufferMode::RING ? "RING" : "RETAINED",
+                        total_ms / FRAME_COUNT, up_render_device->GetUploadedBytes(), diff_count);
+            if (diff_count != 0 && !instanced)
+                result = 1;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,128 @@
+//
+//  tile_traversal.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  TileSet traversal with LINKED against DENSE storage after random churn. Every frame a
+//  share of the tiles is removed at random and as many are inserted after random tiles,
+//  like the bullets in main.cpp, on both sets alike. Then each set is read once with
+//  NextBlock, DENSE after Compact. The two sets have to hand out the same tiles in the
+//  same order. Times are means per frame over FRAME_COUNT frames.
+//  usage: tile_traversal
+//
+
+#include <cstdio>
+#include <limits>
+#include <vector>
+#include "scene.h"
+#include "bench.h"
+
+namespace
+{
+    const std::size_t TILE_COUNT_LIST[] = { 512, 8192, 32768 };
+    const int CHURN_PERCENT_LIST[] = { 5, 50 };
+    const int FRAME_COUNT = 100;
+
+    // order dependent hash of the tiles, read the way updateBatch reads them
+    std::uint32_t Traverse(const hardrock::TileSet& tile_set, std::size_t& out_count)
+    {
+        auto tile_seq = tile_set.GetTileSequence();
+        std::uint32_t hash = 0;
+        out_count = 0;
+        const hardrock::Tile* p_block;
+        std::size_t block_count;
+        while ((block_count = tile_seq.NextBlock(p_block, std::numeric_limits<std::size_t>::max())) != 0)
+        {
+            for (std::size_t i = 0; i < block_count; ++i)
+                hash = hash * 31 + static_cast<std::uint32_t>(p_block[i].translate.x) + p_block[i].tex_id;
+            out_count += block_count;
+        }
+        return hash;
+    }
+
+    // return 1 if the sets differ
+    int Run(std::size_t tile_count, int churn_percent)
+    {
+        hardrock::TileSet linked_set(tile_count, hardrock::TileSet::StorageMode::LINKED);
+        hardrock::TileSet dense_set(tile_count, hardrock::TileSet::StorageMode::DENSE);
+        std::vector<hardrock::TileSet::IndexType> live_list;
+        hardrock::BenchRandom random(static_cast<std::uint32_t>(tile_count + churn_percent));
+        std::uint32_t serial = 0;
+        // both sets get the same indices, they share the free list order
+        auto add = [&](hardrock::TileSet::IndexType insert_after_idx)
+        {
+            const hardrock::TileSet::IndexType tile_idx = linked_set.TileAdd(insert_after_idx);
+            if (tile_idx == 0 || dense_set.TileAdd(insert_after_idx) != tile_idx)
+                return 1;
+            for (hardrock::TileSet* p_tile_set : { &linked_set, &dense_set })
+            {
+                hardrock::Tile& tile = p_tile_set->TileAt(tile_idx);
+                tile.translate = glm::vec2(static_cast<float>(serial & 0xffffff), 0.0f);
+                tile.tex_id = static_cast<std::uint16_t>(serial % 5);
+            }
+            ++serial;
+            live_list.push_back(tile_idx);
+            return 0;
+        };
+        for (std::size_t i = 0; i < tile_count; ++i)
+        {
+            if (add(0) != 0)
+                return 1;
+        }
+        dense_set.Compact();
+
+        const std::size_t churn_count = tile_count * churn_percent / 100;
+        double linked_us = 0.0, compact_us = 0.0, dense_us = 0.0;
+        for (int frame = 0; frame < FRAME_COUNT; ++frame)
+        {
+            for (std::size_t i = 0; i < churn_count; ++i)
+            {
+                const std::size_t k = random.Below(static_cast<std::uint32_t>(live_list.size()));
+                linked_set.TileRemove(live_list[k]);
+                dense_set.TileRemove(live_list[k]);
+                live_list[k] = live_list.back();
+                live_list.pop_back();
+            }
+            for (std::size_t i = 0; i < churn_count; ++i)
+            {
+                if (add(live_list[random.Below(static_cast<std::uint32_t>(live_list.size()))]) != 0)
+                    return 1;
+            }
+
+            std::size_t linked_count, dense_count;
+            hardrock::Stopwatch stopwatch;
+            const std::uint32_t linked_hash = Traverse(linked_set, linked_count);
+            linked_us += stopwatch.Nanoseconds() * 1e-3;
+            stopwatch.Restart();
+            dense_set.Compact();
+            compact_us += stopwatch.Nanoseconds() * 1e-3;
+            stopwatch.Restart();
+            const std::uint32_t dense_hash = Traverse(dense_set, dense_count);
+            dense_us += stopwatch.Nanoseconds() * 1e-3;
+            if (linked_hash != dense_hash || linked_count != tile_count || dense_count != tile_count)
+            {
+                std::fprintf(stderr, "the sets differ at frame %d\n", frame);
+                return 1;
+            }
+        }
+        std::printf("  %6zu %5d%% %10.1f %10.1f %10.1f %10.1f\n", tile_count, churn_percent,
+                    linked_us / FRAME_COUNT, compact_us / FRAME_COUNT, dense_us / FRAME_COUNT, (compact_us + dense_us) / FRAME_COUNT);
+        return 0;
+    }
+}
+
+int main()
+{
+    std::printf("   tiles  churn     LINKED    Compact      DENSE      total   (us a frame)\n");
+    for (std::size_t tile_count : TILE_COUNT_LIST)
+    {
+        for (int churn_percent : CHURN_PERCENT_LIST)
+        {
+            if (Run(tile_count, churn_percent) != 0)
+                return 1;
+        }
+    }
+    return 0;
+}
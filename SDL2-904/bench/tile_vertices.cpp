@@ -0,0 +1,181 @@
+//
+//  tile_vertices.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  The tile vertex kernels of RenderDevice, SIMD against scalar, at 1k, 10k and 100k random
+//  tiles. Each run reads the tiles with NextBlock like updateBatch, from a sequence that only
+//  has Next() and from a TileSpanSequence, best of 5 runs, on the prebaked atlas of main.cpp.
+//  All vertex buffers have to be equal byte for byte.
+//  usage: tile_vertices <res.pack>
+//
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "resource.h"
+#include "renderer.h"
+#include "algorithm.h"
+#include "bench.h"
+#include "bench_gl.h"
+
+namespace
+{
+    const std::size_t TILE_COUNT_LIST[] = { 1000, 10000, 100000 };
+    // tiles built per timed run, whatever the size
+    const std::size_t TILES_PER_RUN = 2000000;
+    const int RUN_COUNT = 5;
+    const std::size_t SPRITE_COUNT = 5;
+
+    // only Next(), so NextBlock hands out one tile per call
+    class NextOnlySequence : public hardrock::ITileSequence
+    {
+        const hardrock::Tile* p_tile;
+        std::size_t count;
+    public:
+        NextOnlySequence(const hardrock::Tile* p_tile, std::size_t count) : p_tile(p_tile), count(count) { }
+        bool HasNext() const override { return this->count != 0; }
+        const hardrock::Tile& Next() override
+        {
+            --this->count;
+            return *this->p_tile++;
+        }
+    };
+}
+
+namespace hardrock
+{
+    class TileVertexBench
+    {
+        typedef RenderDevice::TileVertex TileVertex;
+    public:
+        static const std::size_t VERTEX_SIZE = sizeof(TileVertex);
+
+        // the block loop of updateBatch, with the kernel picked by use_scalar
+        static void Build(const RenderDevice& render_device, RenderDevice::AtlasIdType atlas_id, ITileSequence* p_tile_seq, bool use_scalar, std::uint8_t* p_out)
+        {
+            const auto& texture_atlas = *render_device.findTextureAtlas(atlas_id);
+            TileVertex* p = reinterpret_cast<TileVertex*>(p_out);
+            std::size_t tile_count = 0;
+            const Tile* p_block;
+            std::size_t block_count;
+            while ((block_count = p_tile_seq->NextBlock(p_block, std::numeric_limits<std::size_t>::max())) != 0)
+            {
+                if (use_scalar)
+                    render_device.buildTileVerticesScalar(p_block, block_count, texture_atlas, p + (tile_count << 2));
+                else
+                    render_device.buildTileVertices(p_block, block_count, texture_atlas, p + (tile_count << 2));
+                tile_count += block_count;
+            }
+        }
+
+        static bool HasTrim(const RenderDevice& render_device, RenderDevice::AtlasIdType atlas_id)
+        {
+            return render_device.findTextureAtlas(atlas_id)->HasTrim();
+        }
+    };
+}
+
+namespace
+{
+    // best Mtiles/s over RUN_COUNT runs, the vertices of the last build are left in vertex_data
+    template <typename Sequence>
+    double Time(const hardrock::RenderDevice& render_device, hardrock::RenderDevice::AtlasIdType atlas_id, const std::vector<hardrock::Tile>& tile_list, bool use_scalar, std::vector<std::uint8_t>& vertex_data)
+    {
+        const std::size_t repeat_count = std::max<std::size_t>(1, TILES_PER_RUN / tile_list.size());
+        double best_seconds = 1e30;
+        for (int run = 0; run < RUN_COUNT; ++run)
+        {
+            hardrock::Stopwatch stopwatch;
+            for (std::size_t i = 0; i < repeat_count; ++i)
+            {
+                Sequence tile_seq(&tile_list[0], tile_list.size());
+                hardrock::TileVertexBench::Build(render_device, atlas_id, &tile_seq, use_scalar, &vertex_data[0]);
+            }
+            best_seconds = std::min(best_seconds, stopwatch.Seconds());
+        }
+        return repeat_count * tile_list.size() / best_seconds * 1e-6;
+    }
+
+    // return 1 if the buffers differ
+    int Run(const hardrock::RenderDevice& render_device, hardrock::RenderDevice::AtlasIdType atlas_id)
+    {
+        std::printf("sprite.atlas, %s\n", hardrock::TileVertexBench::HasTrim(render_device, atlas_id) ? "trimmed" : "untrimmed");
+        std::printf("                 Next() only      TileSpanSequence\n");
+        std::printf("   tiles  scalar    SIMD  scalar    SIMD   (Mtiles/s)\n");
+        hardrock::BenchRandom random(17);
+        for (std::size_t tile_count : TILE_COUNT_LIST)
+        {
+            std::vector<hardrock::Tile> tile_list(tile_count);
+            for (auto& tile : tile_list)
+            {
+                const float scale = random.Range(8.0f, 64.0f);
+                const float angle = random.Range(0.0f, 6.2831853f);
+                tile.transform = glm::mat2(std::cos(angle) * scale, std::sin(angle) * scale, -std::sin(angle) * scale, std::cos(angle) * scale);
+                tile.translate = glm::vec2(random.Range(0.0f, 640.0f), random.Range(0.0f, 480.0f));
+                tile.tex_id = static_cast<std::uint16_t>(random.Below(SPRITE_COUNT));
+                tile.palette_id = 0;
+                tile.color = glm::u8vec4(random.Below(256), random.Below(256), random.Below(256), 255);
+            }
+            const std::size_t vertex_data_size = tile_count * 4 * hardrock::TileVertexBench::VERTEX_SIZE;
+            std::vector<std::uint8_t> expect_data(vertex_data_size), vertex_data(vertex_data_size);
+            double rate_list[4];
+            rate_list[0] = Time<NextOnlySequence>(render_device, atlas_id, tile_list, true, expect_data);
+            rate_list[1] = Time<NextOnlySequence>(render_device, atlas_id, tile_list, false, vertex_data);
+            bool is_equal = std::memcmp(&expect_data[0], &vertex_data[0], vertex_data_size) == 0;
+            rate_list[2] = Time<hardrock::TileSpanSequence>(render_device, atlas_id, tile_list, true, vertex_data);
+            is_equal = is_equal && std::memcmp(&expect_data[0], &vertex_data[0], vertex_data_size) == 0;
+            rate_list[3] = Time<hardrock::TileSpanSequence>(render_device, atlas_id, tile_list, false, vertex_data);
+            is_equal = is_equal && std::memcmp(&expect_data[0], &vertex_data[0], vertex_data_size) == 0;
+            std::printf("  %6zu %7.1f %7.1f %7.1f %7.1f\n", tile_count, rate_list[0], rate_list[1], rate_list[2], rate_list[3]);
+            if (!is_equal)
+            {
+                std::fprintf(stderr, "the vertices differ at %zu tiles\n", tile_count);
+                return 1;
+            }
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char* args[])
+{
+    if (argc != 2)
+    {
+        std::fprintf(stderr, "usage: %s <res.pack>\n", args[0]);
+        return 1;
+    }
+    hardrock::MappedPackResourceManager resource_manager(args[1]);
+    hardrock::BenchGlContext gl_context;
+    if (gl_context.Create(640, 480) != 0)
+        return 1;
+    auto up_render_device = hardrock::CreateBenchRenderDevice(resource_manager, 640, 480);
+    if (!up_render_device)
+        return 1;
+    // the sprites of main.cpp
+    std::array<std::uint32_t, SPRITE_COUNT> tex_res_id_list =
+    {
+        hardrock::FnvHash("self_l.webp"),
+        hardrock::FnvHash("self_m.webp"),
+        hardrock::FnvHash("self_r.webp"),
+        hardrock::FnvHash("bullet_0.webp"),
+        hardrock::FnvHash("bullet_1.webp"),
+    };
+    std::sort(tex_res_id_list.begin(), tex_res_id_list.end());
+
+    hardrock::RenderDevice::AtlasIdType prebaked_atlas_id;
+    auto up_sprite_atlas_data = resource_manager.LoadResource(hardrock::FnvHash("sprite.atlas"));
+    if (!up_sprite_atlas_data ||
+        up_render_device->CreatePrebakedTextureAtlas(&up_sprite_atlas_data->at(0), up_sprite_atlas_data->size(), &tex_res_id_list[0], tex_res_id_list.size(), prebaked_atlas_id) != 0)
+    {
+        std::fprintf(stderr, "loading sprite.atlas failed\n");
+        return 1;
+    }
+    return Run(*up_render_device, prebaked_atlas_id);
+}
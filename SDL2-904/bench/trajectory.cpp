@@ -0,0 +1,154 @@
+//
+//  trajectory.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+//  TrajectoryStore against integrating straight movers every frame. LineMove::GetExitTime
+//  is first checked against stepping GetPos for 100k random moves. Then 100k movers are
+//  created, a tenth removed by hand and the rest expired over 600 frames, with every live
+//  handle evaluated each 100 frames and required to be in the bounds. A steady run spawns
+//  1000 movers a frame, and MotionSystem integrates 100k linear movers and tests each.
+//  usage: trajectory
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include "motion.h"
+#include "algorithm.h"
+#include "bench.h"
+
+namespace
+{
+    const glm::vec2 BOUNDS_MIN(0.0f, 0.0f);
+    const glm::vec2 BOUNDS_MAX(640.0f, 480.0f);
+    const int EXIT_CHECK_COUNT = 100000;
+    // moves that stay in longer are not checked
+    const int EXIT_STEP_LIMIT = 2000;
+    const std::size_t MOVER_COUNT = 100000;
+    const int EXPIRE_FRAME_COUNT = 600;
+    const int EVALUATE_INTERVAL = 100;
+    const int STEADY_SPAWN_COUNT = 1000;
+    const int STEADY_FRAME_COUNT = 2000;
+    const int INTEGRATE_RUN_COUNT = 20;
+
+    bool Inside(const glm::vec2& pos)
+    {
+        return pos.x >= BOUNDS_MIN.x && pos.x <= BOUNDS_MAX.x && pos.y >= BOUNDS_MIN.y && pos.y <= BOUNDS_MAX.y;
+    }
+
+    // 1 in 10 moves is vertical, so one axis never leaves on its own
+    hardrock::LineMove RandomLineMove(hardrock::BenchRandom& random, int k)
+    {
+        const glm::vec2 pos(random.Range(-80.0f, 720.0f), random.Range(-60.0f, 540.0f));
+        glm::vec2 move_vector(random.Range(-8.0f, 8.0f), random.Range(-8.0f, 8.0f));
+        if (k % 10 == 0)
+            move_vector.x = 0.0f;
+        return hardrock::LineMove(move_vector, pos, k % 1000);
+    }
+}
+
+int main()
+{
+    hardrock::BenchRandom random(5);
+    std::size_t checked_count = 0, exit_diff_count = 0;
+    for (int k = 0; k < EXIT_CHECK_COUNT; ++k)
+    {
+        const hardrock::LineMove line_move = RandomLineMove(random, k);
+        const int origin_time = k % 1000;
+        const int exit_time = line_move.GetExitTime(BOUNDS_MIN, BOUNDS_MAX);
+        if (exit_time - origin_time >= EXIT_STEP_LIMIT - 1)
+            continue;
+        int expect = origin_time;
+        for (int t = origin_time; t < origin_time + EXIT_STEP_LIMIT; ++t)
+        {
+            if (Inside(line_move.GetPos(t)))
+                expect = t + 1;
+        }
+        ++checked_count;
+        exit_diff_count += exit_time != expect;
+    }
+    std::printf("exit time differs from stepping GetPos for %zu of %zu moves\n", exit_diff_count, checked_count);
+
+    std::vector<glm::vec2> move_vector_list(MOVER_COUNT), pos_list(MOVER_COUNT);
+    for (std::size_t i = 0; i < MOVER_COUNT; ++i)
+    {
+        move_vector_list[i] = glm::vec2(random.Range(-4.0f, 4.0f), random.Range(-4.0f, 4.0f));
+        pos_list[i] = glm::vec2(random.Range(20.0f, 620.0f), random.Range(20.0f, 460.0f));
+    }
+    hardrock::TrajectoryStore store(BOUNDS_MIN, BOUNDS_MAX, MOVER_COUNT);
+    std::vector<hardrock::TrajectoryStore::HandleType> handle_list(MOVER_COUNT);
+    std::size_t error_count = 0;
+    hardrock::Stopwatch stopwatch;
+    for (std::size_t i = 0; i < MOVER_COUNT; ++i)
+        error_count += store.Create(move_vector_list[i], pos_list[i], 0, handle_list[i]);
+    const double create_ns = stopwatch.Nanoseconds() / MOVER_COUNT;
+    // the ones a collision would take out
+    for (std::size_t i = 0; i < MOVER_COUNT; i += 10)
+        error_count += store.Remove(handle_list[i]);
+
+    double expire_ms = 0.0;
+    std::size_t expired_count = 0, outside_count = 0;
+    for (int time = 1; time <= EXPIRE_FRAME_COUNT; ++time)
+    {
+        stopwatch.Restart();
+        expired_count += store.Expire(time);
+        expire_ms += stopwatch.Milliseconds();
+        if (time % EVALUATE_INTERVAL != 0)
+            continue;
+        for (std::size_t i = 0; i < MOVER_COUNT; ++i)
+        {
+            glm::vec2 pos;
+            if (store.GetPos(handle_list[i], time, pos) == 0)
+                outside_count += !Inside(pos);
+        }
+    }
+    std::printf("create %zu: %.1f ns each, expired %zu over %d frames: %.1f us a frame, %zu left, %zu live positions out of the bounds\n",
+                MOVER_COUNT, create_ns, expired_count, EXPIRE_FRAME_COUNT, expire_ms * 1000.0 / EXPIRE_FRAME_COUNT, store.Size(), outside_count);
+
+    hardrock::TrajectoryStore steady_store(BOUNDS_MIN, BOUNDS_MAX);
+    double steady_ms = 0.0;
+    std::size_t peak_size = 0;
+    for (int time = 0; time < STEADY_FRAME_COUNT; ++time)
+    {
+        stopwatch.Restart();
+        for (int i = 0; i < STEADY_SPAWN_COUNT; ++i)
+        {
+            hardrock::TrajectoryStore::HandleType handle;
+            error_count += steady_store.Create(move_vector_list[(time * STEADY_SPAWN_COUNT + i) % MOVER_COUNT], glm::vec2(320.0f, 240.0f), time, handle);
+        }
+        steady_store.Expire(time);
+        // the first half fills the store up
+        if (time >= STEADY_FRAME_COUNT / 2)
+            steady_ms += stopwatch.Milliseconds();
+        peak_size = std::max(peak_size, steady_store.Size());
+    }
+    std::printf("steady %d spawns a frame: %.1f us a frame for spawn and expire, up to %zu alive\n",
+                STEADY_SPAWN_COUNT, steady_ms * 1000.0 / (STEADY_FRAME_COUNT / 2), peak_size);
+
+    hardrock::MotionSystem motion_system;
+    std::vector<hardrock::MotionRef> ref_list(MOVER_COUNT);
+    for (std::size_t i = 0; i < MOVER_COUNT; ++i)
+        error_count += motion_system.CreateLinear(pos_list[i], move_vector_list[i], ref_list[i]);
+    double best_ms = 1e30;
+    std::size_t outside_sum = 0;
+    for (int run = 0; run < INTEGRATE_RUN_COUNT; ++run)
+    {
+        stopwatch.Restart();
+        motion_system.Update();
+        for (const hardrock::MotionRef& ref : ref_list)
+        {
+            glm::vec2 pos;
+            motion_system.GetPos(ref, pos);
+            outside_sum += !Inside(pos);
+        }
+        best_ms = std::min(best_ms, stopwatch.Milliseconds());
+    }
+    std::printf("integrating %zu linear movers and testing each: %.1f us a frame (%zu outside)\n", MOVER_COUNT, best_ms * 1000.0, outside_sum);
+
+    if (error_count != 0)
+        std::fprintf(stderr, "%zu handle errors\n", error_count);
+    return exit_diff_count != 0 || outside_count != 0 || error_count != 0 ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+//
+//  command.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-24.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#include "command.h"
+#include <cassert>
+#include <cstring>
+
+namespace hardrock
+{
+    namespace
+    {
+        const std::uint64_t FNV64_OFFSET_BASIS = 14695981039346656037ull;
+        const std::uint64_t FNV64_PRIME = 1099511628211ull;
+    }
+
+    HeadlessCommandExecutor::HeadlessCommandExecutor(Mode mode, std::size_t tile_data_size, std::size_t region_size, std::size_t region_count)
+    : mode(mode)
+    , tile_data_size(tile_data_size)
+    , region_size(region_size)
+    , tile_buffer(region_size * region_count)
+    , instance_tile(0)
+    , checksum(FNV64_OFFSET_BASIS)
+    , command_count(0)
+    {
+    }
+
+    void HeadlessCommandExecutor::hash(const void* p_data, std::size_t size)
+    {
+        const std::uint8_t* p = static_cast<const std::uint8_t*>(p_data);
+        std::uint64_t h = this->checksum;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            h = (h ^ p[i]) * FNV64_PRIME;
+        }
+        this->checksum = h;
+    }
+
+    std::uint8_t* HeadlessCommandExecutor::MapRegion(std::size_t ring_slot, RenderFrameStats&)
+    {
+        assert((ring_slot + 1) * this->region_size <= this->tile_buffer.size());
+        return &this->tile_buffer[ring_slot * this->region_size];
+    }
+
+    int HeadlessCommandExecutor::Execute(const RenderCommandBuffer& command_buffer, RenderFrameStats&)
+    {
+        const bool checksum = this->mode != Mode::COUNT;
+        const RenderCommand* const p_command_list = command_buffer.GetCommands();
+        const std::size_t count = command_buffer.GetCount();
+        std::uint8_t* const p_tile_buffer = this->tile_buffer.data();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const RenderCommand& command = p_command_list[i];
+            if (checksum)
+                this->hash(&command, sizeof(command));
+            switch (command.type)
+            {
+                case RenderCommandType::WRITE_TILES:
+                    if (command.range.offset + command.range.size > this->tile_buffer.size())
+                        return 1;
+                    // with RING the bytes are in the region already
+                    if (command_buffer.GetTileData())
+                        std::memcpy(p_tile_buffer + command.range.offset, command_buffer.GetTileData() + command.range.source_offset, command.range.size);
+                    break;
+                case RenderCommandType::COPY_TILES:
+                    if (command.range.offset + command.range.size > this->tile_buffer.size() || command.range.source_offset + command.range.size > this->tile_buffer.size())
+                        return 1;
+                    std::memmove(p_tile_buffer + command.range.offset, p_tile_buffer + command.range.source_offset, command.range.size);
+                    break;
+                case RenderCommandType::BIND_INSTANCES:
+                    this->instance_tile = command.draw.first;
+                    break;
+                case RenderCommandType::DRAW_ELEMENTS:
+                case RenderCommandType::DRAW_INSTANCED:
+                    if (checksum)
+                    {
+                        // the tiles the draw reads, 6 indices and 4 vertices per tile
+                        std::size_t first_tile;
+                        std::size_t tile_count;
+                        if (command.type == RenderCommandType::DRAW_ELEMENTS)
+                        {
+                            first_tile = command.draw.first / 6 + command.draw.base_vertex / 4;
+                            tile_count = command.draw.count / 6;
+                        }
+                        else
+                        {
+                            first_tile = this->instance_tile;
+                            tile_count = command.draw.count;
+                        }
+                        if ((first_tile + tile_count) * this->tile_data_size > this->tile_buffer.size())
+                            return 1;
+                        this->hash(p_tile_buffer + first_tile * this->tile_data_size, tile_count * this->tile_data_size);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        this->command_count += count;
+        if (this->mode == Mode::RECORD)
+            this->recorded_list.insert(this->recorded_list.end(), p_command_list, p_command_list + count);
+        return 0;
+    }
+}
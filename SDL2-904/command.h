@@ -0,0 +1,186 @@
+//
+//  command.h
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-24.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#ifndef __SDL2_904__command__
+#define __SDL2_904__command__
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace hardrock
+{
+    struct RenderFrameStats
+    {
+        // tile data written for the GPU, and unchanged data the GPU copied forward in RING mode
+        std::size_t uploaded_bytes;
+        std::size_t copied_bytes;
+        // time in buffer upload, map and copy calls, and waiting for a ring region to be free
+        std::uint32_t upload_microseconds;
+        std::uint32_t sync_wait_microseconds;
+        // draw commands, and texture, uniform and attribute changes made for them
+        std::uint32_t draw_calls;
+        std::uint32_t state_changes;
+    };
+
+    enum class RenderCommandType : std::uint8_t
+    {
+        // frame is the frame number, ring_slot the tile buffer region it draws from
+        BEGIN_FRAME,
+        // new storage of range.size bytes for the tile buffer, the GPU keeps the old one while it reads it
+        ORPHAN_TILES,
+        // Bytes of the tile buffer at range.offset. With RETAINED they come from the tile data of
+        // the command buffer at range.source_offset, with RING they were built into the mapped
+        // region already.
+        WRITE_TILES,
+        // range.size bytes from range.source_offset to range.offset inside the tile buffer
+        COPY_TILES,
+        // value[0, 1], clip space
+        SET_TRANSLATE,
+        // value[0, 4], column-major
+        SET_TRANSFORM,
+        BIND_ATLAS,
+        // point the instance attributes at tile draw.first of the tile buffer
+        BIND_INSTANCES,
+        // draw.count indices from draw.first, draw.base_vertex added to each
+        DRAW_ELEMENTS,
+        // draw.count instances of the bound tiles
+        DRAW_INSTANCED,
+        END_FRAME,
+    };
+
+    // 20 bytes, the arguments are the union member named in the comment of the type.
+    struct RenderCommand
+    {
+        struct Range
+        {
+            std::uint32_t offset;
+            std::uint32_t size;
+            std::uint32_t source_offset;
+        };
+        struct Atlas
+        {
+            std::uint32_t texture;
+            // 0 unless the atlas is INDEX8
+            std::uint32_t palette_texture;
+            std::uint32_t palette_count;
+        };
+        struct Draw
+        {
+            std::uint32_t first;
+            std::uint32_t count;
+            std::int32_t base_vertex;
+        };
+        struct Frame
+        {
+            std::uint32_t frame;
+            std::uint32_t ring_slot;
+        };
+        RenderCommandType type;
+        std::uint8_t padding[3];
+        union
+        {
+            Range range;
+            Atlas atlas;
+            Draw draw;
+            Frame frame;
+            float value[4];
+        };
+    };
+
+    // One frame of commands, replayed in order by an IRenderCommandExecutor.
+    class RenderCommandBuffer
+    {
+        std::vector<RenderCommand> command_list;
+        // source of WRITE_TILES with RETAINED, it has to stay unchanged until the buffer is executed
+        const std::uint8_t* p_tile_data;
+    public:
+        RenderCommandBuffer() : p_tile_data(nullptr) { }
+        void Clear(const std::uint8_t* p_tile_data)
+        {
+            this->command_list.clear();
+            this->p_tile_data = p_tile_data;
+        }
+        // The arguments are left for the caller to fill in.
+        RenderCommand& Add(RenderCommandType type)
+        {
+            this->command_list.emplace_back();
+            RenderCommand& command = this->command_list.back();
+            command.type = type;
+            return command;
+        }
+        const RenderCommand* GetCommands() const { return this->command_list.data(); }
+        std::size_t GetCount() const { return this->command_list.size(); }
+        const std::uint8_t* GetTileData() const { return this->p_tile_data; }
+    };
+
+    // Texels of an atlas kept in memory, for executors that sample on the CPU. Each texel is
+    // R | G << 8 | B << 16 | A << 24, or the palette index of an INDEX8 atlas, and each of the
+    // palette_count palettes is 256 such colours.
+    struct MemoryTexture
+    {
+        std::uint32_t width;
+        std::uint32_t height;
+        const std::uint32_t* p_texel_data;
+        const std::uint32_t* p_palette_data;
+        std::uint32_t palette_count;
+    };
+
+    class IRenderCommandExecutor
+    {
+    public:
+        virtual ~IRenderCommandExecutor() { }
+        // RING only: memory of tile buffer region ring_slot, the tiles of the frame are built into
+        // it before its commands are executed. Waits until the GPU is done with the region.
+        virtual std::uint8_t* MapRegion(std::size_t ring_slot, RenderFrameStats& stats) = 0;
+        // RING only: give back the region of a frame that is dropped before it is executed.
+        virtual void UnmapRegion(RenderFrameStats&) { }
+        virtual int Execute(const RenderCommandBuffer& command_buffer, RenderFrameStats& stats) = 0;
+        // Texels behind a texture name of BIND_ATLAS, for executors that sample on the CPU. The
+        // memory stays the atlas' and outlives the name, a null one removes the name.
+        virtual void SetTexture(std::uint32_t, const MemoryTexture*) { }
+    };
+
+    // Executes without a GPU: keeps the tile buffer in memory and checksums or records what
+    // would be drawn, for tests and benchmarks.
+    class HeadlessCommandExecutor : public IRenderCommandExecutor
+    {
+    public:
+        enum class Mode : std::uint8_t
+        {
+            // only apply buffer writes and count commands
+            COUNT,
+            // also hash every command and the tile bytes each draw reads
+            CHECKSUM,
+            // CHECKSUM and keep a copy of every command
+            RECORD,
+        };
+    private:
+        const Mode mode;
+        const std::size_t tile_data_size;
+        const std::size_t region_size;
+        std::vector<std::uint8_t> tile_buffer;
+        // tile BIND_INSTANCES pointed at
+        std::size_t instance_tile;
+        std::uint64_t checksum;
+        std::size_t command_count;
+        std::vector<RenderCommand> recorded_list;
+        void hash(const void* p_data, std::size_t size);
+    public:
+        // region_count regions of region_size bytes, tile_data_size bytes per tile
+        HeadlessCommandExecutor(Mode mode, std::size_t tile_data_size, std::size_t region_size, std::size_t region_count);
+        std::uint8_t* MapRegion(std::size_t ring_slot, RenderFrameStats& stats) override;
+        int Execute(const RenderCommandBuffer& command_buffer, RenderFrameStats& stats) override;
+        // FNV-1a of everything executed so far
+        std::uint64_t GetChecksum() const { return this->checksum; }
+        std::size_t GetCommandCount() const { return this->command_count; }
+        const std::vector<RenderCommand>& GetRecordedCommands() const { return this->recorded_list; }
+    };
+}
+
+#endif /* defined(__SDL2_904__command__) */
@@ -0,0 +1,441 @@
+//
+//  gl_executor.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-24.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#include "gl_executor.h"
+#include <iostream>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <chrono>
+
+namespace hardrock
+{
+    namespace
+    {
+        // attribute locations of tile_instanced.vert, bound before the program is linked
+        const GLuint INSTANCE_TRANSLATE_ATTRIB = 0;
+        const GLuint INSTANCE_VEC_X_ATTRIB = 1;
+        const GLuint INSTANCE_VEC_Y_ATTRIB = 2;
+        const GLuint INSTANCE_TEX_ATTRIB = 3;
+        const GLuint INSTANCE_COLOR_ATTRIB = 4;
+        const GLuint INSTANCE_PALETTE_ATTRIB = 5;
+        
+        // Index buffer of tile_count quads, vertices 0 1 2 and 2 3 0 of each.
+        template<typename Index>
+        void UploadQuadIndices(std::size_t tile_count)
+        {
+            static const Index elements[] =
+            {
+                0, 1, 2,
+                2, 3, 0,
+            };
+            std::vector<Index> index_data(tile_count * 6);
+            Index* p_index_data = &index_data[0];
+            for (std::size_t i = 0; i < tile_count; ++i) {
+                Index *p = p_index_data + i * 6;
+                const Index base = static_cast<Index>(i * 4);
+                p[0] = elements[0] + base;
+                p[1] = elements[1] + base;
+                p[2] = elements[2] + base;
+                p[3] = elements[3] + base;
+                p[4] = elements[4] + base;
+                p[5] = elements[5] + base;
+            }
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Index) * index_data.size(), p_index_data, GL_STATIC_DRAW);
+        }
+        
+        // how long MapRegion waits on a ring region before it checks the fence again
+        const GLuint64 RING_WAIT_TIMEOUT = 1000000;
+        
+        bool HasBufferStorage()
+        {
+            GLint major = 0;
+            GLint minor = 0;
+            glGetIntegerv(GL_MAJOR_VERSION, &major);
+            glGetIntegerv(GL_MINOR_VERSION, &minor);
+            if (major > 4 || (major == 4 && minor >= 4))
+                return true;
+            GLint extension_count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+            for (GLint i = 0; i < extension_count; ++i)
+            {
+                const GLubyte* p_name = glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i));
+                if (p_name && std::strcmp(reinterpret_cast<const char*>(p_name), "GL_ARB_buffer_storage") == 0)
+                    return true;
+            }
+            return false;
+        }
+        
+        std::uint32_t MicrosecondsSince(std::chrono::steady_clock::time_point start)
+        {
+            return static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+        
+        bool IsUploadCommand(RenderCommandType type)
+        {
+            return type == RenderCommandType::ORPHAN_TILES || type == RenderCommandType::WRITE_TILES || type == RenderCommandType::COPY_TILES;
+        }
+    }
+    
+    GlCommandExecutor::GlCommandExecutor(RenderDevice::RenderPath render_path, RenderDevice::BufferMode buffer_mode, std::size_t tile_capacity)
+    : render_path(render_path)
+    , buffer_mode(buffer_mode)
+    , region_size(RenderDevice::TileDataSize(render_path) * tile_capacity)
+    , index_type(tile_capacity <= RenderDevice::MAX_SHORT_INDEX_TILE_COUNT ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT)
+    , h_vertex_arrays(1)
+    , h_buffers(2)
+    , palette_count(-1)
+    , persistent_map(false)
+    , p_map_data(nullptr)
+    , region_mapped(false)
+    , ring_slot(0)
+    {
+        this->vao = this->h_vertex_arrays.get(0);
+        this->vbo = this->h_buffers.get(0);
+        this->ebo = this->h_buffers.get(1);
+        std::fill(std::begin(this->ring_fence_list), std::end(this->ring_fence_list), nullptr);
+    }
+    
+    GlCommandExecutor::~GlCommandExecutor()
+    {
+        for (GLsync fence : this->ring_fence_list)
+        {
+            if (fence)
+                glDeleteSync(fence);
+        }
+        if (this->persistent_map || this->region_mapped)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+    }
+    
+    std::unique_ptr<GlCommandExecutor> GlCommandExecutor::Create(const std::uint8_t* p_vert_shader_data, std::size_t vert_shader_data_size, const std::uint8_t* p_frag_shader_data, std::size_t frag_shader_data_size, RenderDevice::RenderPath render_path, RenderDevice::BufferMode buffer_mode, std::size_t tile_capacity)
+    {
+        std::unique_ptr<GlCommandExecutor> up_executor(new GlCommandExecutor(render_path, buffer_mode, tile_capacity));
+        
+        int r;
+        GLenum error;
+        do
+        {
+            GlHandle<OpGlShader> h_vertex_shader(GL_VERTEX_SHADER);
+            {
+                const GLchar* vertex_shader_data_list[1] =
+                {
+                    reinterpret_cast<const GLchar*>(p_vert_shader_data)
+                };
+                GLint vertex_shader_size_list[1] =
+                {
+                    static_cast<GLint>(vert_shader_data_size)
+                };
+                glShaderSource(h_vertex_shader, 1, vertex_shader_data_list, vertex_shader_size_list);
+                glCompileShader(h_vertex_shader);
+                glGetShaderiv(h_vertex_shader, GL_COMPILE_STATUS, &r);
+                if (r != GL_TRUE)
+                {
+                    char buffer[512];
+                    glGetShaderInfoLog(h_vertex_shader, 512, NULL, buffer);
+                    std::cerr << buffer << std::endl;
+                    break;
+                }
+            }
+            
+            GlHandle<OpGlShader> h_fragment_shader(GL_FRAGMENT_SHADER);
+            {
+                const GLchar* frag_shader_data_list[1] =
+                {
+                    reinterpret_cast<const GLchar*>(p_frag_shader_data)
+                };
+                GLint frag_shader_size_list[1] =
+                {
+                    static_cast<GLint>(frag_shader_data_size)
+                };
+                glShaderSource(h_fragment_shader, 1, frag_shader_data_list, frag_shader_size_list);
+                glCompileShader(h_fragment_shader);
+                glGetShaderiv(h_fragment_shader, GL_COMPILE_STATUS, &r);
+                if (r != GL_TRUE)
+                {
+                    char buffer[512];
+                    glGetShaderInfoLog(h_fragment_shader, 512, NULL, buffer);
+                    std::cerr << buffer << std::endl;
+                    break;
+                }
+            }
+            
+            glAttachShader(up_executor->h_program, h_vertex_shader);
+            glAttachShader(up_executor->h_program, h_fragment_shader);
+            if (render_path == RenderDevice::RenderPath::INSTANCED)
+            {
+                glBindAttribLocation(up_executor->h_program, INSTANCE_TRANSLATE_ATTRIB, "translate");
+                glBindAttribLocation(up_executor->h_program, INSTANCE_VEC_X_ATTRIB, "vec_x");
+                glBindAttribLocation(up_executor->h_program, INSTANCE_VEC_Y_ATTRIB, "vec_y");
+                glBindAttribLocation(up_executor->h_program, INSTANCE_TEX_ATTRIB, "texrect");
+                glBindAttribLocation(up_executor->h_program, INSTANCE_COLOR_ATTRIB, "color");
+                glBindAttribLocation(up_executor->h_program, INSTANCE_PALETTE_ATTRIB, "palette");
+            }
+            glLinkProgram(up_executor->h_program);
+            
+            
+            glBindBuffer(GL_ARRAY_BUFFER, up_executor->vbo);
+            if (buffer_mode == RenderDevice::BufferMode::RING)
+            {
+                const std::size_t ring_size = up_executor->region_size * RenderDevice::RING_FRAME_COUNT;
+#if defined(GL_MAP_PERSISTENT_BIT)
+                if (HasBufferStorage())
+                {
+                    // mapped once for the life of the device, the fences keep CPU and GPU apart
+                    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                    glBufferStorage(GL_ARRAY_BUFFER, ring_size, nullptr, flags);
+                    up_executor->p_map_data = static_cast<std::uint8_t*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, ring_size, flags));
+                    if (up_executor->p_map_data == nullptr)
+                    {
+                        std::cerr << "OpenGL error: " << glGetError() << std::endl;
+                        return nullptr;
+                    }
+                    up_executor->persistent_map = true;
+                }
+                else
+#endif
+                {
+                    glBufferData(GL_ARRAY_BUFFER, ring_size, nullptr, GL_STREAM_DRAW);
+                }
+            }
+            else
+            {
+                glBufferData(GL_ARRAY_BUFFER, up_executor->region_size, nullptr, GL_DYNAMIC_DRAW);
+            }
+            
+            if (render_path == RenderDevice::RenderPath::INSTANCED)
+            {
+                // no index buffer, each instance is a 4 vertex triangle strip
+                glBindVertexArray(up_executor->vao);
+                const GLuint instance_attrib_list[] =
+                {
+                    INSTANCE_TRANSLATE_ATTRIB, INSTANCE_VEC_X_ATTRIB, INSTANCE_VEC_Y_ATTRIB,
+                    INSTANCE_TEX_ATTRIB, INSTANCE_COLOR_ATTRIB, INSTANCE_PALETTE_ATTRIB,
+                };
+                for (GLuint attrib : instance_attrib_list)
+                {
+                    glEnableVertexAttribArray(attrib);
+                    glVertexAttribDivisor(attrib, 1);
+                }
+                up_executor->bindInstanceAttributes(0);
+                glBindVertexArray(0);
+            }
+            else
+            {
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, up_executor->ebo);
+                if (up_executor->index_type == GL_UNSIGNED_SHORT)
+                    UploadQuadIndices<GLushort>(tile_capacity);
+                else
+                    UploadQuadIndices<GLuint>(tile_capacity);
+                
+                glBindVertexArray(up_executor->vao);
+                GLint pos_attrib = glGetAttribLocation(up_executor->h_program, "position");
+                glEnableVertexAttribArray(pos_attrib);
+                glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(RenderDevice::TileVertex), (void*)offsetof(RenderDevice::TileVertex, pos));
+                GLint tex_attrib = glGetAttribLocation(up_executor->h_program, "texcoord");
+                glEnableVertexAttribArray(tex_attrib);
+                glVertexAttribPointer(tex_attrib, 2, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(RenderDevice::TileVertex), (void*)offsetof(RenderDevice::TileVertex, tex));
+                GLint color_attrib = glGetAttribLocation(up_executor->h_program, "color");
+                glEnableVertexAttribArray(color_attrib);
+                glVertexAttribPointer(color_attrib, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(RenderDevice::TileVertex), (void*)offsetof(RenderDevice::TileVertex, color));
+                GLint palette_attrib = glGetAttribLocation(up_executor->h_program, "palette");
+                glEnableVertexAttribArray(palette_attrib);
+                glVertexAttribPointer(palette_attrib, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(RenderDevice::TileVertex), (void*)offsetof(RenderDevice::TileVertex, palette));
+                glBindVertexArray(0);
+            }
+            
+            up_executor->shader_transform = glGetUniformLocation(up_executor->h_program, "WorldTransform");
+            up_executor->shader_translate = glGetUniformLocation(up_executor->h_program, "WorldTranslate");
+            up_executor->shader_sampler = glGetUniformLocation(up_executor->h_program, "TexSampler");
+            up_executor->shader_palette_sampler = glGetUniformLocation(up_executor->h_program, "PaletteSampler");
+            up_executor->shader_palette_count = glGetUniformLocation(up_executor->h_program, "PaletteCount");
+            
+            error = glGetError();
+            if (error != GL_NO_ERROR)
+            {
+                std::cerr << "OpenGL error: " << error << std::endl;
+                return nullptr;
+            }
+        } while (false);
+        error = glGetError();
+        if (error != GL_NO_ERROR)
+        {
+            std::cerr << "OpenGL error: " << error << std::endl;
+            return nullptr;
+        }
+        else
+        {
+            return up_executor;
+        }
+    }    
+    std::uint8_t* GlCommandExecutor::MapRegion(std::size_t ring_slot, RenderFrameStats& stats)
+    {
+        // the region was last drawn from RING_FRAME_COUNT frames ago, wait until the GPU is done with it
+        this->ring_slot = ring_slot;
+        GLsync& fence = this->ring_fence_list[ring_slot];
+        if (fence)
+        {
+            const auto wait_start = std::chrono::steady_clock::now();
+            GLenum status;
+            while ((status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, RING_WAIT_TIMEOUT)) == GL_TIMEOUT_EXPIRED)
+            {
+            }
+            stats.sync_wait_microseconds += MicrosecondsSince(wait_start);
+            glDeleteSync(fence);
+            fence = nullptr;
+            if (status == GL_WAIT_FAILED)
+            {
+                std::cerr << "OpenGL error: " << glGetError() << std::endl;
+                return nullptr;
+            }
+        }
+        if (this->persistent_map)
+            return this->p_map_data + this->region_size * ring_slot;
+        
+        // nothing the GPU still reads is in the region, so the driver need not synchronize
+        const auto map_start = std::chrono::steady_clock::now();
+        glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+        this->p_map_data = static_cast<std::uint8_t*>(glMapBufferRange(GL_ARRAY_BUFFER, this->region_size * ring_slot, this->region_size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT));
+        stats.upload_microseconds += MicrosecondsSince(map_start);
+        if (this->p_map_data == nullptr)
+        {
+            std::cerr << "OpenGL error: " << glGetError() << std::endl;
+            return nullptr;
+        }
+        this->region_mapped = true;
+        return this->p_map_data;
+    }
+    
+    void GlCommandExecutor::unmapRegion(RenderFrameStats& stats)
+    {
+        const auto unmap_start = std::chrono::steady_clock::now();
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        stats.upload_microseconds += MicrosecondsSince(unmap_start);
+        this->p_map_data = nullptr;
+        this->region_mapped = false;
+    }
+    
+    void GlCommandExecutor::UnmapRegion(RenderFrameStats& stats)
+    {
+        if (this->region_mapped)
+            this->unmapRegion(stats);
+    }
+    
+    void GlCommandExecutor::bindInstanceAttributes(std::size_t tile_offset)
+    {
+        typedef RenderDevice::TileInstance TileInstance;
+        const std::size_t base = sizeof(TileInstance) * tile_offset;
+        const GLsizei stride = sizeof(TileInstance);
+        glVertexAttribPointer(INSTANCE_TRANSLATE_ATTRIB, 2, GL_FLOAT, GL_FALSE, stride, (void*)(base + offsetof(TileInstance, translate)));
+        glVertexAttribPointer(INSTANCE_VEC_X_ATTRIB, 2, GL_FLOAT, GL_FALSE, stride, (void*)(base + offsetof(TileInstance, vec_x)));
+        glVertexAttribPointer(INSTANCE_VEC_Y_ATTRIB, 2, GL_FLOAT, GL_FALSE, stride, (void*)(base + offsetof(TileInstance, vec_y)));
+        glVertexAttribPointer(INSTANCE_TEX_ATTRIB, 4, GL_UNSIGNED_BYTE, GL_FALSE, stride, (void*)(base + offsetof(TileInstance, tex)));
+        glVertexAttribPointer(INSTANCE_COLOR_ATTRIB, 4, GL_UNSIGNED_BYTE, GL_FALSE, stride, (void*)(base + offsetof(TileInstance, color)));
+        glVertexAttribPointer(INSTANCE_PALETTE_ATTRIB, 1, GL_UNSIGNED_BYTE, GL_FALSE, stride, (void*)(base + offsetof(TileInstance, palette)));
+    }
+    
+    int GlCommandExecutor::Execute(const RenderCommandBuffer& command_buffer, RenderFrameStats& stats)
+    {
+        const RenderCommand* const p_command_list = command_buffer.GetCommands();
+        const std::size_t count = command_buffer.GetCount();
+        const std::size_t index_size = this->index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+        const std::size_t region_offset = this->region_size * this->ring_slot;
+        // the upload commands come in one run, it is timed as a whole
+        bool uploading = false;
+        std::chrono::steady_clock::time_point upload_start;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const RenderCommand& command = p_command_list[i];
+            const bool upload = IsUploadCommand(command.type);
+            if (upload && !uploading)
+                upload_start = std::chrono::steady_clock::now();
+            else if (!upload && uploading)
+                stats.upload_microseconds += MicrosecondsSince(upload_start);
+            uploading = upload;
+            // the GPU may only read the region once the writes into it are flushed and it is unmapped
+            if (this->region_mapped && command.type != RenderCommandType::BEGIN_FRAME && command.type != RenderCommandType::WRITE_TILES)
+                this->unmapRegion(stats);
+            switch (command.type)
+            {
+                case RenderCommandType::BEGIN_FRAME:
+                    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                    glEnable(GL_BLEND);
+                    glUseProgram(this->h_program);
+                    glActiveTexture(GL_TEXTURE0);
+                    glUniform1i(this->shader_sampler, 0);
+                    glUniform1i(this->shader_palette_sampler, 1);
+                    glBindVertexArray(this->vao);
+                    glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+                    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ebo);
+                    this->palette_count = -1;
+                    break;
+                case RenderCommandType::ORPHAN_TILES:
+                    glBufferData(GL_ARRAY_BUFFER, command.range.size, nullptr, GL_DYNAMIC_DRAW);
+                    break;
+                case RenderCommandType::WRITE_TILES:
+                    if (this->buffer_mode == RenderDevice::BufferMode::RETAINED)
+                        glBufferSubData(GL_ARRAY_BUFFER, command.range.offset, command.range.size, command_buffer.GetTileData() + command.range.source_offset);
+                    else if (this->region_mapped)
+                        glFlushMappedBufferRange(GL_ARRAY_BUFFER, command.range.offset - region_offset, command.range.size);
+                    break;
+                case RenderCommandType::COPY_TILES:
+                    glCopyBufferSubData(GL_ARRAY_BUFFER, GL_ARRAY_BUFFER, command.range.source_offset, command.range.offset, command.range.size);
+                    break;
+                case RenderCommandType::SET_TRANSLATE:
+                    glUniform2f(this->shader_translate, command.value[0], command.value[1]);
+                    break;
+                case RenderCommandType::SET_TRANSFORM:
+                    glUniformMatrix2fv(this->shader_transform, 1, GL_FALSE, command.value);
+                    break;
+                case RenderCommandType::BIND_ATLAS:
+                    glBindTexture(GL_TEXTURE_2D, command.atlas.texture);
+                    if (command.atlas.palette_count)
+                    {
+                        glActiveTexture(GL_TEXTURE1);
+                        glBindTexture(GL_TEXTURE_2D, command.atlas.palette_texture);
+                        glActiveTexture(GL_TEXTURE0);
+                    }
+                    if (this->palette_count != static_cast<GLint>(command.atlas.palette_count))
+                    {
+                        this->palette_count = static_cast<GLint>(command.atlas.palette_count);
+                        glUniform1i(this->shader_palette_count, this->palette_count);
+                    }
+                    break;
+                case RenderCommandType::BIND_INSTANCES:
+                    this->bindInstanceAttributes(command.draw.first);
+                    break;
+                case RenderCommandType::DRAW_ELEMENTS:
+                    glDrawElementsBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(command.draw.count), this->index_type, reinterpret_cast<const GLvoid *>(command.draw.first * index_size), command.draw.base_vertex);
+                    break;
+                case RenderCommandType::DRAW_INSTANCED:
+                    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(command.draw.count));
+                    break;
+                case RenderCommandType::END_FRAME:
+                {
+                    if (this->buffer_mode == RenderDevice::BufferMode::RING)
+                        this->ring_fence_list[command.frame.ring_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                    // the only error check of the frame, glGetError waits for the driver
+                    GLenum error = glGetError();
+                    if (error != GL_NO_ERROR)
+                    {
+                        std::cerr << "OpenGL error: " << error << std::endl;
+                        return 1;
+                    }
+                    break;
+                }
+                default:
+                    return 1;
+            }
+        }
+        if (uploading)
+            stats.upload_microseconds += MicrosecondsSince(upload_start);
+        return 0;
+    }
+}
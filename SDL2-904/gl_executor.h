@@ -0,0 +1,66 @@
+//
+//  gl_executor.h
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-24.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#ifndef __SDL2_904__gl_executor__
+#define __SDL2_904__gl_executor__
+
+#include <memory>
+#include "command.h"
+#include "glhandle.h"
+#include "renderer.h"
+
+namespace hardrock
+{
+    // Replays render commands with OpenGL, owns the program, the tile buffer and the index buffer.
+    // Everything here runs on the thread of the GL context.
+    class GlCommandExecutor : public IRenderCommandExecutor
+    {
+        const RenderDevice::RenderPath render_path;
+        const RenderDevice::BufferMode buffer_mode;
+        // bytes of one ring region, or of the whole tile buffer with RETAINED
+        const std::size_t region_size;
+        // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, by tile capacity
+        const GLenum index_type;
+
+        GLuint vao;
+        GLuint vbo;
+        GLuint ebo;
+        GLuint shader_sampler;
+        GLuint shader_palette_sampler;
+        GLuint shader_palette_count;
+        GLuint shader_translate;
+        GLuint shader_transform;
+        GlHandles<OpGlVertexArrays> h_vertex_arrays;
+        GlHandles<OpGlBuffers> h_buffers;
+        GlHandle<OpGlProgram> h_program;
+        // last PaletteCount set in the frame, -1 before the first
+        GLint palette_count;
+
+        // RING only. The persistent map covers every region, otherwise p_map_data is the region
+        // MapRegion mapped, until the first command that does not write into it.
+        bool persistent_map;
+        std::uint8_t* p_map_data;
+        bool region_mapped;
+        std::size_t ring_slot;
+        GLsync ring_fence_list[RenderDevice::RING_FRAME_COUNT];
+
+        GlCommandExecutor(RenderDevice::RenderPath render_path, RenderDevice::BufferMode buffer_mode, std::size_t tile_capacity);
+        void unmapRegion(RenderFrameStats& stats);
+        // Point the instance attributes at the tiles from tile_offset, GL 3.2 has no base instance.
+        void bindInstanceAttributes(std::size_t tile_offset);
+    public:
+        // The vertex shader has to match render_path, test.vert or tile_instanced.vert.
+        static std::unique_ptr<GlCommandExecutor> Create(const std::uint8_t* p_vert_shader_data, std::size_t vert_shader_data_size, const std::uint8_t* p_frag_shader_data, std::size_t frag_shader_data_size, RenderDevice::RenderPath render_path, RenderDevice::BufferMode buffer_mode, std::size_t tile_capacity);
+        ~GlCommandExecutor();
+        std::uint8_t* MapRegion(std::size_t ring_slot, RenderFrameStats& stats) override;
+        void UnmapRegion(RenderFrameStats& stats) override;
+        int Execute(const RenderCommandBuffer& command_buffer, RenderFrameStats& stats) override;
+    };
+}
+
+#endif /* defined(__SDL2_904__gl_executor__) */
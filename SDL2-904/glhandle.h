@@ -81,7 +81,7 @@ namespace hardrock
     struct OpGlProgram
     {
         GLuint gen() { return glCreateProgram(); }
-        void del(GLuint h) { glDeleteShader(h); }
+        void del(GLuint h) { glDeleteProgram(h); }
     };
 }
 
@@ -11,6 +11,8 @@
 #include "scene.h"
 #include "algorithm.h"
 #include "resource.h"
+#include "parallel.h"
+#include "motion.h"
 
 
 static const int SCREEN_WIDTH = 640;
@@ -122,76 +124,12 @@ namespace hardrock
             return this->button_mask;
         }
     };
-
-    class LineMoveRef
-    {
-        ObjRefUPtr up_obj_ref;
-        LineMoveRef(ObjRefUPtr &&up_obj_ref)
-        : up_obj_ref(std::move(up_obj_ref))
-        {
-        }
-    public:
-        class LineMoveManager
-        {
-            std::vector<glm::vec2> move_vector;
-            std::vector<glm::vec2> position;
-            std::vector<ObjRef::ModifyHandle> modify_handle;
-            std::size_t count;
-        public:
-            LineMoveManager(std::size_t capacity)
-            : move_vector(capacity)
-            , position(capacity)
-            , modify_handle(capacity)
-            , count(1)
-            {
-            }
-            std::size_t Capacity() const { return this->move_vector.size(); }
-            LineMoveRef CreateLineMove(ObjRefPool &obj_ref_pool ,const glm::vec2 &move_vector, const glm::vec2 &position)
-            {
-                const auto next_idx = static_cast<std::uint32_t>(this->count);
-                if (next_idx >= this->Capacity())
-                {
-                    return LineMoveRef(nullptr);
-                }
-                ++this->count;
-                this->move_vector[next_idx] = move_vector;
-                this->position[next_idx] = position;
-                auto up_obj_ref = obj_ref_pool.CreateObjRef(next_idx, &this->modify_handle[next_idx]);
-                assert(up_obj_ref);
-                return LineMoveRef(std::move(up_obj_ref));
-            }
-            void Update(ObjRefPool &obj_ref_pool)
-            {
-                std::size_t new_count = 1;
-                for (auto i = 1; i < this->count; ++i)
-                {
-                    const auto modify_handle = this->modify_handle[i];
-                    auto &idx = modify_handle.RefData();
-                    if (idx != 0)
-                    {
-                        const auto move_vector = this->move_vector[i];
-                        this->position[new_count] = this->position[i] + move_vector;
-                        this->move_vector[new_count] = move_vector;
-                        this->modify_handle[new_count] = modify_handle;
-                        idx = static_cast<std::uint32_t>(new_count);
-                        ++new_count;
-                    }
-                }
-                this->count = new_count;
-            }
-            glm::vec2 GetPos(const LineMoveRef &line_move_ref) const
-            {
-                const auto idx = line_move_ref.up_obj_ref.get()->GetData();
-                return this->position[idx];
-            }
-        };
-    };
     
 }
 
 int main(int argc, char* args[])
 {
-    hardrock::PackResourceManager resource_manager("res.pack");
+    hardrock::MappedPackResourceManager resource_manager("res.pack");
 
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
     {
@@ -220,11 +158,17 @@ int main(int argc, char* args[])
     }
 
     {
-        auto up_vert_shader_data = std::move(resource_manager.LoadResource(hardrock::FnvHash("test.vert")));
-        assert(up_vert_shader_data);
-        auto up_frag_shader_data = std::move(resource_manager.LoadResource(hardrock::FnvHash("test.frag")));
-        assert(up_frag_shader_data);
-        auto up_render_device = hardrock::RenderDevice::Create(SCREEN_WIDTH, SCREEN_HEIGHT, &up_vert_shader_data->at(0), up_vert_shader_data->size(), &up_frag_shader_data->at(0), up_frag_shader_data->size());
+        int r;
+        // res_build keeps the shaders and the atlas uncompressed, so they are viewed in the mapping
+        const std::uint8_t* p_vert_shader_data;
+        std::size_t vert_shader_data_size;
+        r = resource_manager.GetResourceView(hardrock::FnvHash("test.vert"), p_vert_shader_data, vert_shader_data_size);
+        assert(r == 0);
+        const std::uint8_t* p_frag_shader_data;
+        std::size_t frag_shader_data_size;
+        r = resource_manager.GetResourceView(hardrock::FnvHash("test.frag"), p_frag_shader_data, frag_shader_data_size);
+        assert(r == 0);
+        auto up_render_device = hardrock::RenderDevice::Create(SCREEN_WIDTH, SCREEN_HEIGHT, p_vert_shader_data, vert_shader_data_size, p_frag_shader_data, frag_shader_data_size, hardrock::RenderDevice::RenderPath::VERTICES, hardrock::RenderDevice::BufferMode::RING);
         assert(up_render_device);
         std::array<std::uint32_t, 5> tex_res_id_list =
         {
@@ -235,17 +179,28 @@ int main(int argc, char* args[])
             hardrock::FnvHash("bullet_1.webp"),
         };
         std::sort(tex_res_id_list.begin(), tex_res_id_list.end());
-        auto up_tex_res_bundle = resource_manager.LoadResourceBatch(&tex_res_id_list[0], tex_res_id_list.size());
-        assert(up_tex_res_bundle);
-        int r;
         hardrock::RenderDevice::AtlasIdType atlas_id;
-        r = up_render_device->CreateTextureAtlas(*up_tex_res_bundle, 16, 16, 16, atlas_id);
-        assert(r == 0);
+        // prefer the atlas baked by res_build, fall back to decoding and packing the sprites
+        const std::uint8_t* p_sprite_atlas_data;
+        std::size_t sprite_atlas_data_size;
+        if (resource_manager.GetResourceView(hardrock::FnvHash("sprite.atlas"), p_sprite_atlas_data, sprite_atlas_data_size) == 0)
+        {
+            r = up_render_device->CreatePrebakedTextureAtlas(p_sprite_atlas_data, sprite_atlas_data_size, &tex_res_id_list[0], tex_res_id_list.size(), atlas_id);
+            assert(r == 0);
+        }
+        else
+        {
+            auto up_tex_res_bundle = resource_manager.LoadResourceBatch(&tex_res_id_list[0], tex_res_id_list.size());
+            assert(up_tex_res_bundle);
+            hardrock::ThreadPool decode_thread_pool;
+            r = up_render_device->CreateTextureAtlas(*up_tex_res_bundle, 16, 16, 16, atlas_id, &decode_thread_pool);
+            assert(r == 0);
+        }
 
         hardrock::RenderDevice::BatchIdType sprite_batch_id;
         r = up_render_device->CreateBatch(512, atlas_id, sprite_batch_id);
         assert(r == 0);
-        std::array<hardrock::RenderDevice::RenderQuest, 2> render_quest_list
+        std::array<hardrock::RenderDevice::RenderQuest, 1> render_quest_list
         {{
             { nullptr, {}, {}, sprite_batch_id, {} },
         }};
@@ -263,8 +218,7 @@ int main(int argc, char* args[])
         
         hardrock::SpriteModel empty_model({}, {}, 0);
         
-        hardrock::ObjRefPool obj_ref_pool(65000);
-        hardrock::TileSet sprite_tile_set(512);
+        hardrock::TileSet sprite_tile_set(512, hardrock::TileSet::StorageMode::DENSE);
         
         struct PlayerData
         {
@@ -286,11 +240,11 @@ int main(int argc, char* args[])
         const auto player_bullet_tile_head_idx = sprite_tile_set.TileAdd();
         empty_model.SetTileWithPos({}, &sprite_tile_set.TileAt(player_bullet_tile_head_idx));
         
-        hardrock::LineMoveRef::LineMoveManager line_move_manager(128);
+        hardrock::TrajectoryStore trajectory_store({0, 0}, {SCREEN_WIDTH, SCREEN_HEIGHT});
         
         struct PlayerBulletData
         {
-            hardrock::LineMoveRef line_move_ref;
+            hardrock::TrajectoryStore::HandleType trajectory;
             hardrock::TileSet::IndexType tile_idx;
             hardrock::TileSet::IndexType padding;
         };
@@ -302,6 +256,9 @@ int main(int argc, char* args[])
         typedef decltype(SDL_GetTicks()) tick_t;
         tick_t last_fps_tick = SDL_GetTicks();
         tick_t last_fps_frame = 0;
+        // buffer time of the frames since the last fps line
+        std::uint32_t upload_microseconds = 0;
+        std::uint32_t sync_wait_microseconds = 0;
         DelayQueue<unsigned int, 6> tick_time_queue;
         int tick_count = 0;
         while (true)
@@ -332,15 +289,16 @@ int main(int argc, char* args[])
                 break;
             }
             
-            line_move_manager.Update(obj_ref_pool);
+            trajectory_store.Expire(tick_count);
             
             for (std::size_t i = 0; i < player_bullet_data.size();)
             {
                 const auto &bullet_data = player_bullet_data[i];
                 const auto bullet_idx = bullet_data.tile_idx;
-                const auto pos = line_move_manager.GetPos(bullet_data.line_move_ref);
-                if (pos.y < 0)
+                glm::vec2 pos;
+                if (trajectory_store.GetPos(bullet_data.trajectory, tick_count, pos) != 0)
                 {
+                    // left the screen
                     sprite_tile_set.TileRemove(bullet_idx);
                     player_bullet_data[i] = std::move(player_bullet_data.back());
                     player_bullet_data.pop_back();
@@ -358,8 +316,10 @@ int main(int argc, char* args[])
                 player_data.shoot_cool_down = player_data.shoot_cool_down_max;
                 const auto bullet_pos = player_data.pos;
                 const auto tile_idx = sprite_tile_set.TileAdd(player_bullet_tile_head_idx);
-                auto line_move_ref = line_move_manager.CreateLineMove(obj_ref_pool, {0, -8.0f}, bullet_pos);
-                player_bullet_data.push_back({std::move(line_move_ref), tile_idx});
+                hardrock::TrajectoryStore::HandleType trajectory;
+                r = trajectory_store.Create({0, -8.0f}, bullet_pos, tick_count, trajectory);
+                assert(r == 0);
+                player_bullet_data.push_back({trajectory, tile_idx});
                 bullet_1_model.SetTileWithPos(bullet_pos, &sprite_tile_set.TileAt(tile_idx));
             }
 
@@ -369,9 +329,18 @@ int main(int argc, char* args[])
             glClearColor(0.2f, 0.0f, 0.2f, 1.0f);
             glClear(GL_COLOR_BUFFER_BIT);
             {
+                sprite_tile_set.Compact();
                 auto sprite_tile_seq = sprite_tile_set.GetTileSequence();
                 render_quest_list[0].p_tile_seq = &sprite_tile_seq;
-                up_render_device->Render(render_quest_list.begin(), render_quest_list.end());
+                r = up_render_device->Render(render_quest_list.begin(), render_quest_list.end());
+                if (r != 0)
+                {
+                    std::cerr << "Render failed: " << r << std::endl;
+                    break;
+                }
+                sprite_tile_set.ClearChanges();
+                upload_microseconds += up_render_device->GetFrameStats().upload_microseconds;
+                sync_wait_microseconds += up_render_device->GetFrameStats().sync_wait_microseconds;
             }
             glFlush();
 
@@ -388,7 +357,9 @@ int main(int argc, char* args[])
             ++last_fps_frame;
             if (last_fps_frame >= 60)
             {
-                std::cout << "fps: " << 60000.0 / (now - last_fps_tick) << std::endl;
+                std::cout << "fps: " << 60000.0 / (now - last_fps_tick) << ", vertex upload: " << up_render_device->GetUploadedBytes() << " bytes, upload: " << upload_microseconds / 60 << " us, sync wait: " << sync_wait_microseconds / 60 << " us, draw calls: " << up_render_device->GetFrameStats().draw_calls << ", state changes: " << up_render_device->GetFrameStats().state_changes << std::endl;
+                upload_microseconds = 0;
+                sync_wait_microseconds = 0;
                 last_fps_tick = now;
                 last_fps_frame = 0;
             }
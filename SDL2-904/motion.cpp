@@ -0,0 +1,409 @@
+//
+//  motion.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#include "motion.h"
+#include <cassert>
+#include <algorithm>
+#include <limits>
+#include "glm/geometric.hpp"
+#include "glm/gtc/constants.hpp"
+#include "parallel.h"
+#include "simd.h"
+
+namespace hardrock
+{
+    namespace
+    {
+        using namespace simd;
+
+        // the columns of each kind, in the order of the kernels
+        enum { X, Y };
+        enum { LINEAR_VX = 2, LINEAR_VY, LINEAR_COLUMN_COUNT };
+        enum { ACCELERATED_VX = 2, ACCELERATED_VY, ACCELERATED_AX, ACCELERATED_AY, ACCELERATED_COLUMN_COUNT };
+        enum { POLAR_ANGLE = 2, POLAR_SPEED, POLAR_ANGULAR_SPEED, POLAR_ACCELERATION, POLAR_COLUMN_COUNT };
+        enum { SINE_CX = 2, SINE_CY, SINE_VX, SINE_VY, SINE_OX, SINE_OY, SINE_PHASE, SINE_PHASE_SPEED, SINE_COLUMN_COUNT };
+        enum { HOMING_VX = 2, HOMING_VY, HOMING_SPEED, HOMING_STEER, HOMING_COLUMN_COUNT };
+        const std::size_t COLUMN_COUNT[] =
+        {
+            LINEAR_COLUMN_COUNT,
+            ACCELERATED_COLUMN_COUNT,
+            POLAR_COLUMN_COUNT,
+            SINE_COLUMN_COUNT,
+            HOMING_COLUMN_COUNT,
+        };
+
+        const float PI = glm::pi<float>();
+        const float HALF_PI = glm::half_pi<float>();
+        const float TWO_PI = PI + PI;
+
+        // the angle brought back to [-pi, pi], so angles that keep turning do not lose precision
+        inline Float4 WrapAngle(Float4 r)
+        {
+            return Sub(r, Mul(Splat(TWO_PI), RoundSmall(Mul(r, Splat(1.0f / TWO_PI)))));
+        }
+
+        // The polynomials of glm::fastSin and glm::fastCos, folded into [-pi / 2, pi / 2] like FastSinCos.
+        inline void FastSinCos4(Float4 r, Float4& out_sin, Float4& out_cos)
+        {
+            const Float4 zero = Splat(0.0f);
+            r = WrapAngle(r);
+            const Mask4 fold = Less(Splat(HALF_PI), Max(r, Sub(zero, r)));
+            r = Select(fold, Sub(Select(Less(r, zero), Splat(-PI), Splat(PI)), r), r);
+            const Float4 r2 = Mul(r, r);
+            const Float4 s = Add(Splat(1.0f / 120.0f), Mul(r2, Splat(-1.0f / 5040.0f)));
+            out_sin = Mul(r, Add(Splat(1.0f), Mul(r2, Add(Splat(-1.0f / 6.0f), Mul(r2, s)))));
+            const Float4 c = Add(Splat(0.041666666666f), Mul(r2, Splat(-0.00138888888888f)));
+            const Float4 cos = Add(Splat(1.0f), Mul(r2, Add(Splat(-0.5f), Mul(r2, c))));
+            out_cos = Select(fold, Sub(zero, cos), cos);
+        }
+
+        // Kernels over [begin, end), 4 movers at a time. end is rounded up into the column padding.
+        void UpdateLinear(float* const* p_column, std::size_t begin, std::size_t end)
+        {
+            float* const p_x = p_column[X];
+            float* const p_y = p_column[Y];
+            const float* const p_vx = p_column[LINEAR_VX];
+            const float* const p_vy = p_column[LINEAR_VY];
+            for (std::size_t i = begin; i < end; i += 4)
+            {
+                Store(p_x + i, Add(Load(p_x + i), Load(p_vx + i)));
+                Store(p_y + i, Add(Load(p_y + i), Load(p_vy + i)));
+            }
+        }
+
+        void UpdateAccelerated(float* const* p_column, std::size_t begin, std::size_t end)
+        {
+            float* const p_x = p_column[X];
+            float* const p_y = p_column[Y];
+            float* const p_vx = p_column[ACCELERATED_VX];
+            float* const p_vy = p_column[ACCELERATED_VY];
+            const float* const p_ax = p_column[ACCELERATED_AX];
+            const float* const p_ay = p_column[ACCELERATED_AY];
+            for (std::size_t i = begin; i < end; i += 4)
+            {
+                const Float4 vx = Add(Load(p_vx + i), Load(p_ax + i));
+                const Float4 vy = Add(Load(p_vy + i), Load(p_ay + i));
+                Store(p_vx + i, vx);
+                Store(p_vy + i, vy);
+                Store(p_x + i, Add(Load(p_x + i), vx));
+                Store(p_y + i, Add(Load(p_y + i), vy));
+            }
+        }
+
+        void UpdatePolar(float* const* p_column, std::size_t begin, std::size_t end)
+        {
+            float* const p_x = p_column[X];
+            float* const p_y = p_column[Y];
+            float* const p_angle = p_column[POLAR_ANGLE];
+            float* const p_speed = p_column[POLAR_SPEED];
+            const float* const p_angular_speed = p_column[POLAR_ANGULAR_SPEED];
+            const float* const p_acceleration = p_column[POLAR_ACCELERATION];
+            for (std::size_t i = begin; i < end; i += 4)
+            {
+                const Float4 speed = Add(Load(p_speed + i), Load(p_acceleration + i));
+                const Float4 angle = WrapAngle(Add(Load(p_angle + i), Load(p_angular_speed + i)));
+                Store(p_speed + i, speed);
+                Store(p_angle + i, angle);
+                Float4 sin, cos;
+                FastSinCos4(angle, sin, cos);
+                Store(p_x + i, Add(Load(p_x + i), Mul(cos, speed)));
+                Store(p_y + i, Add(Load(p_y + i), Mul(sin, speed)));
+            }
+        }
+
+        void UpdateSine(float* const* p_column, std::size_t begin, std::size_t end)
+        {
+            float* const p_x = p_column[X];
+            float* const p_y = p_column[Y];
+            float* const p_cx = p_column[SINE_CX];
+            float* const p_cy = p_column[SINE_CY];
+            const float* const p_vx = p_column[SINE_VX];
+            const float* const p_vy = p_column[SINE_VY];
+            const float* const p_ox = p_column[SINE_OX];
+            const float* const p_oy = p_column[SINE_OY];
+            float* const p_phase = p_column[SINE_PHASE];
+            const float* const p_phase_speed = p_column[SINE_PHASE_SPEED];
+            for (std::size_t i = begin; i < end; i += 4)
+            {
+                const Float4 cx = Add(Load(p_cx + i), Load(p_vx + i));
+                const Float4 cy = Add(Load(p_cy + i), Load(p_vy + i));
+                const Float4 phase = WrapAngle(Add(Load(p_phase + i), Load(p_phase_speed + i)));
+                Store(p_cx + i, cx);
+                Store(p_cy + i, cy);
+                Store(p_phase + i, phase);
+                Float4 sin, cos;
+                FastSinCos4(phase, sin, cos);
+                Store(p_x + i, Add(cx, Mul(Load(p_ox + i), sin)));
+                Store(p_y + i, Add(cy, Mul(Load(p_oy + i), sin)));
+            }
+        }
+
+        void UpdateHoming(float* const* p_column, std::size_t begin, std::size_t end, const glm::vec2& target)
+        {
+            float* const p_x = p_column[X];
+            float* const p_y = p_column[Y];
+            float* const p_vx = p_column[HOMING_VX];
+            float* const p_vy = p_column[HOMING_VY];
+            const float* const p_speed = p_column[HOMING_SPEED];
+            const float* const p_steer = p_column[HOMING_STEER];
+            const Float4 tx = Splat(target.x);
+            const Float4 ty = Splat(target.y);
+            // a mover on the target keeps its velocity
+            const Float4 min_distance2 = Splat(1e-12f);
+            for (std::size_t i = begin; i < end; i += 4)
+            {
+                const Float4 x = Load(p_x + i);
+                const Float4 y = Load(p_y + i);
+                const Float4 dx = Sub(tx, x);
+                const Float4 dy = Sub(ty, y);
+                const Float4 distance = Sqrt(Max(Add(Mul(dx, dx), Mul(dy, dy)), min_distance2));
+                const Float4 scale = Div(Load(p_speed + i), distance);
+                const Float4 steer = Load(p_steer + i);
+                Float4 vx = Load(p_vx + i);
+                Float4 vy = Load(p_vy + i);
+                vx = Add(vx, Mul(Sub(Mul(dx, scale), vx), steer));
+                vy = Add(vy, Mul(Sub(Mul(dy, scale), vy), steer));
+                Store(p_vx + i, vx);
+                Store(p_vy + i, vy);
+                Store(p_x + i, Add(x, vx));
+                Store(p_y + i, Add(y, vy));
+            }
+        }
+    }
+
+    MotionSystem::MotionSystem(ThreadPool* p_thread_pool)
+    : p_thread_pool(p_thread_pool)
+    , homing_target(0, 0)
+    {
+        for (std::size_t i = 0; i < static_cast<std::size_t>(MotionKind::COUNT); ++i)
+        {
+            assert(COLUMN_COUNT[i] <= MAX_COLUMN_COUNT);
+            this->group_list[i].column_count = COLUMN_COUNT[i];
+        }
+    }
+
+    int MotionSystem::create(MotionKind kind, const float* p_value, MotionRef& out_ref)
+    {
+        Group& group = this->group_list[static_cast<std::size_t>(kind)];
+        LargeSlotMap::HandleType handle;
+        if (group.slot_map.Create(handle) != 0)
+            return 1;
+        const std::size_t index = group.slot_map.Size() - 1;
+        const std::size_t padded_size = (index + 4) & ~static_cast<std::size_t>(3);
+        for (std::size_t i = 0; i < group.column_count; ++i)
+        {
+            std::vector<float>& column = group.column_list[i];
+            if (column.size() < padded_size)
+                column.resize(padded_size);
+            column[index] = p_value[i];
+        }
+        out_ref.handle = handle;
+        out_ref.kind = kind;
+        return 0;
+    }
+
+    int MotionSystem::CreateLinear(const glm::vec2& pos, const glm::vec2& velocity, MotionRef& out_ref)
+    {
+        const float value[LINEAR_COLUMN_COUNT] = {pos.x, pos.y, velocity.x, velocity.y};
+        return this->create(MotionKind::LINEAR, value, out_ref);
+    }
+
+    int MotionSystem::CreateAccelerated(const glm::vec2& pos, const glm::vec2& velocity, const glm::vec2& acceleration, MotionRef& out_ref)
+    {
+        const float value[ACCELERATED_COLUMN_COUNT] = {pos.x, pos.y, velocity.x, velocity.y, acceleration.x, acceleration.y};
+        return this->create(MotionKind::ACCELERATED, value, out_ref);
+    }
+
+    int MotionSystem::CreatePolar(const glm::vec2& pos, float angle, float speed, float angular_speed, float acceleration, MotionRef& out_ref)
+    {
+        const float value[POLAR_COLUMN_COUNT] = {pos.x, pos.y, angle, speed, angular_speed, acceleration};
+        return this->create(MotionKind::POLAR, value, out_ref);
+    }
+
+    int MotionSystem::CreateSine(const glm::vec2& pos, const glm::vec2& velocity, float amplitude, float phase, float phase_speed, MotionRef& out_ref)
+    {
+        const float length = glm::length(velocity);
+        const glm::vec2 offset = length > 0 ? glm::vec2(-velocity.y, velocity.x) * (amplitude / length) : glm::vec2(0, amplitude);
+        float sin, cos;
+        FastSinCos(phase, &sin, &cos);
+        const float value[SINE_COLUMN_COUNT] =
+        {
+            pos.x + offset.x * sin, pos.y + offset.y * sin,
+            pos.x, pos.y,
+            velocity.x, velocity.y,
+            offset.x, offset.y,
+            phase, phase_speed,
+        };
+        return this->create(MotionKind::SINE, value, out_ref);
+    }
+
+    int MotionSystem::CreateHoming(const glm::vec2& pos, const glm::vec2& velocity, float speed, float steer, MotionRef& out_ref)
+    {
+        const float value[HOMING_COLUMN_COUNT] = {pos.x, pos.y, velocity.x, velocity.y, speed, steer};
+        return this->create(MotionKind::HOMING, value, out_ref);
+    }
+
+    int MotionSystem::Remove(const MotionRef& ref)
+    {
+        Group& group = this->group_list[static_cast<std::size_t>(ref.kind)];
+        std::size_t index;
+        if (group.slot_map.Remove(ref.handle, index) != 0)
+            return 1;
+        const std::size_t last = group.slot_map.Size();
+        for (std::size_t i = 0; i < group.column_count; ++i)
+        {
+            std::vector<float>& column = group.column_list[i];
+            column[index] = column[last];
+        }
+        return 0;
+    }
+
+    int MotionSystem::GetPos(const MotionRef& ref, glm::vec2& out_pos) const
+    {
+        const Group& group = this->group_list[static_cast<std::size_t>(ref.kind)];
+        std::size_t index;
+        if (group.slot_map.Find(ref.handle, index) != 0)
+            return 1;
+        out_pos = glm::vec2(group.column_list[X][index], group.column_list[Y][index]);
+        return 0;
+    }
+
+    std::size_t MotionSystem::Size() const
+    {
+        std::size_t size = 0;
+        for (const Group& group : this->group_list)
+        {
+            size += group.slot_map.Size();
+        }
+        return size;
+    }
+
+    void MotionSystem::updateGroup(MotionKind kind)
+    {
+        Group& group = this->group_list[static_cast<std::size_t>(kind)];
+        const std::size_t count = group.slot_map.Size();
+        if (count == 0)
+            return;
+        float* column[MAX_COLUMN_COUNT];
+        for (std::size_t i = 0; i < group.column_count; ++i)
+        {
+            column[i] = group.column_list[i].data();
+        }
+        const glm::vec2 target = this->homing_target;
+        const ThreadPool::RangeFunc update = [kind, &column, target](std::size_t begin, std::size_t end)
+        {
+            switch (kind)
+            {
+                case MotionKind::LINEAR:
+                    UpdateLinear(column, begin, end);
+                    break;
+                case MotionKind::ACCELERATED:
+                    UpdateAccelerated(column, begin, end);
+                    break;
+                case MotionKind::POLAR:
+                    UpdatePolar(column, begin, end);
+                    break;
+                case MotionKind::SINE:
+                    UpdateSine(column, begin, end);
+                    break;
+                case MotionKind::HOMING:
+                    UpdateHoming(column, begin, end, target);
+                    break;
+                case MotionKind::COUNT:
+                    break;
+            }
+        };
+        if (this->p_thread_pool)
+            this->p_thread_pool->ParallelFor(count, GRAIN, update);
+        else
+            update(0, count);
+    }
+
+    void MotionSystem::Update()
+    {
+        for (std::size_t i = 0; i < static_cast<std::size_t>(MotionKind::COUNT); ++i)
+        {
+            this->updateGroup(static_cast<MotionKind>(i));
+        }
+    }
+
+    TrajectoryStore::TrajectoryStore(const glm::vec2& bounds_min, const glm::vec2& bounds_max, std::size_t capacity)
+    : slot_map(capacity)
+    , expire_time(std::numeric_limits<int>::min())
+    , bounds_min(bounds_min)
+    , bounds_max(bounds_max)
+    {
+        this->line_move_list.reserve(capacity);
+    }
+
+    int TrajectoryStore::Create(const glm::vec2& move_vector, const glm::vec2& pos, int time, HandleType& out_handle)
+    {
+        HandleType handle;
+        if (this->slot_map.Create(handle) != 0)
+            return 1;
+        const LineMove line_move(move_vector, pos, time);
+        this->line_move_list.push_back(line_move);
+        const int exit_time = line_move.GetExitTime(this->bounds_min, this->bounds_max);
+        if (exit_time != std::numeric_limits<int>::max())
+        {
+            // one already out goes to the next Expire
+            const int wheel_time = std::max(exit_time, this->expire_time + 1);
+            this->exit_wheel[static_cast<unsigned int>(wheel_time) & (EXIT_WHEEL_SIZE - 1)].push_back({exit_time, handle});
+        }
+        out_handle = handle;
+        return 0;
+    }
+
+    int TrajectoryStore::Remove(HandleType handle)
+    {
+        std::size_t index;
+        if (this->slot_map.Remove(handle, index) != 0)
+            return 1;
+        this->line_move_list[index] = this->line_move_list.back();
+        this->line_move_list.pop_back();
+        return 0;
+    }
+
+    int TrajectoryStore::GetPos(HandleType handle, int time, glm::vec2& out_pos) const
+    {
+        std::size_t index;
+        if (this->slot_map.Find(handle, index) != 0)
+            return 1;
+        out_pos = this->line_move_list[index].GetPos(time);
+        return 0;
+    }
+
+    std::size_t TrajectoryStore::Expire(int time)
+    {
+        if (time <= this->expire_time)
+            return 0;
+        // every slot once at most
+        const std::int64_t elapsed = static_cast<std::int64_t>(time) - this->expire_time;
+        const std::size_t slot_count = elapsed < static_cast<std::int64_t>(EXIT_WHEEL_SIZE) ? static_cast<std::size_t>(elapsed) : EXIT_WHEEL_SIZE;
+        std::size_t count = 0;
+        for (std::size_t i = 1; i <= slot_count; ++i)
+        {
+            std::vector<Exit>& slot = this->exit_wheel[(static_cast<unsigned int>(this->expire_time) + i) & (EXIT_WHEEL_SIZE - 1)];
+            for (std::size_t j = 0; j < slot.size();)
+            {
+                if (slot[j].time > time)
+                {
+                    ++j;
+                    continue;
+                }
+                // a handle removed before its exit is stale by now and refused
+                if (this->Remove(slot[j].handle) == 0)
+                    ++count;
+                slot[j] = slot.back();
+                slot.pop_back();
+            }
+        }
+        this->expire_time = time;
+        return count;
+    }
+}
@@ -0,0 +1,124 @@
+//
+//  motion.h
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#ifndef __SDL2_904__motion__
+#define __SDL2_904__motion__
+
+#include <cstdint>
+#include <vector>
+#include "glm/vec2.hpp"
+#include "structure.h"
+#include "algorithm.h"
+
+namespace hardrock
+{
+    class ThreadPool;
+
+    enum class MotionKind : std::uint8_t
+    {
+        // position += velocity
+        LINEAR,
+        // velocity += acceleration, then position += velocity
+        ACCELERATED,
+        // speed += acceleration and angle += angular_speed, then position += speed * (cos, sin)(angle)
+        POLAR,
+        // a centre moves linearly and the position swings across its path by amplitude * sin(phase)
+        SINE,
+        // velocity turns towards the homing target by steer of the difference, then position += velocity
+        HOMING,
+        COUNT,
+    };
+
+    struct MotionRef
+    {
+        LargeSlotMap::HandleType handle;
+        MotionKind kind;
+    };
+
+    // Moves points once per Update, kept as one float array per field and one group per kind so
+    // every kind runs as a 4 lane loop. Groups larger than GRAIN are split over the thread pool.
+    // Sines and cosines use the polynomials of FastSinCos.
+    class MotionSystem
+    {
+    public:
+        // movers per ThreadPool chunk, a multiple of 4
+        static const std::size_t GRAIN = 8192;
+        static const std::size_t MAX_COLUMN_COUNT = 10;
+    private:
+        struct Group
+        {
+            LargeSlotMap slot_map;
+            // x and y first, the rest as the kernel of the kind wants them. Columns are padded to
+            // a multiple of 4, the lanes past the last mover are never read back.
+            std::vector<float> column_list[MAX_COLUMN_COUNT];
+            std::size_t column_count;
+        };
+        Group group_list[static_cast<std::size_t>(MotionKind::COUNT)];
+        ThreadPool* const p_thread_pool;
+        glm::vec2 homing_target;
+        int create(MotionKind kind, const float* p_value, MotionRef& out_ref);
+        void updateGroup(MotionKind kind);
+    public:
+        // p_thread_pool may be null, every group then runs on the calling thread.
+        MotionSystem(ThreadPool* p_thread_pool = nullptr);
+        // return 0 on success, 1 if the group of the kind is full
+        int CreateLinear(const glm::vec2& pos, const glm::vec2& velocity, MotionRef& out_ref);
+        int CreateAccelerated(const glm::vec2& pos, const glm::vec2& velocity, const glm::vec2& acceleration, MotionRef& out_ref);
+        // angle in radians
+        int CreatePolar(const glm::vec2& pos, float angle, float speed, float angular_speed, float acceleration, MotionRef& out_ref);
+        // the swing is along (-velocity.y, velocity.x), phase and phase_speed in radians
+        int CreateSine(const glm::vec2& pos, const glm::vec2& velocity, float amplitude, float phase, float phase_speed, MotionRef& out_ref);
+        // steer in [0, 1], 1 turns straight to the target at once
+        int CreateHoming(const glm::vec2& pos, const glm::vec2& velocity, float speed, float steer, MotionRef& out_ref);
+        // return 1 for a stale ref
+        int Remove(const MotionRef& ref);
+        int GetPos(const MotionRef& ref, glm::vec2& out_pos) const;
+        void SetHomingTarget(const glm::vec2& target) { this->homing_target = target; }
+        std::size_t Size() const;
+        void Update();
+    };
+
+    // Straight movers kept as their LineMove alone, nothing is written per frame: positions are
+    // worked out for the time asked, and each mover is dropped at the time it leaves the bounds,
+    // found once when it is created.
+    class TrajectoryStore
+    {
+    public:
+        typedef LargeSlotMap::HandleType HandleType;
+        // times the exit wheel spans, a power of 2
+        static const std::size_t EXIT_WHEEL_SIZE = 256;
+    private:
+        struct Exit
+        {
+            int time;
+            HandleType handle;
+        };
+        LargeSlotMap slot_map;
+        std::vector<LineMove> line_move_list;
+        // Movers by exit time modulo EXIT_WHEEL_SIZE, those further off are passed over until
+        // their turn. Entries of removed movers stay until they come up.
+        std::vector<Exit> exit_wheel[EXIT_WHEEL_SIZE];
+        // time of the last Expire
+        int expire_time;
+        const glm::vec2 bounds_min;
+        const glm::vec2 bounds_max;
+    public:
+        TrajectoryStore(const glm::vec2& bounds_min, const glm::vec2& bounds_max, std::size_t capacity = 0);
+        // at pos at time, moving by move_vector each step. return 1 if the store is full.
+        int Create(const glm::vec2& move_vector, const glm::vec2& pos, int time, HandleType& out_handle);
+        // return 1 for a stale handle
+        int Remove(HandleType handle);
+        bool Contains(HandleType handle) const { return this->slot_map.Contains(handle); }
+        int GetPos(HandleType handle, int time, glm::vec2& out_pos) const;
+        // Remove the movers out of the bounds at time, their handles turn stale. return how many.
+        std::size_t Expire(int time);
+        std::size_t Size() const { return this->slot_map.Size(); }
+    };
+}
+
+#endif /* defined(__SDL2_904__motion__) */
@@ -0,0 +1,116 @@
+//
+//  parallel.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-10.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#include "parallel.h"
+#include <algorithm>
+
+namespace hardrock
+{
+    ThreadPool::ThreadPool(std::size_t thread_count)
+    : p_func(nullptr)
+    , count(0)
+    , grain(1)
+    , next(0)
+    , generation(0)
+    , busy_count(0)
+    , job_open(false)
+    , quit(false)
+    {
+        if (thread_count == 0)
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+        for (std::size_t i = 1; i < thread_count; ++i)
+        {
+            this->thread_list.push_back(std::thread(&ThreadPool::run, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->state_mutex);
+            this->quit = true;
+        }
+        this->start_cond.notify_all();
+        for (auto& thread : this->thread_list)
+        {
+            thread.join();
+        }
+    }
+
+    void ThreadPool::run()
+    {
+        std::size_t seen_generation = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(this->state_mutex);
+                while (this->generation == seen_generation && !this->quit)
+                    this->start_cond.wait(lock);
+                if (this->quit)
+                    return;
+                seen_generation = this->generation;
+                // woke up after the job was closed, nothing left to do
+                if (!this->job_open)
+                    continue;
+                ++this->busy_count;
+            }
+            this->work();
+            {
+                std::lock_guard<std::mutex> lock(this->state_mutex);
+                --this->busy_count;
+            }
+            this->done_cond.notify_one();
+        }
+    }
+
+    void ThreadPool::work()
+    {
+        const RangeFunc& func = *this->p_func;
+        const std::size_t count = this->count;
+        const std::size_t grain = this->grain;
+        while (true)
+        {
+            const std::size_t begin = this->next.fetch_add(grain);
+            if (begin >= count)
+                break;
+            func(begin, std::min(begin + grain, count));
+        }
+    }
+
+    void ThreadPool::ParallelFor(std::size_t count, std::size_t grain, const RangeFunc& func)
+    {
+        if (count == 0)
+            return;
+        if (grain == 0)
+            grain = 1;
+        if (this->thread_list.empty() || count <= grain)
+        {
+            func(0, count);
+            return;
+        }
+        // one job at a time, the job fields are only written while no worker is busy
+        std::lock_guard<std::mutex> job_lock(this->job_mutex);
+        {
+            std::lock_guard<std::mutex> lock(this->state_mutex);
+            this->p_func = &func;
+            this->count = count;
+            this->grain = grain;
+            this->next = 0;
+            this->job_open = true;
+            ++this->generation;
+        }
+        this->start_cond.notify_all();
+        this->work();
+        // workers that have not joined yet must not touch the job any more
+        std::unique_lock<std::mutex> lock(this->state_mutex);
+        this->job_open = false;
+        while (this->busy_count != 0)
+            this->done_cond.wait(lock);
+        this->p_func = nullptr;
+    }
+}
@@ -0,0 +1,56 @@
+//
+//  parallel.h
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-10.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#ifndef __SDL2_904__parallel__
+#define __SDL2_904__parallel__
+
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace hardrock
+{
+    // Fixed set of worker threads that split index ranges of one job at a time.
+    class ThreadPool
+    {
+    public:
+        typedef std::function<void(std::size_t begin, std::size_t end)> RangeFunc;
+    private:
+        std::vector<std::thread> thread_list;
+        std::mutex job_mutex;
+        std::mutex state_mutex;
+        std::condition_variable start_cond;
+        std::condition_variable done_cond;
+        const RangeFunc* p_func;
+        std::size_t count;
+        std::size_t grain;
+        std::atomic<std::size_t> next;
+        std::size_t generation;
+        std::size_t busy_count;
+        bool job_open;
+        bool quit;
+        void run();
+        void work();
+        ThreadPool(const ThreadPool&);
+        ThreadPool& operator=(const ThreadPool&);
+    public:
+        // thread_count counts the calling thread as well, 0 picks the hardware concurrency.
+        ThreadPool(std::size_t thread_count = 0);
+        ~ThreadPool();
+        std::size_t ThreadCount() const { return this->thread_list.size() + 1; }
+        // Call func on chunks of at most grain indices until [0, count) is covered.
+        // The calling thread takes part and the call returns when every chunk is done.
+        void ParallelFor(std::size_t count, std::size_t grain, const RangeFunc& func);
+    };
+}
+
+#endif /* defined(__SDL2_904__parallel__) */
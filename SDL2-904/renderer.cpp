@@ -9,41 +9,200 @@
 #include "renderer.h"
 #include <iostream>
 #include <cassert>
+#include <cstring>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <algorithm>
 #include "webp/decode.h"
 #include "glm/gtc/matrix_access.hpp"
 #include "glm/gtc/type_ptr.hpp"
 #include "algorithm.h"
+#include "parallel.h"
+#include "simd.h"
+#include "gl_executor.h"
+#include "software_executor.h"
 
+// no fused multiply-add, buildTileVerticesScalar has to round like the SIMD kernel
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
 
 namespace hardrock
 {
-    RenderDevice::TextureAtlas::TextureAtlas()
-    : h_textures(1)
+    namespace
     {
-        this->tex = this->h_textures.get(0);
+        // Bounds (x0, y0, x1, y1) of the pixels with alpha in a decoded RGBA sprite.
+        // A fully transparent sprite keeps its whole rect.
+        glm::ivec4 OpaqueBounds(const std::uint8_t* p_pixels, std::size_t stride, int width, int height)
+        {
+            glm::ivec4 bounds(width, height, 0, 0);
+            for (int y = 0; y < height; ++y)
+            {
+                const std::uint8_t* p_row = p_pixels + y * stride;
+                int x0 = 0;
+                while (x0 < width && p_row[x0 * 4 + 3] == 0)
+                    ++x0;
+                if (x0 == width)
+                    continue;
+                int x1 = width;
+                while (p_row[(x1 - 1) * 4 + 3] == 0)
+                    --x1;
+                bounds.x = std::min(bounds.x, x0);
+                bounds.z = std::max(bounds.z, x1);
+                bounds.y = std::min(bounds.y, y);
+                bounds.w = y + 1;
+            }
+            if (bounds.z <= bounds.x)
+                return glm::ivec4(0, 0, width, height);
+            return bounds;
+        }
+        
+        // Texels in the layout of MemoryTexture, count of them from p_data in format.
+        void ExpandTexels(const std::uint8_t* p_data, std::size_t count, RenderDevice::TexelFormat format, std::uint32_t* p_out)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                std::uint32_t r, g, b, a;
+                switch (format)
+                {
+                    case RenderDevice::TexelFormat::RGBA4444:
+                    {
+                        const std::uint32_t v = p_data[i * 2] | p_data[i * 2 + 1] << 8;
+                        r = (v >> 12) * 17;
+                        g = (v >> 8 & 0xf) * 17;
+                        b = (v >> 4 & 0xf) * 17;
+                        a = (v & 0xf) * 17;
+                        break;
+                    }
+                    case RenderDevice::TexelFormat::RGBA5551:
+                    {
+                        // 5 bits to 8 by repeating the high bits, as GL samplers do
+                        const std::uint32_t v = p_data[i * 2] | p_data[i * 2 + 1] << 8;
+                        r = (v >> 11) << 3 | (v >> 13);
+                        g = (v >> 6 & 0x1f) << 3 | (v >> 8 & 0x7);
+                        b = (v >> 1 & 0x1f) << 3 | (v >> 3 & 0x7);
+                        a = (v & 1) * 255;
+                        break;
+                    }
+                    case RenderDevice::TexelFormat::INDEX8:
+                        p_out[i] = p_data[i];
+                        continue;
+                    default:
+                        r = p_data[i * 4];
+                        g = p_data[i * 4 + 1];
+                        b = p_data[i * 4 + 2];
+                        a = p_data[i * 4 + 3];
+                        break;
+                }
+                p_out[i] = r | g << 8 | b << 16 | a << 24;
+            }
+        }
+        
+        bool SameTransform(const RenderDevice::RenderQuest& a, const RenderDevice::RenderQuest& b)
+        {
+            return a.translate == b.translate && a.transform == b.transform;
+        }
+        
+        // 0 tiles is refused, and so many that 4 vertices each overflow 32-bit indices or the
+        // ring regions overflow the 32-bit offsets of the render commands
+        bool IsValidTileCapacity(std::size_t tile_capacity, std::size_t tile_data_size)
+        {
+            const std::size_t max = std::numeric_limits<std::uint32_t>::max();
+            return tile_capacity != 0 && tile_capacity <= max / 4 && tile_capacity <= max / (tile_data_size * RenderDevice::RING_FRAME_COUNT);
+        }
+    }
+    
+    RenderDevice::TextureAtlas::TextureAtlas(bool has_texture)
+    : full_area(0)
+    , drawn_area(0)
+    , up_textures(has_texture ? new GlHandles<OpGlTextures>(2) : nullptr)
+    , tex(0)
+    , palette_tex(0)
+    , palette_count(0)
+    , tex_width(0)
+    , tex_height(0)
+    {
+        if (has_texture)
+        {
+            this->tex = this->up_textures->get(0);
+            this->palette_tex = this->up_textures->get(1);
+        }
     }
     
-    std::unique_ptr<RenderDevice::TextureAtlas> RenderDevice::TextureAtlas::Create(const IResourceDataSet& data_set, std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, int& out_error_code)
+    RenderDevice::TextureAtlas::~TextureAtlas()
+    {
+    }
+    
+    std::size_t RenderDevice::TextureAtlas::trimSprite(std::size_t tex_id, const glm::ivec4& bounds, int width, int height)
+    {
+        // only whole texture coordinate steps inside the transparent border are cut
+        glm::u8vec4& rect = this->rect_list[tex_id];
+        const int coord_width = rect.z - rect.x;
+        const int coord_height = rect.w - rect.y;
+        const int left = bounds.x * coord_width / width;
+        const int top = bounds.y * coord_height / height;
+        const int right = (width - bounds.z) * coord_width / width;
+        const int bottom = (height - bounds.w) * coord_height / height;
+        rect.x += left;
+        rect.y += top;
+        rect.z -= right;
+        rect.w -= bottom;
+        this->trim_list[tex_id] = glm::vec4(
+            static_cast<float>(left) / coord_width,
+            static_cast<float>(top) / coord_height,
+            1.0f - static_cast<float>(right) / coord_width,
+            1.0f - static_cast<float>(bottom) / coord_height);
+        return static_cast<std::size_t>((coord_width - left - right) * width / coord_width) * ((coord_height - top - bottom) * height / coord_height);
+    }
+    
+    RenderDevice::TextureAtlas::DynamicData::DynamicData(std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, std::uint16_t max_sprite_count)
+    : unit_length(unit_length)
+    , width(width)
+    , height(height)
+    , up_packer(new TexturePacker(width, height))
+    , sprite_pool(max_sprite_count + 2)
+    , sprite_list(max_sprite_count)
+    {
+        // every node starts in the free list
+        this->sprite_pool.MoveTo(USED_LIST_HEAD, USED_LIST_HEAD);
+    }
+    
+    std::unique_ptr<RenderDevice::TextureAtlas> RenderDevice::TextureAtlas::Create(const IResourceDataSet& data_set, std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, ThreadPool* p_thread_pool, bool has_texture, int& out_error_code)
     {
         assert((width & (width - 1)) == 0);
         assert((height & (height - 1)) == 0);
         assert(width <= 128 && height <= 128);
         int r;
-        std::unique_ptr<TextureAtlas> up_render(new TextureAtlas());
+        std::unique_ptr<TextureAtlas> up_render(new TextureAtlas(has_texture));
         auto data_count = data_set.Count();
         up_render->rect_list.resize(data_count);
-        std::vector<TexturePackInput> pack_input(data_count);
-        std::vector<TexturePackOutput> pack_output(data_count);
+        std::vector<TexturePackInput16> pack_input(data_count);
+        std::vector<TexturePackOutput16> pack_output(data_count);
         const int int_unit_length = static_cast<int>(unit_length);
+        // header pass, parsed in parallel and validated in order so the error code stays deterministic
+        std::vector<glm::ivec2> info_list(data_count);
+        auto get_info = [&data_set, &info_list](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                const std::uint8_t* p_webp_data;
+                std::size_t size;
+                int w = -1, h = -1;
+                if (data_set.GetDataByIdx(i, p_webp_data, size) != 0 || WebPGetInfo(p_webp_data, size, &w, &h) == 0)
+                    w = h = -1;
+                info_list[i] = glm::ivec2(w, h);
+            }
+        };
+        if (p_thread_pool)
+            p_thread_pool->ParallelFor(data_count, INFO_GRAIN, get_info);
+        else
+            get_info(0, data_count);
         for (std::size_t i = 0; i < data_count; ++i)
         {
-            int w, h;
-            const std::uint8_t* p_webp_data;
-            std::size_t size;
-            r = data_set.GetDataByIdx(i, p_webp_data, size);
-            assert(r == 0);
-            r = WebPGetInfo(p_webp_data, size, &w, &h);
-            if (r == 0)
+            int w = info_list[i].x;
+            int h = info_list[i].y;
+            if (w < 0)
             {
                 out_error_code = 1;
                 return nullptr;
@@ -70,10 +229,11 @@ namespace hardrock
                 out_error_code = 3;
                 return nullptr;
             }
-            pack_input[i].width = static_cast<std::uint8_t>(w);
-            pack_input[i].height = static_cast<std::uint8_t>(h);
+            pack_input[i].width = static_cast<std::uint16_t>(w);
+            pack_input[i].height = static_cast<std::uint16_t>(h);
         }
-        r = TexturePack(width, height, static_cast<std::uint16_t>(data_count), &pack_input[0], &pack_output[0]);
+        // no rotation, WebP decodes straight into the atlas rows
+        r = TexturePack16(width, height, data_count, &pack_input[0], &pack_output[0], TexturePackHeuristic::MAX_RECTS, false);
         if (r != 0)
         {
             out_error_code = 0x100 | r;
@@ -87,266 +247,1048 @@ namespace hardrock
         std::unique_ptr<std::vector<std::uint8_t>> up_image_data(new std::vector<std::uint8_t>(tex_height * tex_stride));
         const std::uint8_t coord_w_scale = 128 / width;
         const std::uint8_t coord_h_scale = 128 / height;
-        for (std::size_t i = 0; i < data_count; ++i)
+        // every sprite decodes into its own packed region, so the decode is split across threads
+        std::uint8_t* const p_image_data = &up_image_data->at(0);
+        std::atomic<bool> decode_failed(false);
+        std::vector<glm::ivec4> bounds_list(data_count);
+        auto decode = [&](std::size_t begin, std::size_t end)
         {
-            const size_t x = static_cast<size_t>(pack_output[i].x) * size_t_unit_length;
-            const size_t y = static_cast<size_t>(pack_output[i].y) * size_t_unit_length;
-            const size_t sub_tex_height = static_cast<size_t>(pack_input[i].height) * size_t_unit_length;
-            std::uint8_t * const p = &up_image_data->at(0) + y * tex_stride + x * 4 * sizeof(std::uint8_t);
-            const std::uint8_t* p_webp_data;
-            std::size_t size;
-            r = data_set.GetDataByIdx(i, p_webp_data, size);
-            assert(r == 0);
-            const uint8_t* decode_result = WebPDecodeRGBAInto(p_webp_data, size, p, sub_tex_height * tex_stride, int_tex_stride);
-            if (decode_result == nullptr)
+            for (std::size_t i = begin; i < end; ++i)
             {
-                out_error_code = 4;
-                return nullptr;
+                const size_t x = static_cast<size_t>(pack_output[i].x) * size_t_unit_length;
+                const size_t y = static_cast<size_t>(pack_output[i].y) * size_t_unit_length;
+                const size_t sub_tex_height = static_cast<size_t>(pack_input[i].height) * size_t_unit_length;
+                std::uint8_t * const p = p_image_data + y * tex_stride + x * 4 * sizeof(std::uint8_t);
+                const std::uint8_t* p_webp_data;
+                std::size_t size;
+                data_set.GetDataByIdx(i, p_webp_data, size);
+                const uint8_t* decode_result = WebPDecodeRGBAInto(p_webp_data, size, p, sub_tex_height * tex_stride, int_tex_stride);
+                if (decode_result == nullptr)
+                    decode_failed = true;
+                else
+                    bounds_list[i] = OpaqueBounds(p, tex_stride, pack_input[i].width * int_unit_length, pack_input[i].height * int_unit_length);
             }
+        };
+        if (p_thread_pool)
+            p_thread_pool->ParallelFor(data_count, DECODE_GRAIN, decode);
+        else
+            decode(0, data_count);
+        if (decode_failed)
+        {
+            out_error_code = 4;
+            return nullptr;
+        }
+        for (std::size_t i = 0; i < data_count; ++i)
+        {
             up_render->rect_list[i].x = pack_output[i].x * coord_w_scale;
             up_render->rect_list[i].y = pack_output[i].y * coord_h_scale;
             up_render->rect_list[i].z = (pack_output[i].x + pack_input[i].width) * coord_w_scale;
             up_render->rect_list[i].w = (pack_output[i].y + pack_input[i].height) * coord_h_scale;
         }
+        up_render->trim_list.resize(data_count);
+        for (std::size_t i = 0; i < data_count; ++i)
+        {
+            const int sprite_width = pack_input[i].width * int_unit_length;
+            const int sprite_height = pack_input[i].height * int_unit_length;
+            up_render->full_area += static_cast<std::size_t>(sprite_width) * sprite_height;
+            up_render->drawn_area += up_render->trimSprite(i, bounds_list[i], sprite_width, sprite_height);
+        }
         
-        GLenum error;
-        glBindTexture(GL_TEXTURE_2D, up_render->tex);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, static_cast<GLsizei>(tex_width), static_cast<GLsizei>(tex_height), 0, GL_RGBA, GL_UNSIGNED_BYTE, &up_image_data->at(0));
-        error = glGetError();
-        if (error != GL_NO_ERROR)
+        r = up_render->upload(&up_image_data->at(0), tex_width, tex_height);
+        if (r != 0)
         {
-            std::cerr << "OpenGL error: " << error << std::endl;
-            out_error_code = 5;
+            out_error_code = r;
             return nullptr;
         }
 
         return up_render;
     }
     
-    RenderDevice::RenderDevice(int screen_width, int screen_height)
-    : screen_width(screen_width)
-    , screen_height(screen_height)
-    , xm(2.0f / screen_width)
-    , ym(-2.0f / screen_height)
-    , xa(-1.0f - 0.5f / screen_width)
-    , ya(1.0f + 0.5f / screen_height)
-    , h_vertex_arrays(1)
-    , h_buffers(2)
-    , vertex_buffer(MAX_TILE_COUNT * 4)
-    , buffer_allocator(MAX_TILE_COUNT)
+    std::unique_ptr<RenderDevice::TextureAtlas> RenderDevice::TextureAtlas::CreatePrebaked(const std::uint8_t* p_data, std::size_t size, const std::uint32_t* p_sorted_rid_list, std::size_t count, bool has_texture, int& out_error_code)
     {
-        this->vao = this->h_vertex_arrays.get(0);
-        this->vbo = this->h_buffers.get(0);
-        this->ebo = this->h_buffers.get(1);
-    }
-    
-    std::unique_ptr<RenderDevice> RenderDevice::Create(int screen_width, int screen_height, const std::uint8_t* p_vert_shader_data, std::size_t vert_shader_data_size, const std::uint8_t* p_frag_shader_data, std::size_t frag_shader_data_size)
-    {
-        static GLushort elements[] =
+        // layout written by res_build/atlas.py
+        struct AtlasHeader
         {
-            0, 1, 2,
-            2, 3, 0,
+            std::array<char, 4> identifier;
+            std::uint16_t unit_length;
+            std::uint8_t width;
+            std::uint8_t height;
+            std::uint32_t count;
         };
-        
-        std::unique_ptr<RenderDevice> up_render_device(new RenderDevice(screen_width, screen_height));
-        
-        int r;
-        GLenum error;
-        do
+        AtlasHeader header;
+        if (p_data == nullptr || size < sizeof(header))
         {
-            GlHandle<OpGlShader> h_vertex_shader(GL_VERTEX_SHADER);
+            out_error_code = 1;
+            return nullptr;
+        }
+        std::memcpy(&header, p_data, sizeof(header));
+        // ATL2 adds the trim margins after the rects, ATL3 the texel format and palettes after them
+        const bool has_format = header.identifier == std::array<char, 4>({'A', 'T', 'L', '3'});
+        const bool has_trim = has_format || header.identifier == std::array<char, 4>({'A', 'T', 'L', '2'});
+        if (!has_trim && header.identifier != std::array<char, 4>({'A', 'T', 'L', 'S'}))
+        {
+            out_error_code = 1;
+            return nullptr;
+        }
+        const size_t tex_width = static_cast<size_t>(header.width) * header.unit_length;
+        const size_t tex_height = static_cast<size_t>(header.height) * header.unit_length;
+        const size_t rid_list_size = header.count * sizeof(std::uint32_t);
+        const size_t rect_list_size = header.count * sizeof(glm::u8vec4);
+        const size_t trim_list_size = has_trim ? rect_list_size : 0;
+        const size_t format_offset = sizeof(header) + rid_list_size + rect_list_size + trim_list_size;
+        struct FormatHeader
+        {
+            TexelFormat format;
+            std::uint8_t padding;
+            std::uint16_t palette_count;
+        };
+        FormatHeader format_header = {TexelFormat::RGBA8888, 0, 0};
+        if (has_format)
+        {
+            if (size < format_offset + sizeof(format_header))
             {
-                const GLchar* vertex_shader_data_list[1] =
-                {
-                    reinterpret_cast<const GLchar*>(p_vert_shader_data)
-                };
-                GLint vertex_shader_size_list[1] =
-                {
-                    static_cast<GLint>(vert_shader_data_size)
-                };
-                glShaderSource(h_vertex_shader, 1, vertex_shader_data_list, vertex_shader_size_list);
-                glCompileShader(h_vertex_shader);
-                glGetShaderiv(h_vertex_shader, GL_COMPILE_STATUS, &r);
-                if (r != GL_TRUE)
-                {
-                    char buffer[512];
-                    glGetShaderInfoLog(h_vertex_shader, 512, NULL, buffer);
-                    std::cerr << buffer << std::endl;
-                    break;
-                }
+                out_error_code = 2;
+                return nullptr;
             }
-            
-            GlHandle<OpGlShader> h_fragment_shader(GL_FRAGMENT_SHADER);
+            std::memcpy(&format_header, p_data + format_offset, sizeof(format_header));
+        }
+        size_t texel_size;
+        switch (format_header.format)
+        {
+            case TexelFormat::RGBA8888: texel_size = 4; break;
+            case TexelFormat::RGBA4444: texel_size = 2; break;
+            case TexelFormat::RGBA5551: texel_size = 2; break;
+            case TexelFormat::INDEX8: texel_size = 1; break;
+            default:
+                out_error_code = 1;
+                return nullptr;
+        }
+        if ((format_header.format == TexelFormat::INDEX8) != (format_header.palette_count != 0))
+        {
+            out_error_code = 1;
+            return nullptr;
+        }
+        const size_t format_size = has_format ? sizeof(format_header) : 0;
+        const size_t palette_list_size = static_cast<size_t>(format_header.palette_count) * PALETTE_SIZE * 4;
+        if (size != format_offset + format_size + palette_list_size + tex_width * tex_height * texel_size)
+        {
+            out_error_code = 2;
+            return nullptr;
+        }
+        const std::uint8_t* p = p_data + sizeof(header);
+        if (header.count != count || std::memcmp(p, p_sorted_rid_list, rid_list_size) != 0)
+        {
+            out_error_code = 6;
+            return nullptr;
+        }
+        p += rid_list_size;
+        std::unique_ptr<TextureAtlas> up_render(new TextureAtlas(has_texture));
+        up_render->rect_list.resize(count);
+        if (count)
+            std::memcpy(&up_render->rect_list[0], p, rect_list_size);
+        p += rect_list_size;
+        const size_t coord_w_scale = 128 / header.width;
+        const size_t coord_h_scale = 128 / header.height;
+        const size_t unit_area = static_cast<size_t>(header.unit_length) * header.unit_length;
+        if (has_trim)
+            up_render->trim_list.resize(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const glm::u8vec4& rect = up_render->rect_list[i];
+            const int coord_width = rect.z - rect.x;
+            const int coord_height = rect.w - rect.y;
+            int full_width = coord_width;
+            int full_height = coord_height;
+            if (has_trim)
             {
-                const GLchar* frag_shader_data_list[1] =
-                {
-                    reinterpret_cast<const GLchar*>(p_frag_shader_data)
-                };
-                GLint frag_shader_size_list[1] =
-                {
-                    static_cast<GLint>(frag_shader_data_size)
-                };
-                glShaderSource(h_fragment_shader, 1, frag_shader_data_list, frag_shader_size_list);
-                glCompileShader(h_fragment_shader);
-                glGetShaderiv(h_fragment_shader, GL_COMPILE_STATUS, &r);
-                if (r != GL_TRUE)
-                {
-                    char buffer[512];
-                    glGetShaderInfoLog(h_fragment_shader, 512, NULL, buffer);
-                    std::cerr << buffer << std::endl;
-                    break;
-                }
+                // left, top, right, bottom steps cut off by atlas.py
+                const std::uint8_t* p_trim = p + i * 4;
+                full_width += p_trim[0] + p_trim[2];
+                full_height += p_trim[1] + p_trim[3];
+                up_render->trim_list[i] = glm::vec4(
+                    static_cast<float>(p_trim[0]) / full_width,
+                    static_cast<float>(p_trim[1]) / full_height,
+                    static_cast<float>(p_trim[0] + coord_width) / full_width,
+                    static_cast<float>(p_trim[1] + coord_height) / full_height);
             }
-            
-            glAttachShader(up_render_device->h_program, h_vertex_shader);
-            glAttachShader(up_render_device->h_program, h_fragment_shader);
-            glLinkProgram(up_render_device->h_program);
-            
-            
-            glBindBuffer(GL_ARRAY_BUFFER, up_render_device->vbo);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(TileVertex) * 4 * MAX_TILE_COUNT, nullptr, GL_STREAM_DRAW);
-            
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, up_render_device->ebo);
+            up_render->full_area += full_width * full_height * unit_area / (coord_w_scale * coord_h_scale);
+            up_render->drawn_area += coord_width * coord_height * unit_area / (coord_w_scale * coord_h_scale);
+        }
+        p += trim_list_size + format_size;
+        int r;
+        if (format_header.palette_count)
+        {
+            r = up_render->uploadPalette(p, format_header.palette_count);
+            if (r != 0)
             {
-                std::vector<GLushort> index_data(MAX_TILE_COUNT * 6);
-                GLushort* p_index_data = &index_data[0];
-                for (int i = 0; i < MAX_TILE_COUNT; ++i) {
-                    GLushort *p = p_index_data + i * 6;
-                    GLushort base = i * 4;
-                    p[0] = elements[0] + base;
-                    p[1] = elements[1] + base;
-                    p[2] = elements[2] + base;
-                    p[3] = elements[3] + base;
-                    p[4] = elements[4] + base;
-                    p[5] = elements[5] + base;
-                }
-                glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * MAX_TILE_COUNT * 6, p_index_data, GL_STATIC_DRAW);
+                out_error_code = r;
+                return nullptr;
             }
-            
-            glBindVertexArray(up_render_device->vao);
-            GLint pos_attrib = glGetAttribLocation(up_render_device->h_program, "position");
-            glEnableVertexAttribArray(pos_attrib);
-            glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(TileVertex), (void*)offsetof(TileVertex, pos));
-            GLint tex_attrib = glGetAttribLocation(up_render_device->h_program, "texcoord");
-            glEnableVertexAttribArray(tex_attrib);
-            glVertexAttribPointer(tex_attrib, 2, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(TileVertex), (void*)offsetof(TileVertex, tex));
-            GLint color_attrib = glGetAttribLocation(up_render_device->h_program, "color");
-            glEnableVertexAttribArray(color_attrib);
-            glVertexAttribPointer(color_attrib, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(TileVertex), (void*)offsetof(TileVertex, color));
-            glBindVertexArray(0);
-            
-            up_render_device->shader_transform = glGetUniformLocation(up_render_device->h_program, "WorldTransform");
-            up_render_device->shader_translate = glGetUniformLocation(up_render_device->h_program, "WorldTranslate");
-            up_render_device->shader_sampler = glGetUniformLocation(up_render_device->h_program, "TexSampler");
-            
+            p += palette_list_size;
+        }
+        r = up_render->upload(p, tex_width, tex_height, format_header.format);
+        if (r != 0)
+        {
+            out_error_code = r;
+            return nullptr;
+        }
+        return up_render;
+    }
+    
+    std::unique_ptr<RenderDevice::TextureAtlas> RenderDevice::TextureAtlas::CreateDynamic(std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, std::uint16_t max_sprite_count, bool has_texture, int& out_error_code)
+    {
+        assert((width & (width - 1)) == 0);
+        assert((height & (height - 1)) == 0);
+        assert(width <= 128 && height <= 128);
+        if (max_sprite_count == 0 || max_sprite_count > std::numeric_limits<CircleLinkedListPool::IndexType>::max() - 1)
+        {
+            out_error_code = 1;
+            return nullptr;
+        }
+        std::unique_ptr<TextureAtlas> up_render(new TextureAtlas(has_texture));
+        up_render->up_dynamic_data.reset(new DynamicData(unit_length, width, height, max_sprite_count));
+        up_render->rect_list.resize(max_sprite_count, glm::u8vec4(0, 0, 0, 0));
+        up_render->trim_list.resize(max_sprite_count, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+        const size_t tex_width = static_cast<size_t>(width) * unit_length;
+        const size_t tex_height = static_cast<size_t>(height) * unit_length;
+        int r = up_render->upload(nullptr, tex_width, tex_height);
+        if (r != 0)
+        {
+            out_error_code = r;
+            return nullptr;
+        }
+        return up_render;
+    }
+    
+    int RenderDevice::TextureAtlas::InsertSprite(std::uint32_t rid, const std::uint8_t* p_webp_data, std::size_t size, std::uint32_t frame, std::uint16_t& out_tex_id)
+    {
+        DynamicData* const p_dynamic_data = this->up_dynamic_data.get();
+        if (p_dynamic_data == nullptr)
+            return 1;
+        if (this->FindSprite(rid, frame, out_tex_id) == 0)
+            return 0;
+        const int int_unit_length = static_cast<int>(p_dynamic_data->unit_length);
+        int w, h;
+        if (WebPGetInfo(p_webp_data, size, &w, &h) == 0)
+            return 1;
+        if (w % int_unit_length || h % int_unit_length)
+            return 2;
+        if (w / int_unit_length > p_dynamic_data->width || h / int_unit_length > p_dynamic_data->height)
+            return 3;
+        const std::uint16_t unit_width = static_cast<std::uint16_t>(w / int_unit_length);
+        const std::uint16_t unit_height = static_cast<std::uint16_t>(h / int_unit_length);
+        
+        // make room for the sprite slot and its rectangle
+        TexturePackOutput16 position;
+        while (p_dynamic_data->sprite_pool.Next(DynamicData::FREE_LIST_HEAD) == DynamicData::FREE_LIST_HEAD ||
+            p_dynamic_data->up_packer->Insert(unit_width, unit_height, false, position) != 0)
+        {
+            if (this->evictLeastRecentlyUsed(frame) != 0)
+                return 7;
+        }
+        
+        std::vector<std::uint8_t> image_data(static_cast<size_t>(w) * h * 4);
+        if (WebPDecodeRGBAInto(p_webp_data, size, &image_data[0], image_data.size(), w * 4) == nullptr)
+        {
+            p_dynamic_data->up_packer->Free(position.x, position.y, unit_width, unit_height);
+            return 4;
+        }
+        if (this->up_textures)
+        {
+            GLenum error;
+            glBindTexture(GL_TEXTURE_2D, this->tex);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, position.x * int_unit_length, position.y * int_unit_length, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &image_data[0]);
             error = glGetError();
             if (error != GL_NO_ERROR)
             {
                 std::cerr << "OpenGL error: " << error << std::endl;
-                return nullptr;
+                p_dynamic_data->up_packer->Free(position.x, position.y, unit_width, unit_height);
+                return 5;
+            }
+        }
+        else
+        {
+            const std::size_t x = static_cast<std::size_t>(position.x) * int_unit_length;
+            const std::size_t y = static_cast<std::size_t>(position.y) * int_unit_length;
+            for (int row = 0; row < h; ++row)
+            {
+                ExpandTexels(&image_data[static_cast<std::size_t>(row) * w * 4], w, TexelFormat::RGBA8888, &this->texel_list[(y + row) * this->tex_width + x]);
+            }
+        }
+        
+        const CircleLinkedListPool::IndexType node = p_dynamic_data->sprite_pool.Next(DynamicData::FREE_LIST_HEAD);
+        p_dynamic_data->sprite_pool.MoveTo(node, DynamicData::USED_LIST_HEAD);
+        const std::uint16_t tex_id = node - 2;
+        const std::uint8_t coord_w_scale = 128 / p_dynamic_data->width;
+        const std::uint8_t coord_h_scale = 128 / p_dynamic_data->height;
+        this->rect_list[tex_id].x = position.x * coord_w_scale;
+        this->rect_list[tex_id].y = position.y * coord_h_scale;
+        this->rect_list[tex_id].z = (position.x + unit_width) * coord_w_scale;
+        this->rect_list[tex_id].w = (position.y + unit_height) * coord_h_scale;
+        const std::size_t drawn_area = this->trimSprite(tex_id, OpaqueBounds(&image_data[0], w * 4, w, h), w, h);
+        this->full_area += static_cast<std::size_t>(w) * h;
+        this->drawn_area += drawn_area;
+        p_dynamic_data->sprite_list[tex_id] = {rid, frame, frame, static_cast<std::uint32_t>(drawn_area), position.x, position.y, unit_width, unit_height};
+        p_dynamic_data->rid_map[rid] = tex_id;
+        out_tex_id = tex_id;
+        return 0;
+    }
+    
+    int RenderDevice::TextureAtlas::FindSprite(std::uint32_t rid, std::uint32_t frame, std::uint16_t& out_tex_id)
+    {
+        if (this->up_dynamic_data == nullptr)
+            return 1;
+        auto iter = this->up_dynamic_data->rid_map.find(rid);
+        if (iter == this->up_dynamic_data->rid_map.end())
+            return 1;
+        this->TouchSprite(iter->second, frame);
+        out_tex_id = iter->second;
+        return 0;
+    }
+    
+    int RenderDevice::TextureAtlas::RemoveSprite(std::uint32_t rid)
+    {
+        if (this->up_dynamic_data == nullptr)
+            return 1;
+        auto iter = this->up_dynamic_data->rid_map.find(rid);
+        if (iter == this->up_dynamic_data->rid_map.end())
+            return 1;
+        this->evictSprite(iter->second);
+        return 0;
+    }
+    
+    void RenderDevice::TextureAtlas::evictSprite(std::uint16_t tex_id)
+    {
+        DynamicData* const p_dynamic_data = this->up_dynamic_data.get();
+        const Sprite& sprite = p_dynamic_data->sprite_list[tex_id];
+        p_dynamic_data->up_packer->Free(sprite.x, sprite.y, sprite.width, sprite.height);
+        p_dynamic_data->rid_map.erase(sprite.rid);
+        this->full_area -= static_cast<std::size_t>(sprite.width) * sprite.height * p_dynamic_data->unit_length * p_dynamic_data->unit_length;
+        this->drawn_area -= sprite.drawn_area;
+        p_dynamic_data->sprite_pool.MoveTo(tex_id + 2, DynamicData::FREE_LIST_HEAD);
+        // a stale tex_id samples an empty rectangle instead of another sprite
+        this->rect_list[tex_id] = glm::u8vec4(0, 0, 0, 0);
+        this->trim_list[tex_id] = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+    }
+    
+    int RenderDevice::TextureAtlas::evictLeastRecentlyUsed(std::uint32_t frame)
+    {
+        DynamicData* const p_dynamic_data = this->up_dynamic_data.get();
+        CircleLinkedListPool& sprite_pool = p_dynamic_data->sprite_pool;
+        // Second chance: sprites drawn since they were last moved go back to the front.
+        // Sprites drawn this frame are never evicted, their vertices are already in the buffer.
+        // Two rounds are enough to either find a victim or see that everything is pinned.
+        std::size_t visit_count = p_dynamic_data->rid_map.size() * 2;
+        while (visit_count--)
+        {
+            const CircleLinkedListPool::IndexType node = sprite_pool.Prev(DynamicData::USED_LIST_HEAD);
+            Sprite& sprite = p_dynamic_data->sprite_list[node - 2];
+            if (sprite.last_use == frame || sprite.last_use != sprite.list_use)
+            {
+                sprite.list_use = sprite.last_use;
+                sprite_pool.MoveTo(node, DynamicData::USED_LIST_HEAD);
+                continue;
             }
-        } while (false);
+            this->evictSprite(node - 2);
+            return 0;
+        }
+        return 1;
+    }
+    
+    int RenderDevice::TextureAtlas::upload(const std::uint8_t* p_image_data, std::size_t tex_width, std::size_t tex_height, TexelFormat format)
+    {
+        if (this->up_textures == nullptr)
+        {
+            this->tex_width = tex_width;
+            this->tex_height = tex_height;
+            this->texel_list.assign(tex_width * tex_height, 0);
+            if (p_image_data)
+                ExpandTexels(p_image_data, this->texel_list.size(), format, &this->texel_list[0]);
+            return 0;
+        }
+        GLint internal_format;
+        GLenum data_format;
+        GLenum data_type;
+        switch (format)
+        {
+            case TexelFormat::RGBA4444:
+                internal_format = GL_RGBA4;
+                data_format = GL_RGBA;
+                data_type = GL_UNSIGNED_SHORT_4_4_4_4;
+                break;
+            case TexelFormat::RGBA5551:
+                internal_format = GL_RGB5_A1;
+                data_format = GL_RGBA;
+                data_type = GL_UNSIGNED_SHORT_5_5_5_1;
+                break;
+            case TexelFormat::INDEX8:
+                internal_format = GL_R8;
+                data_format = GL_RED;
+                data_type = GL_UNSIGNED_BYTE;
+                break;
+            default:
+                internal_format = GL_RGBA;
+                data_format = GL_RGBA;
+                data_type = GL_UNSIGNED_BYTE;
+                break;
+        }
+        GLenum error;
+        glBindTexture(GL_TEXTURE_2D, this->tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        // 8 and 16-bit rows need not be 4-byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, static_cast<GLsizei>(tex_width), static_cast<GLsizei>(tex_height), 0, data_format, data_type, p_image_data);
         error = glGetError();
         if (error != GL_NO_ERROR)
         {
             std::cerr << "OpenGL error: " << error << std::endl;
-            return nullptr;
+            return 5;
         }
-        else
+        return 0;
+    }
+    
+    int RenderDevice::TextureAtlas::uploadPalette(const std::uint8_t* p_palette_data, std::size_t palette_count)
+    {
+        if (this->up_textures == nullptr)
         {
-            return up_render_device;
+            this->palette_list.resize(PALETTE_SIZE * palette_count);
+            ExpandTexels(p_palette_data, this->palette_list.size(), TexelFormat::RGBA8888, &this->palette_list[0]);
+            this->palette_count = static_cast<std::uint16_t>(palette_count);
+            return 0;
         }
+        GLenum error;
+        glBindTexture(GL_TEXTURE_2D, this->palette_tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, static_cast<GLsizei>(PALETTE_SIZE), static_cast<GLsizei>(palette_count), 0, GL_RGBA, GL_UNSIGNED_BYTE, p_palette_data);
+        error = glGetError();
+        if (error != GL_NO_ERROR)
+        {
+            std::cerr << "OpenGL error: " << error << std::endl;
+            return 5;
+        }
+        this->palette_count = static_cast<std::uint16_t>(palette_count);
+        return 0;
+    }
+    
+    MemoryTexture RenderDevice::TextureAtlas::GetMemoryTexture() const
+    {
+        MemoryTexture texture =
+        {
+            static_cast<std::uint32_t>(this->tex_width),
+            static_cast<std::uint32_t>(this->tex_height),
+            this->texel_list.data(),
+            this->palette_list.data(),
+            this->palette_count,
+        };
+        return texture;
+    }
+    
+    RenderDevice::RenderDevice(int screen_width, int screen_height, RenderPath render_path, BufferMode buffer_mode, std::size_t tile_capacity)
+    : screen_width(screen_width)
+    , screen_height(screen_height)
+    , render_path(render_path)
+    , tile_capacity(tile_capacity)
+    , xm(2.0f / screen_width)
+    , ym(-2.0f / screen_height)
+    , xa(-1.0f - 0.5f / screen_width)
+    , ya(1.0f + 0.5f / screen_height)
+    , vertex_buffer(render_path == RenderPath::VERTICES && buffer_mode == BufferMode::RETAINED ? tile_capacity * 4 : 0)
+    , instance_buffer(render_path == RenderPath::INSTANCED && buffer_mode == BufferMode::RETAINED ? tile_capacity : 0)
+    , buffer_allocator(tile_capacity)
+    , frame_stats()
+    , buffer_mode(buffer_mode)
+    , p_ring_data(nullptr)
+    , ring_slot(0)
+    , p_headless_executor(nullptr)
+    , p_software_executor(nullptr)
+    , has_gl_textures(false)
+    , draw_state()
+    , frame(0)
+    {
+    }
+    
+    RenderDevice::~RenderDevice()
+    {
+    }
+    
+    std::unique_ptr<RenderDevice> RenderDevice::Create(int screen_width, int screen_height, const std::uint8_t* p_vert_shader_data, std::size_t vert_shader_data_size, const std::uint8_t* p_frag_shader_data, std::size_t frag_shader_data_size, RenderPath render_path, BufferMode buffer_mode, std::size_t tile_capacity)
+    {
+        if (!IsValidTileCapacity(tile_capacity, TileDataSize(render_path)))
+            return nullptr;
+        std::unique_ptr<RenderDevice> up_render_device(new RenderDevice(screen_width, screen_height, render_path, buffer_mode, tile_capacity));
+        up_render_device->up_executor = GlCommandExecutor::Create(p_vert_shader_data, vert_shader_data_size, p_frag_shader_data, frag_shader_data_size, render_path, buffer_mode, tile_capacity);
+        if (up_render_device->up_executor == nullptr)
+            return nullptr;
+        up_render_device->has_gl_textures = true;
+        return up_render_device;
+    }
+    
+    std::unique_ptr<RenderDevice> RenderDevice::CreateHeadless(int screen_width, int screen_height, HeadlessCommandExecutor::Mode mode, RenderPath render_path, BufferMode buffer_mode, std::size_t tile_capacity)
+    {
+        if (!IsValidTileCapacity(tile_capacity, TileDataSize(render_path)))
+            return nullptr;
+        std::unique_ptr<RenderDevice> up_render_device(new RenderDevice(screen_width, screen_height, render_path, buffer_mode, tile_capacity));
+        const std::size_t tile_data_size = up_render_device->tileDataSize();
+        const std::size_t region_count = buffer_mode == BufferMode::RING ? RING_FRAME_COUNT : 1;
+        HeadlessCommandExecutor* p_executor = new HeadlessCommandExecutor(mode, tile_data_size, tile_data_size * tile_capacity, region_count);
+        up_render_device->up_executor.reset(p_executor);
+        up_render_device->p_headless_executor = p_executor;
+        return up_render_device;
+    }
+    
+    std::unique_ptr<RenderDevice> RenderDevice::CreateSoftware(int screen_width, int screen_height, ThreadPool* p_thread_pool, RenderPath render_path, BufferMode buffer_mode, std::size_t tile_capacity)
+    {
+        if (!IsValidTileCapacity(tile_capacity, TileDataSize(render_path)) || screen_width <= 0 || screen_height <= 0)
+            return nullptr;
+        std::unique_ptr<RenderDevice> up_render_device(new RenderDevice(screen_width, screen_height, render_path, buffer_mode, tile_capacity));
+        SoftwareCommandExecutor* p_executor = new SoftwareCommandExecutor(screen_width, screen_height, render_path, buffer_mode, tile_capacity, p_thread_pool);
+        up_render_device->up_executor.reset(p_executor);
+        up_render_device->p_software_executor = p_executor;
+        return up_render_device;
     }
 
-    int RenderDevice::CreateTextureAtlas(const IResourceDataSet& data_set, std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, AtlasIdType& out_atlas_id)
+    int RenderDevice::CreateTextureAtlas(const IResourceDataSet& data_set, std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, AtlasIdType& out_atlas_id, ThreadPool* p_thread_pool)
     {
         int error_code;
-        auto up_texture_atlas = TextureAtlas::Create(data_set, unit_length, width, height, error_code);
+        auto up_texture_atlas = TextureAtlas::Create(data_set, unit_length, width, height, p_thread_pool, this->has_gl_textures, error_code);
         if (up_texture_atlas)
         {
-            this->up_texture_atlas_list.push_back(std::move(up_texture_atlas));
-            out_atlas_id = this->up_texture_atlas_list.size() - 1;
+            out_atlas_id = this->addTextureAtlas(std::move(up_texture_atlas));
+            return 0;
+        }
+        return error_code;
+    }
+    
+    int RenderDevice::CreatePrebakedTextureAtlas(const std::uint8_t* p_data, std::size_t size, const std::uint32_t* p_sorted_rid_list, std::size_t count, AtlasIdType& out_atlas_id)
+    {
+        int error_code;
+        auto up_texture_atlas = TextureAtlas::CreatePrebaked(p_data, size, p_sorted_rid_list, count, this->has_gl_textures, error_code);
+        if (up_texture_atlas)
+        {
+            out_atlas_id = this->addTextureAtlas(std::move(up_texture_atlas));
             return 0;
         }
         return error_code;
     }
     
+    int RenderDevice::CreateDynamicTextureAtlas(std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, std::uint16_t max_sprite_count, AtlasIdType& out_atlas_id)
+    {
+        int error_code;
+        auto up_texture_atlas = TextureAtlas::CreateDynamic(unit_length, width, height, max_sprite_count, this->has_gl_textures, error_code);
+        if (up_texture_atlas)
+        {
+            out_atlas_id = this->addTextureAtlas(std::move(up_texture_atlas));
+            return 0;
+        }
+        return error_code;
+    }
+    
+    int RenderDevice::InsertSprite(AtlasIdType atlas_id, std::uint32_t rid, const std::uint8_t* p_webp_data, std::size_t size, std::uint16_t& out_tex_id)
+    {
+        TextureAtlas* const p_texture_atlas = this->findTextureAtlas(atlas_id);
+        if (!p_texture_atlas)
+            return 1;
+        return p_texture_atlas->InsertSprite(rid, p_webp_data, size, this->frame, out_tex_id);
+    }
+    
+    int RenderDevice::FindSprite(AtlasIdType atlas_id, std::uint32_t rid, std::uint16_t& out_tex_id)
+    {
+        TextureAtlas* const p_texture_atlas = this->findTextureAtlas(atlas_id);
+        if (!p_texture_atlas)
+            return 1;
+        return p_texture_atlas->FindSprite(rid, this->frame, out_tex_id);
+    }
+    
+    int RenderDevice::RemoveSprite(AtlasIdType atlas_id, std::uint32_t rid)
+    {
+        TextureAtlas* const p_texture_atlas = this->findTextureAtlas(atlas_id);
+        if (!p_texture_atlas)
+            return 1;
+        return p_texture_atlas->RemoveSprite(rid);
+    }
+    
+    int RenderDevice::GetTextureAtlasTrimReport(AtlasIdType atlas_id, std::size_t& out_full_area, std::size_t& out_drawn_area) const
+    {
+        const TextureAtlas* const p_texture_atlas = this->findTextureAtlas(atlas_id);
+        if (!p_texture_atlas)
+            return 1;
+        out_full_area = p_texture_atlas->GetFullArea();
+        out_drawn_area = p_texture_atlas->GetDrawnArea();
+        return 0;
+    }
+    
+    RenderDevice::TextureAtlas* RenderDevice::findTextureAtlas(AtlasIdType atlas_id) const
+    {
+        const std::size_t i = IdIndex(atlas_id);
+        if (i >= this->up_texture_atlas_list.size() || this->atlas_generation_list[i] != atlas_id >> ID_INDEX_BITS)
+            return nullptr;
+        return this->up_texture_atlas_list[i].get();
+    }
+    
+    RenderDevice::TileBatch* RenderDevice::findBatch(BatchIdType batch_id)
+    {
+        const std::size_t i = IdIndex(batch_id);
+        if (i >= this->tile_batch_list.size())
+            return nullptr;
+        TileBatch& batch = this->tile_batch_list[i];
+        if (!batch.is_used || batch.generation != batch_id >> ID_INDEX_BITS)
+            return nullptr;
+        return &batch;
+    }
+    
+    RenderDevice::AtlasIdType RenderDevice::addTextureAtlas(std::unique_ptr<TextureAtlas> up_texture_atlas)
+    {
+        std::size_t i = 0;
+        while (i < this->up_texture_atlas_list.size() && this->up_texture_atlas_list[i])
+            ++i;
+        if (!this->has_gl_textures)
+        {
+            // memory textures are named after the atlas, 0 stays no texture as with GL
+            const std::uint32_t name = static_cast<std::uint32_t>(i + 1);
+            up_texture_atlas->SetTextureName(name);
+            const MemoryTexture texture = up_texture_atlas->GetMemoryTexture();
+            this->up_executor->SetTexture(name, &texture);
+        }
+        if (i == this->up_texture_atlas_list.size())
+        {
+            this->up_texture_atlas_list.push_back(std::move(up_texture_atlas));
+            this->atlas_generation_list.push_back(1);
+        }
+        else
+        {
+            this->up_texture_atlas_list[i] = std::move(up_texture_atlas);
+        }
+        return MakeId(i, this->atlas_generation_list[i]);
+    }
+    
     int RenderDevice::RemoveTextureAtlas(AtlasIdType atlas_id)
     {
-        if (atlas_id == 0)
+        if (!this->findTextureAtlas(atlas_id))
             return 1;
-        this->up_texture_atlas_list.erase(this->up_texture_atlas_list.begin() + atlas_id);
+        const std::size_t i = IdIndex(atlas_id);
+        if (!this->has_gl_textures)
+            this->up_executor->SetTexture(static_cast<std::uint32_t>(i + 1), nullptr);
+        this->up_texture_atlas_list[i].reset();
+        this->atlas_generation_list[i] = NextGeneration(this->atlas_generation_list[i]);
         return 0;
     }
     
     int RenderDevice::CreateBatch(std::size_t capacity, AtlasIdType atlas_id, BatchIdType& out_batch_id)
     {
-        if (this->tile_batch_list.size() >= MAX_BATCH_COUNT)
+        if (!this->findTextureAtlas(atlas_id))
+            return 1;
+        std::size_t i = 0;
+        while (i < this->tile_batch_list.size() && this->tile_batch_list[i].is_used)
+            ++i;
+        if (i >= MAX_BATCH_COUNT)
             return 1;
         std::size_t offset;
-        int r = this->buffer_allocator.Allocate(capacity, offset);
+        TlsfAllocator::BlockIdType block_id;
+        int r = this->buffer_allocator.Allocate(capacity, offset, block_id);
         if (r != 0)
-            return 1;
-        this->tile_batch_list.push_back({ offset, capacity, 0, atlas_id });
-        out_batch_id = this->tile_batch_list.size() - 1;
+        {
+            if (this->buffer_allocator.GetStats().free_size < capacity)
+                return 1;
+            this->CompactBatches();
+            r = this->buffer_allocator.Allocate(capacity, offset, block_id);
+            if (r != 0)
+                return 1;
+        }
+        if (i == this->tile_batch_list.size())
+        {
+            this->tile_batch_list.push_back(TileBatch());
+            this->tile_batch_list[i].generation = 1;
+        }
+        TileBatch& batch = this->tile_batch_list[i];
+        batch.offset = offset;
+        batch.capacity = capacity;
+        batch.count = 0;
+        batch.atlas_id = atlas_id;
+        batch.block_id = block_id;
+        batch.p_source = nullptr;
+        batch.upload_begin = 0;
+        batch.upload_end = 0;
+        batch.drawn_offset = offset;
+        batch.is_used = true;
+        out_batch_id = MakeId(i, batch.generation);
         return 0;
     }
     
     int RenderDevice::RemoveBatch(BatchIdType batch_id)
     {
-        this->tile_batch_list.erase(this->tile_batch_list.begin() + batch_id);
+        TileBatch* const p_batch = this->findBatch(batch_id);
+        if (!p_batch)
+            return 1;
+        this->buffer_allocator.Free(p_batch->block_id);
+        // an unused slot uploads and draws nothing
+        p_batch->count = 0;
+        p_batch->upload_begin = 0;
+        p_batch->upload_end = 0;
+        p_batch->is_used = false;
+        p_batch->generation = NextGeneration(p_batch->generation);
+        return 0;
+    }
+    
+    int RenderDevice::CompactBatches(std::size_t max_tile_count)
+    {
+        std::vector<TileBatch*> batch_list;
+        for (auto& batch : this->tile_batch_list)
+        {
+            if (batch.is_used)
+                batch_list.push_back(&batch);
+        }
+        std::sort(batch_list.begin(), batch_list.end(), [](const TileBatch* p_a, const TileBatch* p_b) { return p_a->offset < p_b->offset; });
+        const std::size_t tile_data_size = this->tileDataSize();
+        std::size_t moved_tile_count = 0;
+        // every block of buffer_allocator is a batch, one not at the end of the one before slides
+        std::size_t packed_end = 0;
+        for (TileBatch* p_batch : batch_list)
+        {
+            if (p_batch->offset == packed_end)
+            {
+                packed_end += p_batch->capacity;
+                continue;
+            }
+            if (p_batch->count > max_tile_count - moved_tile_count)
+                break;
+            std::size_t offset;
+            if (this->buffer_allocator.SlideDown(p_batch->block_id, offset) != 0)
+                return 1;
+            assert(offset == packed_end);
+            packed_end += p_batch->capacity;
+            moved_tile_count += p_batch->count;
+            // With RING the tiles are in the regions, the next frame copies them from drawn_offset.
+            if (this->buffer_mode == BufferMode::RETAINED && p_batch->count != 0)
+            {
+                std::memmove(this->tileData(offset), this->tileData(p_batch->offset), tile_data_size * p_batch->count);
+                p_batch->upload_begin = 0;
+                p_batch->upload_end = std::max(p_batch->upload_end, p_batch->count);
+            }
+            p_batch->offset = offset;
+        }
         return 0;
     }
     
     int RenderDevice::beginRender()
     {
-        GLenum error;
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        glEnable(GL_BLEND);
-        glUseProgram(this->h_program);
-        glActiveTexture(GL_TEXTURE0);
-        glUniform1i(this->shader_sampler, 0);
-        glBindVertexArray(this->vao);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(TileVertex) * 4 * MAX_TILE_COUNT, nullptr, GL_STREAM_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ebo);
-        error = glGetError();
-        if (error != GL_NO_ERROR)
+        ++this->frame;
+        this->frame_stats = FrameStats();
+        // textures may have been bound by atlas uploads since the last frame
+        this->draw_state = DrawState();
+        if (this->buffer_mode == BufferMode::RING)
         {
-            std::cerr << "OpenGL error: " << error << std::endl;
-            return 1;
+            this->ring_slot = this->frame % RING_FRAME_COUNT;
+            this->p_ring_data = this->up_executor->MapRegion(this->ring_slot, this->frame_stats);
+            if (this->p_ring_data == nullptr)
+                return 1;
+            this->command_buffer.Clear(nullptr);
         }
+        else
+        {
+            this->command_buffer.Clear(static_cast<const std::uint8_t*>(this->tileData(0)));
+        }
+        RenderCommand& command = this->command_buffer.Add(RenderCommandType::BEGIN_FRAME);
+        command.frame.frame = this->frame;
+        command.frame.ring_slot = static_cast<std::uint32_t>(this->ring_slot);
         return 0;
     }
     
     int RenderDevice::updateBatch(BatchIdType batch_id, ITileSequence* p_tile_seq)
     {
-        auto& batch = this->tile_batch_list[batch_id];
+        TileBatch* const p_batch = this->findBatch(batch_id);
+        if (!p_batch)
+            return 1;
+        auto& batch = *p_batch;
         
-        const auto p_texture_atlas = this->up_texture_atlas_list[batch.atlas_id].get();
+        const auto p_texture_atlas = this->findTextureAtlas(batch.atlas_id);
+        if (!p_texture_atlas)
+            return 1;
+        if (!p_tile_seq)
+            return 0;
+        const bool is_dynamic_atlas = p_texture_atlas->IsDynamic();
+        const std::uint32_t frame = this->frame;
+        
+        // Vertices of a dynamic atlas depend on where its sprites are right now, and every sprite
+        // drawn has to be touched, so those batches are always rebuilt.
+        std::size_t change_begin;
+        std::size_t change_end;
+        const void* const p_source = p_tile_seq->GetChanges(change_begin, change_end);
+        if (p_source == nullptr || p_source != batch.p_source || is_dynamic_atlas)
+        {
+            change_begin = 0;
+            change_end = batch.capacity;
+        }
+        change_end = std::min(change_end, batch.capacity);
         
         std::size_t tile_count = 0;
-        const std::size_t vertex_offset = batch.offset << 2;
-        TileVertex* p = &this->vertex_buffer[vertex_offset];
+        const Tile* p_block;
+        std::size_t block_count;
+        // unchanged tiles in front, the changed ones, then count the rest
+        while (tile_count < change_begin && (block_count = p_tile_seq->NextBlock(p_block, change_begin - tile_count)) != 0)
+        {
+            tile_count += block_count;
+        }
+        const std::size_t build_begin = tile_count;
+        while (tile_count < change_end && (block_count = p_tile_seq->NextBlock(p_block, change_end - tile_count)) != 0)
+        {
+            if (is_dynamic_atlas)
+            {
+                for (std::size_t i = 0; i < block_count; ++i)
+                {
+                    p_texture_atlas->TouchSprite(p_block[i].tex_id, frame);
+                }
+            }
+            void* const p_out = this->tileData(batch.offset + tile_count);
+            if (this->render_path == RenderPath::INSTANCED)
+                this->buildTileInstances(p_block, block_count, *p_texture_atlas, static_cast<TileInstance*>(p_out));
+            else
+                this->buildTileVertices(p_block, block_count, *p_texture_atlas, static_cast<TileVertex*>(p_out));
+            tile_count += block_count;
+        }
+        const std::size_t build_end = tile_count;
+        while (tile_count < batch.capacity && (block_count = p_tile_seq->NextBlock(p_block, batch.capacity - tile_count)) != 0)
+        {
+            tile_count += block_count;
+        }
+        
+        batch.count = tile_count;
+        batch.p_source = p_source;
+        if (build_begin != build_end)
+        {
+            if (batch.upload_begin == batch.upload_end)
+            {
+                batch.upload_begin = build_begin;
+                batch.upload_end = build_end;
+            }
+            else
+            {
+                batch.upload_begin = std::min(batch.upload_begin, build_begin);
+                batch.upload_end = std::max(batch.upload_end, build_end);
+            }
+        }
+        return 0;
+    }
+    
+    int RenderDevice::uploadBatches()
+    {
+        const std::size_t tile_data_size = this->tileDataSize();
+        RenderCommandBuffer& command_buffer = this->command_buffer;
+        if (this->buffer_mode == BufferMode::RING)
+        {
+            // The changed tiles are already in the region. The rest did not change since the last
+            // frame, so the GPU copies them from the previous region.
+            const std::size_t slot_size = tile_data_size * this->tile_capacity;
+            const std::size_t write_base = slot_size * this->ring_slot;
+            const std::size_t read_base = slot_size * ((this->ring_slot + RING_FRAME_COUNT - 1) % RING_FRAME_COUNT);
+            for (const auto& batch : this->tile_batch_list)
+            {
+                if (batch.upload_begin == batch.upload_end)
+                    continue;
+                RenderCommand& command = command_buffer.Add(RenderCommandType::WRITE_TILES);
+                command.range.offset = static_cast<std::uint32_t>(write_base + tile_data_size * (batch.offset + batch.upload_begin));
+                command.range.size = static_cast<std::uint32_t>(tile_data_size * (batch.upload_end - batch.upload_begin));
+            }
+            auto copy = [this, &command_buffer, tile_data_size, write_base, read_base](const TileBatch& batch, std::size_t begin, std::size_t end)
+            {
+                if (begin >= end)
+                    return;
+                const std::size_t size = tile_data_size * (end - begin);
+                RenderCommand& command = command_buffer.Add(RenderCommandType::COPY_TILES);
+                command.range.offset = static_cast<std::uint32_t>(write_base + tile_data_size * (batch.offset + begin));
+                command.range.size = static_cast<std::uint32_t>(size);
+                command.range.source_offset = static_cast<std::uint32_t>(read_base + tile_data_size * (batch.drawn_offset + begin));
+                this->frame_stats.copied_bytes += size;
+            };
+            for (auto& batch : this->tile_batch_list)
+            {
+                if (batch.upload_begin == batch.upload_end)
+                {
+                    copy(batch, 0, batch.count);
+                }
+                else
+                {
+                    copy(batch, 0, std::min(batch.upload_begin, batch.count));
+                    copy(batch, batch.upload_end, batch.count);
+                }
+                batch.drawn_offset = batch.offset;
+                this->frame_stats.uploaded_bytes += tile_data_size * (batch.upload_end - batch.upload_begin);
+                batch.upload_begin = 0;
+                batch.upload_end = 0;
+            }
+            return 0;
+        }
+        std::size_t upload_tile_count = 0;
+        std::size_t live_tile_count = 0;
+        for (const auto& batch : this->tile_batch_list)
+        {
+            upload_tile_count += batch.upload_end - batch.upload_begin;
+            live_tile_count += batch.count;
+        }
+        if (upload_tile_count == 0)
+            return 0;
+        // When most tiles change, orphan the buffer instead of writing into storage the GPU may
+        // still read, then every batch has to be sent whole.
+        const bool orphan = upload_tile_count << 1 >= live_tile_count;
+        if (orphan)
+            command_buffer.Add(RenderCommandType::ORPHAN_TILES).range.size = static_cast<std::uint32_t>(tile_data_size * this->tile_capacity);
+        for (auto& batch : this->tile_batch_list)
+        {
+            const std::size_t begin = orphan ? 0 : batch.upload_begin;
+            const std::size_t end = orphan ? batch.count : batch.upload_end;
+            batch.upload_begin = 0;
+            batch.upload_end = 0;
+            if (begin == end)
+                continue;
+            // the tile data of the command buffer is the retained copy, so offsets match
+            const std::size_t offset = tile_data_size * (batch.offset + begin);
+            const std::size_t size = tile_data_size * (end - begin);
+            RenderCommand& command = command_buffer.Add(RenderCommandType::WRITE_TILES);
+            command.range.offset = static_cast<std::uint32_t>(offset);
+            command.range.size = static_cast<std::uint32_t>(size);
+            command.range.source_offset = static_cast<std::uint32_t>(offset);
+            this->frame_stats.uploaded_bytes += size;
+        }
+        return 0;
+    }
+    
+    int RenderDevice::endRender()
+    {
+        this->command_buffer.Add(RenderCommandType::END_FRAME).frame.ring_slot = static_cast<std::uint32_t>(this->ring_slot);
+        return 0;
+    }
+    
+    void RenderDevice::abortRender()
+    {
+        for (auto& batch : this->tile_batch_list)
+        {
+            batch.p_source = nullptr;
+        }
+        if (this->buffer_mode == BufferMode::RING)
+        {
+            this->up_executor->UnmapRegion(this->frame_stats);
+            this->command_buffer.Clear(nullptr);
+        }
+        else
+        {
+            this->command_buffer.Clear(static_cast<const std::uint8_t*>(this->tileData(0)));
+        }
+        RenderCommand& command = this->command_buffer.Add(RenderCommandType::BEGIN_FRAME);
+        command.frame.frame = this->frame;
+        command.frame.ring_slot = static_cast<std::uint32_t>(this->ring_slot);
+        this->endRender();
+    }
+    
+    int RenderDevice::Submit()
+    {
+        return this->up_executor->Execute(this->command_buffer, this->frame_stats);
+    }
+    
+    std::size_t RenderDevice::TileDataSize(RenderPath render_path)
+    {
+        if (render_path == RenderPath::INSTANCED)
+            return sizeof(TileInstance);
+        return sizeof(TileVertex) * 4;
+    }
+    
+    std::size_t RenderDevice::tileDataSize() const
+    {
+        return TileDataSize(this->render_path);
+    }
+    
+    void* RenderDevice::tileData(std::size_t tile_offset)
+    {
+        if (this->buffer_mode == BufferMode::RING)
+            return this->p_ring_data + this->tileDataSize() * tile_offset;
+        if (this->render_path == RenderPath::INSTANCED)
+            return &this->instance_buffer[tile_offset];
+        return &this->vertex_buffer[tile_offset << 2];
+    }
+    
+    std::size_t RenderDevice::ringTileOffset() const
+    {
+        return this->ring_slot * this->tile_capacity;
+    }
+    
+    void RenderDevice::buildTileVertices(const Tile* p_tile, std::size_t count, const TextureAtlas& texture_atlas, TileVertex* p_out) const
+    {
+#if defined(HARDROCK_SIMD_SSE2) || defined(HARDROCK_SIMD_NEON)
+        static_assert(sizeof(TileVertex) == 16, "two vertices per 32 byte store pair");
+        static_assert(sizeof(glm::mat2) == 4 * sizeof(float), "transform is loaded as one vector");
+        // Lanes hold two vertices (x, y, x, y), every lane does the same operations in the same
+        // order as buildTileVerticesScalar, so the results are bit-identical.
+        const simd::Float4 scale = simd::Set(this->xm, this->ym, this->xm, this->ym);
+        const simd::Float4 offset = simd::Set(this->xa, this->ya, this->xa, this->ya);
+        const bool has_trim = texture_atlas.HasTrim();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const Tile& tile = p_tile[i];
+            simd::Float4 translate = simd::Add(simd::Mul(simd::LoadDup2(&tile.translate.x), scale), offset);
+            // (vec_x, vec_y)
+            const simd::Float4 vec = simd::Mul(simd::Load(&tile.transform[0][0]), scale);
+            simd::Float4 vec_x = simd::DupLow(vec);
+            simd::Float4 vec_y = simd::DupHigh(vec);
+            if (has_trim)
+            {
+                const glm::vec4& trim = texture_atlas.GetTrim(tile.tex_id);
+                translate = simd::Add(translate, simd::Add(simd::Mul(vec_x, simd::Splat(trim.x)), simd::Mul(vec_y, simd::Splat(trim.y))));
+                vec_x = simd::Mul(vec_x, simd::Splat(trim.z - trim.x));
+                vec_y = simd::Mul(vec_y, simd::Splat(trim.w - trim.y));
+            }
+            const simd::Float4 pos1 = simd::Add(translate, vec_x);
+            const simd::Float4 pos2 = simd::Add(pos1, vec_y);
+            const simd::Float4 pos3 = simd::Add(translate, vec_y);
+            
+            // tex, palette and color of a vertex as two little-endian words
+            const glm::u8vec4 tex = texture_atlas.GetRect(tile.tex_id);
+            std::uint32_t rect;
+            std::uint32_t color;
+            std::memcpy(&rect, &tex, sizeof(rect));
+            std::memcpy(&color, &tile.color, sizeof(color));
+            const std::uint32_t palette = static_cast<std::uint32_t>(static_cast<std::uint8_t>(tile.palette_id)) << 16;
+            const simd::Int4 tex_palette = simd::Or(simd::QuadCorners(rect), simd::SplatInt(palette));
+            const simd::Int4 color4 = simd::SplatInt(color);
+            TileVertex* const pv = p_out + (i << 2);
+            simd::StoreInterleave2(pv, simd::CombineLow(translate, pos1), simd::ZipLow(tex_palette, color4));
+            simd::StoreInterleave2(pv + 2, simd::CombineLow(pos2, pos3), simd::ZipHigh(tex_palette, color4));
+        }
+#else
+        this->buildTileVerticesScalar(p_tile, count, texture_atlas, p_out);
+#endif
+    }
+    
+    void RenderDevice::buildTileVerticesScalar(const Tile* p_tile, std::size_t count, const TextureAtlas& texture_atlas, TileVertex* p_out) const
+    {
         const float xm = this->xm;
         const float ym = this->ym;
         const float xa = this->xa;
         const float ya = this->ya;
-        while (p_tile_seq->HasNext())
+        const bool has_trim = texture_atlas.HasTrim();
+        for (std::size_t i = 0; i < count; ++i)
         {
-            auto tile = p_tile_seq->Next();
-            TileVertex* pv0 = p + (tile_count << 2);
+            const Tile& tile = p_tile[i];
+            TileVertex* pv0 = p_out + (i << 2);
             TileVertex* pv1 = pv0 + 1;
             TileVertex* pv2 = pv0 + 2;
             TileVertex* pv3 = pv0 + 3;
             glm::vec2 translate(tile.translate.x * xm + xa, tile.translate.y * ym + ya);
-            glm::u8vec4 tex = p_texture_atlas->GetRect(tile.tex_id);
+            glm::u8vec4 tex = texture_atlas.GetRect(tile.tex_id);
             glm::u8vec4 color = tile.color;
             glm::vec2 vec_x(tile.transform[0].x * xm, tile.transform[0].y * ym);
             glm::vec2 vec_y(tile.transform[1].x * xm, tile.transform[1].y * ym);
+            if (has_trim)
+            {
+                // shrink the quad to the trimmed part of the sprite, it stays where it was on screen
+                const glm::vec4& trim = texture_atlas.GetTrim(tile.tex_id);
+                translate += vec_x * trim.x + vec_y * trim.y;
+                vec_x *= trim.z - trim.x;
+                vec_y *= trim.w - trim.y;
+            }
             pv0->pos = translate;
             pv1->pos = translate + vec_x;
             pv2->pos = translate + vec_x + vec_y;
@@ -359,39 +1301,147 @@ namespace hardrock
             pv1->tex.y = tex.y;
             pv2->tex.y = tex.w;
             pv3->tex.y = tex.w;
+            const std::uint8_t palette = static_cast<std::uint8_t>(tile.palette_id);
+            pv0->palette = glm::u8vec2(palette, 0);
+            pv1->palette = glm::u8vec2(palette, 0);
+            pv2->palette = glm::u8vec2(palette, 0);
+            pv3->palette = glm::u8vec2(palette, 0);
             pv0->color = color;
             pv1->color = color;
             pv2->color = color;
             pv3->color = color;
-            
-            ++tile_count;
-            if (tile_count >= batch.capacity)
-                break;
         }
-        
-        batch.count = tile_count;
-        glBufferSubData(GL_ARRAY_BUFFER, sizeof(TileVertex) * vertex_offset, sizeof(TileVertex) * (tile_count << 2), p);
-        
-        return 0;
     }
     
-    int RenderDevice::render(BatchIdType batch_id, const glm::vec2& translate, const glm::mat2& transform)
+    void RenderDevice::buildTileInstances(const Tile* p_tile, std::size_t count, const TextureAtlas& texture_atlas, TileInstance* p_out) const
     {
-        GLenum error;
-
-        glUniform2f(this->shader_translate, translate.x * this->xm, translate.y * this->ym);
-        glUniformMatrix2fv(this->shader_transform, 1, GL_FALSE, glm::value_ptr(transform));
+        const float xm = this->xm;
+        const float ym = this->ym;
+        const float xa = this->xa;
+        const float ya = this->ya;
+        const bool has_trim = texture_atlas.HasTrim();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const Tile& tile = p_tile[i];
+            TileInstance& instance = p_out[i];
+            glm::vec2 translate(tile.translate.x * xm + xa, tile.translate.y * ym + ya);
+            glm::vec2 vec_x(tile.transform[0].x * xm, tile.transform[0].y * ym);
+            glm::vec2 vec_y(tile.transform[1].x * xm, tile.transform[1].y * ym);
+            if (has_trim)
+            {
+                const glm::vec4& trim = texture_atlas.GetTrim(tile.tex_id);
+                translate += vec_x * trim.x + vec_y * trim.y;
+                vec_x *= trim.z - trim.x;
+                vec_y *= trim.w - trim.y;
+            }
+            instance.translate = translate;
+            instance.vec_x = vec_x;
+            instance.vec_y = vec_y;
+            instance.tex = texture_atlas.GetRect(tile.tex_id);
+            instance.color = tile.color;
+            instance.palette = glm::u8vec4(static_cast<std::uint8_t>(tile.palette_id), 0, 0, 0);
+        }
+    }
+    
+    void RenderDevice::drawQuests(QuestOrder quest_order)
+    {
+        std::vector<RenderQuest>& quest_list = this->frame_quest_list;
+        const auto& tile_batch_list = this->tile_batch_list;
+        if (quest_order == QuestOrder::SORTED)
+        {
+            auto less = [&tile_batch_list](const RenderQuest& a, const RenderQuest& b)
+            {
+                if (a.layer != b.layer)
+                    return a.layer < b.layer;
+                const AtlasIdType atlas_a = tile_batch_list[IdIndex(a.batch_id)].atlas_id;
+                const AtlasIdType atlas_b = tile_batch_list[IdIndex(b.batch_id)].atlas_id;
+                if (atlas_a != atlas_b)
+                    return atlas_a < atlas_b;
+                // any strict order groups equal transforms together
+                const int r = std::memcmp(&a.translate, &b.translate, sizeof(a.translate));
+                if (r != 0)
+                    return r < 0;
+                return std::memcmp(&a.transform, &b.transform, sizeof(a.transform)) < 0;
+            };
+            std::stable_sort(quest_list.begin(), quest_list.end(), less);
+        }
+        std::size_t i = 0;
+        while (i < quest_list.size())
+        {
+            const RenderQuest& quest = quest_list[i++];
+            // updateBatch checked the ids
+            const TileBatch& batch = tile_batch_list[IdIndex(quest.batch_id)];
+            if (batch.count == 0)
+                continue;
+            std::size_t tile_count = batch.count;
+            // empty batches in between draw nothing, so they do not end the run
+            for (; i < quest_list.size(); ++i)
+            {
+                const RenderQuest& next = quest_list[i];
+                const TileBatch& next_batch = tile_batch_list[IdIndex(next.batch_id)];
+                if (next_batch.count == 0)
+                    continue;
+                if (next_batch.atlas_id != batch.atlas_id || next_batch.offset != batch.offset + tile_count || !SameTransform(quest, next))
+                    break;
+                tile_count += next_batch.count;
+            }
+            this->drawTiles(batch.offset, tile_count, this->up_texture_atlas_list[IdIndex(batch.atlas_id)].get(), quest.translate, quest.transform);
+        }
+    }
+    
+    void RenderDevice::drawTiles(std::size_t tile_offset, std::size_t tile_count, const TextureAtlas* p_texture_atlas, const glm::vec2& translate, const glm::mat2& transform)
+    {
+        DrawState& state = this->draw_state;
+        FrameStats& stats = this->frame_stats;
+        RenderCommandBuffer& command_buffer = this->command_buffer;
+        if (!state.has_transform || state.translate != translate)
+        {
+            RenderCommand& command = command_buffer.Add(RenderCommandType::SET_TRANSLATE);
+            command.value[0] = translate.x * this->xm;
+            command.value[1] = translate.y * this->ym;
+            ++stats.state_changes;
+        }
+        if (!state.has_transform || state.transform != transform)
+        {
+            RenderCommand& command = command_buffer.Add(RenderCommandType::SET_TRANSFORM);
+            std::memcpy(command.value, glm::value_ptr(transform), sizeof(command.value));
+            ++stats.state_changes;
+        }
+        state.has_transform = true;
+        state.translate = translate;
+        state.transform = transform;
         
-        const auto batch = this->tile_batch_list[batch_id];
-        const auto p_texture_atlas = this->up_texture_atlas_list[batch.atlas_id].get();
-        glBindTexture(GL_TEXTURE_2D, p_texture_atlas->GetGlTexureId());
-        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(6 * batch.count), GL_UNSIGNED_SHORT, reinterpret_cast<const GLvoid *>(6 * batch.offset * sizeof(GLushort)));
-        error = glGetError();
-        if (error != GL_NO_ERROR)
+        if (state.p_texture_atlas != p_texture_atlas)
         {
-            std::cerr << "OpenGL error: " << error << std::endl;
-            return 1;
+            const std::uint16_t palette_count = p_texture_atlas->GetPaletteCount();
+            RenderCommand& command = command_buffer.Add(RenderCommandType::BIND_ATLAS);
+            command.atlas.texture = p_texture_atlas->GetGlTexureId();
+            command.atlas.palette_texture = palette_count ? p_texture_atlas->GetGlPaletteTexureId() : 0;
+            command.atlas.palette_count = palette_count;
+            ++stats.state_changes;
+            if (palette_count)
+                ++stats.state_changes;
+            // the first bind of a frame always sets the palette count
+            if (state.p_texture_atlas == nullptr || state.palette_count != palette_count)
+                ++stats.state_changes;
+            state.p_texture_atlas = p_texture_atlas;
+            state.palette_count = palette_count;
         }
-        return 0;
+        
+        if (this->render_path == RenderPath::INSTANCED)
+        {
+            command_buffer.Add(RenderCommandType::BIND_INSTANCES).draw.first = static_cast<std::uint32_t>(this->ringTileOffset() + tile_offset);
+            ++stats.state_changes;
+            command_buffer.Add(RenderCommandType::DRAW_INSTANCED).draw.count = static_cast<std::uint32_t>(tile_count);
+        }
+        else
+        {
+            // the index buffer covers one region, the base vertex picks the region
+            RenderCommand& command = command_buffer.Add(RenderCommandType::DRAW_ELEMENTS);
+            command.draw.first = static_cast<std::uint32_t>(6 * tile_offset);
+            command.draw.count = static_cast<std::uint32_t>(6 * tile_count);
+            command.draw.base_vertex = static_cast<std::int32_t>(this->ringTileOffset() << 2);
+        }
+        ++stats.draw_calls;
     }
-}
\ No newline at end of file
+}
@@ -11,6 +11,8 @@
 
 #include <vector>
 #include <memory>
+#include <limits>
+#include <unordered_map>
 #define GL_GLEXT_PROTOTYPES
 #include <SDL2/SDL_opengl.h>
 #include "glm/mat2x2.hpp"
@@ -21,107 +23,377 @@
 #include "tile.h"
 #include "resource.h"
 #include "structure.h"
+#include "command.h"
 
 
 namespace hardrock
 {
+    class ThreadPool;
+    class TexturePacker;
+    class GlCommandExecutor;
+    class SoftwareCommandExecutor;
 
     class RenderDevice
     {
     public:
-        const static std::size_t MAX_TILE_COUNT = 1024;
+        // Tiles of all batches together, set at Create. Up to MAX_SHORT_INDEX_TILE_COUNT the index
+        // buffer is 16-bit, above it 32-bit.
+        const static std::size_t DEFAULT_TILE_CAPACITY = 1024;
+        const static std::size_t MAX_SHORT_INDEX_TILE_COUNT = 16384;
         const static std::size_t MAX_BATCH_COUNT = 256;
-        typedef std::uint8_t BatchIdType;
-        typedef std::uint8_t AtlasIdType;
+        // Removing a batch or an atlas makes its id stale rather than shifting the others, a stale
+        // id is refused even when its slot is reused. 0 is never an id.
+        typedef std::uint32_t BatchIdType;
+        typedef std::uint32_t AtlasIdType;
+        // how tiles reach the vertex shader, picked at Create
+        enum class RenderPath : std::uint8_t
+        {
+            // 4 TileVertex and 6 indices per tile, works with test.vert
+            VERTICES,
+            // one TileInstance per tile, tile_instanced.vert builds the quad from gl_VertexID
+            INSTANCED,
+        };
+        // how tile data gets into the vertex buffer, picked at Create
+        enum class BufferMode : std::uint8_t
+        {
+            // built into a copy in memory, changed ranges go out with glBufferSubData
+            RETAINED,
+            // Built straight into one of RING_FRAME_COUNT mapped regions, a fence per region keeps
+            // the GPU from reading what is being written. Persistent mapping with ARB_buffer_storage,
+            // an unsynchronized glMapBufferRange each frame without it.
+            RING,
+        };
+        const static std::size_t RING_FRAME_COUNT = 3;
+        typedef RenderFrameStats FrameStats;
+        // order Render draws the quests in
+        enum class QuestOrder : std::uint8_t
+        {
+            INPUT,
+            // By layer, then atlas, then transform, keeping the input order among equal quests.
+            // Quests in one layer must not depend on the order they are drawn in.
+            SORTED,
+        };
+        // texel formats of a prebaked atlas, the values are the ones res_build/atlas.py writes
+        enum class TexelFormat : std::uint8_t
+        {
+            RGBA8888 = 0,
+            RGBA4444 = 1,
+            RGBA5551 = 2,
+            // 8-bit palette index, a tile picks the palette with its palette_id
+            INDEX8 = 3,
+        };
+        static const std::size_t PALETTE_SIZE = 256;
         struct RenderQuest
         {
             ITileSequence* p_tile_seq;
             glm::vec2 translate;
             glm::mat2 transform;
+            // 0 for a quest that draws nothing
             BatchIdType batch_id;
-            BatchIdType padding[3];
+            // lower layers are drawn first with QuestOrder::SORTED
+            std::uint8_t layer;
+            std::uint8_t padding[3];
         };
     private:
+        // the executors need the tile data layouts
+        friend class GlCommandExecutor;
+        friend class SoftwareCommandExecutor;
+        // the vertex bench calls the kernels directly
+        friend class TileVertexBench;
         const int screen_width;
         const int screen_height;
+        const RenderPath render_path;
+        const std::size_t tile_capacity;
         const float xm, ym, xa, ya;
-        
-        GLuint vao;
-        GLuint vbo;
-        GLuint ebo;
-        GLuint shader_sampler;
-        GLuint shader_translate;
-        GLuint shader_transform;
-        GlHandles<OpGlVertexArrays> h_vertex_arrays;
-        GlHandles<OpGlBuffers> h_buffers;
-        GlHandle<OpGlProgram> h_program;
 
         struct TileVertex
         {
             glm::vec2 pos;
             glm::u8vec2 tex;
-            glm::u8vec2 padding;
+            // x is the palette row of an INDEX8 atlas
+            glm::u8vec2 palette;
+            glm::u8vec4 color;
+        };
+        // Quad of a tile in clip space, corner (u, v) is at translate + u * vec_x + v * vec_y.
+        struct TileInstance
+        {
+            glm::vec2 translate;
+            glm::vec2 vec_x;
+            glm::vec2 vec_y;
+            // (x0, y0, x1, y1)
+            glm::u8vec4 tex;
             glm::u8vec4 color;
+            // x is the palette row of an INDEX8 atlas
+            glm::u8vec4 palette;
         };
+        // only the one of the render path is used and none with RING, both are indexed by tile
         std::vector<TileVertex> vertex_buffer;
-        SimpleMemoryAllocator buffer_allocator;
+        std::vector<TileInstance> instance_buffer;
+        // tile ranges of the batches in the buffers
+        TlsfAllocator buffer_allocator;
         struct TileBatch
         {
             std::size_t offset;
             std::size_t capacity;
             std::size_t count;
             AtlasIdType atlas_id;
-            AtlasIdType padding[3];
+            TlsfAllocator::BlockIdType block_id;
+            // what the vertices were built from, only changed tiles are rebuilt while it stays the same
+            const void* p_source;
+            // tiles rebuilt since the last upload
+            std::size_t upload_begin;
+            std::size_t upload_end;
+            // RING only, offset in the region of the last frame, compaction may have moved it since
+            std::size_t drawn_offset;
+            std::uint16_t generation;
+            bool is_used;
         };
+        // removed batches leave an unused slot, reused by the next CreateBatch
         std::vector<TileBatch> tile_batch_list;
+        FrameStats frame_stats;
+        // quests of the current Render, sorted and merged by drawQuests
+        std::vector<RenderQuest> frame_quest_list;
+        // RING only, ring_slot is the region of the current frame and p_ring_data its memory
+        const BufferMode buffer_mode;
+        std::uint8_t* p_ring_data;
+        std::size_t ring_slot;
+        // commands of the frame being recorded, or recorded and not yet submitted
+        RenderCommandBuffer command_buffer;
+        std::unique_ptr<IRenderCommandExecutor> up_executor;
+        // the executor when the device was made with CreateHeadless or CreateSoftware, null otherwise
+        HeadlessCommandExecutor* p_headless_executor;
+        SoftwareCommandExecutor* p_software_executor;
+        // only atlases of a device made with Create have GL textures
+        bool has_gl_textures;
         
         class TextureAtlas
         {
+            // sprites per ThreadPool chunk in the header and decode passes
+            static const std::size_t INFO_GRAIN = 16;
+            static const std::size_t DECODE_GRAIN = 1;
             std::vector<glm::u8vec4> rect_list;
-            GlHandles<OpGlTextures> h_textures;
+            // Quad of each sprite with its transparent border trimmed off, (x0, y0, x1, y1) as a
+            // fraction of the untrimmed sprite. Empty if the atlas has no trim data.
+            std::vector<glm::vec4> trim_list;
+            // pixels per draw of every sprite, untrimmed and trimmed
+            std::size_t full_area;
+            std::size_t drawn_area;
+            // atlas texture, then the palette texture of an INDEX8 atlas. Null for an atlas of a
+            // device without GL, its texels and palettes are kept in memory instead.
+            std::unique_ptr<GlHandles<OpGlTextures>> up_textures;
             GLuint tex;
-            TextureAtlas();
+            GLuint palette_tex;
+            std::uint16_t palette_count;
+            std::size_t tex_width;
+            std::size_t tex_height;
+            std::vector<std::uint32_t> texel_list;
+            std::vector<std::uint32_t> palette_list;
+            TextureAtlas(bool has_texture);
+            int upload(const std::uint8_t* p_image_data, std::size_t tex_width, std::size_t tex_height, TexelFormat format = TexelFormat::RGBA8888);
+            // palette_count rows of PALETTE_SIZE RGBA8 colours
+            int uploadPalette(const std::uint8_t* p_palette_data, std::size_t palette_count);
+            // Cut whole texture coordinate steps of transparent border off rect tex_id, which holds a
+            // width x height pixel sprite with its opaque pixels in bounds. return the pixels left.
+            std::size_t trimSprite(std::size_t tex_id, const glm::ivec4& bounds, int width, int height);
         public:
-            static std::unique_ptr<TextureAtlas> Create(const IResourceDataSet& data_set, std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, int& out_error_code);
+            // p_thread_pool may be null, the header and decode passes then run on the calling thread.
+            // The GL upload always happens on the calling thread, without has_texture the texels are
+            // kept in memory instead.
+            static std::unique_ptr<TextureAtlas> Create(const IResourceDataSet& data_set, std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, ThreadPool* p_thread_pool, bool has_texture, int& out_error_code);
+            // Load an atlas baked by res_build/atlas.py, in any of its texel formats.
+            // Its sprites must be exactly p_sorted_rid_list.
+            static std::unique_ptr<TextureAtlas> CreatePrebaked(const std::uint8_t* p_data, std::size_t size, const std::uint32_t* p_sorted_rid_list, std::size_t count, bool has_texture, int& out_error_code);
             GLuint GetGlTexureId() const { return this->tex; }
+            GLuint GetGlPaletteTexureId() const { return this->palette_tex; }
+            // Without a GL texture, the name BIND_ATLAS gives the memory texture.
+            void SetTextureName(GLuint name) { this->tex = name; this->palette_tex = name; }
+            MemoryTexture GetMemoryTexture() const;
+            // 0 unless the atlas is INDEX8
+            std::uint16_t GetPaletteCount() const { return this->palette_count; }
             glm::u8vec4 GetRect(std::size_t tex_id) const { return this->rect_list[tex_id]; }
+            bool HasTrim() const { return !this->trim_list.empty(); }
+            const glm::vec4& GetTrim(std::size_t tex_id) const { return this->trim_list[tex_id]; }
+            std::size_t GetFullArea() const { return this->full_area; }
+            std::size_t GetDrawnArea() const { return this->drawn_area; }
+            
+            // Dynamic atlas: an empty texture that sprites are added to and evicted from at runtime.
+            // The texture size and max_sprite_count are the budget, when either runs out the least
+            // recently used sprites are evicted. Sprites drawn in the last frame, or found or
+            // inserted since, are never evicted.
+            static std::unique_ptr<TextureAtlas> CreateDynamic(std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, std::uint16_t max_sprite_count, bool has_texture, int& out_error_code);
+            ~TextureAtlas();
+            bool IsDynamic() const { return this->up_dynamic_data != nullptr; }
+            // A tex_id stays valid until its sprite is evicted or removed.
+            int InsertSprite(std::uint32_t rid, const std::uint8_t* p_webp_data, std::size_t size, std::uint32_t frame, std::uint16_t& out_tex_id);
+            int FindSprite(std::uint32_t rid, std::uint32_t frame, std::uint16_t& out_tex_id);
+            int RemoveSprite(std::uint32_t rid);
+            // Only stamps the sprite, the LRU order is fixed up lazily when space is needed.
+            void TouchSprite(std::size_t tex_id, std::uint32_t frame) { this->up_dynamic_data->sprite_list[tex_id].last_use = frame; }
+        private:
+            struct Sprite
+            {
+                std::uint32_t rid;
+                std::uint32_t last_use;
+                // last_use when the sprite was last moved to the front of the LRU list
+                std::uint32_t list_use;
+                std::uint32_t drawn_area;
+                std::uint16_t x, y, width, height;
+            };
+            struct DynamicData
+            {
+                static const CircleLinkedListPool::IndexType FREE_LIST_HEAD = 0;
+                static const CircleLinkedListPool::IndexType USED_LIST_HEAD = 1;
+                std::uint16_t unit_length;
+                std::uint8_t width;
+                std::uint8_t height;
+                std::unique_ptr<TexturePacker> up_packer;
+                // node tex_id + 2, most recently used first
+                CircleLinkedListPool sprite_pool;
+                std::vector<Sprite> sprite_list;
+                std::unordered_map<std::uint32_t, std::uint16_t> rid_map;
+                DynamicData(std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, std::uint16_t max_sprite_count);
+            };
+            std::unique_ptr<DynamicData> up_dynamic_data;
+            void evictSprite(std::uint16_t tex_id);
+            int evictLeastRecentlyUsed(std::uint32_t frame);
         };
+        // removed atlases leave an empty slot, so the ids of the others stay valid
         std::vector<std::unique_ptr<TextureAtlas>> up_texture_atlas_list;
+        std::vector<std::uint16_t> atlas_generation_list;
+        // what the last draw left bound, so the next one only changes what differs
+        struct DrawState
+        {
+            const TextureAtlas* p_texture_atlas;
+            std::uint16_t palette_count;
+            bool has_transform;
+            glm::vec2 translate;
+            glm::mat2 transform;
+        };
+        DrawState draw_state;
+        std::uint32_t frame;
 
-        RenderDevice(int screen_width, int screen_height);
+        RenderDevice(int screen_width, int screen_height, RenderPath render_path, BufferMode buffer_mode, std::size_t tile_capacity);
+        // An id is the slot index in the low ID_INDEX_BITS bits and the generation of the slot above
+        // them. Removing bumps the generation, which skips 0.
+        const static int ID_INDEX_BITS = 16;
+        static std::uint32_t MakeId(std::size_t index, std::uint16_t generation) { return static_cast<std::uint32_t>(generation) << ID_INDEX_BITS | static_cast<std::uint32_t>(index); }
+        static std::size_t IdIndex(std::uint32_t id) { return id & ((1u << ID_INDEX_BITS) - 1); }
+        static std::uint16_t NextGeneration(std::uint16_t generation) { return generation == 0xffff ? 1 : generation + 1; }
+        // null for a stale id
+        TextureAtlas* findTextureAtlas(AtlasIdType atlas_id) const;
+        TileBatch* findBatch(BatchIdType batch_id);
+        AtlasIdType addTextureAtlas(std::unique_ptr<TextureAtlas> up_texture_atlas);
         int beginRender();
+        // Refuses a stale batch or a batch whose atlas was removed. Without p_tile_seq the batch
+        // keeps its tiles.
         int updateBatch(BatchIdType batch_id, ITileSequence* p_tile_seq);
-        int render(BatchIdType batch_id, const glm::vec2& translate, const glm::mat2& transform);
+        // Send the rebuilt tiles of every batch to the vertex buffer.
+        int uploadBatches();
+        int endRender();
+        // Drop a frame Record could not finish: leave an empty frame, give back the ring region,
+        // and have the next frame rebuild every batch since some were built only in part.
+        void abortRender();
+        // Write the 4 vertices of each of count contiguous tiles, SSE2 or NEON when available.
+        void buildTileVertices(const Tile* p_tile, std::size_t count, const TextureAtlas& texture_atlas, TileVertex* p_out) const;
+        // Plain C++ version, writes the same bits as buildTileVertices.
+        void buildTileVerticesScalar(const Tile* p_tile, std::size_t count, const TextureAtlas& texture_atlas, TileVertex* p_out) const;
+        void buildTileInstances(const Tile* p_tile, std::size_t count, const TextureAtlas& texture_atlas, TileInstance* p_out) const;
+        // Bytes a tile takes in the vertex buffer, and where updateBatch writes them: vertex_buffer
+        // or instance_buffer, or the ring region of the frame.
+        static std::size_t TileDataSize(RenderPath render_path);
+        std::size_t tileDataSize() const;
+        void* tileData(std::size_t tile_offset);
+        // first tile of the region the current frame draws from
+        std::size_t ringTileOffset() const;
+        // Draw frame_quest_list, consecutive quests with the same atlas and transform whose tiles
+        // follow each other in the vertex buffer become one draw.
+        void drawQuests(QuestOrder quest_order);
+        void drawTiles(std::size_t tile_offset, std::size_t tile_count, const TextureAtlas* p_texture_atlas, const glm::vec2& translate, const glm::mat2& transform);
     public:
-        static std::unique_ptr<RenderDevice> Create(int screen_width, int screen_height, const std::uint8_t* p_vert_shader_data, std::size_t vert_shader_data_size, const std::uint8_t* p_frag_shader_data, std::size_t frag_shader_data_size);
+        // The vertex shader has to match render_path, test.vert or tile_instanced.vert.
+        static std::unique_ptr<RenderDevice> Create(int screen_width, int screen_height, const std::uint8_t* p_vert_shader_data, std::size_t vert_shader_data_size, const std::uint8_t* p_frag_shader_data, std::size_t frag_shader_data_size, RenderPath render_path = RenderPath::VERTICES, BufferMode buffer_mode = BufferMode::RETAINED, std::size_t tile_capacity = DEFAULT_TILE_CAPACITY);
+        // A device that needs no GL context: frames go to a HeadlessCommandExecutor, atlases keep
+        // no textures. For tests and benchmarks of everything up to the GL calls.
+        static std::unique_ptr<RenderDevice> CreateHeadless(int screen_width, int screen_height, HeadlessCommandExecutor::Mode mode, RenderPath render_path = RenderPath::VERTICES, BufferMode buffer_mode = BufferMode::RETAINED, std::size_t tile_capacity = DEFAULT_TILE_CAPACITY);
+        // A device that draws on the CPU into the framebuffer of its SoftwareCommandExecutor, with
+        // the shading of test.vert and test.frag. p_thread_pool may be null.
+        static std::unique_ptr<RenderDevice> CreateSoftware(int screen_width, int screen_height, ThreadPool* p_thread_pool = nullptr, RenderPath render_path = RenderPath::VERTICES, BufferMode buffer_mode = BufferMode::RETAINED, std::size_t tile_capacity = DEFAULT_TILE_CAPACITY);
+        ~RenderDevice();
         
-        int CreateTextureAtlas(const IResourceDataSet& data_set, std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, AtlasIdType& out_atlas_id);
+        int CreateTextureAtlas(const IResourceDataSet& data_set, std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, AtlasIdType& out_atlas_id, ThreadPool* p_thread_pool = nullptr);
+        // tex_id is the position in p_sorted_rid_list, the same as with CreateTextureAtlas.
+        int CreatePrebakedTextureAtlas(const std::uint8_t* p_data, std::size_t size, const std::uint32_t* p_sorted_rid_list, std::size_t count, AtlasIdType& out_atlas_id);
+        int CreateDynamicTextureAtlas(std::uint16_t unit_length, std::uint8_t width, std::uint8_t height, std::uint16_t max_sprite_count, AtlasIdType& out_atlas_id);
+        // Decode a sprite into a dynamic atlas, or return its tex_id if it is already there.
+        int InsertSprite(AtlasIdType atlas_id, std::uint32_t rid, const std::uint8_t* p_webp_data, std::size_t size, std::uint16_t& out_tex_id);
+        // return 1 if the sprite is not in the atlas, it may have been evicted.
+        int FindSprite(AtlasIdType atlas_id, std::uint32_t rid, std::uint16_t& out_tex_id);
+        int RemoveSprite(AtlasIdType atlas_id, std::uint32_t rid);
         int RemoveTextureAtlas(AtlasIdType atlas_id);
+        // Pixels covered by drawing every sprite of the atlas once, before and after trimming.
+        int GetTextureAtlasTrimReport(AtlasIdType atlas_id, std::size_t& out_full_area, std::size_t& out_drawn_area) const;
+        // Compacts the batches first when the free tiles are enough but not in one range.
         int CreateBatch(std::size_t capacity, AtlasIdType atlas_id, BatchIdType& out_batch_id);
         int RemoveBatch(BatchIdType batch_id);
+        // Slide batches down over the free tiles before them, lowest first, and stop before the
+        // batch that would take the tiles moved past max_tile_count. Small budgets each frame
+        // compact incrementally. The next Render uploads moved batches whole, or copies them
+        // between the regions with RING. Not between Record and Submit.
+        int CompactBatches(std::size_t max_tile_count = std::numeric_limits<std::size_t>::max());
+        // free tiles of the buffers and how scattered they are
+        TlsfAllocator::Stats GetBufferStats() const { return this->buffer_allocator.GetStats(); }
+        // Vertex bytes sent to the GPU by the last Render.
+        std::size_t GetUploadedBytes() const { return this->frame_stats.uploaded_bytes; }
+        const FrameStats& GetFrameStats() const { return this->frame_stats; }
+        // null unless the device was made with CreateHeadless
+        HeadlessCommandExecutor* GetHeadlessExecutor() const { return this->p_headless_executor; }
+        // null unless the device was made with CreateSoftware
+        SoftwareCommandExecutor* GetSoftwareExecutor() const { return this->p_software_executor; }
+        const RenderCommandBuffer& GetCommandBuffer() const { return this->command_buffer; }
         
         template<typename Iterator>
-        int Render(Iterator begin, Iterator end)
+        int Render(Iterator begin, Iterator end, QuestOrder quest_order = QuestOrder::INPUT)
+        {
+            int r = this->Record(begin, end, quest_order);
+            if (r) return r;
+            return this->Submit();
+        }
+        // Build the tiles and the commands of a frame without executing them. With RETAINED this
+        // makes no GL calls and may run on another thread than Submit, with RING the ring region
+        // is mapped on the calling thread. Nothing else may use the device until Submit.
+        template<typename Iterator>
+        int Record(Iterator begin, Iterator end, QuestOrder quest_order = QuestOrder::INPUT)
         {
             int r;
             r = this->beginRender();
             if (r) return r;
+            this->frame_quest_list.clear();
             for (Iterator i = begin; i < end; ++i)
             {
-                auto p_tile_seq = i->p_tile_seq;
-                if (p_tile_seq)
+                if (i->batch_id == 0)
+                    continue;
+                r = this->updateBatch(i->batch_id, i->p_tile_seq);
+                if (r)
                 {
-                    r = this->updateBatch(i->batch_id, p_tile_seq);
-                    if (r) return r;
+                    this->abortRender();
+                    return r;
                 }
+                this->frame_quest_list.push_back(*i);
             }
-            for (Iterator i = begin; i < end; ++i)
+            r = this->uploadBatches();
+            if (r)
             {
-                r = this->render(i->batch_id, i->translate, i->transform);
-                if (r) return r;
+                this->abortRender();
+                return r;
             }
-            return 0;
+            this->drawQuests(quest_order);
+            r = this->endRender();
+            if (r)
+                this->abortRender();
+            return r;
         }
+        // Execute the commands of the last Record.
+        int Submit();
     };
 }
 
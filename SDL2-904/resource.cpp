@@ -10,6 +10,12 @@
 #include <CoreFoundation/CFBundle.h>
 #include <fstream>
 #include <algorithm>
+#include <cstring>
+#include <exception>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "webp/decode.h"
 #include "algorithm.h"
 
@@ -37,50 +43,215 @@ namespace
         const char* data_path = CFStringGetCStringPtr(cp_data_path.get(), system_encoding);
         return data_path;
     }
+
+    // must match hash_mix and hash_slot in pack.py
+    inline std::uint32_t HashMix(std::uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x85ebca6bu;
+        x ^= x >> 13;
+        x *= 0xc2b2ae35u;
+        x ^= x >> 16;
+        return x;
+    }
+
+    inline std::uint32_t HashSlot(std::uint32_t rid, std::uint32_t seed, std::size_t count)
+    {
+        return static_cast<std::uint32_t>(HashMix(rid ^ (seed * 0x9e3779b9u + 0x7f4a7c15u)) % count);
+    }
+
+    // an LZ4 block never decodes to more than 255 bytes per byte
+    const std::size_t LZ4_MAX_EXPANSION = 255;
+
+    // A compressed entry is stored as its raw size followed by one LZ4 block. Only the size is
+    // read from p_stored. return 1 for a raw size the block could not decode to, so a damaged
+    // entry cannot ask for a huge buffer.
+    int GetRawSize(const std::uint8_t* p_stored, std::size_t stored_size, std::uint32_t& out_raw_size)
+    {
+        if (stored_size < sizeof(out_raw_size))
+            return 1;
+        std::memcpy(&out_raw_size, p_stored, sizeof(out_raw_size));
+        if (out_raw_size > (stored_size - sizeof(out_raw_size)) * LZ4_MAX_EXPANSION)
+            return 1;
+        return 0;
+    }
+
+    int DecompressEntry(const std::uint8_t* p_stored, std::size_t stored_size, std::uint8_t* p_out, std::size_t raw_size)
+    {
+        return hardrock::Lz4DecompressBlock(p_stored + sizeof(std::uint32_t), stored_size - sizeof(std::uint32_t), p_out, raw_size);
+    }
+
+    int ReadAt(int fd, std::uint8_t* p_out, std::size_t size, off_t pos)
+    {
+        while (size)
+        {
+            const ssize_t r = pread(fd, p_out, size, pos);
+            if (r <= 0)
+                return 1;
+            p_out += r;
+            size -= static_cast<std::size_t>(r);
+            pos += r;
+        }
+        return 0;
+    }
 }
 
 namespace hardrock
 {
+    int PackFormat::IndexTable::Load(const std::uint8_t* p_index_data, std::size_t count, const std::uint8_t* p_tail, std::size_t tail_size)
+    {
+        this->Clear();
+        // the index is not aligned inside the pack, so copy it out
+        this->index_list.resize(count);
+        if (count)
+            std::memcpy(&this->index_list[0], p_index_data, count * sizeof(Index));
+
+        HashHeader hash_header;
+        if (count == 0 || tail_size < sizeof(hash_header))
+            return 0;
+        std::memcpy(&hash_header, p_tail, sizeof(hash_header));
+        if (hash_header.identifier != std::array<char, 4>({'H', 'A', 'S', 'H'}) || hash_header.bucket_count == 0)
+            return 0;
+        const std::size_t bucket_count = hash_header.bucket_count;
+        if ((tail_size - sizeof(hash_header)) / sizeof(std::uint32_t) < bucket_count + count)
+            return 1;
+        this->seed_list.resize(bucket_count);
+        this->slot_list.resize(count);
+        const std::uint8_t* p = p_tail + sizeof(hash_header);
+        std::memcpy(&this->seed_list[0], p, bucket_count * sizeof(std::uint32_t));
+        std::memcpy(&this->slot_list[0], p + bucket_count * sizeof(std::uint32_t), count * sizeof(std::uint32_t));
+        // validate once so Find never has to bounds-check
+        for (std::uint32_t seed : this->seed_list)
+        {
+            if ((seed & HASH_DIRECT_SLOT) && (seed & ~HASH_DIRECT_SLOT) >= count)
+            {
+                this->seed_list.clear();
+                this->slot_list.clear();
+                return 1;
+            }
+        }
+        for (std::uint32_t idx : this->slot_list)
+        {
+            if (idx >= count)
+            {
+                this->seed_list.clear();
+                this->slot_list.clear();
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    void PackFormat::IndexTable::Clear()
+    {
+        this->index_list.clear();
+        this->seed_list.clear();
+        this->slot_list.clear();
+    }
+
+    const PackFormat::Index* PackFormat::IndexTable::Find(std::uint32_t rid) const
+    {
+        if (this->slot_list.empty())
+            return this->FindBinary(rid);
+        const std::uint32_t seed = this->seed_list[HashMix(rid) % this->seed_list.size()];
+        const std::uint32_t slot = (seed & HASH_DIRECT_SLOT) ? (seed & ~HASH_DIRECT_SLOT) : HashSlot(rid, seed, this->slot_list.size());
+        const Index& index = this->index_list[this->slot_list[slot]];
+        return index.rid == rid ? &index : nullptr;
+    }
+
+    const PackFormat::Index* PackFormat::IndexTable::FindBinary(std::uint32_t rid) const
+    {
+        auto iter = std::lower_bound(this->index_list.begin(), this->index_list.end(), rid, IndexSearchCmp());
+        if (iter == this->index_list.end() || iter->rid != rid)
+            return nullptr;
+        return &*iter;
+    }
+
     PackResourceManager::PackResourceManager(const char* path)
-    : pack_path(FindResource("res.pack"))
+    : pack_path(FindResource(path))
     {
         Header header;
         std::ifstream file(pack_path);
         file.read(reinterpret_cast<char*>(&header), sizeof(header));
         if (header.identifier != std::array<char, 4>({'P', 'A', 'C', 'K'}))
             return;
+        // read the index together with whatever follows it (the optional hash section)
+        file.seekg(0, std::ios::end);
+        const std::streamoff file_size = file.tellg();
+        const std::size_t index_size = static_cast<std::size_t>(header.count) * sizeof(Index);
+        if (file_size < header.index_pos || static_cast<std::size_t>(file_size - header.index_pos) < index_size)
+            return;
+        std::vector<std::uint8_t> index_data(static_cast<std::size_t>(file_size - header.index_pos));
+        if (index_data.empty())
+            return;
         file.seekg(header.index_pos);
-        this->index_list.resize(header.count);
-        file.read(reinterpret_cast<char*>(&this->index_list[0]), header.count * sizeof(this->index_list[0]));
+        file.read(reinterpret_cast<char*>(&index_data[0]), index_data.size());
+        this->index_table.Load(&index_data[0], header.count, &index_data[0] + index_size, index_data.size() - index_size);
     }
 
     int PackResourceManager::LoadResource(std::uint32_t rid, void* out_buffer, size_t out_size) const
     {
-        auto iter = std::lower_bound(this->index_list.begin(), this->index_list.end(), rid, IndexSearchCmp());
-        if (iter == this->index_list.end() || iter->rid != rid)
+        const Index* iter = this->index_table.Find(rid);
+        if (iter == nullptr)
         {
             return 0;
         }
-        if (out_buffer != nullptr && out_size >= iter->size)
+        const std::uint32_t stored_size = iter->StoredSize();
+        if (!iter->IsCompressed())
+        {
+            if (out_buffer != nullptr && out_size >= stored_size)
+            {
+                std::ifstream file(this->pack_path);
+                file.seekg(iter->pos);
+                file.read(reinterpret_cast<char*>(out_buffer), stored_size);
+            }
+            return static_cast<int>(stored_size);
+        }
+        std::uint32_t raw_size;
+        std::ifstream file(this->pack_path);
+        file.seekg(iter->pos);
+        if (out_buffer == nullptr)
+        {
+            // size query, the raw size prefix is enough
+            std::uint8_t raw_size_data[sizeof(raw_size)];
+            file.read(reinterpret_cast<char*>(raw_size_data), sizeof(raw_size_data));
+            if (!file || GetRawSize(raw_size_data, stored_size, raw_size) != 0)
+                return 0;
+            return static_cast<int>(raw_size);
+        }
+        std::vector<std::uint8_t> stored_data(stored_size);
+        file.read(reinterpret_cast<char*>(&stored_data[0]), stored_size);
+        if (!file || GetRawSize(&stored_data[0], stored_size, raw_size) != 0)
+            return 0;
+        if (out_size >= raw_size)
         {
-            std::ifstream file(this->pack_path);
-            file.seekg(iter->pos);
-            file.read(reinterpret_cast<char*>(out_buffer), iter->size);
+            if (DecompressEntry(&stored_data[0], stored_size, static_cast<std::uint8_t*>(out_buffer), raw_size) != 0)
+                return 0;
         }
-        return static_cast<int>(iter->size);
+        return static_cast<int>(raw_size);
     }
 
     std::unique_ptr<std::vector<std::uint8_t>> PackResourceManager::LoadResource(std::uint32_t rid) const
     {
-        auto iter = std::lower_bound(this->index_list.begin(), this->index_list.end(), rid, IndexSearchCmp());
-        if (iter == this->index_list.end() || iter->rid != rid)
+        const Index* iter = this->index_table.Find(rid);
+        if (iter == nullptr)
         {
             return 0;
         }
-        std::unique_ptr<std::vector<std::uint8_t>> up_buffer(new std::vector<std::uint8_t>(iter->size));
+        std::unique_ptr<std::vector<std::uint8_t>> up_buffer(new std::vector<std::uint8_t>(iter->StoredSize()));
         std::ifstream file(this->pack_path);
         file.seekg(iter->pos);
-        file.read(reinterpret_cast<char*>(&up_buffer->at(0)), iter->size);
+        file.read(reinterpret_cast<char*>(&up_buffer->at(0)), iter->StoredSize());
+        if (iter->IsCompressed())
+        {
+            std::uint32_t raw_size;
+            if (!file || GetRawSize(&up_buffer->at(0), up_buffer->size(), raw_size) != 0)
+                return nullptr;
+            std::unique_ptr<std::vector<std::uint8_t>> up_raw_buffer(new std::vector<std::uint8_t>(raw_size));
+            if (raw_size && DecompressEntry(&up_buffer->at(0), up_buffer->size(), &up_raw_buffer->at(0), raw_size) != 0)
+                return nullptr;
+            return up_raw_buffer;
+        }
         return up_buffer;
     }
     
@@ -97,7 +268,7 @@ namespace hardrock
             int GetDataByRid(std::uint32_t rid, const std::uint8_t*& out_p_data, std::size_t& out_size) const override
             {
                 auto result_iter = std::lower_bound(this->index_list.begin(), this->index_list.end(), rid, IndexSearchCmp());
-                if (result_iter->rid != rid)
+                if (result_iter == this->index_list.end() || result_iter->rid != rid)
                 {
                     out_p_data = nullptr;
                     out_size = 0;
@@ -129,28 +300,389 @@ namespace hardrock
         };
         std::unique_ptr<ResourceDataSet> up_resourece_data_set(new ResourceDataSet());
         up_resourece_data_set->index_list.reserve(count);
-        auto search_iter = this->index_list.begin();
-        auto end_iter = this->index_list.end();
-        std::vector<const Index*> index_list(count);
+        // pack.py writes entries in rid order, so neighbouring rids are usually
+        // neighbours on disk as well. Merge them into runs and read every run
+        // with one positional read; small gaps are read and simply not indexed.
+        // Reading the gaps into data, rather than into a scratch buffer with preadv,
+        // keeps each run one pread into one contiguous range and costs at most
+        // MAX_COALESCE_GAP bytes per entry; preadv only exists from macOS 11 on,
+        // far above the 10.9 deployment target.
+        struct ReadRun
+        {
+            std::uint32_t file_pos;
+            std::uint32_t data_pos;
+            std::uint32_t size;
+        };
+        std::vector<ReadRun> run_list;
         std::uint32_t size = 0;
+        bool has_compressed = false;
         for (size_t i = 0; i < count; ++i) {
             std::uint32_t rid = p_sorted_rid_list[i];
-            auto result_iter = std::lower_bound(search_iter, end_iter, rid, IndexSearchCmp());
-            if (result_iter->rid != rid)
+            const Index* result_iter = this->index_table.Find(rid);
+            if (result_iter == nullptr)
                 return nullptr;
-            index_list[i] = &*result_iter;
+            const std::uint32_t stored_size = result_iter->StoredSize();
+            if (result_iter->IsCompressed())
+                has_compressed = true;
+            if (run_list.size())
+            {
+                ReadRun& run = run_list.back();
+                const std::uint32_t run_end = run.file_pos + run.size;
+                if (result_iter->pos >= run_end && result_iter->pos - run_end <= MAX_COALESCE_GAP)
+                {
+                    const std::uint32_t grow = result_iter->pos + stored_size - run_end;
+                    up_resourece_data_set->index_list.push_back({rid, run.data_pos + (result_iter->pos - run.file_pos), result_iter->size});
+                    run.size += grow;
+                    size += grow;
+                    continue;
+                }
+            }
+            run_list.push_back({result_iter->pos, size, stored_size});
             up_resourece_data_set->index_list.push_back({rid, size, result_iter->size});
-            size += result_iter->size;
+            size += stored_size;
         }
         up_resourece_data_set->data.resize(size);
-        std::uint8_t* p = &up_resourece_data_set->data[0];
-        std::ifstream file(this->pack_path);
+        if (size == 0)
+            return up_resourece_data_set;
+        const int fd = open(this->pack_path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+        std::uint8_t* const p_data = &up_resourece_data_set->data[0];
+        for (const ReadRun& run : run_list)
+        {
+            if (ReadAt(fd, p_data + run.data_pos, run.size, run.file_pos) != 0)
+            {
+                close(fd);
+                return nullptr;
+            }
+        }
+        close(fd);
+        if (has_compressed)
+        {
+            // compressed entries are decoded behind the runs, their index is repointed there
+            auto& data = up_resourece_data_set->data;
+            std::size_t raw_end = data.size();
+            std::vector<std::uint32_t> raw_pos_list;
+            for (const Index& index : up_resourece_data_set->index_list)
+            {
+                std::uint32_t raw_size = 0;
+                if (index.IsCompressed() && GetRawSize(&data[index.pos], index.StoredSize(), raw_size) != 0)
+                    return nullptr;
+                raw_pos_list.push_back(static_cast<std::uint32_t>(raw_end));
+                raw_end += raw_size;
+            }
+            data.resize(raw_end);
+            for (std::size_t i = 0; i < raw_pos_list.size(); ++i)
+            {
+                Index& index = up_resourece_data_set->index_list[i];
+                if (!index.IsCompressed())
+                    continue;
+                const std::uint32_t raw_pos = raw_pos_list[i];
+                const std::uint32_t raw_size = static_cast<std::uint32_t>((i + 1 < raw_pos_list.size() ? raw_pos_list[i + 1] : raw_end) - raw_pos);
+                if (raw_size && DecompressEntry(&data[index.pos], index.StoredSize(), &data[raw_pos], raw_size) != 0)
+                    return nullptr;
+                index.pos = raw_pos;
+                index.size = raw_size;
+            }
+        }
+        return up_resourece_data_set;
+    }
+
+    MappedPackResourceManager::MappedPackResourceManager(const char* path)
+    : p_map(nullptr)
+    , map_size(0)
+    {
+        const std::string pack_path = FindResource(path);
+        const int fd = open(pack_path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0 || static_cast<std::size_t>(file_stat.st_size) < sizeof(Header))
+        {
+            close(fd);
+            return;
+        }
+        const std::size_t file_size = static_cast<std::size_t>(file_stat.st_size);
+        void* p = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        // the mapping keeps its own reference to the file
+        close(fd);
+        if (p == MAP_FAILED)
+            return;
+        this->p_map = static_cast<const std::uint8_t*>(p);
+        this->map_size = file_size;
+
+        Header header;
+        std::memcpy(&header, this->p_map, sizeof(header));
+        if (header.identifier != std::array<char, 4>({'P', 'A', 'C', 'K'}))
+            return;
+        const std::size_t index_size = static_cast<std::size_t>(header.count) * sizeof(Index);
+        if (header.index_pos > file_size || file_size - header.index_pos < index_size)
+            return;
+        const std::uint8_t* p_index_data = this->p_map + header.index_pos;
+        if (this->index_table.Load(p_index_data, header.count, p_index_data + index_size, file_size - header.index_pos - index_size) != 0)
+        {
+            // the pack is damaged, its entries were not bounds-checked either
+            this->index_table.Clear();
+            return;
+        }
+        for (std::size_t i = 0; i < this->index_table.Count(); ++i)
+        {
+            const Index& index = this->index_table.At(i);
+            if (index.pos > file_size || file_size - index.pos < index.StoredSize())
+            {
+                this->index_table.Clear();
+                return;
+            }
+        }
+    }
+
+    MappedPackResourceManager::~MappedPackResourceManager()
+    {
+        if (this->p_map != nullptr)
+            munmap(const_cast<std::uint8_t*>(this->p_map), this->map_size);
+    }
+
+    int MappedPackResourceManager::GetResourceView(std::uint32_t rid, const std::uint8_t*& out_p_data, std::size_t& out_size) const
+    {
+        const Index* p_index = this->index_table.Find(rid);
+        if (p_index == nullptr)
+        {
+            out_p_data = nullptr;
+            out_size = 0;
+            return -1;
+        }
+        if (p_index->IsCompressed())
+        {
+            out_p_data = nullptr;
+            out_size = 0;
+            return 1;
+        }
+        out_p_data = this->p_map + p_index->pos;
+        out_size = p_index->size;
+        return 0;
+    }
+
+    int MappedPackResourceManager::LoadResource(std::uint32_t rid, void* out_buffer, size_t out_size) const
+    {
+        const Index* p_index = this->index_table.Find(rid);
+        if (p_index == nullptr)
+        {
+            return 0;
+        }
+        const std::uint8_t* p = this->p_map + p_index->pos;
+        if (!p_index->IsCompressed())
+        {
+            if (out_buffer != nullptr && out_size >= p_index->size)
+            {
+                std::memcpy(out_buffer, p, p_index->size);
+            }
+            return static_cast<int>(p_index->size);
+        }
+        std::uint32_t raw_size;
+        if (GetRawSize(p, p_index->StoredSize(), raw_size) != 0)
+            return 0;
+        if (out_buffer != nullptr && out_size >= raw_size)
+        {
+            if (DecompressEntry(p, p_index->StoredSize(), static_cast<std::uint8_t*>(out_buffer), raw_size) != 0)
+                return 0;
+        }
+        return static_cast<int>(raw_size);
+    }
+
+    std::unique_ptr<std::vector<std::uint8_t>> MappedPackResourceManager::LoadResource(std::uint32_t rid) const
+    {
+        const Index* p_index = this->index_table.Find(rid);
+        if (p_index == nullptr)
+        {
+            return nullptr;
+        }
+        const std::uint8_t* p = this->p_map + p_index->pos;
+        if (!p_index->IsCompressed())
+            return std::unique_ptr<std::vector<std::uint8_t>>(new std::vector<std::uint8_t>(p, p + p_index->size));
+        std::uint32_t raw_size;
+        if (GetRawSize(p, p_index->StoredSize(), raw_size) != 0)
+            return nullptr;
+        std::unique_ptr<std::vector<std::uint8_t>> up_buffer(new std::vector<std::uint8_t>(raw_size));
+        if (raw_size && DecompressEntry(p, p_index->StoredSize(), &up_buffer->at(0), raw_size) != 0)
+            return nullptr;
+        return up_buffer;
+    }
+
+    std::unique_ptr<IResourceDataSet> MappedPackResourceManager::LoadResourceBatch(const std::uint32_t* p_sorted_rid_list, size_t count) const
+    {
+        struct MappedResourceDataSet : public IResourceDataSet
+        {
+            struct Entry
+            {
+                std::uint32_t rid;
+                std::uint32_t size;
+                const std::uint8_t* p_data;
+            };
+            // only compressed entries are decoded into here, the rest point into the mapping
+            std::vector<std::uint8_t> data;
+            std::vector<Entry> entry_list;
+            std::size_t Count() const override
+            {
+                return entry_list.size();
+            }
+            int GetDataByRid(std::uint32_t rid, const std::uint8_t*& out_p_data, std::size_t& out_size) const override
+            {
+                auto result_iter = std::lower_bound(this->entry_list.begin(), this->entry_list.end(), rid, [](const Entry& entry, std::uint32_t rid)
+                {
+                    return entry.rid < rid;
+                });
+                if (result_iter == this->entry_list.end() || result_iter->rid != rid)
+                {
+                    out_p_data = nullptr;
+                    out_size = 0;
+                    return -1;
+                }
+                else
+                {
+                    out_p_data = result_iter->p_data;
+                    out_size = result_iter->size;
+                    return 0;
+                }
+            }
+            int GetDataByIdx(std::size_t idx, const std::uint8_t*& out_p_data, std::size_t& out_size) const override
+            {
+                if (idx < this->entry_list.size())
+                {
+                    const Entry& entry = this->entry_list[idx];
+                    out_p_data = entry.p_data;
+                    out_size = entry.size;
+                    return 0;
+                }
+                else
+                {
+                    out_p_data = nullptr;
+                    out_size = 0;
+                    return -1;
+                }
+            }
+        };
+        std::unique_ptr<MappedResourceDataSet> up_resource_data_set(new MappedResourceDataSet());
+        std::vector<const Index*> index_list(count);
+        std::size_t raw_total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            const Index* p_index = this->index_table.Find(p_sorted_rid_list[i]);
+            if (p_index == nullptr)
+                return nullptr;
+            index_list[i] = p_index;
+            std::uint32_t raw_size;
+            if (p_index->IsCompressed())
+            {
+                if (GetRawSize(this->p_map + p_index->pos, p_index->StoredSize(), raw_size) != 0)
+                    return nullptr;
+                raw_total += raw_size;
+            }
+        }
+        auto& data = up_resource_data_set->data;
+        data.resize(raw_total);
+        up_resource_data_set->entry_list.reserve(count);
+        std::size_t raw_pos = 0;
         for (const Index* p_index : index_list)
         {
-            file.seekg(p_index->pos);
-            file.read(reinterpret_cast<char*>(p), p_index->size);
-            p += p_index->size;
+            const std::uint8_t* p = this->p_map + p_index->pos;
+            if (!p_index->IsCompressed())
+            {
+                up_resource_data_set->entry_list.push_back({p_index->rid, p_index->size, p});
+                continue;
+            }
+            std::uint32_t raw_size;
+            if (GetRawSize(p, p_index->StoredSize(), raw_size) != 0)
+                return nullptr;
+            if (raw_size && DecompressEntry(p, p_index->StoredSize(), &data[raw_pos], raw_size) != 0)
+                return nullptr;
+            up_resource_data_set->entry_list.push_back({p_index->rid, raw_size, raw_size ? &data[raw_pos] : nullptr});
+            raw_pos += raw_size;
         }
-        return std::move(up_resourece_data_set);
+        return up_resource_data_set;
+    }
+
+    ResourceLoadThread::ResourceLoadThread(const IResourceManager& resource_manager)
+    : resource_manager(resource_manager)
+    , quit(false)
+    {
+        this->thread = std::thread(&ResourceLoadThread::run, this);
+    }
+
+    ResourceLoadThread::~ResourceLoadThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->task_mutex);
+            this->quit = true;
+        }
+        this->task_cond.notify_one();
+        this->thread.join();
+    }
+
+    void ResourceLoadThread::run()
+    {
+        while (true)
+        {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(this->task_mutex);
+                while (this->task_queue.empty() && !this->quit)
+                    this->task_cond.wait(lock);
+                if (this->task_queue.empty())
+                    return;
+                task = std::move(this->task_queue.front());
+                this->task_queue.pop_front();
+            }
+            // an exception must not end the thread, the requests behind this one still wait
+            DataSetUPtr up_data_set;
+            std::exception_ptr p_exception;
+            try
+            {
+                const std::uint32_t* p_rid_list = task.rid_list.size() ? &task.rid_list[0] : nullptr;
+                up_data_set = this->resource_manager.LoadResourceBatch(p_rid_list, task.rid_list.size());
+            }
+            catch (...)
+            {
+                p_exception = std::current_exception();
+            }
+            if (task.callback)
+            {
+                try
+                {
+                    task.callback(std::move(up_data_set));
+                }
+                catch (...)
+                {
+                }
+            }
+            else if (p_exception)
+                task.promise.set_exception(p_exception);
+            else
+                task.promise.set_value(std::move(up_data_set));
+        }
+    }
+
+    void ResourceLoadThread::push(Task&& task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->task_mutex);
+            this->task_queue.push_back(std::move(task));
+        }
+        this->task_cond.notify_one();
+    }
+
+    std::future<ResourceLoadThread::DataSetUPtr> ResourceLoadThread::LoadResourceBatch(const std::uint32_t* p_sorted_rid_list, size_t count)
+    {
+        Task task;
+        task.rid_list.assign(p_sorted_rid_list, p_sorted_rid_list + count);
+        auto future = task.promise.get_future();
+        this->push(std::move(task));
+        return future;
+    }
+
+    void ResourceLoadThread::LoadResourceBatch(const std::uint32_t* p_sorted_rid_list, size_t count, Callback callback)
+    {
+        Task task;
+        task.rid_list.assign(p_sorted_rid_list, p_sorted_rid_list + count);
+        task.callback = std::move(callback);
+        this->push(std::move(task));
     }
 }
\ No newline at end of file
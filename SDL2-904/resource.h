@@ -15,11 +15,18 @@
 #include <string>
 #include <array>
 #include <memory>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 namespace hardrock
 {
     struct IResourceDataSet
     {
+        virtual ~IResourceDataSet() { }
         virtual std::size_t Count() const = 0;
         virtual int GetDataByRid(std::uint32_t rid, const std::uint8_t*& out_p_data, std::size_t& out_size) const = 0;
         virtual int GetDataByIdx(std::size_t idx, const std::uint8_t*& out_p_data, std::size_t& out_size) const = 0;
@@ -33,7 +40,7 @@ namespace hardrock
         virtual std::unique_ptr<IResourceDataSet> LoadResourceBatch(const std::uint32_t* p_sorted_rid_list, size_t count) const = 0;
     };
 
-    class PackResourceManager : public IResourceManager
+    struct PackFormat
     {
         struct Header
         {
@@ -41,17 +48,57 @@ namespace hardrock
             std::uint32_t count;
             std::uint32_t index_pos;
         };
+        // Set in Index::size for entries stored as the raw size followed by one LZ4 block.
+        static const std::uint32_t INDEX_COMPRESSED = 0x80000000u;
         struct Index
         {
             std::uint32_t rid;
             std::uint32_t pos;
             std::uint32_t size;
+            std::uint32_t StoredSize() const { return this->size & ~INDEX_COMPRESSED; }
+            bool IsCompressed() const { return (this->size & INDEX_COMPRESSED) != 0; }
         };
         struct IndexSearchCmp
         {
             bool operator()(const Index& index, std::uint32_t rid) const { return index.rid < rid; }
         };
-        std::vector<Index> index_list;
+        // Optional section written by pack.py right after the index:
+        // HashHeader, bucket_count seeds, then count slots holding index positions.
+        struct HashHeader
+        {
+            std::array<char, 4> identifier;
+            std::uint32_t bucket_count;
+        };
+        // A seed with this bit set stores the slot of a single-rid bucket directly.
+        static const std::uint32_t HASH_DIRECT_SLOT = 0x80000000u;
+
+        // The sorted pack index. Lookups take a single probe into the perfect hash
+        // when the pack has one, and fall back to binary search otherwise.
+        class IndexTable
+        {
+            std::vector<Index> index_list;
+            std::vector<std::uint32_t> seed_list;
+            std::vector<std::uint32_t> slot_list;
+        public:
+            // p_tail points to the bytes following the index, which may hold a hash section.
+            int Load(const std::uint8_t* p_index_data, std::size_t count, const std::uint8_t* p_tail, std::size_t tail_size);
+            void Clear();
+            const Index* Find(std::uint32_t rid) const;
+            const Index* FindBinary(std::uint32_t rid) const;
+            bool HasHash() const { return this->slot_list.size() != 0; }
+            std::size_t Count() const { return this->index_list.size(); }
+            const Index& At(std::size_t idx) const { return this->index_list[idx]; }
+        };
+    };
+
+    class PackResourceManager : public IResourceManager
+    {
+        typedef PackFormat::Header Header;
+        typedef PackFormat::Index Index;
+        typedef PackFormat::IndexSearchCmp IndexSearchCmp;
+        // entries closer than this on disk are fetched by a single read in LoadResourceBatch
+        static const std::uint32_t MAX_COALESCE_GAP = 4096;
+        PackFormat::IndexTable index_table;
         std::string pack_path;
     public:
         PackResourceManager(const char* path);
@@ -59,6 +106,66 @@ namespace hardrock
         std::unique_ptr<std::vector<std::uint8_t>> LoadResource(std::uint32_t rid) const override;
         std::unique_ptr<IResourceDataSet> LoadResourceBatch(const std::uint32_t* p_sorted_rid_list, size_t count) const override;
     };
+
+    // Maps the whole pack once (read-only, shared) and hands out views into the mapping.
+    // Data sets returned by LoadResourceBatch point straight into the mapping,
+    // so they must not outlive the manager.
+    class MappedPackResourceManager : public IResourceManager
+    {
+        typedef PackFormat::Header Header;
+        typedef PackFormat::Index Index;
+        typedef PackFormat::IndexSearchCmp IndexSearchCmp;
+        PackFormat::IndexTable index_table;
+        const std::uint8_t* p_map;
+        std::size_t map_size;
+        MappedPackResourceManager(const MappedPackResourceManager&);
+        MappedPackResourceManager& operator=(const MappedPackResourceManager&);
+    public:
+        MappedPackResourceManager(const char* path);
+        ~MappedPackResourceManager();
+        // Zero-copy access, the view stays valid as long as the manager lives.
+        // Compressed entries have no view, return 1 for them and use LoadResource instead.
+        int GetResourceView(std::uint32_t rid, const std::uint8_t*& out_p_data, std::size_t& out_size) const;
+        int LoadResource(std::uint32_t rid, void* out_buffer, size_t out_size) const override;
+        std::unique_ptr<std::vector<std::uint8_t>> LoadResource(std::uint32_t rid) const override;
+        std::unique_ptr<IResourceDataSet> LoadResourceBatch(const std::uint32_t* p_sorted_rid_list, size_t count) const override;
+    };
+
+    // Runs LoadResourceBatch of a resource manager on a background I/O thread,
+    // so the next stage can be loaded while the current one is still rendering.
+    // Requests are served in order. Callbacks are invoked on the I/O thread.
+    // A load that throws hands its exception to the future, or null to the
+    // callback; exceptions thrown by callbacks are dropped. Either way the
+    // thread goes on with the next request.
+    class ResourceLoadThread
+    {
+    public:
+        typedef std::unique_ptr<IResourceDataSet> DataSetUPtr;
+        typedef std::function<void(DataSetUPtr)> Callback;
+    private:
+        struct Task
+        {
+            std::vector<std::uint32_t> rid_list;
+            std::promise<DataSetUPtr> promise;
+            Callback callback;
+        };
+        const IResourceManager& resource_manager;
+        std::mutex task_mutex;
+        std::condition_variable task_cond;
+        std::deque<Task> task_queue;
+        bool quit;
+        std::thread thread;
+        void run();
+        void push(Task&& task);
+        ResourceLoadThread(const ResourceLoadThread&);
+        ResourceLoadThread& operator=(const ResourceLoadThread&);
+    public:
+        ResourceLoadThread(const IResourceManager& resource_manager);
+        // Pending requests are still served before the thread exits.
+        ~ResourceLoadThread();
+        std::future<DataSetUPtr> LoadResourceBatch(const std::uint32_t* p_sorted_rid_list, size_t count);
+        void LoadResourceBatch(const std::uint32_t* p_sorted_rid_list, size_t count, Callback callback);
+    };
 }
 
 #endif /* defined(__SDL2_904__resource__) */
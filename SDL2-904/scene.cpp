@@ -12,60 +12,219 @@
 
 namespace hardrock
 {
-    TileSet::TileSet(std::size_t capacity)
+    template<typename Index>
+    BasicTileSet<Index>::BasicTileSet(std::size_t capacity, StorageMode storage_mode)
     : capacity(capacity)
+    , storage_mode(storage_mode)
     , tile_list_pool(capacity + 2)
-    , tile_data(capacity + 2)
+    , tile_data(storage_mode == StorageMode::DENSE ? capacity : capacity + 2)
     , tile_count(0)
+    , slot_end(0)
+    , in_draw_order(storage_mode == StorageMode::DENSE)
+    , changed_begin(0)
+    , changed_end(0)
+    , changes_known(false)
     {
         this->tile_list_pool.MoveTo(USED_TILE_LIST_HEAD, USED_TILE_LIST_HEAD);
+        if (storage_mode == StorageMode::DENSE)
+        {
+            this->slot_list.resize(capacity + 2);
+            this->compact_buffer.resize(capacity);
+        }
     }
     
-    TileSet::IndexType TileSet::TileAdd(IndexType insert_after_idx)
+    template<typename Index>
+    typename BasicTileSet<Index>::IndexType BasicTileSet<Index>::TileAdd(IndexType insert_after_idx)
     {
         IndexType tile_idx = this->tile_list_pool.Next(FREE_TILE_LIST_HEAD);
         if (tile_idx == FREE_TILE_LIST_HEAD)
             return 0;
+        // a free index means there is a hole to reclaim
+        if (this->storage_mode == StorageMode::DENSE && this->slot_end == this->capacity)
+            this->Compact();
         this->tile_list_pool.MoveTo(tile_idx, insert_after_idx);
+        if (this->storage_mode == StorageMode::DENSE)
+        {
+            // still in draw order when the tile went to the end of the list
+            if (this->tile_list_pool.Next(tile_idx) != USED_TILE_LIST_HEAD || this->slot_end != this->tile_count)
+                this->in_draw_order = false;
+            this->slot_list[tile_idx] = this->slot_end;
+            this->markChanged(this->slot_end, this->slot_end + 1);
+            ++this->slot_end;
+        }
+        else
+        {
+            this->changes_known = false;
+        }
         ++this->tile_count;
         return tile_idx;
     }
     
-    int TileSet::TileRemove(IndexType tile_idx)
+    template<typename Index>
+    int BasicTileSet<Index>::TileRemove(IndexType tile_idx)
     {
-        if (tile_idx == 0 || tile_idx >= this->tile_data.size())
+        if (tile_idx == 0 || tile_idx >= this->capacity + 2)
             return 1;
         this->tile_list_pool.MoveTo(tile_idx, FREE_TILE_LIST_HEAD);
         --this->tile_count;
+        if (this->storage_mode == StorageMode::DENSE)
+        {
+            if (static_cast<std::size_t>(this->slot_list[tile_idx]) + 1 == this->slot_end)
+                --this->slot_end;
+            else
+                this->in_draw_order = false;
+        }
+        else
+        {
+            this->changes_known = false;
+        }
         return 0;
     }
     
-    Tile& TileSet::TileAt(IndexType tile_idx)
+    template<typename Index>
+    Tile& BasicTileSet<Index>::TileAt(IndexType tile_idx)
     {
-        return this->tile_data[tile_idx];
+        const std::size_t slot = this->slotOf(tile_idx);
+        this->markChanged(slot, slot + 1);
+        return this->tile_data[slot];
     }
     
-    TileSet::TileSequence::TileSequence(const std::vector<Tile>* p_tile_data, const CircleLinkedListPool* p_tile_list_pool)
-    : p_tile_data(p_tile_data)
-    , p_tile_list_pool(p_tile_list_pool)
+    template<typename Index>
+    void BasicTileSet<Index>::markChanged(std::size_t begin, std::size_t end)
     {
-        this->next_idx = p_tile_list_pool->Next(USED_TILE_LIST_HEAD);
+        // with LINKED storage the position of a slot in the sequence is unknown
+        if (this->storage_mode == StorageMode::LINKED)
+        {
+            this->changes_known = false;
+            return;
+        }
+        if (this->changed_begin == this->changed_end)
+        {
+            this->changed_begin = begin;
+            this->changed_end = end;
+        }
+        else
+        {
+            this->changed_begin = std::min(this->changed_begin, begin);
+            this->changed_end = std::max(this->changed_end, end);
+        }
     }
     
-    bool TileSet::TileSequence::HasNext() const
+    template<typename Index>
+    void BasicTileSet<Index>::ClearChanges()
     {
+        this->changed_begin = 0;
+        this->changed_end = 0;
+        this->changes_known = this->in_draw_order || this->storage_mode == StorageMode::LINKED;
+    }
+    
+    template<typename Index>
+    void BasicTileSet<Index>::Compact()
+    {
+        if (this->in_draw_order || this->storage_mode != StorageMode::DENSE)
+            return;
+        // Tiles that stayed keep their relative order in tile_data, so most of the reads below
+        // move forward through memory.
+        // everything from the first tile that moves on has a new position
+        std::size_t slot = 0;
+        std::size_t first_moved_slot = this->tile_count;
+        for (IndexType i = this->tile_list_pool.Next(USED_TILE_LIST_HEAD); i != USED_TILE_LIST_HEAD; i = this->tile_list_pool.Next(i))
+        {
+            if (this->slot_list[i] != slot && first_moved_slot == this->tile_count)
+                first_moved_slot = slot;
+            this->compact_buffer[slot] = this->tile_data[this->slot_list[i]];
+            this->slot_list[i] = slot;
+            ++slot;
+        }
+        this->tile_data.swap(this->compact_buffer);
+        this->slot_end = slot;
+        this->in_draw_order = true;
+        if (first_moved_slot != slot)
+            this->markChanged(first_moved_slot, slot);
+    }
+    
+    template<typename Index>
+    BasicTileSet<Index>::TileSequence::TileSequence(const BasicTileSet* p_tile_set)
+    : p_tile_set(p_tile_set)
+    , in_draw_order(p_tile_set->in_draw_order)
+    , next_slot(0)
+    {
+        this->next_idx = p_tile_set->tile_list_pool.Next(USED_TILE_LIST_HEAD);
+    }
+    
+    template<typename Index>
+    bool BasicTileSet<Index>::TileSequence::HasNext() const
+    {
+        if (this->in_draw_order)
+            return this->next_slot < this->p_tile_set->tile_count;
         return this->next_idx != USED_TILE_LIST_HEAD;
     }
     
-    const Tile& TileSet::TileSequence::Next()
+    template<typename Index>
+    const Tile& BasicTileSet<Index>::TileSequence::Next()
     {
+        if (this->in_draw_order)
+            return this->p_tile_set->tile_data[this->next_slot++];
         IndexType c = this->next_idx;
-        this->next_idx = p_tile_list_pool->Next(c);
-        return this->p_tile_data->at(c);
+        this->next_idx = this->p_tile_set->tile_list_pool.Next(c);
+        return this->p_tile_set->tile_data[this->p_tile_set->slotOf(c)];
     }
     
-    TileSet::TileSequence TileSet::GetTileSequence() const
+    template<typename Index>
+    std::size_t BasicTileSet<Index>::TileSequence::NextBlock(const Tile*& p_block, std::size_t max_count)
     {
-        return TileSequence(&this->tile_data, &this->tile_list_pool);
+        const BasicTileSet* const p_tile_set = this->p_tile_set;
+        if (this->in_draw_order)
+        {
+            const std::size_t count = std::min(p_tile_set->tile_count - this->next_slot, max_count);
+            if (count == 0)
+                return 0;
+            p_block = &p_tile_set->tile_data[this->next_slot];
+            this->next_slot += count;
+            return count;
+        }
+        IndexType c = this->next_idx;
+        if (c == USED_TILE_LIST_HEAD || max_count == 0)
+            return 0;
+        std::size_t slot = p_tile_set->slotOf(c);
+        p_block = &p_tile_set->tile_data[slot];
+        // follow the list as long as it walks through consecutive slots
+        std::size_t count = 1;
+        IndexType next = p_tile_set->tile_list_pool.Next(c);
+        while (count < max_count && next != USED_TILE_LIST_HEAD && p_tile_set->slotOf(next) == slot + 1)
+        {
+            ++slot;
+            next = p_tile_set->tile_list_pool.Next(next);
+            ++count;
+        }
+        this->next_idx = next;
+        return count;
+    }
+    
+    template<typename Index>
+    const void* BasicTileSet<Index>::TileSequence::GetChanges(std::size_t& out_begin, std::size_t& out_end) const
+    {
+        const BasicTileSet* const p_tile_set = this->p_tile_set;
+        const bool positions_known = p_tile_set->storage_mode == StorageMode::LINKED || p_tile_set->in_draw_order;
+        if (p_tile_set->changes_known && positions_known)
+        {
+            out_begin = p_tile_set->changed_begin;
+            out_end = p_tile_set->changed_end;
+        }
+        else
+        {
+            out_begin = 0;
+            out_end = p_tile_set->capacity;
+        }
+        return p_tile_set;
     }
+    
+    template<typename Index>
+    typename BasicTileSet<Index>::TileSequence BasicTileSet<Index>::GetTileSequence() const
+    {
+        return TileSequence(this);
+    }
+    
+    template class BasicTileSet<std::uint16_t>;
+    template class BasicTileSet<std::uint32_t>;
 }
@@ -17,34 +17,77 @@
 
 namespace hardrock
 {
-    class TileSet
+    enum class TileStorageMode
+    {
+        // a tile lives in the slot of its index, the draw order only exists in the list
+        LINKED,
+        // tiles are appended to tile_data and removing one leaves a hole, Compact() packs the
+        // live tiles in draw order again
+        DENSE,
+    };
+    
+    // Index is the type of the tile indices, a set holds at most its maximum - 1 tiles.
+    template<typename Index>
+    class BasicTileSet
     {
     public:
-        typedef CircleLinkedListPool::IndexType IndexType;
+        typedef typename BasicCircleLinkedListPool<Index>::IndexType IndexType;
+        typedef TileStorageMode StorageMode;
     private:
         static const IndexType USED_TILE_LIST_HEAD = 0;
         static const IndexType FREE_TILE_LIST_HEAD = 1;
         const std::size_t capacity;
+        const StorageMode storage_mode;
         std::vector<Tile> tile_data;
-        CircleLinkedListPool tile_list_pool;
+        BasicCircleLinkedListPool<Index> tile_list_pool;
         std::size_t tile_count;
+        // DENSE only, position of each tile in tile_data and the end of the used positions
+        std::vector<IndexType> slot_list;
+        std::vector<Tile> compact_buffer;
+        std::size_t slot_end;
+        // tile_data holds the tiles in draw order without holes
+        bool in_draw_order;
+        // tile_data positions written since ClearChanges, they are sequence positions as long as
+        // the set was in draw order when the changes were cleared and is again now
+        std::size_t changed_begin;
+        std::size_t changed_end;
+        bool changes_known;
+        void markChanged(std::size_t begin, std::size_t end);
+        std::size_t slotOf(IndexType tile_idx) const
+        {
+            return this->storage_mode == StorageMode::LINKED ? tile_idx : this->slot_list[tile_idx];
+        }
     public:
-        TileSet(std::size_t capacity);
+        BasicTileSet(std::size_t capacity, StorageMode storage_mode = StorageMode::LINKED);
         IndexType TileAdd(IndexType insert_after_idx = USED_TILE_LIST_HEAD);
         int TileRemove(IndexType tile_idx);
+        // With DENSE storage the reference moves on TileAdd, TileRemove and Compact.
         Tile& TileAt(IndexType tile_idx);
+        // DENSE only, pack tile_data in draw order after tiles were added in the middle or removed,
+        // so a sequence can hand all tiles out as one block. Call it once a frame before
+        // GetTileSequence.
+        void Compact();
+        // Forget the changes so far, call it once every batch that draws the set has been updated.
+        void ClearChanges();
         class TileSequence : public ITileSequence
         {
-            const std::vector<Tile>* const p_tile_data;
-            const CircleLinkedListPool* const p_tile_list_pool;
+            const BasicTileSet* const p_tile_set;
+            const bool in_draw_order;
             IndexType next_idx;
+            // tile_data position of the next tile while the set is in draw order
+            std::size_t next_slot;
         public:
-            TileSequence(const std::vector<Tile>* p_tile_data, const CircleLinkedListPool* p_tile_list_pool);
+            TileSequence(const BasicTileSet* p_tile_set);
             bool HasNext() const override;
             const Tile& Next() override;
+            std::size_t NextBlock(const Tile*& p_block, std::size_t max_count) override;
+            const void* GetChanges(std::size_t& out_begin, std::size_t& out_end) const override;
         };
         TileSequence GetTileSequence() const;
     };
+    typedef BasicTileSet<std::uint16_t> TileSet;
+    // for more than 65533 tiles, the links take twice the memory
+    typedef BasicTileSet<std::uint32_t> LargeTileSet;
 }
 
 #endif
@@ -0,0 +1,228 @@
+//
+//  simd.h
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-17.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#ifndef __SDL2_904__simd__
+#define __SDL2_904__simd__
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HARDROCK_SIMD_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HARDROCK_SIMD_NEON 1
+#endif
+
+// 4 lane float / int vectors on SSE2 or NEON, with a plain struct when neither is there.
+// Only the operations the renderer and the motion kernels need, every one is exact so all backends
+// give the same bits.
+namespace hardrock
+{
+    namespace simd
+    {
+#if defined(HARDROCK_SIMD_SSE2)
+        typedef __m128 Float4;
+        typedef __m128i Int4;
+        inline Float4 Load(const float* p) { return _mm_loadu_ps(p); }
+        // (p[0], p[1], p[0], p[1])
+        inline Float4 LoadDup2(const float* p) { return _mm_castpd_ps(_mm_load1_pd(reinterpret_cast<const double*>(p))); }
+        inline Float4 Set(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+        inline Float4 Splat(float a) { return _mm_set1_ps(a); }
+        inline Float4 Add(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+        inline Float4 Mul(Float4 a, Float4 b) { return _mm_mul_ps(a, b); }
+        inline Float4 Sub(Float4 a, Float4 b) { return _mm_sub_ps(a, b); }
+        inline Float4 Min(Float4 a, Float4 b) { return _mm_min_ps(a, b); }
+        inline Float4 Max(Float4 a, Float4 b) { return _mm_max_ps(a, b); }
+        inline Float4 Div(Float4 a, Float4 b) { return _mm_div_ps(a, b); }
+        inline Float4 Sqrt(Float4 a) { return _mm_sqrt_ps(a); }
+        inline void Store(float* p, Float4 a) { _mm_storeu_ps(p, a); }
+        // all bits set in the lanes where the comparison holds
+        typedef __m128 Mask4;
+        inline Mask4 Less(Float4 a, Float4 b) { return _mm_cmplt_ps(a, b); }
+        // a where m is set, b elsewhere
+        inline Float4 Select(Mask4 m, Float4 a, Float4 b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+        // (a3, a3, a3, a3)
+        inline Float4 DupLane3(Float4 a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 3)); }
+        // bytes of a, lowest first
+        inline Float4 UnpackBytes(std::uint32_t a)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(a)), zero), zero));
+        }
+        // lanes already rounded to integers in [0, 255] back to bytes, lowest first
+        inline std::uint32_t PackRoundedBytes(Float4 a)
+        {
+            const __m128i i = _mm_cvttps_epi32(a);
+            const __m128i word = _mm_packs_epi32(i, i);
+            return static_cast<std::uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(word, word)));
+        }
+        // (a0, a1, b0, b1)
+        inline Float4 CombineLow(Float4 a, Float4 b) { return _mm_movelh_ps(a, b); }
+        // (a2, a3, a2, a3)
+        inline Float4 DupHigh(Float4 a) { return _mm_movehl_ps(a, a); }
+        inline Int4 SplatInt(std::uint32_t a) { return _mm_set1_epi32(static_cast<int>(a)); }
+        inline Int4 Or(Int4 a, Int4 b) { return _mm_or_si128(a, b); }
+        // (a0, b0, a1, b1)
+        inline Int4 ZipLow(Int4 a, Int4 b) { return _mm_unpacklo_epi32(a, b); }
+        // (a2, b2, a3, b3)
+        inline Int4 ZipHigh(Int4 a, Int4 b) { return _mm_unpackhi_epi32(a, b); }
+        // rect bytes (x0, y0, x1, y1) to the quad corners (x0 | y0 << 8, x1 | y0 << 8, x1 | y1 << 8, x0 | y1 << 8)
+        inline Int4 QuadCorners(std::uint32_t rect)
+        {
+            const __m128i r = _mm_cvtsi32_si128(static_cast<int>(rect));
+            const __m128i pair = _mm_unpacklo_epi32(r, _mm_srli_epi32(r, 16));
+            const __m128i x = _mm_and_si128(_mm_shuffle_epi32(pair, _MM_SHUFFLE(0, 1, 1, 0)), _mm_set1_epi32(0xff));
+            const __m128i y = _mm_and_si128(_mm_shuffle_epi32(pair, _MM_SHUFFLE(1, 1, 0, 0)), _mm_set1_epi32(0xff00));
+            return _mm_or_si128(x, y);
+        }
+        // Store (f0, f1, i0, i1) to p and (f2, f3, i2, i3) to p + 16 bytes.
+        inline void StoreInterleave2(void* p, Float4 f, Int4 i)
+        {
+            const __m128i fi = _mm_castps_si128(f);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_unpacklo_epi64(fi, i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p) + 1, _mm_unpackhi_epi64(fi, i));
+        }
+#elif defined(HARDROCK_SIMD_NEON)
+        typedef float32x4_t Float4;
+        typedef uint32x4_t Int4;
+        inline Float4 Load(const float* p) { return vld1q_f32(p); }
+        inline Float4 LoadDup2(const float* p) { const float32x2_t v = vld1_f32(p); return vcombine_f32(v, v); }
+        inline Float4 Set(float a, float b, float c, float d) { const float v[4] = {a, b, c, d}; return vld1q_f32(v); }
+        inline Float4 Splat(float a) { return vdupq_n_f32(a); }
+        inline Float4 Add(Float4 a, Float4 b) { return vaddq_f32(a, b); }
+        inline Float4 Mul(Float4 a, Float4 b) { return vmulq_f32(a, b); }
+        inline Float4 Sub(Float4 a, Float4 b) { return vsubq_f32(a, b); }
+        inline Float4 Min(Float4 a, Float4 b) { return vminq_f32(a, b); }
+        inline Float4 Max(Float4 a, Float4 b) { return vmaxq_f32(a, b); }
+#if defined(__aarch64__)
+        inline Float4 Div(Float4 a, Float4 b) { return vdivq_f32(a, b); }
+        inline Float4 Sqrt(Float4 a) { return vsqrtq_f32(a); }
+#else
+        // 32 bit NEON has only estimates, so go by lane
+        inline Float4 Div(Float4 a, Float4 b)
+        {
+            float v[4], w[4];
+            vst1q_f32(v, a);
+            vst1q_f32(w, b);
+            return Set(v[0] / w[0], v[1] / w[1], v[2] / w[2], v[3] / w[3]);
+        }
+        inline Float4 Sqrt(Float4 a)
+        {
+            float v[4];
+            vst1q_f32(v, a);
+            return Set(std::sqrt(v[0]), std::sqrt(v[1]), std::sqrt(v[2]), std::sqrt(v[3]));
+        }
+#endif
+        inline void Store(float* p, Float4 a) { vst1q_f32(p, a); }
+        typedef uint32x4_t Mask4;
+        inline Mask4 Less(Float4 a, Float4 b) { return vcltq_f32(a, b); }
+        inline Float4 Select(Mask4 m, Float4 a, Float4 b) { return vbslq_f32(m, a, b); }
+        inline Float4 DupLane3(Float4 a) { return vdupq_lane_f32(vget_high_f32(a), 1); }
+        inline Float4 UnpackBytes(std::uint32_t a)
+        {
+            const uint16x8_t word = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(a)));
+            return vcvtq_f32_u32(vmovl_u16(vget_low_u16(word)));
+        }
+        inline std::uint32_t PackRoundedBytes(Float4 a)
+        {
+            const uint16x4_t word = vmovn_u32(vcvtq_u32_f32(a));
+            return vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(word, word))), 0);
+        }
+        inline Float4 CombineLow(Float4 a, Float4 b) { return vcombine_f32(vget_low_f32(a), vget_low_f32(b)); }
+        inline Float4 DupHigh(Float4 a) { return vcombine_f32(vget_high_f32(a), vget_high_f32(a)); }
+        inline Int4 SplatInt(std::uint32_t a) { return vdupq_n_u32(a); }
+        inline Int4 Or(Int4 a, Int4 b) { return vorrq_u32(a, b); }
+        inline Int4 ZipLow(Int4 a, Int4 b) { return vzipq_u32(a, b).val[0]; }
+        inline Int4 ZipHigh(Int4 a, Int4 b) { return vzipq_u32(a, b).val[1]; }
+        inline Int4 QuadCorners(std::uint32_t rect)
+        {
+            static const std::int32_t x_shift[4] = {0, -16, -16, 0};
+            static const std::int32_t y_shift[4] = {0, 0, -16, -16};
+            const uint32x4_t r = vdupq_n_u32(rect);
+            const uint32x4_t x = vandq_u32(vshlq_u32(r, vld1q_s32(x_shift)), vdupq_n_u32(0xff));
+            const uint32x4_t y = vandq_u32(vshlq_u32(r, vld1q_s32(y_shift)), vdupq_n_u32(0xff00));
+            return vorrq_u32(x, y);
+        }
+        inline void StoreInterleave2(void* p, Float4 f, Int4 i)
+        {
+            const uint32x4_t fi = vreinterpretq_u32_f32(f);
+            vst1q_u32(static_cast<std::uint32_t*>(p), vcombine_u32(vget_low_u32(fi), vget_low_u32(i)));
+            vst1q_u32(static_cast<std::uint32_t*>(p) + 4, vcombine_u32(vget_high_u32(fi), vget_high_u32(i)));
+        }
+#else
+        struct Float4 { float v[4]; };
+        struct Int4 { std::uint32_t v[4]; };
+        inline Float4 Load(const float* p) { Float4 r = {{p[0], p[1], p[2], p[3]}}; return r; }
+        inline Float4 LoadDup2(const float* p) { Float4 r = {{p[0], p[1], p[0], p[1]}}; return r; }
+        inline Float4 Set(float a, float b, float c, float d) { Float4 r = {{a, b, c, d}}; return r; }
+        inline Float4 Splat(float a) { Float4 r = {{a, a, a, a}}; return r; }
+        inline Float4 Add(Float4 a, Float4 b) { Float4 r = {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}}; return r; }
+        inline Float4 Mul(Float4 a, Float4 b) { Float4 r = {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}}; return r; }
+        inline Float4 Sub(Float4 a, Float4 b) { Float4 r = {{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}}; return r; }
+        inline float Min(float a, float b) { return b < a ? b : a; }
+        inline Float4 Min(Float4 a, Float4 b) { Float4 r = {{Min(a.v[0], b.v[0]), Min(a.v[1], b.v[1]), Min(a.v[2], b.v[2]), Min(a.v[3], b.v[3])}}; return r; }
+        inline float Max(float a, float b) { return a < b ? b : a; }
+        inline Float4 Max(Float4 a, Float4 b) { Float4 r = {{Max(a.v[0], b.v[0]), Max(a.v[1], b.v[1]), Max(a.v[2], b.v[2]), Max(a.v[3], b.v[3])}}; return r; }
+        inline Float4 Div(Float4 a, Float4 b) { Float4 r = {{a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]}}; return r; }
+        inline Float4 Sqrt(Float4 a) { Float4 r = {{std::sqrt(a.v[0]), std::sqrt(a.v[1]), std::sqrt(a.v[2]), std::sqrt(a.v[3])}}; return r; }
+        inline void Store(float* p, Float4 a) { std::memcpy(p, a.v, sizeof(a.v)); }
+        struct Mask4 { bool v[4]; };
+        inline Mask4 Less(Float4 a, Float4 b) { Mask4 r = {{a.v[0] < b.v[0], a.v[1] < b.v[1], a.v[2] < b.v[2], a.v[3] < b.v[3]}}; return r; }
+        inline Float4 Select(Mask4 m, Float4 a, Float4 b)
+        {
+            Float4 r = {{m.v[0] ? a.v[0] : b.v[0], m.v[1] ? a.v[1] : b.v[1], m.v[2] ? a.v[2] : b.v[2], m.v[3] ? a.v[3] : b.v[3]}};
+            return r;
+        }
+        inline Float4 DupLane3(Float4 a) { Float4 r = {{a.v[3], a.v[3], a.v[3], a.v[3]}}; return r; }
+        inline Float4 UnpackBytes(std::uint32_t a)
+        {
+            Float4 r = {{static_cast<float>(a & 0xff), static_cast<float>(a >> 8 & 0xff), static_cast<float>(a >> 16 & 0xff), static_cast<float>(a >> 24)}};
+            return r;
+        }
+        inline std::uint32_t PackRoundedBytes(Float4 a)
+        {
+            return static_cast<std::uint32_t>(a.v[0]) | static_cast<std::uint32_t>(a.v[1]) << 8 | static_cast<std::uint32_t>(a.v[2]) << 16 | static_cast<std::uint32_t>(a.v[3]) << 24;
+        }
+        inline Float4 CombineLow(Float4 a, Float4 b) { Float4 r = {{a.v[0], a.v[1], b.v[0], b.v[1]}}; return r; }
+        inline Float4 DupHigh(Float4 a) { Float4 r = {{a.v[2], a.v[3], a.v[2], a.v[3]}}; return r; }
+        inline Int4 SplatInt(std::uint32_t a) { Int4 r = {{a, a, a, a}}; return r; }
+        inline Int4 Or(Int4 a, Int4 b) { Int4 r = {{a.v[0] | b.v[0], a.v[1] | b.v[1], a.v[2] | b.v[2], a.v[3] | b.v[3]}}; return r; }
+        inline Int4 ZipLow(Int4 a, Int4 b) { Int4 r = {{a.v[0], b.v[0], a.v[1], b.v[1]}}; return r; }
+        inline Int4 ZipHigh(Int4 a, Int4 b) { Int4 r = {{a.v[2], b.v[2], a.v[3], b.v[3]}}; return r; }
+        inline Int4 QuadCorners(std::uint32_t rect)
+        {
+            const std::uint32_t x0 = rect & 0xff, x1 = (rect >> 16) & 0xff;
+            const std::uint32_t y0 = rect & 0xff00, y1 = (rect >> 16) & 0xff00;
+            Int4 r = {{x0 | y0, x1 | y0, x1 | y1, x0 | y1}};
+            return r;
+        }
+        inline void StoreInterleave2(void* p, Float4 f, Int4 i)
+        {
+            std::uint8_t* const p_byte = static_cast<std::uint8_t*>(p);
+            std::memcpy(p_byte, f.v, 8);
+            std::memcpy(p_byte + 8, i.v, 8);
+            std::memcpy(p_byte + 16, f.v + 2, 8);
+            std::memcpy(p_byte + 24, i.v + 2, 8);
+        }
+#endif
+        // (a0, a1, a0, a1)
+        inline Float4 DupLow(Float4 a) { return CombineLow(a, a); }
+        // Nearest integer, ties to even, for lanes in (-2^22, 2^22): adding 1.5 * 2^23 leaves no
+        // fraction bits, so the float adder rounds the same way on every backend.
+        inline Float4 RoundSmall(Float4 a)
+        {
+            const Float4 magic = Splat(12582912.0f);
+            return Sub(Add(a, magic), magic);
+        }
+    }
+}
+
+#endif /* defined(__SDL2_904__simd__) */
@@ -0,0 +1,558 @@
+//
+//  software_executor.cpp
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#include "software_executor.h"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "parallel.h"
+#include "simd.h"
+
+// no fused multiply-add, the output has to be the same on every backend
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+namespace hardrock
+{
+    namespace
+    {
+        // subpixel bits of snapped corners, as most GL rasterizers
+        const int SUBPIXEL_BITS = 8;
+        const std::int64_t SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+        const std::int64_t SUBPIXEL_HALF = SUBPIXEL_ONE >> 1;
+        // fraction bits of the texel coordinates stepped along a span
+        const int TEXEL_BITS = 16;
+        // corners further off screen than this many pixels are not drawn, subpixel products stay in 64 bits
+        const float MAX_COORDINATE = 4194304.0f;
+        const std::size_t SETUP_GRAIN = 256;
+
+        // q, r with n = q * d + r and 0 <= r < d, for d > 0
+        void FloorDivide(std::int64_t n, std::int64_t d, std::int64_t& out_q, std::int64_t& out_r)
+        {
+            out_q = n / d;
+            out_r = n % d;
+            if (out_r < 0)
+            {
+                out_r += d;
+                --out_q;
+            }
+        }
+
+        // Bound on the pixel columns an edge lets through, stepped one row at a time without
+        // dividing. numerator = quotient * denominator + remainder.
+        struct EdgeStepper
+        {
+            std::int64_t quotient;
+            std::int64_t remainder;
+            std::int64_t denominator;
+            std::int64_t step_quotient;
+            std::int64_t step_remainder;
+            void step()
+            {
+                this->quotient += this->step_quotient;
+                this->remainder += this->step_remainder;
+                if (this->remainder >= this->denominator)
+                {
+                    this->remainder -= this->denominator;
+                    ++this->quotient;
+                }
+            }
+        };
+
+        std::uint32_t WrapTexel(std::int64_t coord, std::uint32_t size)
+        {
+            const std::int64_t texel = coord >> TEXEL_BITS;
+            if (static_cast<std::uint64_t>(texel) < size)
+                return static_cast<std::uint32_t>(texel);
+            const std::int64_t wrapped = texel % size;
+            return static_cast<std::uint32_t>(wrapped < 0 ? wrapped + size : wrapped);
+        }
+
+        // Blends count pixels from p_pixel on, stepping the texel coordinates s and t by s_step
+        // and t_step. WRAP repeats the texture, HAS_PALETTE looks the texels up in p_palette.
+        template <bool HAS_PALETTE, bool WRAP>
+        void FillSpan(std::uint32_t* p_pixel, std::size_t count, std::int64_t s, std::int64_t t, std::int64_t s_step, std::int64_t t_step, const MemoryTexture& texture, const std::uint32_t* p_palette, bool opaque, simd::Float4 mult, simd::Float4 add)
+        {
+            const simd::Float4 max_byte = simd::Splat(255.0f);
+            const simd::Float4 inv_max_byte = simd::Splat(1.0f / 255.0f);
+            const std::uint32_t* const p_texels = texture.p_texel_data;
+            for (std::size_t i = 0; i < count; ++i, s += s_step, t += t_step)
+            {
+                std::uint32_t texel;
+                if (WRAP)
+                    texel = p_texels[WrapTexel(t, texture.height) * texture.width + WrapTexel(s, texture.width)];
+                else
+                    texel = p_texels[static_cast<std::uint32_t>(t >> TEXEL_BITS) * texture.width + static_cast<std::uint32_t>(s >> TEXEL_BITS)];
+                if (HAS_PALETTE)
+                    texel = p_palette[texel & 0xff];
+                // nothing of a transparent texel shows, the blend leaves the pixel as it was
+                const std::uint32_t alpha = texel >> 24;
+                if (alpha == 0)
+                    continue;
+                // texel * ColorMult + ColorAdd stored to bytes, as for an RGBA8 target, then
+                // GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA on bytes. Products stay exact in floats.
+                const simd::Float4 src = simd::RoundSmall(simd::Min(simd::Add(simd::Mul(simd::UnpackBytes(texel), mult), add), max_byte));
+                if (opaque && alpha == 255)
+                {
+                    p_pixel[i] = simd::PackRoundedBytes(src);
+                    continue;
+                }
+                const simd::Float4 src_alpha = simd::DupLane3(src);
+                const simd::Float4 dst = simd::UnpackBytes(p_pixel[i]);
+                const simd::Float4 src_term = simd::RoundSmall(simd::Mul(simd::Mul(src, src_alpha), inv_max_byte));
+                const simd::Float4 dst_term = simd::RoundSmall(simd::Mul(simd::Mul(dst, simd::Sub(max_byte, src_alpha)), inv_max_byte));
+                p_pixel[i] = simd::PackRoundedBytes(simd::Min(simd::Add(src_term, dst_term), max_byte));
+            }
+        }
+    }
+
+    SoftwareCommandExecutor::SoftwareCommandExecutor(int width, int height, RenderDevice::RenderPath render_path, RenderDevice::BufferMode buffer_mode, std::size_t tile_capacity, ThreadPool* p_thread_pool)
+    : width(width)
+    , height(height)
+    , render_path(render_path)
+    , tile_data_size(RenderDevice::TileDataSize(render_path))
+    , region_size(RenderDevice::TileDataSize(render_path) * tile_capacity)
+    , p_thread_pool(p_thread_pool)
+    , bin_column_count((width + BIN_SIZE - 1) / BIN_SIZE)
+    , bin_row_count((height + BIN_SIZE - 1) / BIN_SIZE)
+    , tile_buffer(this->region_size * (buffer_mode == RenderDevice::BufferMode::RING ? RenderDevice::RING_FRAME_COUNT : 1))
+    , frame_buffer(static_cast<std::size_t>(width) * height, 0)
+    , p_texture(nullptr)
+    , instance_tile(0)
+    , bin_list(static_cast<std::size_t>(this->bin_column_count) * this->bin_row_count)
+    , bin_pixel_count_list(this->bin_list.size(), 0)
+    , pixel_count(0)
+    {
+        std::fill(std::begin(this->translate), std::end(this->translate), 0.0f);
+        std::fill(std::begin(this->transform), std::end(this->transform), 0.0f);
+    }
+
+    std::uint8_t* SoftwareCommandExecutor::MapRegion(std::size_t ring_slot, RenderFrameStats&)
+    {
+        assert((ring_slot + 1) * this->region_size <= this->tile_buffer.size());
+        return &this->tile_buffer[ring_slot * this->region_size];
+    }
+
+    void SoftwareCommandExecutor::SetTexture(std::uint32_t texture, const MemoryTexture* p_texture)
+    {
+        if (p_texture)
+            this->texture_map[texture] = *p_texture;
+        else
+            this->texture_map.erase(texture);
+    }
+
+    void SoftwareCommandExecutor::Clear(std::uint32_t rgba)
+    {
+        std::fill(this->frame_buffer.begin(), this->frame_buffer.end(), rgba);
+    }
+
+    int SoftwareCommandExecutor::Execute(const RenderCommandBuffer& command_buffer, RenderFrameStats&)
+    {
+        const RenderCommand* const p_command_list = command_buffer.GetCommands();
+        const std::size_t count = command_buffer.GetCount();
+        std::uint8_t* const p_tile_buffer = this->tile_buffer.data();
+        const std::size_t tile_buffer_size = this->tile_buffer.size();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const RenderCommand& command = p_command_list[i];
+            switch (command.type)
+            {
+                case RenderCommandType::BEGIN_FRAME:
+                    this->pixel_count = 0;
+                    this->p_texture = nullptr;
+                    break;
+                case RenderCommandType::ORPHAN_TILES:
+                    break;
+                case RenderCommandType::WRITE_TILES:
+                    if (command.range.offset + command.range.size > tile_buffer_size)
+                        return 1;
+                    // the draws recorded so far read the tiles as they were
+                    this->flush();
+                    if (command_buffer.GetTileData())
+                        std::memcpy(p_tile_buffer + command.range.offset, command_buffer.GetTileData() + command.range.source_offset, command.range.size);
+                    break;
+                case RenderCommandType::COPY_TILES:
+                    if (command.range.offset + command.range.size > tile_buffer_size || command.range.source_offset + command.range.size > tile_buffer_size)
+                        return 1;
+                    this->flush();
+                    std::memmove(p_tile_buffer + command.range.offset, p_tile_buffer + command.range.source_offset, command.range.size);
+                    break;
+                case RenderCommandType::SET_TRANSLATE:
+                    this->translate[0] = command.value[0];
+                    this->translate[1] = command.value[1];
+                    break;
+                case RenderCommandType::SET_TRANSFORM:
+                    std::copy(command.value, command.value + 4, this->transform);
+                    break;
+                case RenderCommandType::BIND_ATLAS:
+                {
+                    auto iter = this->texture_map.find(command.atlas.texture);
+                    this->p_texture = iter == this->texture_map.end() ? nullptr : &iter->second;
+                    break;
+                }
+                case RenderCommandType::BIND_INSTANCES:
+                    this->instance_tile = command.draw.first;
+                    break;
+                case RenderCommandType::DRAW_ELEMENTS:
+                case RenderCommandType::DRAW_INSTANCED:
+                {
+                    std::size_t first_tile;
+                    std::size_t tile_count;
+                    if (command.type == RenderCommandType::DRAW_ELEMENTS)
+                    {
+                        first_tile = command.draw.first / 6 + command.draw.base_vertex / 4;
+                        tile_count = command.draw.count / 6;
+                    }
+                    else
+                    {
+                        first_tile = this->instance_tile;
+                        tile_count = command.draw.count;
+                    }
+                    if ((first_tile + tile_count) * this->tile_data_size > tile_buffer_size)
+                        return 1;
+                    // without a texture GL would sample black, an unknown atlas is left out
+                    if (this->p_texture)
+                        this->addDraw(first_tile, tile_count);
+                    break;
+                }
+                case RenderCommandType::END_FRAME:
+                    this->flush();
+                    break;
+                default:
+                    return 1;
+            }
+        }
+        return 0;
+    }
+
+    void SoftwareCommandExecutor::addDraw(std::size_t first_tile, std::size_t tile_count)
+    {
+        Draw draw;
+        draw.first_tile = first_tile;
+        draw.tile_count = tile_count;
+        draw.quad_offset = this->draw_list.empty() ? 0 : this->draw_list.back().quad_offset + this->draw_list.back().tile_count;
+        std::copy(std::begin(this->translate), std::end(this->translate), draw.translate);
+        std::copy(std::begin(this->transform), std::end(this->transform), draw.transform);
+        draw.p_texture = this->p_texture;
+        this->draw_list.push_back(draw);
+    }
+
+    void SoftwareCommandExecutor::flush()
+    {
+        if (this->draw_list.empty())
+            return;
+        const std::size_t quad_count = this->draw_list.back().quad_offset + this->draw_list.back().tile_count;
+        this->quad_list.resize(quad_count);
+        this->quad_visible_list.assign(quad_count, 0);
+        if (this->p_thread_pool)
+            this->p_thread_pool->ParallelFor(quad_count, SETUP_GRAIN, [this](std::size_t begin, std::size_t end) { this->setupQuads(begin, end); });
+        else
+            this->setupQuads(0, quad_count);
+
+        // bins keep the quads in draw order, so each can be filled on its own
+        for (auto& bin : this->bin_list)
+        {
+            bin.clear();
+        }
+        for (std::size_t i = 0; i < quad_count; ++i)
+        {
+            if (!this->quad_visible_list[i])
+                continue;
+            const Quad& quad = this->quad_list[i];
+            for (int row = quad.y0 / BIN_SIZE; row <= quad.y1 / BIN_SIZE; ++row)
+            {
+                for (int column = quad.x0 / BIN_SIZE; column <= quad.x1 / BIN_SIZE; ++column)
+                {
+                    this->bin_list[row * this->bin_column_count + column].push_back(static_cast<std::uint32_t>(i));
+                }
+            }
+        }
+        const std::size_t bin_count = this->bin_list.size();
+        if (this->p_thread_pool)
+            this->p_thread_pool->ParallelFor(bin_count, 1, [this](std::size_t begin, std::size_t end)
+            {
+                for (std::size_t i = begin; i < end; ++i)
+                {
+                    this->fillBin(i);
+                }
+            });
+        else
+        {
+            for (std::size_t i = 0; i < bin_count; ++i)
+            {
+                this->fillBin(i);
+            }
+        }
+        for (std::uint64_t bin_pixel_count : this->bin_pixel_count_list)
+        {
+            this->pixel_count += bin_pixel_count;
+        }
+        this->draw_list.clear();
+    }
+
+    void SoftwareCommandExecutor::setupQuads(std::size_t begin, std::size_t end)
+    {
+        auto iter = std::upper_bound(this->draw_list.begin(), this->draw_list.end(), begin, [](std::size_t quad, const Draw& draw) { return quad < draw.quad_offset; }) - 1;
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            while (i >= iter->quad_offset + iter->tile_count)
+                ++iter;
+            const std::uint8_t* const p_tile_data = &this->tile_buffer[(iter->first_tile + i - iter->quad_offset) * this->tile_data_size];
+            this->quad_visible_list[i] = this->setupQuad(*iter, p_tile_data, this->quad_list[i]);
+        }
+    }
+
+    bool SoftwareCommandExecutor::setupQuad(const Draw& draw, const std::uint8_t* p_tile_data, Quad& out_quad) const
+    {
+        // corner (0, 0), (1, 0) and (0, 1) of the tile in clip space, before the world transform
+        float position[3][2];
+        glm::u8vec4 rect;
+        glm::u8vec4 color;
+        std::uint8_t palette;
+        if (this->render_path == RenderDevice::RenderPath::INSTANCED)
+        {
+            RenderDevice::TileInstance instance;
+            std::memcpy(&instance, p_tile_data, sizeof(instance));
+            position[0][0] = instance.translate.x;
+            position[0][1] = instance.translate.y;
+            position[1][0] = instance.translate.x + instance.vec_x.x;
+            position[1][1] = instance.translate.y + instance.vec_x.y;
+            position[2][0] = instance.translate.x + instance.vec_y.x;
+            position[2][1] = instance.translate.y + instance.vec_y.y;
+            rect = instance.tex;
+            color = instance.color;
+            palette = instance.palette.x;
+        }
+        else
+        {
+            RenderDevice::TileVertex vertex_list[4];
+            std::memcpy(vertex_list, p_tile_data, sizeof(vertex_list));
+            position[0][0] = vertex_list[0].pos.x;
+            position[0][1] = vertex_list[0].pos.y;
+            position[1][0] = vertex_list[1].pos.x;
+            position[1][1] = vertex_list[1].pos.y;
+            position[2][0] = vertex_list[3].pos.x;
+            position[2][1] = vertex_list[3].pos.y;
+            rect = glm::u8vec4(vertex_list[0].tex.x, vertex_list[0].tex.y, vertex_list[2].tex.x, vertex_list[2].tex.y);
+            color = vertex_list[0].color;
+            palette = vertex_list[0].palette.x;
+        }
+        if (color.w == 0)
+            return false;
+
+        // position * WorldTransform + WorldTranslate, then to pixels with row 0 at the top
+        const float* const m = draw.transform;
+        const float half_width = 0.5f * this->width;
+        const float half_height = 0.5f * this->height;
+        double window[3][2];
+        for (int i = 0; i < 3; ++i)
+        {
+            const float clip_x = position[i][0] * m[0] + position[i][1] * m[1] + draw.translate[0];
+            const float clip_y = position[i][0] * m[2] + position[i][1] * m[3] + draw.translate[1];
+            const float x = (clip_x + 1.0f) * half_width;
+            const float y = (1.0f - clip_y) * half_height;
+            if (!(std::fabs(x) < MAX_COORDINATE && std::fabs(y) < MAX_COORDINATE))
+                return false;
+            window[i][0] = x;
+            window[i][1] = y;
+        }
+
+        // snapped corners in order around the quad, the fourth one completes the parallelogram
+        std::int64_t corner[4][2];
+        for (int i = 0; i < 3; ++i)
+        {
+            corner[i == 2 ? 3 : i][0] = static_cast<std::int64_t>(std::floor(window[i][0] * SUBPIXEL_ONE + 0.5));
+            corner[i == 2 ? 3 : i][1] = static_cast<std::int64_t>(std::floor(window[i][1] * SUBPIXEL_ONE + 0.5));
+        }
+        corner[2][0] = corner[1][0] + corner[3][0] - corner[0][0];
+        corner[2][1] = corner[1][1] + corner[3][1] - corner[0][1];
+        const std::int64_t area = (corner[1][0] - corner[0][0]) * (corner[3][1] - corner[0][1]) - (corner[1][1] - corner[0][1]) * (corner[3][0] - corner[0][0]);
+        if (area == 0)
+            return false;
+        std::int64_t min_x = corner[0][0], max_x = corner[0][0], min_y = corner[0][1], max_y = corner[0][1];
+        for (int i = 0; i < 4; ++i)
+        {
+            const std::int64_t dx = corner[(i + 1) & 3][0] - corner[i][0];
+            const std::int64_t dy = corner[(i + 1) & 3][1] - corner[i][1];
+            // inside is a >= 0 side for either winding, GL does not cull
+            const std::int64_t sign = area > 0 ? 1 : -1;
+            const std::int64_t a = -dy * sign;
+            const std::int64_t b = dx * sign;
+            out_quad.edge_a[i] = a;
+            out_quad.edge_b[i] = b;
+            out_quad.edge_c[i] = -a * corner[i][0] - b * corner[i][1];
+            // top-left rule: pixel centres on left and top edges are in, on the others out
+            out_quad.edge_bias[i] = (a > 0 || (a == 0 && b > 0)) ? 0 : 1;
+            min_x = std::min(min_x, corner[i][0]);
+            max_x = std::max(max_x, corner[i][0]);
+            min_y = std::min(min_y, corner[i][1]);
+            max_y = std::max(max_y, corner[i][1]);
+        }
+        // pixels whose centres lie within the bounds
+        auto first_pixel = [](std::int64_t v) { std::int64_t q, r; FloorDivide(v - SUBPIXEL_HALF, SUBPIXEL_ONE, q, r); return q + (r != 0); };
+        auto last_pixel = [](std::int64_t v) { std::int64_t q, r; FloorDivide(v - SUBPIXEL_HALF, SUBPIXEL_ONE, q, r); return q; };
+        const std::int64_t x0 = std::max<std::int64_t>(first_pixel(min_x), 0);
+        const std::int64_t y0 = std::max<std::int64_t>(first_pixel(min_y), 0);
+        const std::int64_t x1 = std::min<std::int64_t>(last_pixel(max_x), this->width - 1);
+        const std::int64_t y1 = std::min<std::int64_t>(last_pixel(max_y), this->height - 1);
+        if (x0 > x1 || y0 > y1)
+            return false;
+        out_quad.x0 = static_cast<int>(x0);
+        out_quad.y0 = static_cast<int>(y0);
+        out_quad.x1 = static_cast<int>(x1);
+        out_quad.y1 = static_cast<int>(y1);
+
+        // (u, v) of the pixel centre in the unsnapped quad, then the texel coordinates as in test.vert
+        const MemoryTexture& texture = *draw.p_texture;
+        const double ex_x = window[1][0] - window[0][0], ex_y = window[1][1] - window[0][1];
+        const double ey_x = window[2][0] - window[0][0], ey_y = window[2][1] - window[0][1];
+        const double det = ex_x * ey_y - ex_y * ey_x;
+        if (det == 0.0)
+            return false;
+        const double ox = 0.5 - window[0][0], oy = 0.5 - window[0][1];
+        const double u_x = ey_y / det, u_y = -ey_x / det, u_c = (ox * ey_y - oy * ey_x) / det;
+        const double v_x = -ex_y / det, v_y = ex_x / det, v_c = (ex_x * oy - ex_y * ox) / det;
+        const double s_scale = texture.width / 128.0, t_scale = texture.height / 128.0;
+        const double s0 = rect.x * s_scale, s1 = (rect.z - rect.x) * s_scale;
+        const double t0 = rect.y * t_scale, t1 = (rect.w - rect.y) * t_scale;
+        out_quad.s = s0 + s1 * u_c;
+        out_quad.s_x = s1 * u_x;
+        out_quad.s_y = s1 * u_y;
+        out_quad.t = t0 + t1 * v_c;
+        out_quad.t_x = t1 * v_x;
+        out_quad.t_y = t1 * v_y;
+
+        // ColorMult and ColorAdd of test.vert, on bytes
+        out_quad.mult[0] = (color.x >> 4) / 15.0f;
+        out_quad.mult[1] = (color.y >> 4) / 15.0f;
+        out_quad.mult[2] = (color.z >> 4) / 15.0f;
+        out_quad.mult[3] = color.w / 255.0f;
+        out_quad.add[0] = static_cast<float>((color.x & 15) * 17);
+        out_quad.add[1] = static_cast<float>((color.y & 15) * 17);
+        out_quad.add[2] = static_cast<float>((color.z & 15) * 17);
+        out_quad.add[3] = 0.0f;
+        out_quad.p_texture = &texture;
+        out_quad.p_palette = nullptr;
+        if (texture.palette_count)
+            out_quad.p_palette = texture.p_palette_data + RenderDevice::PALETTE_SIZE * std::min<std::uint32_t>(palette, texture.palette_count - 1);
+        return true;
+    }
+
+    void SoftwareCommandExecutor::fillBin(std::size_t bin)
+    {
+        const int bin_x0 = static_cast<int>(bin % this->bin_column_count) * BIN_SIZE;
+        const int bin_y0 = static_cast<int>(bin / this->bin_column_count) * BIN_SIZE;
+        const int bin_x1 = std::min(bin_x0 + BIN_SIZE, this->width) - 1;
+        const int bin_y1 = std::min(bin_y0 + BIN_SIZE, this->height) - 1;
+        std::uint32_t* const p_frame_buffer = this->frame_buffer.data();
+        std::uint64_t pixel_count = 0;
+        for (std::uint32_t quad_index : this->bin_list[bin])
+        {
+            const Quad& quad = this->quad_list[quad_index];
+            const int y0 = std::max(quad.y0, bin_y0);
+            const int y1 = std::min(quad.y1, bin_y1);
+            const int x0 = std::max(quad.x0, bin_x0);
+            const int x1 = std::min(quad.x1, bin_x1);
+            if (y0 > y1 || x0 > x1)
+                continue;
+
+            // Columns each edge lets through at row y0. a * (256 x + 128) >= bias - c - b * Y
+            // bounds x from below for a > 0 and from above for a < 0.
+            EdgeStepper stepper_list[4];
+            int lower_list[4];
+            int upper_list[4];
+            int lower_count = 0;
+            int upper_count = 0;
+            int flat_list[4];
+            int flat_count = 0;
+            const std::int64_t first_y = SUBPIXEL_ONE * y0 + SUBPIXEL_HALF;
+            for (int i = 0; i < 4; ++i)
+            {
+                const std::int64_t a = quad.edge_a[i];
+                const std::int64_t b = quad.edge_b[i];
+                if (a == 0)
+                {
+                    flat_list[flat_count++] = i;
+                    continue;
+                }
+                const std::int64_t bound = quad.edge_bias[i] - quad.edge_c[i] - a * SUBPIXEL_HALF - b * first_y;
+                const std::int64_t row_step = -b * SUBPIXEL_ONE;
+                EdgeStepper& stepper = stepper_list[i];
+                stepper.denominator = (a > 0 ? a : -a) * SUBPIXEL_ONE;
+                FloorDivide(a > 0 ? bound : -bound, stepper.denominator, stepper.quotient, stepper.remainder);
+                FloorDivide(a > 0 ? row_step : -row_step, stepper.denominator, stepper.step_quotient, stepper.step_remainder);
+                if (a > 0)
+                    lower_list[lower_count++] = i;
+                else
+                    upper_list[upper_count++] = i;
+            }
+
+            const MemoryTexture& texture = *quad.p_texture;
+            const std::uint32_t* const p_palette = quad.p_palette;
+            const std::int64_t s_step = static_cast<std::int64_t>(std::floor(quad.s_x * (1 << TEXEL_BITS) + 0.5));
+            const std::int64_t t_step = static_cast<std::int64_t>(std::floor(quad.t_x * (1 << TEXEL_BITS) + 0.5));
+            const simd::Float4 mult = simd::Load(quad.mult);
+            const simd::Float4 add = simd::Load(quad.add);
+            // opaque texels cover the pixel when the tile colour keeps the alpha
+            const bool opaque = quad.mult[3] == 1.0f;
+            for (int y = y0; y <= y1; ++y)
+            {
+                std::int64_t begin = x0;
+                std::int64_t end = x1;
+                for (int j = 0; j < lower_count; ++j)
+                {
+                    EdgeStepper& stepper = stepper_list[lower_list[j]];
+                    begin = std::max(begin, stepper.quotient + (stepper.remainder != 0));
+                    stepper.step();
+                }
+                for (int j = 0; j < upper_count; ++j)
+                {
+                    EdgeStepper& stepper = stepper_list[upper_list[j]];
+                    end = std::min(end, stepper.quotient);
+                    stepper.step();
+                }
+                bool inside = true;
+                const std::int64_t row_y = SUBPIXEL_ONE * y + SUBPIXEL_HALF;
+                for (int j = 0; j < flat_count; ++j)
+                {
+                    const int i = flat_list[j];
+                    inside = inside && quad.edge_b[i] * row_y + quad.edge_c[i] >= quad.edge_bias[i];
+                }
+                if (!inside || begin > end)
+                    continue;
+                pixel_count += end - begin + 1;
+
+                std::int64_t s = static_cast<std::int64_t>(std::floor((quad.s + quad.s_x * begin + quad.s_y * y) * (1 << TEXEL_BITS) + 0.5));
+                std::int64_t t = static_cast<std::int64_t>(std::floor((quad.t + quad.t_x * begin + quad.t_y * y) * (1 << TEXEL_BITS) + 0.5));
+                const std::size_t span = static_cast<std::size_t>(end - begin + 1);
+                std::uint32_t* const p_span = p_frame_buffer + static_cast<std::size_t>(y) * this->width + begin;
+                // a span that stays inside the texture needs no repeat
+                const std::int64_t last_s = s + s_step * static_cast<std::int64_t>(span - 1);
+                const std::int64_t last_t = t + t_step * static_cast<std::int64_t>(span - 1);
+                const bool wrap = std::min(s, last_s) < 0 || (std::max(s, last_s) >> TEXEL_BITS) >= texture.width || std::min(t, last_t) < 0 || (std::max(t, last_t) >> TEXEL_BITS) >= texture.height;
+                if (p_palette)
+                {
+                    if (wrap)
+                        FillSpan<true, true>(p_span, span, s, t, s_step, t_step, texture, p_palette, opaque, mult, add);
+                    else
+                        FillSpan<true, false>(p_span, span, s, t, s_step, t_step, texture, p_palette, opaque, mult, add);
+                }
+                else
+                {
+                    if (wrap)
+                        FillSpan<false, true>(p_span, span, s, t, s_step, t_step, texture, p_palette, opaque, mult, add);
+                    else
+                        FillSpan<false, false>(p_span, span, s, t, s_step, t_step, texture, p_palette, opaque, mult, add);
+                }
+            }
+        }
+        this->bin_pixel_count_list[bin] = pixel_count;
+    }
+}
@@ -0,0 +1,112 @@
+//
+//  software_executor.h
+//  SDL2-904
+//
+//  Created by Huang Wei on 14-5-25.
+//  Copyright (c) 2014年 hweigame. All rights reserved.
+//
+
+#ifndef __SDL2_904__software_executor__
+#define __SDL2_904__software_executor__
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include "command.h"
+#include "renderer.h"
+
+namespace hardrock
+{
+    class ThreadPool;
+
+    // Draws render commands on the CPU into an RGBA framebuffer, with the shading of test.vert and
+    // test.frag and GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA blending. Quads are set up and sorted
+    // into screen bins at END_FRAME, then the bins are filled in parallel, each keeping the draw
+    // order. Pixel centres and the top-left fill rule follow GL on 8 subpixel bits, texels are
+    // sampled nearest with repeat. The output is the same on every SIMD backend.
+    class SoftwareCommandExecutor : public IRenderCommandExecutor
+    {
+    public:
+        // bins are BIN_SIZE x BIN_SIZE pixels
+        static const int BIN_SIZE = 64;
+    private:
+        // a tile ready to be filled, in framebuffer pixels with row 0 at the top
+        struct Quad
+        {
+            // inclusive pixel bounds
+            int x0, y0, x1, y1;
+            // edge i is a * X + b * Y + c >= bias at subpixel (X, Y), for the 4 edges
+            std::int64_t edge_a[4];
+            std::int64_t edge_b[4];
+            std::int64_t edge_c[4];
+            std::int64_t edge_bias[4];
+            // texel coordinate at pixel centre (x, y) is s + s_x * x + s_y * y, the same for t
+            double s, s_x, s_y;
+            double t, t_x, t_y;
+            // ColorMult scaled to bytes, ColorAdd in bytes, as RGBA
+            float mult[4];
+            float add[4];
+            const MemoryTexture* p_texture;
+            // palette row of an INDEX8 texture, null otherwise
+            const std::uint32_t* p_palette;
+        };
+        // one draw of the frame, the uniforms and the atlas it was made with
+        struct Draw
+        {
+            std::size_t first_tile;
+            std::size_t tile_count;
+            // quads of the draws before
+            std::size_t quad_offset;
+            float translate[2];
+            float transform[4];
+            const MemoryTexture* p_texture;
+        };
+        const int width;
+        const int height;
+        const RenderDevice::RenderPath render_path;
+        const std::size_t tile_data_size;
+        const std::size_t region_size;
+        ThreadPool* const p_thread_pool;
+        const int bin_column_count;
+        const int bin_row_count;
+        std::vector<std::uint8_t> tile_buffer;
+        std::vector<std::uint32_t> frame_buffer;
+        std::unordered_map<std::uint32_t, MemoryTexture> texture_map;
+        // uniforms and bindings as the commands left them
+        float translate[2];
+        float transform[4];
+        const MemoryTexture* p_texture;
+        std::size_t instance_tile;
+        std::vector<Draw> draw_list;
+        std::vector<Quad> quad_list;
+        // quads that cover nothing on screen are left out of the bins
+        std::vector<std::uint8_t> quad_visible_list;
+        // quad indices per bin, in draw order
+        std::vector<std::vector<std::uint32_t>> bin_list;
+        std::vector<std::uint64_t> bin_pixel_count_list;
+        std::uint64_t pixel_count;
+
+        void addDraw(std::size_t first_tile, std::size_t tile_count);
+        // set up the quads of quad_list[begin, end)
+        void setupQuads(std::size_t begin, std::size_t end);
+        bool setupQuad(const Draw& draw, const std::uint8_t* p_tile_data, Quad& out_quad) const;
+        void fillBin(std::size_t bin);
+        // draw what was recorded since the last flush
+        void flush();
+    public:
+        SoftwareCommandExecutor(int width, int height, RenderDevice::RenderPath render_path, RenderDevice::BufferMode buffer_mode, std::size_t tile_capacity, ThreadPool* p_thread_pool);
+        std::uint8_t* MapRegion(std::size_t ring_slot, RenderFrameStats& stats) override;
+        int Execute(const RenderCommandBuffer& command_buffer, RenderFrameStats& stats) override;
+        void SetTexture(std::uint32_t texture, const MemoryTexture* p_texture) override;
+        // rgba is R | G << 8 | B << 16 | A << 24, as every pixel
+        void Clear(std::uint32_t rgba);
+        int GetWidth() const { return this->width; }
+        int GetHeight() const { return this->height; }
+        // width x height pixels, row 0 at the top of the screen
+        const std::uint32_t* GetPixels() const { return this->frame_buffer.data(); }
+        // pixels the quads of the last frame covered, every layer of overdraw counts
+        std::uint64_t GetPixelCount() const { return this->pixel_count; }
+    };
+}
+
+#endif /* defined(__SDL2_904__software_executor__) */
@@ -9,17 +9,23 @@
 #include "structure.h"
 #include <cassert>
 #include <limits>
+#include <algorithm>
+#include <iterator>
+#include <cstdio>
 
 namespace hardrock
 {
-    CircleLinkedListPool::CircleLinkedListPool(size_t size)
+    template<typename Index>
+    BasicCircleLinkedListPool<Index>::BasicCircleLinkedListPool(size_t size)
     : data_list(size)
     {
-        assert(size <= std::numeric_limits<IndexType>::max() + 1);
+        assert(size - 1 <= std::numeric_limits<IndexType>::max());
         LinkedData* p_base = &this->data_list[0];
-        IndexType i_prev = size - 1;
+        IndexType i_prev = static_cast<IndexType>(size - 1);
         LinkedData* p_prev = p_base + i_prev;
-        for (IndexType i = 0; i < size; ++i) {
+        // size_t counter, the last index may be the maximum of IndexType
+        for (size_t s = 0; s < size; ++s) {
+            const IndexType i = static_cast<IndexType>(s);
             LinkedData* p_curr = p_base + i;
             p_curr->prev = i_prev;
             p_prev->next = i;
@@ -28,7 +34,8 @@ namespace hardrock
         }
     }
     
-    CircleLinkedListPool::IndexType CircleLinkedListPool::MoveTo(IndexType idx_curr, IndexType idx_head)
+    template<typename Index>
+    typename BasicCircleLinkedListPool<Index>::IndexType BasicCircleLinkedListPool<Index>::MoveTo(IndexType idx_curr, IndexType idx_head)
     {
         assert(static_cast<size_t>(idx_curr) < this->data_list.size());
         assert(static_cast<size_t>(idx_head) < this->data_list.size());
@@ -58,7 +65,8 @@ namespace hardrock
         return idx_next;
     }
 
-    void CircleLinkedListPool::Cross(IndexType idx_head0, IndexType idx_head1)
+    template<typename Index>
+    void BasicCircleLinkedListPool<Index>::Cross(IndexType idx_head0, IndexType idx_head1)
     {
         assert(static_cast<size_t>(idx_head0) < this->data_list.size());
         assert(static_cast<size_t>(idx_head1) < this->data_list.size());
@@ -77,7 +85,8 @@ namespace hardrock
         p_tail0->prev = idx_head1;
     }
 
-    CircleLinkedListPool::IndexType CircleLinkedListPool::Next(IndexType idx_curr) const
+    template<typename Index>
+    typename BasicCircleLinkedListPool<Index>::IndexType BasicCircleLinkedListPool<Index>::Next(IndexType idx_curr) const
     {
         assert(static_cast<size_t>(idx_curr) < this->data_list.size());
         const LinkedData* p_base = &this->data_list[0];
@@ -85,171 +94,419 @@ namespace hardrock
         return p_curr->next;
     }
 
-    CircleLinkedListPool::IndexType CircleLinkedListPool::Prev(IndexType idx_curr) const
+    template<typename Index>
+    typename BasicCircleLinkedListPool<Index>::IndexType BasicCircleLinkedListPool<Index>::Prev(IndexType idx_curr) const
     {
         assert(static_cast<size_t>(idx_curr) < this->data_list.size());
         const LinkedData* p_base = &this->data_list[0];
         const LinkedData* p_curr = p_base + idx_curr;
         return p_curr->prev;
     }
+    
+    template class BasicCircleLinkedListPool<std::uint16_t>;
+    template class BasicCircleLinkedListPool<std::uint32_t>;
 
-    SimpleMemoryAllocator::SimpleMemoryAllocator(std::size_t size)
+    namespace
     {
-        free_list.push_back({0, size});
+        int HighestBit(std::uint64_t v)
+        {
+            assert(v != 0);
+#if defined(__GNUC__)
+            return 63 - __builtin_clzll(v);
+#else
+            int bit = 0;
+            while (v >>= 1)
+                ++bit;
+            return bit;
+#endif
+        }
+        
+        int LowestBit(std::uint64_t v)
+        {
+            assert(v != 0);
+#if defined(__GNUC__)
+            return __builtin_ctzll(v);
+#else
+            int bit = 0;
+            while (!(v & 1))
+            {
+                v >>= 1;
+                ++bit;
+            }
+            return bit;
+#endif
+        }
     }
     
-    int SimpleMemoryAllocator::Allocate(std::size_t size, std::size_t& out_pos)
+    TlsfAllocator::TlsfAllocator(std::size_t size)
+    : first_block_id(0)
+    , first_level_map(0)
+    , free_size(0)
+    , free_block_count(0)
+    , used_block_count(0)
     {
-        auto cmp = [](const FreeSpace& free_space, std::size_t s)
-        {
-            return free_space.size < s;
-        };
-        auto iter = std::lower_bound(this->free_list.begin(), this->free_list.end(), size, cmp);
-        if (iter == this->free_list.end())
-            return 1;
-        out_pos = iter->pos;
-        if (iter->size == size)
+        std::fill(std::begin(this->second_level_map), std::end(this->second_level_map), 0);
+        for (auto& bin_head_row : this->bin_head_list)
         {
-            this->free_list.erase(iter);
+            for (auto& bin_head : bin_head_row)
+            {
+                bin_head = NONE;
+            }
         }
-        else
+        this->block_list.push_back({0, size, NONE, NONE, NONE, NONE, false});
+        if (size > 0)
+            this->insertFree(0);
+    }
+    
+    TlsfAllocator::BlockIdType TlsfAllocator::newBlock()
+    {
+        if (!this->unused_block_list.empty())
         {
-            iter->pos += size;
-            iter->size -= size;
+            const BlockIdType block_id = this->unused_block_list.back();
+            this->unused_block_list.pop_back();
+            return block_id;
         }
-        return 0;
+        this->block_list.push_back(Block());
+        return static_cast<BlockIdType>(this->block_list.size() - 1);
+    }
+    
+    void TlsfAllocator::releaseBlock(BlockIdType block_id)
+    {
+        // not used any more, so a second Free of the id is refused until newBlock hands it out again
+        this->block_list[block_id].used = false;
+        this->unused_block_list.push_back(block_id);
+    }
+    
+    void TlsfAllocator::insertFree(BlockIdType block_id)
+    {
+        Block& block = this->block_list[block_id];
+        int first_level;
+        int second_level;
+        MapSize(block.size, first_level, second_level);
+        BlockIdType& head = this->bin_head_list[first_level][second_level];
+        block.used = false;
+        block.prev_free = NONE;
+        block.next_free = head;
+        if (head != NONE)
+            this->block_list[head].prev_free = block_id;
+        head = block_id;
+        this->first_level_map |= static_cast<std::uint64_t>(1) << first_level;
+        this->second_level_map[first_level] |= 1u << second_level;
+        this->free_size += block.size;
+        ++this->free_block_count;
     }
     
-    int SimpleMemoryAllocator::Free(std::size_t pos, std::size_t size)
+    void TlsfAllocator::removeFree(BlockIdType block_id)
     {
-        if (this->free_list.size() == 0)
+        Block& block = this->block_list[block_id];
+        if (block.prev_free != NONE)
+            this->block_list[block.prev_free].next_free = block.next_free;
+        if (block.next_free != NONE)
+            this->block_list[block.next_free].prev_free = block.prev_free;
+        int first_level;
+        int second_level;
+        MapSize(block.size, first_level, second_level);
+        BlockIdType& head = this->bin_head_list[first_level][second_level];
+        if (head == block_id)
         {
-            this->free_list.push_back({pos, size});
-            return 0;
+            head = block.next_free;
+            if (head == NONE)
+            {
+                this->second_level_map[first_level] &= ~(1u << second_level);
+                if (this->second_level_map[first_level] == 0)
+                    this->first_level_map &= ~(static_cast<std::uint64_t>(1) << first_level);
+            }
         }
-        auto cmp = [](std::size_t p, const FreeSpace& free_space)
+        this->free_size -= block.size;
+        --this->free_block_count;
+    }
+    
+    void TlsfAllocator::MapSize(std::size_t size, int& out_first_level, int& out_second_level)
+    {
+        if (size < SECOND_LEVEL_COUNT)
         {
-            return p < free_space.pos;
-        };
-        auto iter = std::upper_bound(this->free_list.begin(), this->free_list.end(), pos, cmp);
-        if (iter == this->free_list.begin())
+            out_first_level = 0;
+            out_second_level = static_cast<int>(size);
+            return;
+        }
+        const int bit = HighestBit(size);
+        out_first_level = bit - SECOND_LEVEL_BITS + 1;
+        out_second_level = static_cast<int>(size >> (bit - SECOND_LEVEL_BITS)) & (SECOND_LEVEL_COUNT - 1);
+    }
+    
+    int TlsfAllocator::Allocate(std::size_t size, std::size_t& out_pos, BlockIdType& out_block_id)
+    {
+        if (size == 0)
+            return 1;
+        // round up to the next bin, every block there or above fits
+        std::size_t search_size = size;
+        if (size >= SECOND_LEVEL_COUNT)
         {
-            // free block is at the front of the list
-            std::size_t end = pos + size;
-            if (end < iter->pos)
-            {
-                this->free_list.insert(iter, {pos, size});
-                return 0;
-            }
-            else if (end == iter->pos)
-            {
-                iter->pos = pos;
-                iter->size += size;
-                return 0;
-            }
-            else
-            {
+            const std::size_t round = (static_cast<std::size_t>(1) << (HighestBit(size) - SECOND_LEVEL_BITS)) - 1;
+            if (size > std::numeric_limits<std::size_t>::max() - round)
                 return 1;
-            }
+            search_size = size + round;
         }
-        if (iter == this->free_list.end())
+        int first_level;
+        int second_level;
+        MapSize(search_size, first_level, second_level);
+        BlockIdType block_id = NONE;
+        std::uint32_t second_level_bits = this->second_level_map[first_level] & (~0u << second_level);
+        if (second_level_bits == 0 && first_level + 1 < FIRST_LEVEL_COUNT)
         {
-            // free block is at the end of the list
-            --iter;
-            std::size_t free_end = iter->pos + iter->size;
-            if (free_end < pos)
+            const std::uint64_t first_level_bits = this->first_level_map & (~static_cast<std::uint64_t>(0) << (first_level + 1));
+            if (first_level_bits != 0)
             {
-                this->free_list.push_back({pos, size});
-                return 0;
+                first_level = LowestBit(first_level_bits);
+                second_level_bits = this->second_level_map[first_level];
             }
-            else if (free_end == pos)
+        }
+        if (second_level_bits != 0)
+        {
+            block_id = this->bin_head_list[first_level][LowestBit(second_level_bits)];
+        }
+        else
+        {
+            // nothing in the bins above, a block of the bin of size itself may still be large enough
+            MapSize(size, first_level, second_level);
+            for (block_id = this->bin_head_list[first_level][second_level]; block_id != NONE; block_id = this->block_list[block_id].next_free)
             {
-                iter->size += size;
-                return 0;
+                if (this->block_list[block_id].size >= size)
+                    break;
             }
-            else
-            {
+            if (block_id == NONE)
                 return 1;
-            }
         }
+        this->removeFree(block_id);
+        
+        // the rest of the block stays free right after it
+        if (this->block_list[block_id].size > size)
         {
-            std::size_t end = pos + size;
-            if (end > iter->pos)
-                return 1;
-            auto prev_iter = iter - 1;
-            std::size_t free_end = prev_iter->pos + prev_iter->size;
-            if (pos < free_end)
-                return 1;
-            if (end == iter->pos && pos == free_end)
-            {
-                prev_iter->size += size + iter->size;
-                this->free_list.erase(iter);
-                return 0;
-            }
-            if (end == iter->pos)
-            {
-                iter->pos = pos;
-                iter->size += size;
-                return 0;
-            }
-            if (pos == free_end)
+            const BlockIdType rest_id = this->newBlock();
+            Block& block = this->block_list[block_id];
+            Block& rest = this->block_list[rest_id];
+            rest.pos = block.pos + size;
+            rest.size = block.size - size;
+            rest.prev = block_id;
+            rest.next = block.next;
+            if (block.next != NONE)
+                this->block_list[block.next].prev = rest_id;
+            block.next = rest_id;
+            block.size = size;
+            this->insertFree(rest_id);
+        }
+        Block& block = this->block_list[block_id];
+        block.used = true;
+        ++this->used_block_count;
+        out_pos = block.pos;
+        out_block_id = block_id;
+        return 0;
+    }
+    
+    int TlsfAllocator::Free(BlockIdType block_id)
+    {
+        if (block_id >= this->block_list.size() || !this->block_list[block_id].used)
+            return 1;
+        --this->used_block_count;
+        BlockIdType merged_id = block_id;
+        const BlockIdType prev_id = this->block_list[block_id].prev;
+        if (prev_id != NONE && !this->block_list[prev_id].used)
+        {
+            this->removeFree(prev_id);
+            Block& prev = this->block_list[prev_id];
+            const Block& block = this->block_list[block_id];
+            prev.size += block.size;
+            prev.next = block.next;
+            if (block.next != NONE)
+                this->block_list[block.next].prev = prev_id;
+            this->releaseBlock(block_id);
+            merged_id = prev_id;
+        }
+        const BlockIdType next_id = this->block_list[merged_id].next;
+        if (next_id != NONE && !this->block_list[next_id].used)
+        {
+            this->removeFree(next_id);
+            Block& merged = this->block_list[merged_id];
+            const Block& next = this->block_list[next_id];
+            merged.size += next.size;
+            merged.next = next.next;
+            if (next.next != NONE)
+                this->block_list[next.next].prev = merged_id;
+            this->releaseBlock(next_id);
+        }
+        this->insertFree(merged_id);
+        return 0;
+    }
+    
+    int TlsfAllocator::SlideDown(BlockIdType block_id, std::size_t& out_pos)
+    {
+        if (block_id >= this->block_list.size() || !this->block_list[block_id].used)
+            return 1;
+        const BlockIdType free_id = this->block_list[block_id].prev;
+        if (free_id == NONE || this->block_list[free_id].used)
+        {
+            out_pos = this->block_list[block_id].pos;
+            return 0;
+        }
+        this->removeFree(free_id);
+        Block& block = this->block_list[block_id];
+        Block& free_block = this->block_list[free_id];
+        // swap places, merges keep the lower block so the free one is not merged into yet
+        const BlockIdType prev_id = free_block.prev;
+        const BlockIdType next_id = block.next;
+        block.pos = free_block.pos;
+        free_block.pos = block.pos + block.size;
+        block.prev = prev_id;
+        block.next = free_id;
+        free_block.prev = block_id;
+        free_block.next = next_id;
+        if (prev_id != NONE)
+            this->block_list[prev_id].next = block_id;
+        else
+            this->first_block_id = block_id;
+        if (next_id != NONE)
+        {
+            this->block_list[next_id].prev = free_id;
+            if (!this->block_list[next_id].used)
             {
-                prev_iter->size += size;
-                return 0;
+                this->removeFree(next_id);
+                Block& next = this->block_list[next_id];
+                free_block.size += next.size;
+                free_block.next = next.next;
+                if (next.next != NONE)
+                    this->block_list[next.next].prev = free_id;
+                this->releaseBlock(next_id);
             }
+        }
+        this->insertFree(free_id);
+        out_pos = block.pos;
+        return 0;
+    }
+    
+    TlsfAllocator::Stats TlsfAllocator::GetStats() const
+    {
+        Stats stats;
+        stats.free_size = this->free_size;
+        stats.largest_free_size = 0;
+        stats.free_block_count = this->free_block_count;
+        stats.used_block_count = this->used_block_count;
+        if (this->first_level_map != 0)
+        {
+            const int first_level = HighestBit(this->first_level_map);
+            const int second_level = HighestBit(this->second_level_map[first_level]);
+            for (BlockIdType block_id = this->bin_head_list[first_level][second_level]; block_id != NONE; block_id = this->block_list[block_id].next_free)
             {
-                this->free_list.insert(iter, {pos, size});
-                return 0;
+                stats.largest_free_size = std::max(stats.largest_free_size, this->block_list[block_id].size);
             }
         }
+        stats.fragmentation = stats.free_size == 0 ? 0.0f : 1.0f - static_cast<float>(stats.largest_free_size) / stats.free_size;
+        return stats;
     }
     
-    void SimpleMemoryAllocator::DebugPrint() const
+    void TlsfAllocator::DebugPrint() const
     {
-        printf("SimpleMemoryPool\n");
-        for (auto free_space : this->free_list)
+        printf("TlsfAllocator\n");
+        for (BlockIdType block_id = this->first_block_id; block_id != NONE; block_id = this->block_list[block_id].next)
         {
-            printf("%lu %lu\n", free_space.pos, free_space.size);
+            const Block& block = this->block_list[block_id];
+            printf("%zu %zu%s\n", block.pos, block.size, block.used ? " used" : "");
         }
     }
     
-    ObjRef::ObjRef()
-    : ref_data(0)
+    template<int IndexBits>
+    BasicSlotMap<IndexBits>::BasicSlotMap(std::size_t capacity)
+    : free_head(NONE)
+    , free_tail(NONE)
+    {
+        assert(capacity <= MAX_SIZE);
+        this->slot_list.reserve(capacity);
+        this->generation_list.reserve(capacity);
+        this->element_slot_list.reserve(capacity);
+    }
+    
+    template<int IndexBits>
+    int BasicSlotMap<IndexBits>::Create(HandleType& out_handle)
     {
+        std::uint32_t slot = this->free_head;
+        if (slot != NONE)
+        {
+            this->free_head = this->slot_list[slot];
+            if (this->free_head == NONE)
+                this->free_tail = NONE;
+        }
+        else
+        {
+            if (this->slot_list.size() >= MAX_SIZE)
+                return 1;
+            slot = static_cast<std::uint32_t>(this->slot_list.size());
+            this->slot_list.push_back(0);
+            this->generation_list.push_back(1);
+        }
+        this->slot_list[slot] = static_cast<std::uint32_t>(this->element_slot_list.size());
+        this->element_slot_list.push_back(slot);
+        out_handle = this->generation_list[slot] << IndexBits | slot;
+        return 0;
     }
     
-    ObjRef::ObjRef(std::uint32_t ref_data)
-    : ref_data(ref_data)
+    template<int IndexBits>
+    int BasicSlotMap<IndexBits>::Find(HandleType handle, std::size_t& out_index) const
     {
+        if (!this->Contains(handle))
+            return 1;
+        out_index = this->slot_list[handle & INDEX_MASK];
+        return 0;
     }
     
-    ObjRef::ModifyHandle::ModifyHandle(ObjRef* p_obj_ref)
-    : p_obj_ref(p_obj_ref)
+    template<int IndexBits>
+    bool BasicSlotMap<IndexBits>::Contains(HandleType handle) const
     {
+        const std::uint32_t slot = handle & INDEX_MASK;
+        // a free slot already has the next generation
+        return slot < this->slot_list.size() && this->generation_list[slot] == handle >> IndexBits;
     }
     
-    ObjRef::ModifyHandle::Pool::Pool(std::size_t size)
-    : ref_item_pool(size)
-    , ref_item_buffer(size)
+    template<int IndexBits>
+    int BasicSlotMap<IndexBits>::Remove(HandleType handle, std::size_t& out_index)
     {
-        this->ref_item_pool.MoveTo(USED_LIST_HEAD, USED_LIST_HEAD);
+        std::size_t index;
+        if (this->Find(handle, index) != 0)
+            return 1;
+        const std::uint32_t slot = handle & INDEX_MASK;
+        const std::uint32_t last_slot = this->element_slot_list.back();
+        this->element_slot_list[index] = last_slot;
+        this->slot_list[last_slot] = static_cast<std::uint32_t>(index);
+        this->element_slot_list.pop_back();
+        
+        std::uint32_t& generation = this->generation_list[slot];
+        generation = (generation + 1) & (~static_cast<std::uint32_t>(0) >> IndexBits);
+        if (generation == 0)
+            generation = 1;
+        this->slot_list[slot] = NONE;
+        if (this->free_tail != NONE)
+            this->slot_list[this->free_tail] = slot;
+        else
+            this->free_head = slot;
+        this->free_tail = slot;
+        out_index = index;
+        return 0;
     }
     
-    std::unique_ptr<ObjRef, ObjRef::Deleter> ObjRef::ModifyHandle::Pool::CreateObjRef(std::uint32_t ref_data, ModifyHandle* p_modify_handle)
+    template<int IndexBits>
+    typename BasicSlotMap<IndexBits>::HandleType BasicSlotMap<IndexBits>::HandleAt(std::size_t index) const
     {
-        const auto next_free_idx = this->ref_item_pool.Next(FREE_LIST_HEAD);
-        if (next_free_idx == FREE_LIST_HEAD)
-            return nullptr;
-        this->ref_item_pool.MoveTo(next_free_idx, USED_LIST_HEAD);
-        auto p_ref_item = &this->ref_item_buffer[next_free_idx];
-        p_ref_item->ref_data = ref_data;
-        p_modify_handle->p_obj_ref = p_ref_item;
-        return std::unique_ptr<ObjRef, ObjRef::Deleter>(p_ref_item);
+        assert(index < this->element_slot_list.size());
+        const std::uint32_t slot = this->element_slot_list[index];
+        return this->generation_list[slot] << IndexBits | slot;
     }
     
-    void ObjRef::ModifyHandle::Pool::Remove(ModifyHandle modify_handle)
+    template<int IndexBits>
+    void BasicSlotMap<IndexBits>::Clear()
     {
-        const auto ref_idx =  modify_handle.p_obj_ref - &this->ref_item_buffer[0];
-        this->ref_item_pool.MoveTo(ref_idx, FREE_LIST_HEAD);
+        std::size_t index;
+        while (!this->element_slot_list.empty())
+            this->Remove(this->HandleAt(this->element_slot_list.size() - 1), index);
     }
+    
+    template class BasicSlotMap<16>;
+    template class BasicSlotMap<20>;
 }
\ No newline at end of file
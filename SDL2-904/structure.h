@@ -14,10 +14,12 @@
 
 namespace hardrock
 {
-    class CircleLinkedListPool
+    // Index is the unsigned type of the links, it limits the pool to its range.
+    template<typename Index>
+    class BasicCircleLinkedListPool
     {
     public:
-        typedef std::uint16_t IndexType;
+        typedef Index IndexType;
     private:
         struct LinkedData
         {
@@ -26,7 +28,7 @@ namespace hardrock
         };
         std::vector<LinkedData> data_list;
     public:
-        CircleLinkedListPool(size_t size);
+        BasicCircleLinkedListPool(size_t size);
         size_t Size() const { return this->data_list.size(); }
         // Move a element to another circle.
         // If it move to it self, a new circle is created.
@@ -38,60 +40,112 @@ namespace hardrock
         IndexType Next(IndexType idx_curr) const;
         IndexType Prev(IndexType idx_curr) const;
     };
+    typedef BasicCircleLinkedListPool<std::uint16_t> CircleLinkedListPool;
     
-    class SimpleMemoryAllocator
+    // Two-level segregated fit over the offsets [0, size), for sub-allocating a buffer. Free blocks
+    // are binned by the highest bit of their size, then by the SECOND_LEVEL_BITS bits below it, and
+    // bitmaps of the bins that are not empty find a fitting one, so Allocate and Free are O(1).
+    // A freed block merges with its free neighbours at once. Blocks are kept outside the buffer.
+    class TlsfAllocator
     {
-        struct FreeSpace
+    public:
+        typedef std::uint32_t BlockIdType;
+        struct Stats
+        {
+            std::size_t free_size;
+            std::size_t largest_free_size;
+            std::size_t free_block_count;
+            std::size_t used_block_count;
+            // 1 - largest_free_size / free_size, 0 while the free space is one block
+            float fragmentation;
+        };
+    private:
+        static const int SECOND_LEVEL_BITS = 4;
+        static const std::size_t SECOND_LEVEL_COUNT = 1 << SECOND_LEVEL_BITS;
+        // sizes below SECOND_LEVEL_COUNT share the first level 0
+        static const int FIRST_LEVEL_COUNT = sizeof(std::size_t) * 8 - SECOND_LEVEL_BITS + 1;
+        static const BlockIdType NONE = ~static_cast<BlockIdType>(0);
+        struct Block
         {
             std::size_t pos;
             std::size_t size;
+            // neighbours in the buffer
+            BlockIdType prev;
+            BlockIdType next;
+            // neighbours in the bin of a free block
+            BlockIdType prev_free;
+            BlockIdType next_free;
+            bool used;
         };
-        std::vector<FreeSpace> free_list;
+        std::vector<Block> block_list;
+        // entries of block_list that merged away, for reuse
+        std::vector<BlockIdType> unused_block_list;
+        BlockIdType first_block_id;
+        std::uint64_t first_level_map;
+        std::uint32_t second_level_map[FIRST_LEVEL_COUNT];
+        BlockIdType bin_head_list[FIRST_LEVEL_COUNT][SECOND_LEVEL_COUNT];
+        std::size_t free_size;
+        std::size_t free_block_count;
+        std::size_t used_block_count;
+        static void MapSize(std::size_t size, int& out_first_level, int& out_second_level);
+        BlockIdType newBlock();
+        void releaseBlock(BlockIdType block_id);
+        void insertFree(BlockIdType block_id);
+        void removeFree(BlockIdType block_id);
     public:
-        SimpleMemoryAllocator(std::size_t size);
-        int Allocate(std::size_t size, std::size_t& out_pos);
-        int Free(std::size_t pos, std::size_t size);
+        TlsfAllocator(std::size_t size);
+        // out_block_id frees the block again
+        int Allocate(std::size_t size, std::size_t& out_pos, BlockIdType& out_block_id);
+        int Free(BlockIdType block_id);
+        // Move a used block down to the start of the free space right before it, which then follows
+        // it and merges with what is free after. For compaction, the caller moves the data.
+        int SlideDown(BlockIdType block_id, std::size_t& out_pos);
+        // offset of a used block
+        std::size_t GetPos(BlockIdType block_id) const { return this->block_list[block_id].pos; }
+        // O(1) but for largest_free_size, which walks the largest bin
+        Stats GetStats() const;
         void DebugPrint() const;
     };
 
 
-    class ObjRef
+    // Handles to the elements of dense arrays kept by the owner, one array per field. A handle is
+    // a slot index in the low IndexBits bits and the generation of the slot above them. Removing
+    // bumps the generation, so a stale handle is refused even once its slot is reused, and 0 is
+    // never a handle. Elements only move by the swap of Remove, which the owner repeats.
+    template<int IndexBits>
+    class BasicSlotMap
     {
     public:
-        struct Deleter
-        {
-            void operator () (ObjRef* p_obj_ref) const
-            {
-                p_obj_ref->ref_data = 0;
-            }
-        };
-        class ModifyHandle
-        {
-            ObjRef* p_obj_ref;
-            ModifyHandle(ObjRef* p_obj_ref);
-        public:
-            ModifyHandle() { }
-            std::uint32_t &RefData() const { return this->p_obj_ref->ref_data; }
-            class Pool
-            {
-                CircleLinkedListPool ref_item_pool;
-                std::vector<ObjRef> ref_item_buffer;
-                static const CircleLinkedListPool::IndexType FREE_LIST_HEAD = 0;
-                static const CircleLinkedListPool::IndexType USED_LIST_HEAD = 1;
-            public:
-                Pool(std::size_t size);
-                std::unique_ptr<ObjRef, Deleter> CreateObjRef(std::uint32_t ref_data, ModifyHandle* p_modify_handle);
-                void Remove(ModifyHandle modify_handle);
-            };
-        };
-        ObjRef();
-        std::uint32_t GetData() const { return this->ref_data; }
+        typedef std::uint32_t HandleType;
+        static const std::size_t MAX_SIZE = (static_cast<std::size_t>(1) << IndexBits) - 1;
     private:
-        ObjRef(std::uint32_t ref_data);
-        std::uint32_t ref_data;
+        static const std::uint32_t INDEX_MASK = (static_cast<std::uint32_t>(1) << IndexBits) - 1;
+        static const std::uint32_t NONE = INDEX_MASK;
+        // dense index of a used slot, the next free slot of a free one
+        std::vector<std::uint32_t> slot_list;
+        std::vector<std::uint32_t> generation_list;
+        // slot of each element
+        std::vector<std::uint32_t> element_slot_list;
+        // freed slots are reused oldest first, so generations wrap as late as they can
+        std::uint32_t free_head;
+        std::uint32_t free_tail;
+    public:
+        BasicSlotMap(std::size_t capacity = 0);
+        std::size_t Size() const { return this->element_slot_list.size(); }
+        // The new element is at Size() - 1, the owner appends to its arrays.
+        int Create(HandleType& out_handle);
+        // return 1 for a stale handle
+        int Find(HandleType handle, std::size_t& out_index) const;
+        bool Contains(HandleType handle) const;
+        // The last element takes the place out_index of the removed one, the owner moves its
+        // element at Size() to out_index and pops its arrays.
+        int Remove(HandleType handle, std::size_t& out_index);
+        HandleType HandleAt(std::size_t index) const;
+        void Clear();
     };
-    typedef ObjRef::ModifyHandle::Pool ObjRefPool;
-    typedef std::unique_ptr<ObjRef, ObjRef::Deleter> ObjRefUPtr;
+    typedef BasicSlotMap<16> SlotMap;
+    // for more than 65534 elements, generations wrap after 4095 reuses of a slot
+    typedef BasicSlotMap<20> LargeSlotMap;
     
 }
 
@@ -13,6 +13,7 @@
 #include "glm/vec2.hpp"
 #include "glm/vec3.hpp"
 #include "glm/vec4.hpp"
+#include <cstddef>
 
 namespace hardrock
 {
@@ -30,6 +31,47 @@ namespace hardrock
         virtual ~ITileSequence() { }
         virtual bool HasNext() const = 0;
         virtual const Tile& Next() = 0;
+        // Point p_block at up to max_count tiles that lie next to each other in memory and skip
+        // past them, 0 when the sequence is done. Sequences that only have Next() hand out one
+        // tile per call, override it when the tiles are stored in runs.
+        virtual std::size_t NextBlock(const Tile*& p_block, std::size_t max_count)
+        {
+            if (max_count == 0 || !this->HasNext())
+                return 0;
+            p_block = &this->Next();
+            return 1;
+        }
+        // Return what the tiles come from and set [out_begin, out_end) to the positions in the
+        // sequence that changed since that source last cleared its changes, the range may run
+        // past the end. nullptr means the sequence does not track changes and every tile counts
+        // as changed.
+        virtual const void* GetChanges(std::size_t& /* out_begin */, std::size_t& /* out_end */) const
+        {
+            return nullptr;
+        }
+    };
+    
+    // Sequence over tiles kept in one array, hands the whole array out as a single block.
+    class TileSpanSequence : public ITileSequence
+    {
+        const Tile* p_tile;
+        std::size_t count;
+    public:
+        TileSpanSequence(const Tile* p_tile, std::size_t count) : p_tile(p_tile), count(count) { }
+        bool HasNext() const override { return this->count != 0; }
+        const Tile& Next() override
+        {
+            --this->count;
+            return *this->p_tile++;
+        }
+        std::size_t NextBlock(const Tile*& p_block, std::size_t max_count) override
+        {
+            const std::size_t block_count = this->count < max_count ? this->count : max_count;
+            p_block = this->p_tile;
+            this->p_tile += block_count;
+            this->count -= block_count;
+            return block_count;
+        }
     };
 }
 
@@ -0,0 +1,322 @@
+#!/usr/bin/env python
+# -*- coding: UTF-8 -*-
+
+# Bake a texture atlas offline, so the game uploads it with a single
+# glTexImage2D instead of decoding and packing every sprite at startup.
+#
+# Fully transparent borders are trimmed off every sprite before packing, so
+# the atlas holds less and the game draws smaller quads. Trimming works in
+# texture coordinate steps, (width * unit_length) / 128 pixels.
+#
+# Output layout (little-endian):
+#   FMT_ATLAS_HEADER  'ATL2', unit_length, width, height (in units), count
+#   count * FMT_RID   sprite rids, sorted (tex_id is the position in this list)
+#   count * FMT_RECT  x0, y0, x1, y1 of the trimmed sprite in the 0..128 texture coordinate space
+#   count * FMT_TRIM  left, top, right, bottom steps trimmed off the original sprite
+#   FMT_PIXEL_FORMAT  pixel format (PIXEL_FORMAT_*), palette count
+#   palette count * 256 * RGBA8 palettes, only for PIXEL_FORMAT_INDEX8
+#   pixels, (width * unit_length) * (height * unit_length) texels of PIXEL_FORMAT_SIZE bytes
+#
+# 16-bit texels are little-endian GL_UNSIGNED_SHORT_4_4_4_4 / 5_5_5_1.
+# PIXEL_FORMAT_INDEX8 texels index a palette row, which a tile selects with
+# its palette_id. Extra rows are colour-swapped copies of the first one.
+
+import struct
+import zlib
+
+FMT_ATLAS_HEADER = '4sHBBI'
+FMT_RID = 'I'
+FMT_RECT = 'BBBB'
+FMT_TRIM = 'BBBB'
+FMT_PIXEL_FORMAT = 'BxH'
+ATLAS_IDENTIFIER = 'ATL3'
+PIXEL_FORMAT_RGBA8888 = 0
+PIXEL_FORMAT_RGBA4444 = 1
+PIXEL_FORMAT_RGBA5551 = 2
+PIXEL_FORMAT_INDEX8 = 3
+PIXEL_FORMAT_NAME = {
+    'rgba8888': PIXEL_FORMAT_RGBA8888,
+    'rgba4444': PIXEL_FORMAT_RGBA4444,
+    'rgba5551': PIXEL_FORMAT_RGBA5551,
+    'index8': PIXEL_FORMAT_INDEX8,
+}
+PIXEL_FORMAT_SIZE = {
+    PIXEL_FORMAT_RGBA8888: 4,
+    PIXEL_FORMAT_RGBA4444: 2,
+    PIXEL_FORMAT_RGBA5551: 2,
+    PIXEL_FORMAT_INDEX8: 1,
+}
+PALETTE_SIZE = 256
+COORD_RANGE = 128
+
+def read_png_rgba(path):
+    # Minimal decoder for 8-bit, non-interlaced RGB/RGBA PNGs, which is
+    # what png_src holds.
+    with open(path, 'rb') as f:
+        d = f.read()
+    if d[:8] != '\x89PNG\r\n\x1a\n':
+        raise ValueError('%s: not a png' % path)
+    pos = 8
+    idat = []
+    while pos < len(d):
+        length, chunk_type = struct.unpack('>I4s', d[pos:pos + 8])
+        chunk = d[pos + 8:pos + 8 + length]
+        pos += 12 + length
+        if chunk_type == 'IHDR':
+            width, height, bit_depth, color_type, _, _, interlace = struct.unpack('>IIBBBBB', chunk)
+        elif chunk_type == 'IDAT':
+            idat.append(chunk)
+        elif chunk_type == 'IEND':
+            break
+    if bit_depth != 8 or interlace != 0 or color_type not in (2, 6):
+        raise ValueError('%s: unsupported png format' % path)
+    bpp = 4 if color_type == 6 else 3
+    stride = width * bpp
+    raw = bytearray(zlib.decompress(''.join(idat)))
+    pixels = bytearray(width * height * 4)
+    prev = bytearray(stride)
+    for y in range(height):
+        filter_type = raw[y * (stride + 1)]
+        line = raw[y * (stride + 1) + 1:(y + 1) * (stride + 1)]
+        for x in range(stride):
+            a = line[x - bpp] if x >= bpp else 0
+            b = prev[x]
+            c = prev[x - bpp] if x >= bpp else 0
+            if filter_type == 1:
+                line[x] = (line[x] + a) & 0xff
+            elif filter_type == 2:
+                line[x] = (line[x] + b) & 0xff
+            elif filter_type == 3:
+                line[x] = (line[x] + ((a + b) >> 1)) & 0xff
+            elif filter_type == 4:
+                p = a + b - c
+                pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+                if pa <= pb and pa <= pc:
+                    pr = a
+                elif pb <= pc:
+                    pr = b
+                else:
+                    pr = c
+                line[x] = (line[x] + pr) & 0xff
+        for x in range(width):
+            o = (y * width + x) * 4
+            pixels[o:o + 3] = line[x * bpp:x * bpp + 3]
+            pixels[o + 3] = line[x * bpp + 3] if bpp == 4 else 255
+        prev = line
+    return width, height, pixels
+
+def opaque_bounds(width, height, pixels, step):
+    # Smallest step-aligned (x0, y0, x1, y1) holding every pixel with alpha,
+    # at least one step for a fully transparent sprite.
+    x0, y0, x1, y1 = width, height, 0, 0
+    for y in range(height):
+        row = pixels[y * width * 4:(y + 1) * width * 4]
+        xs = [x for x in range(width) if row[x * 4 + 3]]
+        if xs:
+            x0 = min(x0, xs[0])
+            x1 = max(x1, xs[-1] + 1)
+            y0 = min(y0, y)
+            y1 = y + 1
+    if x1 <= x0:
+        return 0, 0, step, step
+    x0 = x0 // step * step
+    y0 = y0 // step * step
+    x1 = min(width, (x1 + step - 1) // step * step)
+    y1 = min(height, (y1 + step - 1) // step * step)
+    return x0, y0, x1, y1
+
+def shelf_pack(width, height, size_list):
+    # Place sizes tallest first on shelves. Return positions in input order.
+    order = sorted(range(len(size_list)), key=lambda i: (-size_list[i][1], -size_list[i][0]))
+    pos_list = [None] * len(size_list)
+    shelf_y = 0
+    shelf_height = 0
+    x = 0
+    for i in order:
+        w, h = size_list[i]
+        if x + w > width:
+            shelf_y += shelf_height
+            shelf_height = 0
+            x = 0
+        if w > width or shelf_y + h > height:
+            raise RuntimeError('atlas is too small')
+        pos_list[i] = (x, shelf_y)
+        x += w
+        shelf_height = max(shelf_height, h)
+    return pos_list
+
+def median_cut(color_count, size):
+    # Reduce {rgba: pixel count} to at most size colours. Return the palette
+    # and a {rgba: palette index} map.
+    boxes = [color_count.keys()]
+    while len(boxes) < size:
+        # split the box with the most pixels along its widest channel
+        splittable = [b for b in boxes if len(b) > 1]
+        if not splittable:
+            break
+        box = max(splittable, key=lambda b: sum(color_count[c] for c in b))
+        ranges = [max(c[i] for c in box) - min(c[i] for c in box) for i in range(4)]
+        channel = ranges.index(max(ranges))
+        box.sort(key=lambda c: c[channel])
+        total = sum(color_count[c] for c in box)
+        acc = 0
+        for cut in range(1, len(box)):
+            acc += color_count[box[cut - 1]]
+            if acc * 2 >= total:
+                break
+        boxes.remove(box)
+        boxes.append(box[:cut])
+        boxes.append(box[cut:])
+    palette = []
+    index_map = {}
+    for box in boxes:
+        total = sum(color_count[c] for c in box)
+        palette.append(tuple((sum(c[i] * color_count[c] for c in box) + total // 2) // total for i in range(4)))
+        for c in box:
+            index_map[c] = len(palette) - 1
+    return palette, index_map
+
+def quantize(pixels, variant_list):
+    # Index every texel into a shared palette, index 0 stays fully transparent.
+    # Return palette rows (the base one, then one per variant), the indices
+    # and the mean absolute channel error of the opaque texels.
+    texel_list = [tuple(pixels[i:i + 4]) for i in range(0, len(pixels), 4)]
+    color_count = {}
+    for c in texel_list:
+        if c[3]:
+            color_count[c] = color_count.get(c, 0) + 1
+    if color_count:
+        palette, index_map = median_cut(color_count, PALETTE_SIZE - 1)
+    else:
+        palette, index_map = [], {}
+    base = [(0, 0, 0, 0)] + palette
+    indices = bytearray(len(texel_list))
+    error = 0
+    for i, c in enumerate(texel_list):
+        if c[3]:
+            idx = index_map[c] + 1
+            indices[i] = idx
+            error += sum(abs(a - b) for a, b in zip(c, base[idx]))
+    rows = [base]
+    for variant in variant_list:
+        row = list(base)
+        for src, dst in variant:
+            # swap the entry closest to the source colour, keep its alpha
+            idx = min(range(1, len(base)), key=lambda k: sum(abs(a - b) for a, b in zip(src, base[k][:3])))
+            row[idx] = dst + (base[idx][3],)
+        rows.append(row)
+    return rows, indices, float(error) / max(sum(color_count.values()) * 4, 1)
+
+def convert_pixels(pixels, pixel_format):
+    # RGBA8 to a 16-bit format, little-endian texels.
+    out = bytearray(len(pixels) // 2)
+    for i in range(0, len(pixels) // 4):
+        r, g, b, a = pixels[i * 4:i * 4 + 4]
+        if pixel_format == PIXEL_FORMAT_RGBA4444:
+            v = (r >> 4) << 12 | (g >> 4) << 8 | (b >> 4) << 4 | a >> 4
+        else:
+            v = (r >> 3) << 11 | (g >> 3) << 6 | (b >> 3) << 1 | a >> 7
+        out[i * 2] = v & 0xff
+        out[i * 2 + 1] = v >> 8
+    return out
+
+def parse_variant(text):
+    # 'rrggbb=rrggbb,...' colour swaps for one palette variant
+    variant = []
+    for pair in text.split(','):
+        src, dst = pair.split('=')
+        variant.append((tuple(ord(c) for c in src.strip().decode('hex')), tuple(ord(c) for c in dst.strip().decode('hex'))))
+    return variant
+
+def write_atlas(atlas_path, unit_length, width, height, rid_path_list, pixel_format=PIXEL_FORMAT_RGBA8888, variant_list=[]):
+    rid_path_list = sorted(rid_path_list)
+    image_list = [read_png_rgba(path) for rid, path in rid_path_list]
+    tex_width = width * unit_length
+    tex_height = height * unit_length
+    # pixels per texture coordinate step
+    step_w = tex_width // COORD_RANGE
+    step_h = tex_height // COORD_RANGE
+    if step_w == 0 or step_h == 0 or unit_length % step_w or unit_length % step_h:
+        raise ValueError('atlas is too small for %d texture coordinate steps' % COORD_RANGE)
+    bounds_list = []
+    size_list = []
+    full_area = 0
+    trimmed_area = 0
+    for (rid, path), (w, h, pixels) in zip(rid_path_list, image_list):
+        if w % unit_length or h % unit_length:
+            raise ValueError('%s: size is not a multiple of %d' % (path, unit_length))
+        x0, y0, x1, y1 = opaque_bounds(w, h, pixels, max(step_w, step_h))
+        bounds_list.append((x0, y0, x1, y1))
+        size_list.append(((x1 - x0) // step_w, (y1 - y0) // step_h))
+        full_area += w * h
+        trimmed_area += (x1 - x0) * (y1 - y0)
+    pos_list = shelf_pack(COORD_RANGE, COORD_RANGE, size_list)
+
+    atlas_pixels = bytearray(tex_width * tex_height * 4)
+    rect_list = []
+    trim_list = []
+    for (w, h, pixels), (cx, cy), (cw, ch), (x0, y0, x1, y1) in zip(image_list, pos_list, size_list, bounds_list):
+        x = cx * step_w
+        y = cy * step_h
+        for row in range(y1 - y0):
+            o = ((y + row) * tex_width + x) * 4
+            src = ((y0 + row) * w + x0) * 4
+            atlas_pixels[o:o + (x1 - x0) * 4] = pixels[src:src + (x1 - x0) * 4]
+        rect_list.append((cx, cy, cx + cw, cy + ch))
+        trim_list.append((x0 // step_w, y0 // step_h, (w - x1) // step_w, (h - y1) // step_h))
+
+    with open(atlas_path, 'wb') as f:
+        f.write(struct.pack(FMT_ATLAS_HEADER, ATLAS_IDENTIFIER, unit_length, width, height, len(rid_path_list)))
+        for rid, path in rid_path_list:
+            f.write(struct.pack(FMT_RID, rid))
+        for rect in rect_list:
+            f.write(struct.pack(FMT_RECT, *rect))
+        for trim in trim_list:
+            f.write(struct.pack(FMT_TRIM, *trim))
+        if pixel_format == PIXEL_FORMAT_INDEX8:
+            rows, texels, error = quantize(atlas_pixels, variant_list)
+            f.write(struct.pack(FMT_PIXEL_FORMAT, pixel_format, len(rows)))
+            for row in rows:
+                row = row + [(0, 0, 0, 0)] * (PALETTE_SIZE - len(row))
+                f.write(''.join(struct.pack('BBBB', *c) for c in row))
+            print '%s: %d palette entries, mean channel error %.2f of opaque texels' % (atlas_path, len(rows[0]), error)
+        else:
+            if pixel_format == PIXEL_FORMAT_RGBA8888:
+                texels = atlas_pixels
+            else:
+                texels = convert_pixels(atlas_pixels, pixel_format)
+            f.write(struct.pack(FMT_PIXEL_FORMAT, pixel_format, 0))
+        f.write(str(texels))
+    print '%s: %d sprites, %d of %d pixels drawn after trimming (%.1f%% saved)' % (
+        atlas_path, len(rid_path_list), trimmed_area, full_area,
+        100.0 * (full_area - trimmed_area) / max(full_area, 1))
+    print '%s: %d texture bytes, %d as RGBA8' % (atlas_path, len(texels), len(atlas_pixels))
+
+def main():
+    import argparse
+    import os.path
+    from pack import fnv_hash
+    parser = argparse.ArgumentParser(description='Bake texture atlas.')
+    parser.add_argument('-o', '--output', help='Output file.', required=True)
+    parser.add_argument('-l', '--list', help='Sprite list file, one png name per line.', required=True)
+    parser.add_argument('-d', '--dir', help='Png directory.', required=True)
+    parser.add_argument('-u', '--unit', help='Unit length in pixels.', type=int, required=True)
+    parser.add_argument('-W', '--width', help='Atlas width in units.', type=int, required=True)
+    parser.add_argument('-H', '--height', help='Atlas height in units.', type=int, required=True)
+    parser.add_argument('-f', '--format', help='Texel format.', choices=sorted(PIXEL_FORMAT_NAME.keys()), default='rgba8888')
+    parser.add_argument('-v', '--variant', help='Extra index8 palette, rrggbb=rrggbb colour swaps separated by commas.', action='append', default=[])
+    args = parser.parse_args()
+    rid_path_list = []
+    with open(args.list, 'r') as f:
+        for line in f:
+            name = line.strip()
+            if not name or name.startswith('#'):
+                continue
+            # sprites are addressed by the name of their webp resource
+            base = os.path.splitext(name)[0]
+            rid_path_list.append((fnv_hash(base + '.webp'), os.path.join(args.dir, base + '.png')))
+    write_atlas(args.output, args.unit, args.width, args.height, rid_path_list,
+        PIXEL_FORMAT_NAME[args.format], [parse_variant(v) for v in args.variant])
+
+if __name__ == '__main__':
+    main()
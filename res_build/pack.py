@@ -3,33 +3,168 @@
 
 FMT_HEADER = '4sII'
 FMT_INDEX = 'III'
+FMT_HASH_HEADER = '4sI'
+UINT32_MASK = 0xffffffff
+HASH_DIRECT_SLOT = 0x80000000
+INDEX_COMPRESSED = 0x80000000
+FMT_RAW_SIZE = 'I'
 
-def write_new_pack(pack_path, res_rid_name_path_list):
+def hash_mix(x):
+    x ^= x >> 16
+    x = (x * 0x85ebca6b) & UINT32_MASK
+    x ^= x >> 13
+    x = (x * 0xc2b2ae35) & UINT32_MASK
+    x ^= x >> 16
+    return x
+
+def hash_slot(rid, seed, count):
+    return hash_mix(rid ^ ((seed * 0x9e3779b9 + 0x7f4a7c15) & UINT32_MASK)) % count
+
+def build_perfect_hash(rid_list):
+    # Hash and displace: rids are spread into buckets, then every bucket gets a
+    # seed that places all its rids into free slots. Buckets of a single rid
+    # store their slot directly (HASH_DIRECT_SLOT), so the tail of the build is
+    # not a random search for the last free slots.
+    count = len(rid_list)
+    bucket_count = max(1, (count + 3) // 4)
+    bucket_list = [[] for _ in range(bucket_count)]
+    for idx, rid in enumerate(rid_list):
+        bucket_list[hash_mix(rid) % bucket_count].append(idx)
+    seed_list = [0] * bucket_count
+    slot_list = [None] * count
+    order = sorted(range(bucket_count), key=lambda b: -len(bucket_list[b]))
+    free_slot_list = None
+    for b in order:
+        item_list = bucket_list[b]
+        if len(item_list) == 0:
+            break
+        if len(item_list) == 1:
+            if free_slot_list is None:
+                free_slot_list = [s for s in range(count) if slot_list[s] is None]
+            slot = free_slot_list.pop()
+            slot_list[slot] = item_list[0]
+            seed_list[b] = HASH_DIRECT_SLOT | slot
+            continue
+        seed = 0
+        while True:
+            slots = set()
+            for idx in item_list:
+                slot = hash_slot(rid_list[idx], seed, count)
+                if slot in slots or slot_list[slot] is not None:
+                    break
+                slots.add(slot)
+            else:
+                break
+            seed += 1
+            if seed >= HASH_DIRECT_SLOT:
+                raise RuntimeError('perfect hash build failed')
+        for idx in item_list:
+            slot_list[hash_slot(rid_list[idx], seed, count)] = idx
+        seed_list[b] = seed
+    return seed_list, slot_list
+
+def write_hash_section(f, rid_list):
+    import struct
+    seed_list, slot_list = build_perfect_hash(rid_list)
+    f.write(struct.pack(FMT_HASH_HEADER, 'HASH', len(seed_list)))
+    f.write(struct.pack('%dI' % len(seed_list), *seed_list))
+    f.write(struct.pack('%dI' % len(slot_list), *slot_list))
+
+def lz4_write_length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+def lz4_write_sequence(out, literals, offset, match_length):
+    literal_length = len(literals)
+    token = min(literal_length, 15) << 4
+    if offset:
+        token |= min(match_length - 4, 15)
+    out.append(token)
+    if literal_length >= 15:
+        lz4_write_length(out, literal_length - 15)
+    out.extend(literals)
+    if offset:
+        out.append(offset & 0xff)
+        out.append(offset >> 8)
+        if match_length - 4 >= 15:
+            lz4_write_length(out, match_length - 4 - 15)
+
+def lz4_compress_block(d):
+    # Greedy LZ4 block compressor. The format requires the last 5 bytes to be
+    # literals and the last match to start at least 12 bytes before the end.
+    MIN_MATCH = 4
+    LAST_LITERALS = 5
+    MF_LIMIT = 12
+    MAX_OFFSET = 65535
+    size = len(d)
+    out = bytearray()
+    last_pos = {}
+    anchor = 0
+    i = 0
+    while i < size - MF_LIMIT:
+        key = d[i:i + MIN_MATCH]
+        ref = last_pos.get(key)
+        last_pos[key] = i
+        if ref is None or i - ref > MAX_OFFSET:
+            i += 1
+            continue
+        match_length = MIN_MATCH
+        max_match_length = size - LAST_LITERALS - i
+        while match_length < max_match_length and d[ref + match_length] == d[i + match_length]:
+            match_length += 1
+        lz4_write_sequence(out, d[anchor:i], i - ref, match_length)
+        i += match_length
+        anchor = i
+    lz4_write_sequence(out, d[anchor:], 0, 0)
+    return str(out)
+
+def compress_entry(d):
+    # Stored as the raw size followed by one LZ4 block. Return None when it does not pay off.
+    import struct
+    c = struct.pack(FMT_RAW_SIZE, len(d)) + lz4_compress_block(d)
+    if len(c) >= len(d):
+        return None
+    return c
+
+def write_new_pack(pack_path, res_rid_name_path_raw_list, with_hash=False, with_compress=False):
     import struct
     with open(pack_path, 'wb') as f:
         f.write(struct.pack(FMT_HEADER, '????', 0, 0))
-        res_rid_name_path_list = sorted(res_rid_name_path_list)
+        res_rid_name_path_raw_list = sorted(res_rid_name_path_raw_list)
 
         pos = struct.calcsize(FMT_HEADER)
         res_rid_pos_size_name_list = []
         import os.path
-        for rid, name, path in res_rid_name_path_list:
+        for rid, name, path, raw in res_rid_name_path_raw_list:
             with open(path, 'rb') as g:
                 d = g.read()
             size = len(d)
             if size == 0:
                 continue
+            flag = 0
+            # raw entries stay as they are, so the mapped manager can hand out a view of them
+            if with_compress and not raw:
+                c = compress_entry(d)
+                if c is not None:
+                    d = c
+                    size = len(d)
+                    flag = INDEX_COMPRESSED
             f.write(d)
-            res_rid_pos_size_name_list.append((rid, pos, size, name))
+            res_rid_pos_size_name_list.append((rid, pos, size | flag, name))
             pos += size
 
         index_pos = pos
         for rid, pos, size, name in res_rid_pos_size_name_list:
             f.write(struct.pack(FMT_INDEX, rid, pos, size))
-            print '%08x' % rid, name, pos, size
+            print '%08x' % rid, name, pos, size & ~INDEX_COMPRESSED, 'lz4' if size & INDEX_COMPRESSED else ''
+
+        if with_hash and res_rid_pos_size_name_list:
+            write_hash_section(f, [rid for rid, pos, size, name in res_rid_pos_size_name_list])
 
         f.seek(0)
-        f.write(struct.pack(FMT_HEADER, 'PACK', len(res_rid_name_path_list), index_pos))
+        f.write(struct.pack(FMT_HEADER, 'PACK', len(res_rid_pos_size_name_list), index_pos))
 
 def fnv_hash(s):
     FNV_PRIME = 16777619
@@ -46,19 +181,25 @@ def main():
     import argparse
     parser = argparse.ArgumentParser(description='Pack resource.')
     parser.add_argument('-o', '--output', help='Output file.', required=True)
-    parser.add_argument('-l', '--list', help='Resource list file.', required=True)
+    parser.add_argument('-l', '--list', help='Resource list file of "name path" lines, "name path raw" keeps the entry uncompressed.', required=True)
+    parser.add_argument('-p', '--perfect-hash', help='Append a perfect hash section for O(1) lookup.', action='store_true')
+    parser.add_argument('-c', '--compress', help='LZ4 compress entries that get smaller.', action='store_true')
     args = parser.parse_args()
-    res_rid_name_path_list = []
+    res_rid_name_path_raw_list = []
     import os
     print os.getcwd()
     with open(args.list, 'r') as f:
         for line in f:
             parts = line.split()
-            if len(parts) != 2:
+            if len(parts) == 3 and parts[2] == 'raw':
+                raw = True
+            elif len(parts) == 2:
+                raw = False
+            else:
                 continue
-            name, path = parts
-            res_rid_name_path_list.append((fnv_hash(name), name, path))
-    write_new_pack(args.output, res_rid_name_path_list)
+            name, path = parts[:2]
+            res_rid_name_path_raw_list.append((fnv_hash(name), name, path, raw))
+    write_new_pack(args.output, res_rid_name_path_raw_list, args.perfect_hash, args.compress)
 
 if __name__ == '__main__':
     main()
@@ -1,14 +1,24 @@
 #version 150
 
 uniform sampler2D TexSampler;
+// palettes of an INDEX8 atlas, one row each, PaletteCount is 0 for colour atlases
+uniform sampler2D PaletteSampler;
+uniform int PaletteCount;
 
 in vec2 Texcoord;
 in vec4 ColorMult;
 in vec3 ColorAdd;
+flat in float Palette;
 
 out vec4 outColor;
 
 void main()
 {
-    outColor = texture(TexSampler, Texcoord) * ColorMult + vec4(ColorAdd, 0.0);
+    vec4 texel = texture(TexSampler, Texcoord);
+    if (PaletteCount > 0)
+    {
+        int row = min(int(Palette), PaletteCount - 1);
+        texel = texelFetch(PaletteSampler, ivec2(int(texel.r * 255.0 + 0.5), row), 0);
+    }
+    outColor = texel * ColorMult + vec4(ColorAdd, 0.0);
 }
@@ -6,15 +6,18 @@ uniform mat2 WorldTransform;
 in vec2 position;
 in vec2 texcoord;
 in vec4 color;
+in float palette;
 
 out vec2 Texcoord;
 out vec4 ColorMult;
 out vec3 ColorAdd;
+flat out float Palette;
 
 void main()
 {
     gl_Position = vec4(position * WorldTransform + WorldTranslate, 0.5, 1.0);
     Texcoord = texcoord / 128.0;
+    Palette = palette;
     vec3 m = color.rgb / 16.0;
     vec3 n = floor(m);
     ColorMult = vec4(n / 15.0, color.a / 255.0);
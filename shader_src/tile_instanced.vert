@@ -0,0 +1,30 @@
+#version 150
+
+uniform vec2 WorldTranslate;
+uniform mat2 WorldTransform;
+
+// one set per tile, the 4 corners come from gl_VertexID of a triangle strip
+in vec2 translate;
+in vec2 vec_x;
+in vec2 vec_y;
+in vec4 texrect;
+in vec4 color;
+in float palette;
+
+out vec2 Texcoord;
+out vec4 ColorMult;
+out vec3 ColorAdd;
+flat out float Palette;
+
+void main()
+{
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 position = translate + vec_x * corner.x + vec_y * corner.y;
+    gl_Position = vec4(position * WorldTransform + WorldTranslate, 0.5, 1.0);
+    Texcoord = mix(texrect.xy, texrect.zw, corner) / 128.0;
+    Palette = palette;
+    vec3 m = color.rgb / 16.0;
+    vec3 n = floor(m);
+    ColorMult = vec4(n / 15.0, color.a / 255.0);
+    ColorAdd = (m - n) * 16.0 / 15.0;
+}